@@ -33,6 +33,15 @@
 #include <stdio.h>
 #include <string.h>
 #include <float.h>
+#include <math.h>
+#include <time.h>
+
+#if !defined(_WIN32) || defined(__MINGW32__)
+/* POSIX threads are available */
+#include <pthread.h>
+#define NET_THREADS
+#include <sys/time.h>
+#endif
 
 #if defined(_WIN32) && !defined(__MINGW32__)
 #include "config-msvc.h"
@@ -71,15 +80,40 @@
 #define ARG_ONEWAY_FROMTO	9
 #define ARG_OUT_TABLE		10
 #define ARG_VIRT_TABLE		11
+#define ARG_THREADS		12
+#define ARG_CH_TABLE		13
+#define ARG_NODE_ORDER		14
+#define ARG_SNAPSHOT		15
+#define ARG_COST_PROFILE	16
+#define ARG_BENCHMARK		17
+#define ARG_SEED		18
+#define ARG_BLOCK_SIZE		19
+#define ARG_COMPACT		20
+#define ARG_SNAP_TOLERANCE	21
 
 #define MAX_BLOCK	1048576
+#define MAX_SNAP_CELL	4611686018427387904.0	/* 2^62 */
+#define ARENA_CHUNK	65536
+#define MAX_COST_PROFILES	16
+#define MAX_BLOCK_NODES	65535
+
+#define NET_COMPACT_START	0x6a
+#define NET_COMPACT_A_STAR_START	0x6b
+#define NET_COMPACT_COSTS	0xa7
+
+#define COMPACT_NONE		0
+#define COMPACT_LOSSLESS	1
+#define COMPACT_FLOAT		2
+
+#define NODE_ORDER_ID		0
+#define NODE_ORDER_HILBERT	1
+#define NODE_ORDER_BFS		2
 
 struct pre_node
 {
 /* a preliminary node */
     sqlite3_int64 id;
     char code[32];
-    struct pre_node *next;
 };
 
 struct node
@@ -90,64 +124,107 @@ struct node
     char code[32];
     double x;
     double y;
-    struct arc_ref *first_outcoming;
-    struct arc_ref *last_outcoming;
-    struct arc_ref *first_incoming;
-    struct arc_ref *last_incoming;
-    struct node *next;
 };
 
 struct arc
 {
 /* an ARC */
     sqlite3_int64 rowid;
-    struct node *from;
-    struct node *to;
+    int from;			/* position of the FromNode into the Nodes arena */
+    int to;			/* position of the ToNode into the Nodes arena */
     double cost;
-    struct arc *next;
-};
-
-struct arc_ref
-{
-/* a reference to an Arc */
-    struct arc *reference;
-    struct arc_ref *next;
 };
 
 struct graph
 {
-    struct pre_node *first_pre;
-    struct pre_node *last_pre;
+/*
+/ the graph is stored into few contiguous arenas:
+/ - Nodes are sorted by ID (or CODE), so that each Node is
+/   simply identified by its position
+/ - once all Arcs have been loaded they are packed in CSR order;
+/   the outcoming Arcs of the i-th Node are the slice
+/   arcs[out_offsets[i] .. out_offsets[i + 1] - 1], sorted by Cost
+/ - in_arcs[in_offsets[i] .. in_offsets[i + 1] - 1] are the
+/   positions of the incoming Arcs of the i-th Node
+/ - Nodes are looked up through an open-addressing hash index;
+/   index_slots holds the Node position + 1 [0 marks a free slot]
+/   and index_hashes the full hash of the Node ID or CODE
+/ - components[i] is the Strongly Connected Component of the
+/   i-th Node [#0 always being the largest one]
+/ - costs holds the alternative Cost profiles: while loading
+/   n_costs values for each Arc, once packed n_costs arrays
+/   [one for each profile] of n_arcs values in CSR order
+*/
+    struct pre_node *pre_nodes;
     int n_pre_nodes;
-    struct pre_node **sorted_pre_nodes;
-    struct arc *first_arc;
-    struct arc *last_arc;
-    struct node *first_node;
-    struct node *last_node;
+    int max_pre_nodes;
+    struct node *nodes;
     int n_nodes;
-    struct node **sorted_nodes;
+    struct arc *arcs;
+    int n_arcs;
+    int max_arcs;
+    int *out_offsets;
+    int *in_offsets;
+    int *in_arcs;
+    int *index_slots;
+    unsigned int *index_hashes;
+    unsigned int index_mask;
+    int *components;
+    int n_components;
+    int n_costs;
+    double *costs;
+    const double *arc_costs;	/* alternative Costs of the Arc being inserted */
+    double snap_tolerance;	/* max Node coords mismatch [0.0: exact] */
+    double max_snapped;		/* largest tolerated coords mismatch */
     int error;
     int node_code;
     int max_code_length;
 };
 
+struct net_options
+{
+/* optional features selected on the command line */
+    int threads;		/* NETWORK-DATA blocks encoding threads */
+    const char *ch_table;	/* Contraction Hierarchy companion table */
+    int node_order;		/* NETWORK-DATA serialization order */
+    int track_changes;		/* maintaining the change log */
+    int write_components;	/* the Component of each Arc */
+    const char *snapshot;	/* binary graph snapshot file */
+    int incremental;		/* only applying the change log */
+    int n_costs;		/* alternative Cost profiles */
+    const char *cost_columns[MAX_COST_PROFILES];
+    int block_size;		/* max NETWORK-DATA block size */
+    int compact;		/* compact NETWORK-DATA encoding */
+    double snap_tolerance;	/* merging near-coincident end points */
+    int write_node_ids;		/* creating the missing Node columns */
+};
+
 static struct graph *
 graph_init ()
 {
 /* allocates and initializes the graph structure */
     struct graph *p = malloc (sizeof (struct graph));
-    p->first_pre = NULL;
-    p->last_pre = NULL;
+    p->pre_nodes = NULL;
     p->n_pre_nodes = 0;
-    p->sorted_pre_nodes = NULL;
-    p->n_pre_nodes = 0;
-    p->sorted_pre_nodes = NULL;
-    p->first_arc = NULL;
-    p->last_arc = NULL;
-    p->first_node = NULL;
-    p->last_node = NULL;
+    p->max_pre_nodes = 0;
+    p->nodes = NULL;
     p->n_nodes = 0;
-    p->sorted_nodes = NULL;
+    p->arcs = NULL;
+    p->n_arcs = 0;
+    p->max_arcs = 0;
+    p->out_offsets = NULL;
+    p->in_offsets = NULL;
+    p->in_arcs = NULL;
+    p->index_slots = NULL;
+    p->index_hashes = NULL;
+    p->index_mask = 0;
+    p->components = NULL;
+    p->n_components = 0;
+    p->n_costs = 0;
+    p->costs = NULL;
+    p->arc_costs = NULL;
+    p->snap_tolerance = 0.0;
+    p->max_snapped = 0.0;
     p->error = 0;
     p->node_code = 0;
     p->max_code_length = 0;
@@ -157,87 +234,59 @@ graph_init ()
 static void
 graph_free_pre (struct graph *p)
 {
-/* cleaning up the preliminary Nodes list */
-    struct pre_node *pP;
-    struct pre_node *pPn;
+/* cleaning up the preliminary Nodes arena */
     if (!p)
 	return;
-    pP = p->first_pre;
-    while (pP)
-      {
-	  pPn = pP->next;
-	  free (pP);
-	  pP = pPn;
-      }
-    p->first_pre = NULL;
-    p->last_pre = NULL;
+    if (p->pre_nodes)
+	free (p->pre_nodes);
+    p->pre_nodes = NULL;
     p->n_pre_nodes = 0;
-    if (p->sorted_pre_nodes)
-	free (p->sorted_pre_nodes);
-    p->sorted_pre_nodes = NULL;
+    p->max_pre_nodes = 0;
 }
 
 static void
 graph_free (struct graph *p)
 {
 /* cleaning up any memory allocation for the graph structure */
-    struct arc *pA;
-    struct arc *pAn;
-    struct node *pN;
-    struct node *pNn;
-    struct arc_ref *pAR;
-    struct arc_ref *pARn;
     if (!p)
 	return;
     graph_free_pre (p);
-    pA = p->first_arc;
-    while (pA)
-      {
-	  pAn = pA->next;
-	  free (pA);
-	  pA = pAn;
-      }
-    pN = p->first_node;
-    while (pN)
-      {
-	  pNn = pN->next;
-	  pAR = pN->first_incoming;
-	  while (pAR)
-	    {
-		pARn = pAR->next;
-		free (pAR);
-		pAR = pARn;
-	    }
-	  pAR = pN->first_outcoming;
-	  while (pAR)
-	    {
-		pARn = pAR->next;
-		free (pAR);
-		pAR = pARn;
-	    }
-	  free (pN);
-	  pN = pNn;
-      }
-    if (p->sorted_nodes)
-	free (p->sorted_nodes);
+    if (p->nodes)
+	free (p->nodes);
+    if (p->arcs)
+	free (p->arcs);
+    if (p->out_offsets)
+	free (p->out_offsets);
+    if (p->in_offsets)
+	free (p->in_offsets);
+    if (p->in_arcs)
+	free (p->in_arcs);
+    if (p->index_slots)
+	free (p->index_slots);
+    if (p->index_hashes)
+	free (p->index_hashes);
+    if (p->components)
+	free (p->components);
+    if (p->costs)
+	free (p->costs);
     free (p);
 }
 
 static int
-cmp_nodes2_code (const void *p1, const void *p2)
+cmp_nodes_code (const void *p1, const void *p2)
 {
 /* compares two nodes  by CODE [for BSEARCH] */
     struct node *pN1 = (struct node *) p1;
-    struct node *pN2 = *((struct node **) p2);
+    struct node *pN2 = (struct node *) p2;
     return strcmp (pN1->code, pN2->code);
 }
 
 static int
-cmp_nodes2_id (const void *p1, const void *p2)
+cmp_nodes_id (const void *p1, const void *p2)
 {
 /* compares two nodes  by ID [for BSEARCH] */
     struct node *pN1 = (struct node *) p1;
-    struct node *pN2 = *((struct node **) p2);
+    struct node *pN2 = (struct node *) p2;
     if (pN1->id == pN2->id)
 	return 0;
     if (pN1->id > pN2->id)
@@ -245,13 +294,88 @@ cmp_nodes2_id (const void *p1, const void *p2)
     return -1;
 }
 
+static unsigned int
+hash_node_id (sqlite3_int64 id)
+{
+/* hashing an INTEGER Node ID [64 bit finalizer] */
+    sqlite3_uint64 h = (sqlite3_uint64) id;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (unsigned int) h;
+}
+
+static unsigned int
+hash_node_code (const char *code)
+{
+/* hashing a TEXT Node CODE [FNV-1a] */
+    unsigned int h = 2166136261u;
+    const unsigned char *p = (const unsigned char *) code;
+    while (*p)
+      {
+	  h ^= *p++;
+	  h *= 16777619u;
+      }
+    return h;
+}
+
+static void
+build_node_index (struct graph *p_graph)
+{
+/* building the hash index on Nodes */
+    int i;
+    unsigned int size = 1024;
+    unsigned int h;
+    unsigned int slot;
+    struct node *pN;
+    sqlite3_int64 wanted = (sqlite3_int64) p_graph->n_nodes * 2;
+/*
+/ at least twice the Nodes [computed in 64 bits], capped at 2^31 slots:
+/ n_nodes is an int, so the table never gets full and probing ends
+*/
+    while ((sqlite3_int64) size < wanted && size < 0x80000000u)
+	size *= 2;
+    p_graph->index_slots = calloc (size, sizeof (int));
+    p_graph->index_hashes = calloc (size, sizeof (unsigned int));
+    if (!(p_graph->index_slots) || !(p_graph->index_hashes))
+      {
+	  /* not enough memory; find_node() will fall back to BSEARCH */
+	  if (p_graph->index_slots)
+	      free (p_graph->index_slots);
+	  if (p_graph->index_hashes)
+	      free (p_graph->index_hashes);
+	  p_graph->index_slots = NULL;
+	  p_graph->index_hashes = NULL;
+	  return;
+      }
+    p_graph->index_mask = size - 1;
+    for (i = 0; i < p_graph->n_nodes; i++)
+      {
+	  pN = p_graph->nodes + i;
+	  if (p_graph->node_code)
+	      h = hash_node_code (pN->code);
+	  else
+	      h = hash_node_id (pN->id);
+	  slot = h & p_graph->index_mask;
+	  while (p_graph->index_slots[slot])
+	      slot = (slot + 1) & p_graph->index_mask;
+	  p_graph->index_slots[slot] = i + 1;
+	  p_graph->index_hashes[slot] = h;
+      }
+}
+
 static struct node *
 find_node (struct graph *p_graph, sqlite3_int64 id, const char *code)
 {
-/* searching a Node into the sorted list */
-    struct node **ret;
+/* searching a Node by ID or CODE */
     struct node pN;
-    if (!(p_graph->sorted_nodes))
+    struct node *pFound;
+    unsigned int h;
+    unsigned int slot;
+    int ind;
+    if (!(p_graph->nodes))
 	return NULL;
     if (p_graph->node_code)
       {
@@ -264,92 +388,136 @@ find_node (struct graph *p_graph, sqlite3_int64 id, const char *code)
 	    }
 	  else
 	      strcpy (pN.code, code);
-	  ret = bsearch (&pN, p_graph->sorted_nodes, p_graph->n_nodes,
-			 sizeof (struct node *), cmp_nodes2_code);
       }
     else
       {
 	  /* Nodes are identified by an INTEGER id */
 	  pN.id = id;
-	  ret = bsearch (&pN, p_graph->sorted_nodes, p_graph->n_nodes,
-			 sizeof (struct node *), cmp_nodes2_id);
       }
-    if (!ret)
-	return NULL;
-    return *ret;
+    if (!(p_graph->index_slots))
+      {
+	  /* no hash index: searching the sorted arena */
+	  if (p_graph->node_code)
+	      return bsearch (&pN, p_graph->nodes, p_graph->n_nodes,
+			      sizeof (struct node), cmp_nodes_code);
+	  return bsearch (&pN, p_graph->nodes, p_graph->n_nodes,
+			  sizeof (struct node), cmp_nodes_id);
+      }
+    if (p_graph->node_code)
+	h = hash_node_code (pN.code);
+    else
+	h = hash_node_id (id);
+    slot = h & p_graph->index_mask;
+    while ((ind = p_graph->index_slots[slot]) != 0)
+      {
+	  if (p_graph->index_hashes[slot] == h)
+	    {
+		/* full hash match; checking the key itself */
+		pFound = p_graph->nodes + ind - 1;
+		if (p_graph->node_code)
+		  {
+		      if (strcmp (pFound->code, pN.code) == 0)
+			  return pFound;
+		  }
+		else if (pFound->id == id)
+		    return pFound;
+	    }
+	  slot = (slot + 1) & p_graph->index_mask;
+      }
+    return NULL;
 }
 
 static int
-cmp_nodes1_code (const void *p1, const void *p2)
+cmp_prenodes_code (const void *p1, const void *p2)
 {
-/* compares two nodes  by CODE [for QSORT] */
-    struct node *pN1 = *((struct node **) p1);
-    struct node *pN2 = *((struct node **) p2);
-    return strcmp (pN1->code, pN2->code);
+/* compares two preliminary nodes  by CODE [for QSORT] */
+    struct pre_node *pP1 = (struct pre_node *) p1;
+    struct pre_node *pP2 = (struct pre_node *) p2;
+    return strcmp (pP1->code, pP2->code);
 }
 
 static int
-cmp_nodes1_id (const void *p1, const void *p2)
+cmp_prenodes_id (const void *p1, const void *p2)
 {
-/* compares two nodes  by ID [for QSORT] */
-    struct node *pN1 = *((struct node **) p1);
-    struct node *pN2 = *((struct node **) p2);
-    if (pN1->id == pN2->id)
+/* compares two preliminary nodes  by ID [for QSORT] */
+    struct pre_node *pP1 = (struct pre_node *) p1;
+    struct pre_node *pP2 = (struct pre_node *) p2;
+    if (pP1->id == pP2->id)
 	return 0;
-    if (pN1->id > pN2->id)
+    if (pP1->id > pP2->id)
 	return 1;
     return -1;
 }
 
 static void
-sort_nodes (struct graph *p_graph)
+compact_pre_nodes (struct graph *p_graph, int node_code)
 {
-/* updating the Nodes sorted list */
+/* sorting the preliminary Nodes arena and removing any duplicate */
     int i;
-    struct node *pN;
-    p_graph->n_nodes = 0;
-    if (p_graph->sorted_nodes)
-      {
-	  /* we must free the already existent sorted list */
-	  free (p_graph->sorted_nodes);
-      }
-    p_graph->sorted_nodes = NULL;
-    pN = p_graph->first_node;
-    while (pN)
-      {
-	  (p_graph->n_nodes)++;
-	  pN = pN->next;
-      }
-    if (!(p_graph->n_nodes))
+    int n = 0;
+    struct pre_node *pP;
+    struct pre_node *pLast = NULL;
+    if (!(p_graph->n_pre_nodes))
 	return;
-    p_graph->sorted_nodes = malloc (sizeof (struct node *) * p_graph->n_nodes);
-    i = 0;
-    pN = p_graph->first_node;
-    while (pN)
-      {
-	  *(p_graph->sorted_nodes + i++) = pN;
-	  pN = pN->next;
-      }
-    if (p_graph->node_code)
+    if (node_code)
       {
 	  /* Nodes are identified by a TEXT code */
-	  qsort (p_graph->sorted_nodes, p_graph->n_nodes,
-		 sizeof (struct node *), cmp_nodes1_code);
+	  qsort (p_graph->pre_nodes, p_graph->n_pre_nodes,
+		 sizeof (struct pre_node), cmp_prenodes_code);
       }
     else
       {
 	  /* Nodes are identified by an INTEGER id */
-	  qsort (p_graph->sorted_nodes, p_graph->n_nodes,
-		 sizeof (struct node *), cmp_nodes1_id);
+	  qsort (p_graph->pre_nodes, p_graph->n_pre_nodes,
+		 sizeof (struct pre_node), cmp_prenodes_id);
+      }
+    for (i = 0; i < p_graph->n_pre_nodes; i++)
+      {
+	  pP = p_graph->pre_nodes + i;
+	  if (pLast)
+	    {
+		if (node_code && strcmp (pP->code, pLast->code) == 0)
+		    continue;
+		if (!node_code && pP->id == pLast->id)
+		    continue;
+	    }
+	  pLast = p_graph->pre_nodes + n++;
+	  if (pLast != pP)
+	      memcpy (pLast, pP, sizeof (struct pre_node));
       }
+    p_graph->n_pre_nodes = n;
 }
 
 static void
 insert_node (struct graph *p_graph, sqlite3_int64 id, const char *code,
 	     int node_code)
 {
-/* inserts a Node into the preliminary list */
-    struct pre_node *pP = malloc (sizeof (struct pre_node));
+/* inserts a Node into the preliminary arena */
+    struct pre_node *pP;
+    if (p_graph->error)
+	return;
+    if (p_graph->n_pre_nodes >= p_graph->max_pre_nodes)
+      {
+	  /* the arena is full; squeezing out duplicates before growing */
+	  compact_pre_nodes (p_graph, node_code);
+	  if (p_graph->n_pre_nodes >= p_graph->max_pre_nodes / 2)
+	    {
+		int max = p_graph->max_pre_nodes + ARENA_CHUNK;
+		if (p_graph->max_pre_nodes > ARENA_CHUNK)
+		    max = p_graph->max_pre_nodes * 2;
+		pP = realloc (p_graph->pre_nodes,
+			      sizeof (struct pre_node) * max);
+		if (!pP)
+		  {
+		      printf ("ERROR: insufficient memory [Nodes]\n");
+		      p_graph->error = 1;
+		      return;
+		  }
+		p_graph->pre_nodes = pP;
+		p_graph->max_pre_nodes = max;
+	    }
+      }
+    pP = p_graph->pre_nodes + p_graph->n_pre_nodes;
     if (node_code)
       {
 	  /* Node is identified by a TEXT code */
@@ -369,20 +537,15 @@ insert_node (struct graph *p_graph, sqlite3_int64 id, const char *code,
 	  *(pP->code) = '\0';
 	  pP->id = id;
       }
-    pP->next = NULL;
-    if (!(p_graph->first_pre))
-	p_graph->first_pre = pP;
-    if (p_graph->last_pre)
-	p_graph->last_pre->next = pP;
-    p_graph->last_pre = pP;
+    p_graph->n_pre_nodes += 1;
 }
 
 static void
 add_node (struct graph *p_graph, sqlite3_int64 id, const char *code)
 {
-/* inserts a Node into the final list */
+/* inserts a Node into the final arena */
     int len;
-    struct node *pN = malloc (sizeof (struct node));
+    struct node *pN = p_graph->nodes + p_graph->n_nodes;
     if (p_graph->node_code)
       {
 	  /* Nodes are identified by a TEXT code */
@@ -398,18 +561,10 @@ add_node (struct graph *p_graph, sqlite3_int64 id, const char *code)
 	  *(pN->code) = '\0';
 	  pN->id = id;
       }
+    pN->internal_index = p_graph->n_nodes;
     pN->x = DBL_MAX;
     pN->y = DBL_MAX;
-    pN->first_incoming = NULL;
-    pN->last_incoming = NULL;
-    pN->first_outcoming = NULL;
-    pN->last_outcoming = NULL;
-    pN->next = NULL;
-    if (!(p_graph->first_node))
-	p_graph->first_node = pN;
-    if (p_graph->last_node)
-	p_graph->last_node->next = pN;
-    p_graph->last_node = pN;
+    p_graph->n_nodes += 1;
 }
 
 static struct node *
@@ -429,10 +584,25 @@ process_node (struct graph *p_graph, sqlite3_int64 id, const char *code,
 	    }
 	  else
 	    {
+		double dist;
 		if (pN->x == x && pN->y == y)
 		    ;
+		else if (p_graph->snap_tolerance == DBL_MAX)
+		    ;		/* automatic IDs: already snapped */
 		else
-		    *pOther = pN;
+		  {
+		      dist =
+			  sqrt (((pN->x - x) * (pN->x - x)) +
+				((pN->y - y) * (pN->y - y)));
+		      if (dist <= p_graph->snap_tolerance)
+			{
+			    /* within tolerance; the first coords are retained */
+			    if (dist > p_graph->max_snapped)
+				p_graph->max_snapped = dist;
+			}
+		      else
+			  *pOther = pN;
+		  }
 	    }
 	  return pN;
       }
@@ -441,31 +611,50 @@ process_node (struct graph *p_graph, sqlite3_int64 id, const char *code,
 }
 
 static void
-add_incoming_arc (struct node *pN, struct arc *pA)
-{
-/* adds an incoming Arc to a Node */
-    struct arc_ref *pAR = malloc (sizeof (struct arc_ref));
-    pAR->reference = pA;
-    pAR->next = NULL;
-    if (!(pN->first_incoming))
-	pN->first_incoming = pAR;
-    if (pN->last_incoming)
-	pN->last_incoming->next = pAR;
-    pN->last_incoming = pAR;
-}
-
-static void
-add_outcoming_arc (struct node *pN, struct arc *pA)
+push_arc (struct graph *p_graph, sqlite3_int64 rowid, int from, int to,
+	  double cost)
 {
-/* adds an outcoming Arc to a Node */
-    struct arc_ref *pAR = malloc (sizeof (struct arc_ref));
-    pAR->reference = pA;
-    pAR->next = NULL;
-    if (!(pN->first_outcoming))
-	pN->first_outcoming = pAR;
-    if (pN->last_outcoming)
-	pN->last_outcoming->next = pAR;
-    pN->last_outcoming = pAR;
+/* appending an Arc to the Arcs arena */
+    struct arc *pA;
+    double *pC;
+    if (p_graph->n_arcs >= p_graph->max_arcs)
+      {
+	  /* growing the Arcs arena */
+	  int max = p_graph->max_arcs + ARENA_CHUNK;
+	  if (p_graph->max_arcs > ARENA_CHUNK)
+	      max = p_graph->max_arcs * 2;
+	  pA = realloc (p_graph->arcs, sizeof (struct arc) * max);
+	  if (!pA)
+	    {
+		printf ("ERROR: insufficient memory [Arcs]\n");
+		p_graph->error = 1;
+		return;
+	    }
+	  p_graph->arcs = pA;
+	  if (p_graph->n_costs)
+	    {
+		/* growing the alternative Costs arena as well */
+		pC = realloc (p_graph->costs,
+			      sizeof (double) * p_graph->n_costs * max);
+		if (!pC)
+		  {
+		      printf ("ERROR: insufficient memory [Costs]\n");
+		      p_graph->error = 1;
+		      return;
+		  }
+		p_graph->costs = pC;
+	    }
+	  p_graph->max_arcs = max;
+      }
+    pA = p_graph->arcs + p_graph->n_arcs;
+    pA->rowid = rowid;
+    pA->from = from;
+    pA->to = to;
+    pA->cost = cost;
+    if (p_graph->n_costs)
+	memcpy (p_graph->costs + ((size_t) p_graph->n_arcs * p_graph->n_costs),
+		p_graph->arc_costs, sizeof (double) * p_graph->n_costs);
+    p_graph->n_arcs += 1;
 }
 
 static void
@@ -478,7 +667,6 @@ add_arc (struct graph *p_graph, sqlite3_int64 rowid, sqlite3_int64 id_from,
     struct node *pFrom;
     struct node *pTo;
     struct node *pN2;
-    struct arc *pA;
     char xRowid[128];
     sprintf (xRowid, FORMAT_64, rowid);
     pFrom =
@@ -519,153 +707,169 @@ add_arc (struct graph *p_graph, sqlite3_int64 rowid, sqlite3_int64 id_from,
       }
     if (p_graph->error)
 	return;
-    pA = malloc (sizeof (struct arc));
-    pA->rowid = rowid;
-    pA->from = pFrom;
-    pA->to = pTo;
-    pA->cost = cost;
-    pA->next = NULL;
-    if (!(p_graph->first_arc))
-	p_graph->first_arc = pA;
-    if (p_graph->last_arc)
-	p_graph->last_arc->next = pA;
-    p_graph->last_arc = pA;
-/* updating Node connections */
-    add_outcoming_arc (pFrom, pA);
-    add_incoming_arc (pTo, pA);
+    push_arc (p_graph, rowid, pFrom - p_graph->nodes, pTo - p_graph->nodes,
+	      cost);
 }
 
-static int
-cmp_prenodes_code (const void *p1, const void *p2)
+static void
+init_nodes (struct graph *p_graph)
 {
-/* compares two preliminary nodes  by CODE [for QSORT] */
-    struct pre_node *pP1 = *((struct pre_node **) p1);
-    struct pre_node *pP2 = *((struct pre_node **) p2);
-    return strcmp (pP1->code, pP2->code);
+/* prepares the final Nodes arena */
+    int i;
+    struct pre_node *pP;
+/* sorting preliminary nodes and removing duplicates */
+    compact_pre_nodes (p_graph, p_graph->node_code);
+    if (!(p_graph->n_pre_nodes))
+	return;
+/* creating the final Nodes arena; it's already sorted */
+    p_graph->nodes = malloc (sizeof (struct node) * p_graph->n_pre_nodes);
+    if (!(p_graph->nodes))
+      {
+	  printf ("ERROR: insufficient memory [Nodes]\n");
+	  p_graph->error = 1;
+	  graph_free_pre (p_graph);
+	  return;
+      }
+    p_graph->n_nodes = 0;
+    for (i = 0; i < p_graph->n_pre_nodes; i++)
+      {
+	  pP = p_graph->pre_nodes + i;
+	  add_node (p_graph, pP->id, pP->code);
+      }
+/* cleaning up the preliminary Nodes arena */
+    graph_free_pre (p_graph);
+/* building the hash index */
+    build_node_index (p_graph);
 }
 
 static int
-cmp_prenodes_id (const void *p1, const void *p2)
-{
-/* compares two preliminary nodes  by ID [for QSORT] */
-    struct pre_node *pP1 = *((struct pre_node **) p1);
-    struct pre_node *pP2 = *((struct pre_node **) p2);
-    if (pP1->id == pP2->id)
-	return 0;
-    if (pP1->id > pP2->id)
-	return 1;
-    return -1;
-}
-
-static void
-init_nodes (struct graph *p_graph)
+pack_arcs (struct graph *p_graph)
 {
-/* prepares the final Nodes list */
-    sqlite3_int64 last_id;
-    char last_code[32];
+/* rearranging the Arcs arena in CSR order */
     int i;
-    struct pre_node *pP;
-    p_graph->n_pre_nodes = 0;
-/* sorting preliminary nodes */
-    if (p_graph->sorted_pre_nodes)
+    int j;
+    int k;
+    int n_star;
+    int *next = NULL;
+    struct arc *packed = NULL;
+    struct arc *slice;
+    struct arc swap;
+    int *origin = NULL;
+    int swap_origin;
+    double *costs = NULL;
+    int n_nodes = p_graph->n_nodes;
+    int n_arcs = p_graph->n_arcs;
+    int n_costs = p_graph->n_costs;
+    p_graph->out_offsets = calloc (n_nodes + 1, sizeof (int));
+    p_graph->in_offsets = calloc (n_nodes + 1, sizeof (int));
+    p_graph->in_arcs = malloc (sizeof (int) * (n_arcs + 1));
+    next = malloc (sizeof (int) * (n_nodes + 1));
+    packed = malloc (sizeof (struct arc) * (n_arcs + 1));
+    if (n_costs)
       {
-	  /* we must free the already existent sorted list */
-	  free (p_graph->sorted_pre_nodes);
+	  /* tracking where each Arc comes from, so to gather its alternative Costs */
+	  origin = malloc (sizeof (int) * (n_arcs + 1));
+	  costs = malloc (sizeof (double) * n_costs * ((size_t) n_arcs + 1));
       }
-    p_graph->sorted_pre_nodes = NULL;
-    pP = p_graph->first_pre;
-    while (pP)
+    if (!(p_graph->out_offsets) || !(p_graph->in_offsets)
+	|| !(p_graph->in_arcs) || !next || !packed
+	|| (n_costs && (!origin || !costs)))
       {
-	  (p_graph->n_pre_nodes)++;
-	  pP = pP->next;
+	  printf ("ERROR: insufficient memory [CSR]\n");
+	  p_graph->error = 1;
+	  if (next)
+	      free (next);
+	  if (packed)
+	      free (packed);
+	  if (origin)
+	      free (origin);
+	  if (costs)
+	      free (costs);
+	  return 0;
       }
-    if (!(p_graph->n_pre_nodes))
-	return;
-    p_graph->sorted_pre_nodes =
-	malloc (sizeof (struct pre_node *) * p_graph->n_pre_nodes);
-    i = 0;
-    pP = p_graph->first_pre;
-    while (pP)
+/* counting how many outcoming / incoming arcs each Node has */
+    for (i = 0; i < n_arcs; i++)
       {
-	  *(p_graph->sorted_pre_nodes + i++) = pP;
-	  pP = pP->next;
+	  p_graph->out_offsets[p_graph->arcs[i].from + 1] += 1;
+	  p_graph->in_offsets[p_graph->arcs[i].to + 1] += 1;
       }
-    if (p_graph->node_code)
+    for (i = 0; i < n_nodes; i++)
       {
-	  /* Nodes are identified by a TEXT code */
-	  qsort (p_graph->sorted_pre_nodes, p_graph->n_pre_nodes,
-		 sizeof (struct pre_node *), cmp_prenodes_code);
+	  p_graph->out_offsets[i + 1] += p_graph->out_offsets[i];
+	  p_graph->in_offsets[i + 1] += p_graph->in_offsets[i];
       }
-    else
+/* stable bucketing of the Arcs by FromNode */
+    memcpy (next, p_graph->out_offsets, sizeof (int) * n_nodes);
+    for (i = 0; i < n_arcs; i++)
       {
-	  /* Nodes are identified by an INTEGER id */
-	  qsort (p_graph->sorted_pre_nodes, p_graph->n_pre_nodes,
-		 sizeof (struct pre_node *), cmp_prenodes_id);
+	  j = next[p_graph->arcs[i].from]++;
+	  packed[j] = p_graph->arcs[i];
+	  if (origin)
+	      origin[j] = i;
       }
-/* creating the final Nodes linked list */
-    last_id = -1;
-    *last_code = '\0';
-    for (i = 0; i < p_graph->n_pre_nodes; i++)
+    free (p_graph->arcs);
+    p_graph->arcs = packed;
+    p_graph->max_arcs = n_arcs;
+    for (i = 0; i < n_nodes; i++)
       {
-	  pP = *(p_graph->sorted_pre_nodes + i);
-	  if (p_graph->node_code)
+	  /* sorting each outcoming slice by Cost; insertion sort is stable */
+	  slice = p_graph->arcs + p_graph->out_offsets[i];
+	  n_star = p_graph->out_offsets[i + 1] - p_graph->out_offsets[i];
+	  for (j = 1; j < n_star; j++)
 	    {
-		/* Nodes are identified by a TEXT code */
-		if (strcmp (pP->code, last_code) != 0)
-		    add_node (p_graph, pP->id, pP->code);
+		swap = slice[j];
+		if (origin)
+		    swap_origin = origin[p_graph->out_offsets[i] + j];
+		k = j - 1;
+		while (k >= 0 && slice[k].cost > swap.cost)
+		  {
+		      slice[k + 1] = slice[k];
+		      if (origin)
+			  origin[p_graph->out_offsets[i] + k + 1] =
+			      origin[p_graph->out_offsets[i] + k];
+		      k--;
+		  }
+		slice[k + 1] = swap;
+		if (origin)
+		    origin[p_graph->out_offsets[i] + k + 1] = swap_origin;
 	    }
-	  else
+      }
+    if (origin)
+      {
+	  /* gathering the alternative Costs by profile [structure of arrays] */
+	  for (k = 0; k < n_costs; k++)
 	    {
-		/* Nodes are identified by an INTEGER id */
-		if (pP->id != last_id)
-		    add_node (p_graph, pP->id, pP->code);
+		for (i = 0; i < n_arcs; i++)
+		    costs[((size_t) k * n_arcs) + i] =
+			p_graph->costs[((size_t) origin[i] * n_costs) + k];
 	    }
-	  last_id = pP->id;
-	  strcpy (last_code, pP->code);
+	  free (p_graph->costs);
+	  p_graph->costs = costs;
+	  free (origin);
       }
-/* sorting the final Nodes list */
-    sort_nodes (p_graph);
-/* cleaning up the preliminary Nodes structs */
-    graph_free_pre (p_graph);
+/* referencing the incoming Arcs */
+    memcpy (next, p_graph->in_offsets, sizeof (int) * n_nodes);
+    for (i = 0; i < n_arcs; i++)
+	p_graph->in_arcs[next[p_graph->arcs[i].to]++] = i;
+    free (next);
+    return 1;
 }
 
 static void
 print_report (struct graph *p_graph)
 {
 /* printing the final report */
-    int cnt = 0;
+    int i;
     int max_in = 0;
     int max_out = 0;
     int card_in;
     int card_out;
     int card_1 = 0;
     int card_2 = 0;
-    struct node *pN;
-    struct arc_ref *pAR;
-    struct arc *pA = p_graph->first_arc;
-    while (pA)
-      {
-	  /* counting the Arcs */
-	  cnt++;
-	  pA = pA->next;
-      }
-    pN = p_graph->first_node;
-    while (pN)
+    for (i = 0; i < p_graph->n_nodes; i++)
       {
-	  card_in = 0;
-	  pAR = pN->first_incoming;
-	  while (pAR)
-	    {
-		card_in++;
-		pAR = pAR->next;
-	    }
-	  card_out = 0;
-	  pAR = pN->first_outcoming;
-	  while (pAR)
-	    {
-		card_out++;
-		pAR = pAR->next;
-	    }
+	  card_in = p_graph->in_offsets[i + 1] - p_graph->in_offsets[i];
+	  card_out = p_graph->out_offsets[i + 1] - p_graph->out_offsets[i];
 	  if (card_in > max_in)
 	      max_in = card_in;
 	  if (card_out > max_out)
@@ -674,162 +878,314 @@ print_report (struct graph *p_graph)
 	      card_1++;
 	  if (card_in == 2 && card_out == 2)
 	      card_2++;
-	  pN = pN->next;
       }
     printf ("\nStatistics\n");
     printf
 	("==================================================================\n");
-    printf ("\t# Arcs : %d\n", cnt);
+    printf ("\t# Arcs : %d\n", p_graph->n_arcs);
     printf ("\t# Nodes: %d\n", p_graph->n_nodes);
     printf ("\tNode max  incoming arcs: %d\n", max_in);
     printf ("\tNode max outcoming arcs: %d\n", max_out);
     printf ("\t# Nodes   cardinality=1: %d [terminal nodes]\n", card_1);
     printf ("\t# Nodes   cardinality=2: %d [meaningless, pass-through]\n",
 	    card_2);
+    if (p_graph->max_snapped > 0.0)
+	printf ("\tmax snapped end points distance: %1.6f\n",
+		p_graph->max_snapped);
     printf
 	("==================================================================\n");
 }
 
-static struct arc **
-prepareOutcomings (struct node *pN, int *count)
+static int
+cmp_component_sizes (const void *p1, const void *p2)
 {
-/* preparing the outcoming arc array */
-    struct arc **arc_array;
-    int n = 0;
+/* sorting components by decreasing size [ties by id] */
+    const int *c1 = (const int *) p1;
+    const int *c2 = (const int *) p2;
+    if (c1[1] != c2[1])
+	return c2[1] - c1[1];
+    return c1[0] - c2[0];
+}
+
+static int
+find_components (struct graph *p_graph)
+{
+/* 
+/ identifying the Strongly Connected Components [iterative Tarjan];
+/ components are then renumbered by decreasing size, so that
+/ component #0 always is the largest one
+*/
+    int n = p_graph->n_nodes;
+    int *index = malloc (sizeof (int) * n);
+    int *lowlink = malloc (sizeof (int) * n);
+    int *stack = malloc (sizeof (int) * n);
+    int *call_node = malloc (sizeof (int) * n);
+    int *call_arc = malloc (sizeof (int) * n);
+    char *on_stack = malloc (n);
+    int *component = malloc (sizeof (int) * n);
+    int *sizes = NULL;
+    int n_components = 0;
+    int counter = 0;
+    int top = 0;
+    int n_calls;
     int i;
-    int ok;
-    struct arc_ref *pAR;
-    struct arc *pA0;
-    struct arc *pA1;
-    pAR = pN->first_outcoming;
-    while (pAR)
+    int v;
+    int w;
+    int e;
+    int ok = 0;
+    if (!index || !lowlink || !stack || !call_node || !call_arc || !on_stack
+	|| !component)
+	goto stop;
+    for (i = 0; i < n; i++)
       {
-	  /* counting how many outcoming arsc are there */
-	  n++;
-	  pAR = pAR->next;
+	  index[i] = -1;
+	  on_stack[i] = 0;
       }
-    if (!n)
+    for (i = 0; i < n; i++)
       {
-	  *count = 0;
-	  return NULL;
+	  if (index[i] >= 0)
+	      continue;
+	  index[i] = counter;
+	  lowlink[i] = counter++;
+	  stack[top++] = i;
+	  on_stack[i] = 1;
+	  call_node[0] = i;
+	  call_arc[0] = p_graph->out_offsets[i];
+	  n_calls = 1;
+	  while (n_calls > 0)
+	    {
+		v = call_node[n_calls - 1];
+		e = call_arc[n_calls - 1];
+		if (e < p_graph->out_offsets[v + 1])
+		  {
+		      /* exploring the next outcoming Arc */
+		      call_arc[n_calls - 1] += 1;
+		      w = p_graph->arcs[e].to;
+		      if (index[w] < 0)
+			{
+			    index[w] = counter;
+			    lowlink[w] = counter++;
+			    stack[top++] = w;
+			    on_stack[w] = 1;
+			    call_node[n_calls] = w;
+			    call_arc[n_calls] = p_graph->out_offsets[w];
+			    n_calls++;
+			}
+		      else if (on_stack[w] && index[w] < lowlink[v])
+			  lowlink[v] = index[w];
+		      continue;
+		  }
+		/* all Arcs have been explored */
+		n_calls--;
+		if (lowlink[v] == index[v])
+		  {
+		      /* v is the root of a component */
+		      do
+			{
+			    w = stack[--top];
+			    on_stack[w] = 0;
+			    component[w] = n_components;
+			}
+		      while (w != v);
+		      n_components++;
+		  }
+		if (n_calls > 0)
+		  {
+		      w = call_node[n_calls - 1];
+		      if (lowlink[v] < lowlink[w])
+			  lowlink[w] = lowlink[v];
+		  }
+	    }
       }
-    arc_array = malloc (sizeof (struct arc *) * n);
-    i = 0;
-    pAR = pN->first_outcoming;
-    while (pAR)
+/* renumbering the components by decreasing size */
+    sizes = malloc (sizeof (int) * 2 * n_components);
+    if (!sizes)
+	goto stop;
+    for (i = 0; i < n_components; i++)
       {
-	  /* populating the arcs array */
-	  *(arc_array + i++) = pAR->reference;
-	  pAR = pAR->next;
+	  sizes[i * 2] = i;
+	  sizes[(i * 2) + 1] = 0;
       }
+    for (i = 0; i < n; i++)
+	sizes[(component[i] * 2) + 1] += 1;
+    qsort (sizes, n_components, sizeof (int) * 2, cmp_component_sizes);
+    for (i = 0; i < n_components; i++)
+	index[sizes[i * 2]] = i;
+    for (i = 0; i < n; i++)
+	component[i] = index[component[i]];
+    p_graph->components = component;
+    p_graph->n_components = n_components;
+    component = NULL;
     ok = 1;
-    while (ok)
+  stop:
+    if (index)
+	free (index);
+    if (lowlink)
+	free (lowlink);
+    if (stack)
+	free (stack);
+    if (call_node)
+	free (call_node);
+    if (call_arc)
+	free (call_arc);
+    if (on_stack)
+	free (on_stack);
+    if (component)
+	free (component);
+    if (sizes)
+	free (sizes);
+    return ok;
+}
+
+static int
+find_island (int *parent, int i)
+{
+/* union-find: returns the representative of an island */
+    while (parent[i] != i)
       {
-	  /* bubble sorting the arcs by Cost */
-	  ok = 0;
-	  for (i = 1; i < n; i++)
-	    {
-		pA0 = *(arc_array + i - 1);
-		pA1 = *(arc_array + i);
-		if (pA0->cost > pA1->cost)
-		  {
-		      /* swapping the arcs */
-		      *(arc_array + i - 1) = pA1;
-		      *(arc_array + i) = pA0;
-		      ok = 1;
-		  }
-	    }
+	  parent[i] = parent[parent[i]];
+	  i = parent[i];
       }
-    *count = n;
-    return arc_array;
+    return i;
 }
 
 static void
-output_node (unsigned char *auxbuf, int *size, int ind, int node_code,
-	     int max_node_length, struct node *pN, int endian_arch,
-	     int a_star_supported)
+print_components_report (struct graph *p_graph)
 {
-/* exporting a Node into NETWORK-DATA */
-    int n_star;
+/* 
+/ printing the connectivity report:
+/ - islands are groups of Nodes not connected at all to the
+/   remaining graph, whatever the direction of Arcs
+/ - a trap is a component that can be entered but never left;
+/   an unreachable component can be left but never entered
+*/
+    int n = p_graph->n_nodes;
+    int *parent;
+    int *island_sizes;
+    char *has_in;
+    char *has_out;
     int i;
-    struct arc **arc_array;
+    int a;
+    int b;
+    int c1;
+    int c2;
+    int n_islands = 0;
+    int max_island = 0;
+    int n_traps = 0;
+    int trap_nodes = 0;
+    int n_unreachable = 0;
+    int unreachable_nodes = 0;
+    int largest = 0;
     struct arc *pA;
-    unsigned char *out = auxbuf;
-    *out++ = GAIA_NET_NODE;
-    gaiaExport32 (out, ind, 1, endian_arch);	/* the Node internal index */
-    out += 4;
-    if (node_code)
+    if (!find_components (p_graph))
       {
-	  /* Nodes are identified by a TEXT Code */
-	  memset (out, '\0', max_node_length);
-	  strcpy ((char *) out, pN->code);
-	  out += max_node_length;
+	  printf ("ERROR: insufficient memory [Components]\n");
+	  return;
       }
-    else
+    parent = malloc (sizeof (int) * n);
+    island_sizes = malloc (sizeof (int) * n);
+    has_in = malloc (p_graph->n_components);
+    has_out = malloc (p_graph->n_components);
+    if (!parent || !island_sizes || !has_in || !has_out)
       {
-	  /* Nodes are identified by an INTEGER Id */
-	  gaiaExportI64 (out, pN->id, 1, endian_arch);	/* the Node ID */
-	  out += 8;
+	  printf ("ERROR: insufficient memory [Components]\n");
+	  goto stop;
       }
-    if (a_star_supported)
+    memset (has_in, 0, p_graph->n_components);
+    memset (has_out, 0, p_graph->n_components);
+    for (i = 0; i < n; i++)
       {
-	  /* in order to support the A* algorithm [X,Y] are required for each node */
-	  gaiaExport64 (out, pN->x, 1, endian_arch);
-	  out += 8;
-	  gaiaExport64 (out, pN->y, 1, endian_arch);
-	  out += 8;
+	  parent[i] = i;
+	  island_sizes[i] = 0;
+	  if (p_graph->components[i] == 0)
+	      largest++;
       }
-    arc_array = prepareOutcomings (pN, &n_star);
-    gaiaExport16 (out, n_star, 1, endian_arch);	/* # of outcoming arcs */
-    out += 2;
-    for (i = 0; i < n_star; i++)
+    for (i = 0; i < p_graph->n_arcs; i++)
       {
-	  /* exporting the outcoming arcs */
-	  pA = *(arc_array + i);
-	  *out++ = GAIA_NET_ARC;
-	  gaiaExportI64 (out, pA->rowid, 1, endian_arch);	/* the Arc rowid */
-	  out += 8;
-	  gaiaExport32 (out, pA->to->internal_index, 1, endian_arch);	/* the ToNode internal index */
-	  out += 4;
-	  gaiaExport64 (out, pA->cost, 1, endian_arch);	/* the Arc Cost */
-	  out += 8;
-	  *out++ = GAIA_NET_END;
+	  pA = p_graph->arcs + i;
+	  a = find_island (parent, pA->from);
+	  b = find_island (parent, pA->to);
+	  if (a != b)
+	      parent[a] = b;
+	  c1 = p_graph->components[pA->from];
+	  c2 = p_graph->components[pA->to];
+	  if (c1 != c2)
+	    {
+		has_out[c1] = 1;
+		has_in[c2] = 1;
+	    }
       }
-    if (arc_array)
-	free (arc_array);
-    *out++ = GAIA_NET_END;
-    *size = out - auxbuf;
-}
-
-static int
-create_network_data (sqlite3 * handle, const char *out_table,
-		     int force_creation, struct graph *p_graph,
-		     const char *table, const char *from_column,
-		     const char *to_column, const char *geom_column,
-		     const char *name_column, int a_star_supported,
-		     double a_star_coeff)
-{
-/* creates the NETWORK-DATA table */
+    for (i = 0; i < n; i++)
+	island_sizes[find_island (parent, i)] += 1;
+    for (i = 0; i < n; i++)
+      {
+	  if (island_sizes[i] == 0)
+	      continue;
+	  n_islands++;
+	  if (island_sizes[i] > max_island)
+	      max_island = island_sizes[i];
+      }
+    for (i = 0; i < n; i++)
+      {
+	  c1 = p_graph->components[i];
+	  if (c1 == 0)
+	      continue;
+	  if (has_in[c1] && !has_out[c1])
+	      trap_nodes++;
+	  if (has_out[c1] && !has_in[c1])
+	      unreachable_nodes++;
+      }
+    for (i = 1; i < p_graph->n_components; i++)
+      {
+	  if (has_in[i] && !has_out[i])
+	      n_traps++;
+	  if (has_out[i] && !has_in[i])
+	      n_unreachable++;
+      }
+    printf ("\nConnectivity\n");
+    printf
+	("==================================================================\n");
+    printf ("\t# Islands: %d [largest: %d Nodes]\n", n_islands, max_island);
+    printf ("\t# Strongly Connected Components: %d [largest: %d Nodes]\n",
+	    p_graph->n_components, largest);
+    printf ("\t# Nodes outside the largest Component: %d\n", n - largest);
+    printf ("\t# one-way traps: %d [%d Nodes; can be entered, never left]\n",
+	    n_traps, trap_nodes);
+    printf ("\t# unreachable  : %d [%d Nodes; can be left, never entered]\n",
+	    n_unreachable, unreachable_nodes);
+    if (n_islands > 1 || p_graph->n_components > 1)
+	printf ("\tWARNING: routing between different Components will fail\n"
+		"\tafter exhausting the whole reachable graph\n");
+    printf
+	("==================================================================\n");
+  stop:
+    if (parent)
+	free (parent);
+    if (island_sizes)
+	free (island_sizes);
+    if (has_in)
+	free (has_in);
+    if (has_out)
+	free (has_out);
+}
+
+static int
+write_components (sqlite3 * handle, const char *out_table,
+		  struct graph *p_graph)
+{
+/* 
+/ writing the Component of each Arc into "<out_table>_components";
+/ the input table is left untouched, so no change is logged
+/ Arcs connecting two different Components are set to NULL
+*/
     int ret;
+    int i;
+    int c1;
+    int c2;
     char sql[1024];
     char *err_msg = NULL;
-    unsigned char *auxbuf = malloc (MAX_BLOCK);
-    unsigned char *buf = malloc (MAX_BLOCK);
-    unsigned char *out;
-    sqlite3_stmt *stmt;
-    int i;
-    int size;
-    int endian_arch = gaiaEndianArch ();
-    struct node *pN;
-    int pk = 0;
-    int nodes_cnt;
-    int len;
-    for (i = 0; i < p_graph->n_nodes; i++)
-      {
-	  /* setting the internal index to each Node */
-	  pN = *(p_graph->sorted_nodes + i);
-	  pN->internal_index = i;
-      }
+    sqlite3_stmt *stmt = NULL;
+    struct arc *pA;
 /* starts a transaction */
     strcpy (sql, "BEGIN");
     ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
@@ -837,22 +1193,19 @@ create_network_data (sqlite3 * handle, const char *out_table,
       {
 	  printf ("BEGIN error: %s\n", err_msg);
 	  sqlite3_free (err_msg);
-	  goto abort;
+	  return 0;
       }
-    if (force_creation)
+    sprintf (sql, "DROP TABLE IF EXISTS \"%s_components\"", out_table);
+    ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
       {
-	  sprintf (sql, "DROP TABLE IF EXISTS \"%s\"", out_table);
-	  ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
-	  if (ret != SQLITE_OK)
-	    {
-		printf ("DROP TABLE error: %s\n", err_msg);
-		sqlite3_free (err_msg);
-		goto abort;
-	    }
+	  printf ("DROP TABLE error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  goto abort;
       }
-/* creating the NETWORK-DATA table */
-    sprintf (sql, "CREATE TABLE \"%s\" (", out_table);
-    strcat (sql, "\"Id\" INTEGER PRIMARY KEY, \"NetworkData\" BLOB NOT NULL)");
+    sprintf (sql, "CREATE TABLE \"%s_components\" ("
+	     "\"RowId\" INTEGER PRIMARY KEY, \"Component\" INTEGER)",
+	     out_table);
     ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
     if (ret != SQLITE_OK)
       {
@@ -860,8 +1213,7 @@ create_network_data (sqlite3 * handle, const char *out_table,
 	  sqlite3_free (err_msg);
 	  goto abort;
       }
-/* preparing the SQL statement */
-    sprintf (sql, "INSERT INTO \"%s\" (\"Id\", \"NetworkData\") VALUES (?, ?)",
+    sprintf (sql, "INSERT OR IGNORE INTO \"%s_components\" VALUES (?, ?)",
 	     out_table);
     ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &stmt, NULL);
     if (ret != SQLITE_OK)
@@ -869,160 +1221,29 @@ create_network_data (sqlite3 * handle, const char *out_table,
 	  printf ("INSERT error: %s\n", sqlite3_errmsg (handle));
 	  goto abort;
       }
-    if (pk == 0)
+    for (i = 0; i < p_graph->n_arcs; i++)
       {
-	  /* preparing the HEADER block */
-	  out = buf;
-	  if (a_star_supported)
-	      *out++ = GAIA_NET64_A_STAR_START;
-	  else
-	      *out++ = GAIA_NET64_START;
-	  *out++ = GAIA_NET_HEADER;
-	  gaiaExport32 (out, p_graph->n_nodes, 1, endian_arch);	/* how many Nodes are there */
-	  out += 4;
-	  if (p_graph->node_code)
-	      *out++ = GAIA_NET_CODE;	/* Nodes are identified by a TEXT code */
-	  else
-	      *out++ = GAIA_NET_ID;	/* Nodes are identified by an INTEGER id */
-	  if (p_graph->node_code)
-	      *out++ = p_graph->max_code_length;	/* max TEXT code length */
-	  else
-	      *out++ = 0x00;
-	  /* inserting the main Table name */
-	  *out++ = GAIA_NET_TABLE;
-	  len = strlen (table) + 1;
-	  gaiaExport16 (out, len, 1, endian_arch);	/* the Table Name length, including last '\0' */
-	  out += 2;
-	  memset (out, '\0', len);
-	  strcpy ((char *) out, table);
-	  out += len;
-	  /* inserting the NodeFrom column name */
-	  *out++ = GAIA_NET_FROM;
-	  len = strlen (from_column) + 1;
-	  gaiaExport16 (out, len, 1, endian_arch);	/* the NodeFrom column Name length, including last '\0' */
-	  out += 2;
-	  memset (out, '\0', len);
-	  strcpy ((char *) out, from_column);
-	  out += len;
-	  /* inserting the NodeTo column name */
-	  *out++ = GAIA_NET_TO;
-	  len = strlen (to_column) + 1;
-	  gaiaExport16 (out, len, 1, endian_arch);	/* the NodeTo column Name length, including last '\0' */
-	  out += 2;
-	  memset (out, '\0', len);
-	  strcpy ((char *) out, to_column);
-	  out += len;
-	  /* inserting the Geometry column name */
-	  *out++ = GAIA_NET_GEOM;
-	  if (!geom_column)
-	      len = 1;
-	  else
-	      len = strlen (geom_column) + 1;
-	  gaiaExport16 (out, len, 1, endian_arch);	/* the Geometry column Name length, including last '\0' */
-	  out += 2;
-	  memset (out, '\0', len);
-	  if (geom_column)
-	      strcpy ((char *) out, geom_column);
-	  out += len;
-	  /* inserting the Name column name - may be empty */
-	  *out++ = GAIA_NET_NAME;
-	  if (!name_column)
-	      len = 1;
-	  else
-	      len = strlen (name_column) + 1;
-	  gaiaExport16 (out, len, 1, endian_arch);	/* the Name column Name length, including last '\0' */
-	  out += 2;
-	  memset (out, '\0', len);
-	  if (name_column)
-	      strcpy ((char *) out, name_column);
-	  out += len;
-	  if (a_star_supported)
-	    {
-		/* inserting the A* Heuristic Coeff */
-		*out++ = GAIA_NET_A_STAR_COEFF;
-		gaiaExport64 (out, a_star_coeff, 1, endian_arch);
-		out += 8;
-	    }
-	  *out++ = GAIA_NET_END;
-	  /* INSERTing the Header block */
+	  pA = p_graph->arcs + i;
+	  c1 = p_graph->components[pA->from];
+	  c2 = p_graph->components[pA->to];
 	  sqlite3_reset (stmt);
 	  sqlite3_clear_bindings (stmt);
-	  sqlite3_bind_int64 (stmt, 1, pk);
-	  sqlite3_bind_blob (stmt, 2, buf, out - buf, SQLITE_STATIC);
-	  ret = sqlite3_step (stmt);
-	  if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-	      ;
+	  sqlite3_bind_int64 (stmt, 1, pA->rowid);
+	  if (c1 == c2)
+	      sqlite3_bind_int (stmt, 2, c1);
 	  else
-	    {
-		printf ("sqlite3_step() error: %s\n", sqlite3_errmsg (handle));
-		sqlite3_finalize (stmt);
-		goto abort;
-	    }
-	  pk++;
-	  /* preparing a new block */
-	  out = buf;
-	  *out++ = GAIA_NET_BLOCK;
-	  gaiaExport16 (out, 0, 1, endian_arch);	/* how many Nodes are into this block */
-	  out += 2;
-	  nodes_cnt = 0;
-      }
-    for (i = 0; i < p_graph->n_nodes; i++)
-      {
-	  /* looping on each Node */
-	  pN = *(p_graph->sorted_nodes + i);
-	  output_node (auxbuf, &size, i, p_graph->node_code,
-		       p_graph->max_code_length, pN, endian_arch,
-		       a_star_supported);
-	  if (size >= (MAX_BLOCK - (out - buf)))
-	    {
-		/* inserting the last block */
-		gaiaExport16 (buf + 1, nodes_cnt, 1, endian_arch);	/* how many Nodes are into this block */
-		sqlite3_reset (stmt);
-		sqlite3_clear_bindings (stmt);
-		sqlite3_bind_int64 (stmt, 1, pk);
-		sqlite3_bind_blob (stmt, 2, buf, out - buf, SQLITE_STATIC);
-		ret = sqlite3_step (stmt);
-		if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-		    ;
-		else
-		  {
-		      printf ("sqlite3_step() error: %s\n",
-			      sqlite3_errmsg (handle));
-		      sqlite3_finalize (stmt);
-		      goto abort;
-		  }
-		pk++;
-		/* preparing a new block */
-		out = buf;
-		*out++ = GAIA_NET_BLOCK;
-		gaiaExport16 (out, 0, 1, endian_arch);	/* how many Nodes are into this block */
-		out += 2;
-		nodes_cnt = 0;
-	    }
-	  /* inserting the current Node into the block */
-	  nodes_cnt++;
-	  memcpy (out, auxbuf, size);
-	  out += size;
-      }
-    if (nodes_cnt)
-      {
-	  /* inserting the last block */
-	  gaiaExport16 (buf + 1, nodes_cnt, 1, endian_arch);	/* how many Nodes are into this block */
-	  sqlite3_reset (stmt);
-	  sqlite3_clear_bindings (stmt);
-	  sqlite3_bind_int64 (stmt, 1, pk);
-	  sqlite3_bind_blob (stmt, 2, buf, out - buf, SQLITE_STATIC);
+	      sqlite3_bind_null (stmt, 2);
 	  ret = sqlite3_step (stmt);
 	  if (ret == SQLITE_DONE || ret == SQLITE_ROW)
 	      ;
 	  else
 	    {
 		printf ("sqlite3_step() error: %s\n", sqlite3_errmsg (handle));
-		sqlite3_finalize (stmt);
 		goto abort;
 	    }
       }
     sqlite3_finalize (stmt);
+    stmt = NULL;
 /* commits the transaction */
     strcpy (sql, "COMMIT");
     ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
@@ -1032,104 +1253,4057 @@ create_network_data (sqlite3 * handle, const char *out_table,
 	  sqlite3_free (err_msg);
 	  goto abort;
       }
-    if (buf)
-	free (buf);
-    if (auxbuf)
-	free (auxbuf);
     return 1;
   abort:
-    if (buf)
-	free (buf);
-    if (auxbuf)
-	free (auxbuf);
+    if (stmt)
+	sqlite3_finalize (stmt);
+    sqlite3_exec (handle, "ROLLBACK", NULL, NULL, NULL);
     return 0;
 }
 
-static int
-create_virtual_network (sqlite3 * handle, const char *out_table,
-			const char *virt_table, int force_creation)
+static struct arc *
+prepareOutcomings (struct graph *p_graph, int ind, int *count)
 {
-/* creates the VirtualNetwork table */
-    int ret;
-    char sql[1024];
-    char *err_msg = NULL;
-    if (force_creation)
+/* returns the slice of outcoming arcs [already sorted by Cost] */
+    *count = p_graph->out_offsets[ind + 1] - p_graph->out_offsets[ind];
+    return p_graph->arcs + p_graph->out_offsets[ind];
+}
+
+static void
+output_node (unsigned char *auxbuf, int *size, struct graph *p_graph,
+	     int ind, int endian_arch, int a_star_supported,
+	     const double *costs)
+{
+/* exporting a Node into NETWORK-DATA; costs [if any] replace the Arc Costs */
+    int n_star;
+    int i;
+    struct arc *arc_array;
+    struct arc *pA;
+    struct node *pN = p_graph->nodes + ind;
+    unsigned char *out = auxbuf;
+    *out++ = GAIA_NET_NODE;
+    gaiaExport32 (out, pN->internal_index, 1, endian_arch);	/* the Node internal index */
+    out += 4;
+    if (p_graph->node_code)
       {
-	  sprintf (sql, "DROP TABLE IF EXISTS \"%s\"", virt_table);
-	  ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
-	  if (ret != SQLITE_OK)
+	  /* Nodes are identified by a TEXT Code */
+	  memset (out, '\0', p_graph->max_code_length);
+	  strcpy ((char *) out, pN->code);
+	  out += p_graph->max_code_length;
+      }
+    else
+      {
+	  /* Nodes are identified by an INTEGER Id */
+	  gaiaExportI64 (out, pN->id, 1, endian_arch);	/* the Node ID */
+	  out += 8;
+      }
+    if (a_star_supported)
+      {
+	  /* in order to support the A* algorithm [X,Y] are required for each node */
+	  gaiaExport64 (out, pN->x, 1, endian_arch);
+	  out += 8;
+	  gaiaExport64 (out, pN->y, 1, endian_arch);
+	  out += 8;
+      }
+    arc_array = prepareOutcomings (p_graph, ind, &n_star);
+    gaiaExport16 (out, n_star, 1, endian_arch);	/* # of outcoming arcs */
+    out += 2;
+    for (i = 0; i < n_star; i++)
+      {
+	  /* exporting the outcoming arcs */
+	  pA = arc_array + i;
+	  *out++ = GAIA_NET_ARC;
+	  gaiaExportI64 (out, pA->rowid, 1, endian_arch);	/* the Arc rowid */
+	  out += 8;
+	  gaiaExport32 (out, p_graph->nodes[pA->to].internal_index, 1, endian_arch);	/* the ToNode internal index */
+	  out += 4;
+	  if (costs)
+	      gaiaExport64 (out, costs[p_graph->out_offsets[ind] + i], 1, endian_arch);	/* the alternative Arc Cost */
+	  else
+	      gaiaExport64 (out, pA->cost, 1, endian_arch);	/* the Arc Cost */
+	  out += 8;
+	  *out++ = GAIA_NET_END;
+      }
+    *out++ = GAIA_NET_END;
+    *size = out - auxbuf;
+}
+
+struct net_block
+{
+/* a NETWORK-DATA block: a range of consecutive Nodes */
+    int first_node;		/* first position into the serialization order */
+    int n_nodes;
+    int size;
+    unsigned char *buf;
+    int ready;
+};
+
+struct net_blocks
+{
+/* the NETWORK-DATA blocks to be created */
+    struct net_block *blocks;
+    int n_blocks;
+    int max_size;
+    struct graph *p_graph;
+    int *order;			/* serialization order; NULL means by position */
+    const double *costs;	/* alternative Cost profile; NULL means the primary one */
+    int endian_arch;
+    int a_star_supported;
+    int compact;
+#ifdef NET_THREADS
+    int next_block;		/* the next block to be encoded */
+    int written;		/* how many blocks have already been inserted */
+    int window;			/* max number of encoded blocks waiting to be inserted */
+    int abort;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
+};
+
+static unsigned int
+hilbert_key (unsigned int x, unsigned int y)
+{
+/* the position of a point along a 65536 x 65536 Hilbert curve */
+    unsigned int s;
+    unsigned int rx;
+    unsigned int ry;
+    unsigned int t;
+    unsigned int d = 0;
+    for (s = 32768; s > 0; s /= 2)
+      {
+	  rx = (x & s) > 0;
+	  ry = (y & s) > 0;
+	  d += s * s * ((3 * rx) ^ ry);
+	  if (ry == 0)
 	    {
-		printf ("DROP TABLE error: %s\n", err_msg);
-		sqlite3_free (err_msg);
-		goto abort;
+		/* rotating the quadrant */
+		if (rx == 1)
+		  {
+		      x = 65535 - x;
+		      y = 65535 - y;
+		  }
+		t = x;
+		x = y;
+		y = t;
 	    }
       }
-/* creating the VirtualNetwork table */
-    sprintf (sql, "CREATE VIRTUAL TABLE \"%s\" USING  VirtualNetwork(\"%s\")",
-	     virt_table, out_table);
-    ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
-    if (ret != SQLITE_OK)
+    return d;
+}
+
+struct hilbert_item
+{
+/* a Node and its position along the Hilbert curve */
+    unsigned int key;
+    int ind;
+};
+
+static int
+cmp_hilbert (const void *p1, const void *p2)
+{
+/* compares two Hilbert keys [ties are resolved by Node position] */
+    const struct hilbert_item *pH1 = (const struct hilbert_item *) p1;
+    const struct hilbert_item *pH2 = (const struct hilbert_item *) p2;
+    if (pH1->key == pH2->key)
+	return pH1->ind - pH2->ind;
+    return (pH1->key < pH2->key) ? -1 : 1;
+}
+
+static int *
+order_nodes_hilbert (struct graph *p_graph)
+{
+/* sorting the Nodes along a Hilbert curve over their X/Y coordinates */
+    int i;
+    double min_x = DBL_MAX;
+    double min_y = DBL_MAX;
+    double max_x = -DBL_MAX;
+    double max_y = -DBL_MAX;
+    double scale_x;
+    double scale_y;
+    struct node *pN;
+    struct hilbert_item *items;
+    int *order;
+    for (i = 0; i < p_graph->n_nodes; i++)
       {
-	  printf ("CREATE TABLE error: %s\n", err_msg);
-	  sqlite3_free (err_msg);
-	  goto abort;
+	  pN = p_graph->nodes + i;
+	  if (pN->x == DBL_MAX || pN->y == DBL_MAX)
+	      continue;
+	  if (pN->x < min_x)
+	      min_x = pN->x;
+	  if (pN->x > max_x)
+	      max_x = pN->x;
+	  if (pN->y < min_y)
+	      min_y = pN->y;
+	  if (pN->y > max_y)
+	      max_y = pN->y;
       }
-    return 1;
-  abort:
-    return 0;
+    scale_x = (max_x > min_x) ? 65535.0 / (max_x - min_x) : 0.0;
+    scale_y = (max_y > min_y) ? 65535.0 / (max_y - min_y) : 0.0;
+    items = malloc (sizeof (struct hilbert_item) * p_graph->n_nodes);
+    order = malloc (sizeof (int) * p_graph->n_nodes);
+    if (items == NULL || order == NULL)
+      {
+	  if (items)
+	      free (items);
+	  if (order)
+	      free (order);
+	  return NULL;
+      }
+    for (i = 0; i < p_graph->n_nodes; i++)
+      {
+	  pN = p_graph->nodes + i;
+	  items[i].ind = i;
+	  if (pN->x == DBL_MAX || pN->y == DBL_MAX)
+	      items[i].key = 0xffffffff;	/* undefined coords: placed last */
+	  else
+	      items[i].key =
+		  hilbert_key ((unsigned int) ((pN->x - min_x) * scale_x),
+			       (unsigned int) ((pN->y - min_y) * scale_y));
+      }
+    qsort (items, p_graph->n_nodes, sizeof (struct hilbert_item),
+	   cmp_hilbert);
+    for (i = 0; i < p_graph->n_nodes; i++)
+	order[i] = items[i].ind;
+    free (items);
+    return order;
 }
 
-static void
-spatialite_autocreate (sqlite3 * db)
+static int *
+order_nodes_bfs (struct graph *p_graph)
 {
-/* attempting to perform self-initialization for a newly created DB */
-    int ret;
-    char sql[1024];
-    char *err_msg = NULL;
-    int count;
+/* 
+/ sorting the Nodes in Breadth-First order; both outcoming
+/ and incoming Arcs are followed, and each disconnected
+/ component starts from its lowest-positioned Node
+*/
     int i;
-    char **results;
-    int rows;
-    int columns;
+    int j;
+    int ind;
+    int next;
+    int head = 0;
+    int tail = 0;
+    int *order = malloc (sizeof (int) * p_graph->n_nodes);
+    char *visited = malloc (p_graph->n_nodes);
+    if (order == NULL || visited == NULL)
+      {
+	  if (order)
+	      free (order);
+	  if (visited)
+	      free (visited);
+	  return NULL;
+      }
+    memset (visited, 0, p_graph->n_nodes);
+    for (i = 0; i < p_graph->n_nodes; i++)
+      {
+	  if (visited[i])
+	      continue;
+	  visited[i] = 1;
+	  order[tail++] = i;
+	  while (head < tail)
+	    {
+		ind = order[head++];
+		for (j = p_graph->out_offsets[ind];
+		     j < p_graph->out_offsets[ind + 1]; j++)
+		  {
+		      next = p_graph->arcs[j].to;
+		      if (!visited[next])
+			{
+			    visited[next] = 1;
+			    order[tail++] = next;
+			}
+		  }
+		for (j = p_graph->in_offsets[ind];
+		     j < p_graph->in_offsets[ind + 1]; j++)
+		  {
+		      next = p_graph->arcs[p_graph->in_arcs[j]].from;
+		      if (!visited[next])
+			{
+			    visited[next] = 1;
+			    order[tail++] = next;
+			}
+		  }
+	    }
+      }
+    free (visited);
+    return order;
+}
 
-/* checking if this DB is really empty */
-    strcpy (sql, "SELECT Count(*) from sqlite_master");
-    ret = sqlite3_get_table (db, sql, &results, &rows, &columns, NULL);
-    if (ret != SQLITE_OK)
-	return;
-    if (rows < 1)
-	;
+static int
+node_size (struct graph *p_graph, int ind, int a_star_supported)
+{
+/* computing how many bytes a Node will require into NETWORK-DATA */
+    int n_star = p_graph->out_offsets[ind + 1] - p_graph->out_offsets[ind];
+    int size = 1 + 4 + 2 + 1;	/* NODE marker, internal index, # of arcs, END marker */
+    if (p_graph->node_code)
+	size += p_graph->max_code_length;
     else
+	size += 8;
+    if (a_star_supported)
+	size += 16;
+    return size + (n_star * 22);	/* ARC marker, rowid, ToNode index, cost, END marker */
+}
+
+/*
+/ the compact NETWORK-DATA encoding [--compact-encoding]:
+/ the Header only differs by its start marker and by a further
+/ NET_COMPACT_COSTS item declaring the Cost width [8 or 4 bytes];
+/ each block still starts by the BLOCK marker followed by the
+/ 16-bit # of Nodes, but Nodes and Arcs carry no markers at all:
+/ - internal index: zigzag varint, delta from the previous Node
+/   of the same block [absolute for the first one]
+/ - ID: zigzag varint, delta as above; CODE: varint length + chars
+/ - X, Y [A* only]: two doubles
+/ - # of outcoming Arcs: varint
+/ - for each Arc: ROWID as a zigzag varint delta from the previous
+/   Arc of the same Node [absolute for the first one], ToNode as a
+/   zigzag varint delta from the Node's own internal index, and
+/   Cost as a double [or a float]
+/ VirtualNetwork doesn't support this encoding; it's intended for
+/ routing engines directly reading NETWORK-DATA by themselves
+*/
+
+static sqlite3_uint64
+zigzag (sqlite3_int64 value)
+{
+/* mapping signed values to unsigned ones, small magnitudes first */
+    return ((sqlite3_uint64) value << 1) ^ (sqlite3_uint64) (value >> 63);
+}
+
+static sqlite3_int64
+unzigzag (sqlite3_uint64 value)
+{
+/* reverting zigzag() */
+    return (sqlite3_int64) (value >> 1) ^ -((sqlite3_int64) (value & 1));
+}
+
+static int
+varint_size (sqlite3_uint64 value)
+{
+/* how many bytes a varint will require */
+    int len = 1;
+    while (value >= 0x80)
+      {
+	  value >>= 7;
+	  len++;
+      }
+    return len;
+}
+
+static unsigned char *
+put_varint (unsigned char *out, sqlite3_uint64 value)
+{
+/* exporting a varint [7 bits for each byte, least significant first] */
+    while (value >= 0x80)
+      {
+	  *out++ = (unsigned char) (value & 0x7f) | 0x80;
+	  value >>= 7;
+      }
+    *out++ = (unsigned char) value;
+    return out;
+}
+
+static const unsigned char *
+get_varint (const unsigned char *in, const unsigned char *end,
+	    sqlite3_uint64 * value)
+{
+/* importing a varint; returns NULL if it's truncated or invalid */
+    int shift = 0;
+    *value = 0;
+    while (in < end && shift < 64)
+      {
+	  *value |= (sqlite3_uint64) (*in & 0x7f) << shift;
+	  if (!(*in++ & 0x80))
+	      return in;
+	  shift += 7;
+      }
+    return NULL;
+}
+
+static int
+compact_node_size (struct graph *p_graph, int ind, int prev,
+		   int a_star_supported, int compact)
+{
+/* computing how many bytes a Node will require into compact NETWORK-DATA */
+    int i;
+    int len;
+    sqlite3_int64 last_rowid = 0;
+    struct node *pN = p_graph->nodes + ind;
+    struct arc *pA;
+    int n_star = p_graph->out_offsets[ind + 1] - p_graph->out_offsets[ind];
+    int size =
+	varint_size (zigzag
+		     ((sqlite3_int64) pN->internal_index -
+		      (prev < 0 ? 0 : p_graph->nodes[prev].internal_index)));
+    if (p_graph->node_code)
+      {
+	  len = strlen (pN->code);
+	  size += varint_size (len) + len;
+      }
+    else
+	size +=
+	    varint_size (zigzag
+			 (pN->id - (prev < 0 ? 0 : p_graph->nodes[prev].id)));
+    if (a_star_supported)
+	size += 16;
+    size += varint_size (n_star);
+    for (i = 0; i < n_star; i++)
+      {
+	  pA = p_graph->arcs + p_graph->out_offsets[ind] + i;
+	  size += varint_size (zigzag (pA->rowid - last_rowid));
+	  last_rowid = pA->rowid;
+	  size +=
+	      varint_size (zigzag
+			   ((sqlite3_int64) p_graph->nodes[pA->to].
+			    internal_index - pN->internal_index));
+	  size += (compact == COMPACT_FLOAT) ? 4 : 8;
+      }
+    return size;
+}
+
+static int
+output_compact_node (unsigned char *auxbuf, struct graph *p_graph, int ind,
+		     int prev, int endian_arch, int a_star_supported,
+		     int compact, const double *costs)
+{
+/* exporting a Node into compact NETWORK-DATA; returns its size */
+    int i;
+    int len;
+    sqlite3_int64 last_rowid = 0;
+    double cost;
+    struct node *pN = p_graph->nodes + ind;
+    struct arc *pA;
+    unsigned char *out = auxbuf;
+    int n_star = p_graph->out_offsets[ind + 1] - p_graph->out_offsets[ind];
+    out =
+	put_varint (out,
+		    zigzag ((sqlite3_int64) pN->internal_index -
+			    (prev <
+			     0 ? 0 : p_graph->nodes[prev].internal_index)));
+    if (p_graph->node_code)
+      {
+	  /* Nodes are identified by a TEXT Code */
+	  len = strlen (pN->code);
+	  out = put_varint (out, len);
+	  memcpy (out, pN->code, len);
+	  out += len;
+      }
+    else
+      {
+	  /* Nodes are identified by an INTEGER Id */
+	  out =
+	      put_varint (out,
+			  zigzag (pN->id -
+				  (prev < 0 ? 0 : p_graph->nodes[prev].id)));
+      }
+    if (a_star_supported)
+      {
+	  gaiaExport64 (out, pN->x, 1, endian_arch);
+	  out += 8;
+	  gaiaExport64 (out, pN->y, 1, endian_arch);
+	  out += 8;
+      }
+    out = put_varint (out, n_star);
+    for (i = 0; i < n_star; i++)
+      {
+	  /* exporting the outcoming arcs */
+	  pA = p_graph->arcs + p_graph->out_offsets[ind] + i;
+	  out = put_varint (out, zigzag (pA->rowid - last_rowid));
+	  last_rowid = pA->rowid;
+	  out =
+	      put_varint (out,
+			  zigzag ((sqlite3_int64) p_graph->nodes[pA->to].
+				  internal_index - pN->internal_index));
+	  cost = costs ? costs[p_graph->out_offsets[ind] + i] : pA->cost;
+	  if (compact == COMPACT_FLOAT)
+	    {
+		gaiaExportF32 (out, (float) cost, 1, endian_arch);
+		out += 4;
+	    }
+	  else
+	    {
+		gaiaExport64 (out, cost, 1, endian_arch);
+		out += 8;
+	    }
+      }
+    return out - auxbuf;
+}
+
+static void
+free_blocks (struct net_blocks *list)
+{
+/* memory cleanup - NETWORK-DATA blocks */
+    int i;
+    if (!list)
+	return;
+    for (i = 0; i < list->n_blocks; i++)
+      {
+	  if (list->blocks[i].buf)
+	      free (list->blocks[i].buf);
+      }
+    if (list->blocks)
+	free (list->blocks);
+    if (list->order)
+	free (list->order);
+    free (list);
+}
+
+static struct net_blocks *
+plan_blocks (struct graph *p_graph, int *order, int count, int endian_arch,
+	     int a_star_supported, int block_size, int compact)
+{
+/* 
+/ splitting count Nodes into NETWORK-DATA blocks; the order
+/ array [if any] is owned by the returned list
+*/
+    int i;
+    int ind;
+    int prev = -1;
+    int size;
+    int max = 0;
+    struct net_block *pB = NULL;
+    struct net_blocks *list = malloc (sizeof (struct net_blocks));
+    list->blocks = NULL;
+    list->n_blocks = 0;
+    list->max_size = 0;
+    list->p_graph = p_graph;
+    list->order = order;
+    list->costs = NULL;
+    list->endian_arch = endian_arch;
+    list->a_star_supported = a_star_supported;
+    list->compact = compact;
+    for (i = 0; i < count; i++)
+      {
+	  ind = order ? order[i] : i;
+	  if (compact)
+	      size =
+		  compact_node_size (p_graph, ind, prev, a_star_supported,
+				     compact);
+	  else
+	      size = node_size (p_graph, ind, a_star_supported);
+	  if (pB == NULL || (size >= (block_size - pB->size) && pB->n_nodes)
+	      || pB->n_nodes >= MAX_BLOCK_NODES)
+	    {
+		/* starting a new block */
+		if (list->n_blocks >= max)
+		  {
+		      max += 1024;
+		      pB = realloc (list->blocks,
+				    sizeof (struct net_block) * max);
+		      if (!pB)
+			{
+			    free_blocks (list);
+			    return NULL;
+			}
+		      list->blocks = pB;
+		  }
+		pB = list->blocks + list->n_blocks;
+		list->n_blocks += 1;
+		pB->first_node = i;
+		pB->n_nodes = 0;
+		pB->size = 3;	/* BLOCK marker, # of Nodes */
+		pB->buf = NULL;
+		pB->ready = 0;
+		if (compact)
+		  {
+		      /* the first Node of each block is absolutely encoded */
+		      size =
+			  compact_node_size (p_graph, ind, -1,
+					     a_star_supported, compact);
+		  }
+	    }
+	  pB->n_nodes += 1;
+	  pB->size += size;
+	  prev = ind;
+	  if (pB->size > list->max_size)
+	      list->max_size = pB->size;
+      }
+    return list;
+}
+
+static void
+encode_block (struct net_blocks *list, struct net_block *pB,
+	      unsigned char *buf)
+{
+/* exporting a range of Nodes into a NETWORK-DATA block */
+    int i;
+    int ind;
+    int prev = -1;
+    int size;
+    unsigned char *out = buf;
+    *out++ = GAIA_NET_BLOCK;
+    gaiaExport16 (out, pB->n_nodes, 1, list->endian_arch);	/* how many Nodes are into this block */
+    out += 2;
+    for (i = 0; i < pB->n_nodes; i++)
+      {
+	  ind = pB->first_node + i;
+	  if (list->order)
+	      ind = list->order[ind];
+	  if (list->compact)
+	      size =
+		  output_compact_node (out, list->p_graph, ind, prev,
+				       list->endian_arch,
+				       list->a_star_supported, list->compact,
+				       list->costs);
+	  else
+	      output_node (out, &size, list->p_graph, ind, list->endian_arch,
+			   list->a_star_supported, list->costs);
+	  out += size;
+	  prev = ind;
+      }
+}
+
+static int
+insert_block (sqlite3 * handle, sqlite3_stmt * stmt, int pk,
+	      const unsigned char *buf, int size)
+{
+/* INSERTing a NETWORK-DATA block */
+    int ret;
+    sqlite3_reset (stmt);
+    sqlite3_clear_bindings (stmt);
+    sqlite3_bind_int64 (stmt, 1, pk);
+    sqlite3_bind_blob (stmt, 2, buf, size, SQLITE_STATIC);
+    ret = sqlite3_step (stmt);
+    if (ret == SQLITE_DONE || ret == SQLITE_ROW)
+	return 1;
+    printf ("sqlite3_step() error: %s\n", sqlite3_errmsg (handle));
+    return 0;
+}
+
+static int
+write_blocks (sqlite3 * handle, sqlite3_stmt * stmt,
+	      struct net_blocks *list, int *pk)
+{
+/* encoding and inserting all NETWORK-DATA blocks one at each time */
+    int i;
+    struct net_block *pB;
+    unsigned char *buf = malloc (list->max_size);
+    if (!buf)
+      {
+	  printf ("ERROR: insufficient memory [NETWORK-DATA]\n");
+	  return 0;
+      }
+    for (i = 0; i < list->n_blocks; i++)
+      {
+	  pB = list->blocks + i;
+	  encode_block (list, pB, buf);
+	  if (!insert_block (handle, stmt, *pk, buf, pB->size))
+	    {
+		free (buf);
+		return 0;
+	    }
+	  *pk += 1;
+      }
+    free (buf);
+    return 1;
+}
+
+#ifdef NET_THREADS
+static void *
+block_worker (void *arg)
+{
+/* worker thread: encoding NETWORK-DATA blocks */
+    struct net_blocks *list = (struct net_blocks *) arg;
+    struct net_block *pB;
+    unsigned char *buf;
+    int k;
+    pthread_mutex_lock (&(list->mutex));
+    while (!(list->abort) && list->next_block < list->n_blocks)
+      {
+	  k = list->next_block++;
+	  while (!(list->abort) && k - list->written >= list->window)
+	      pthread_cond_wait (&(list->cond), &(list->mutex));
+	  if (list->abort)
+	      break;
+	  pthread_mutex_unlock (&(list->mutex));
+	  pB = list->blocks + k;
+	  buf = malloc (pB->size);
+	  if (buf)
+	      encode_block (list, pB, buf);
+	  pthread_mutex_lock (&(list->mutex));
+	  pB->buf = buf;
+	  pB->ready = 1;
+	  pthread_cond_broadcast (&(list->cond));
+      }
+    pthread_mutex_unlock (&(list->mutex));
+    return NULL;
+}
+
+static int
+write_blocks_threaded (sqlite3 * handle, sqlite3_stmt * stmt,
+		       struct net_blocks *list, int *pk, int threads)
+{
+/*
+/ encoding NETWORK-DATA blocks on a pool of worker threads;
+/ the main thread acts as the single writer, inserting
+/ each block in the expected order as soon as it's ready
+*/
+    int i;
+    int ok = 1;
+    int n_workers = 0;
+    struct net_block *pB;
+    pthread_t *workers = malloc (sizeof (pthread_t) * threads);
+    if (!workers)
+	return write_blocks (handle, stmt, list, pk);
+    list->next_block = 0;
+    list->written = 0;
+    list->window = threads * 2;
+    list->abort = 0;
+    pthread_mutex_init (&(list->mutex), NULL);
+    pthread_cond_init (&(list->cond), NULL);
+    for (i = 0; i < threads; i++)
+      {
+	  if (pthread_create (workers + n_workers, NULL, block_worker, list)
+	      == 0)
+	      n_workers++;
+      }
+    if (!n_workers)
+      {
+	  /* unable to start any thread; falling back to sequential mode */
+	  pthread_cond_destroy (&(list->cond));
+	  pthread_mutex_destroy (&(list->mutex));
+	  free (workers);
+	  return write_blocks (handle, stmt, list, pk);
+      }
+    for (i = 0; i < list->n_blocks && ok; i++)
+      {
+	  pB = list->blocks + i;
+	  pthread_mutex_lock (&(list->mutex));
+	  while (!(pB->ready))
+	      pthread_cond_wait (&(list->cond), &(list->mutex));
+	  pthread_mutex_unlock (&(list->mutex));
+	  if (!(pB->buf))
+	    {
+		printf ("ERROR: insufficient memory [NETWORK-DATA]\n");
+		ok = 0;
+	    }
+	  else if (!insert_block (handle, stmt, *pk, pB->buf, pB->size))
+	      ok = 0;
+	  else
+	      *pk += 1;
+	  if (pB->buf)
+	      free (pB->buf);
+	  pB->buf = NULL;
+	  pthread_mutex_lock (&(list->mutex));
+	  list->written += 1;
+	  if (!ok)
+	      list->abort = 1;
+	  pthread_cond_broadcast (&(list->cond));
+	  pthread_mutex_unlock (&(list->mutex));
+      }
+    for (i = 0; i < n_workers; i++)
+	pthread_join (workers[i], NULL);
+    pthread_cond_destroy (&(list->cond));
+    pthread_mutex_destroy (&(list->mutex));
+    free (workers);
+    return ok;
+}
+#endif
+
+static int
+encode_header (unsigned char *buf, struct graph *p_graph, const char *table,
+	       const char *from_column, const char *to_column,
+	       const char *geom_column, const char *name_column,
+	       int a_star_supported, double a_star_coeff, int endian_arch,
+	       int compact)
+{
+/* exporting the NETWORK-DATA Header block; returns its size */
+    unsigned char *out = buf;
+    int len;
+    if (compact)
+	*out++ =
+	    a_star_supported ? NET_COMPACT_A_STAR_START : NET_COMPACT_START;
+    else if (a_star_supported)
+	*out++ = GAIA_NET64_A_STAR_START;
+    else
+	*out++ = GAIA_NET64_START;
+    *out++ = GAIA_NET_HEADER;
+    gaiaExport32 (out, p_graph->n_nodes, 1, endian_arch); /* how many Nodes are there */
+    out += 4;
+    if (p_graph->node_code)
+	*out++ = GAIA_NET_CODE;	/* Nodes are identified by a TEXT code */
+    else
+	*out++ = GAIA_NET_ID;	/* Nodes are identified by an INTEGER id */
+    if (p_graph->node_code)
+	*out++ = p_graph->max_code_length;	/* max TEXT code length */
+    else
+	*out++ = 0x00;
+    /* inserting the main Table name */
+    *out++ = GAIA_NET_TABLE;
+    len = strlen (table) + 1;
+    gaiaExport16 (out, len, 1, endian_arch);	/* the Table Name length, including last '\0' */
+    out += 2;
+    memset (out, '\0', len);
+    strcpy ((char *) out, table);
+    out += len;
+    /* inserting the NodeFrom column name */
+    *out++ = GAIA_NET_FROM;
+    len = strlen (from_column) + 1;
+    gaiaExport16 (out, len, 1, endian_arch);	/* the NodeFrom column Name length, including last '\0' */
+    out += 2;
+    memset (out, '\0', len);
+    strcpy ((char *) out, from_column);
+    out += len;
+    /* inserting the NodeTo column name */
+    *out++ = GAIA_NET_TO;
+    len = strlen (to_column) + 1;
+    gaiaExport16 (out, len, 1, endian_arch);	/* the NodeTo column Name length, including last '\0' */
+    out += 2;
+    memset (out, '\0', len);
+    strcpy ((char *) out, to_column);
+    out += len;
+    /* inserting the Geometry column name */
+    *out++ = GAIA_NET_GEOM;
+    if (!geom_column)
+	len = 1;
+    else
+	len = strlen (geom_column) + 1;
+    gaiaExport16 (out, len, 1, endian_arch);	/* the Geometry column Name length, including last '\0' */
+    out += 2;
+    memset (out, '\0', len);
+    if (geom_column)
+	strcpy ((char *) out, geom_column);
+    out += len;
+    /* inserting the Name column name - may be empty */
+    *out++ = GAIA_NET_NAME;
+    if (!name_column)
+	len = 1;
+    else
+	len = strlen (name_column) + 1;
+    gaiaExport16 (out, len, 1, endian_arch);	/* the Name column Name length, including last '\0' */
+    out += 2;
+    memset (out, '\0', len);
+    if (name_column)
+	strcpy ((char *) out, name_column);
+    out += len;
+    if (a_star_supported)
+      {
+	  /* inserting the A* Heuristic Coeff */
+	  *out++ = GAIA_NET_A_STAR_COEFF;
+	  if (compact == COMPACT_FLOAT)
+	    {
+		/* float Costs could be rounded down: still an admissible heuristic */
+		a_star_coeff *= 1.0 - FLT_EPSILON;
+	    }
+	  gaiaExport64 (out, a_star_coeff, 1, endian_arch);
+	  out += 8;
+      }
+    if (compact)
+      {
+	  /* inserting the Cost width */
+	  *out++ = NET_COMPACT_COSTS;
+	  *out++ = (compact == COMPACT_FLOAT) ? 4 : 8;
+      }
+    *out++ = GAIA_NET_END;
+    return out - buf;
+}
+
+static int
+create_network_data (sqlite3 * handle, const char *out_table,
+		     int force_creation, struct graph *p_graph,
+		     const char *table, const char *from_column,
+		     const char *to_column, const char *geom_column,
+		     const char *name_column, int a_star_supported,
+		     double a_star_coeff, const double *costs,
+		     struct net_options *options)
+{
+/* creates the NETWORK-DATA table; costs [if any] is an alternative Cost profile */
+    int ret;
+    char sql[1024];
+    char *err_msg = NULL;
+    unsigned char *buf = malloc (MAX_BLOCK);
+    sqlite3_stmt *stmt;
+    int i;
+    int endian_arch = gaiaEndianArch ();
+    struct node *pN;
+    struct net_blocks *blocks = NULL;
+    int *order = NULL;
+    int pk = 0;
+    int len;
+    for (i = 0; i < p_graph->n_nodes; i++)
+      {
+	  /* setting the internal index to each Node */
+	  pN = p_graph->nodes + i;
+	  pN->internal_index = i;
+      }
+/* starts a transaction */
+    strcpy (sql, "BEGIN");
+    ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("BEGIN error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  goto abort;
+      }
+    if (force_creation)
+      {
+	  sprintf (sql, "DROP TABLE IF EXISTS \"%s\"", out_table);
+	  ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+	  if (ret != SQLITE_OK)
+	    {
+		printf ("DROP TABLE error: %s\n", err_msg);
+		sqlite3_free (err_msg);
+		goto abort;
+	    }
+      }
+/* creating the NETWORK-DATA table */
+    sprintf (sql, "CREATE TABLE \"%s\" (", out_table);
+    strcat (sql, "\"Id\" INTEGER PRIMARY KEY, \"NetworkData\" BLOB NOT NULL)");
+    ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("CREATE TABLE error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  goto abort;
+      }
+/* preparing the SQL statement */
+    sprintf (sql, "INSERT INTO \"%s\" (\"Id\", \"NetworkData\") VALUES (?, ?)",
+	     out_table);
+    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &stmt, NULL);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("INSERT error: %s\n", sqlite3_errmsg (handle));
+	  goto abort;
+      }
+    if (pk == 0)
+      {
+	  /* preparing the HEADER block */
+	  len =
+	      encode_header (buf, p_graph, table, from_column, to_column,
+			     geom_column, name_column, a_star_supported,
+			     a_star_coeff, endian_arch, options->compact);
+	  /* INSERTing the Header block */
+	  sqlite3_reset (stmt);
+	  sqlite3_clear_bindings (stmt);
+	  sqlite3_bind_int64 (stmt, 1, pk);
+	  sqlite3_bind_blob (stmt, 2, buf, len, SQLITE_STATIC);
+	  ret = sqlite3_step (stmt);
+	  if (ret == SQLITE_DONE || ret == SQLITE_ROW)
+	      ;
+	  else
+	    {
+		printf ("sqlite3_step() error: %s\n", sqlite3_errmsg (handle));
+		sqlite3_finalize (stmt);
+		goto abort;
+	    }
+	  pk++;
+      }
+/* 
+/ encoding and inserting the Nodes blocks; the internal index
+/ of each Node never changes [VirtualNetwork expects it to
+/ follow the ID/CODE sort order], but the Nodes can be stored
+/ in a different order so that neighbouring Nodes will share
+/ the same blocks
+*/
+    if (options->node_order == NODE_ORDER_HILBERT)
+	order = order_nodes_hilbert (p_graph);
+    else if (options->node_order == NODE_ORDER_BFS)
+	order = order_nodes_bfs (p_graph);
+    if (options->node_order != NODE_ORDER_ID && !order)
+      {
+	  printf ("ERROR: insufficient memory [NETWORK-DATA]\n");
+	  sqlite3_finalize (stmt);
+	  goto abort;
+      }
+    blocks =
+	plan_blocks (p_graph, order, p_graph->n_nodes, endian_arch,
+		     a_star_supported, options->block_size, options->compact);
+    if (!blocks)
+      {
+	  if (order)
+	      free (order);
+	  printf ("ERROR: insufficient memory [NETWORK-DATA]\n");
+	  sqlite3_finalize (stmt);
+	  goto abort;
+      }
+    blocks->costs = costs;
+#ifdef NET_THREADS
+    if (options->threads > 1)
+	ret =
+	    write_blocks_threaded (handle, stmt, blocks, &pk,
+				   options->threads);
+    else
+#endif
+	ret = write_blocks (handle, stmt, blocks, &pk);
+    free_blocks (blocks);
+    if (!ret)
+      {
+	  sqlite3_finalize (stmt);
+	  goto abort;
+      }
+    sqlite3_finalize (stmt);
+/* commits the transaction */
+    strcpy (sql, "COMMIT");
+    ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("COMMIT error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  goto abort;
+      }
+    if (buf)
+	free (buf);
+    return 1;
+  abort:
+    if (buf)
+	free (buf);
+    return 0;
+}
+
+static int
+create_virtual_network (sqlite3 * handle, const char *out_table,
+			const char *virt_table, int force_creation)
+{
+/* creates the VirtualNetwork table */
+    int ret;
+    char sql[1024];
+    char *err_msg = NULL;
+    if (force_creation)
+      {
+	  sprintf (sql, "DROP TABLE IF EXISTS \"%s\"", virt_table);
+	  ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+	  if (ret != SQLITE_OK)
+	    {
+		printf ("DROP TABLE error: %s\n", err_msg);
+		sqlite3_free (err_msg);
+		goto abort;
+	    }
+      }
+/* creating the VirtualNetwork table */
+    sprintf (sql, "CREATE VIRTUAL TABLE \"%s\" USING  VirtualNetwork(\"%s\")",
+	     virt_table, out_table);
+    ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("CREATE TABLE error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  goto abort;
+      }
+    return 1;
+  abort:
+    return 0;
+}
+
+static void
+create_cost_profiles (sqlite3 * handle, const char *out_table,
+		      const char *virt_table, int force_creation,
+		      struct graph *p_graph, const char *table,
+		      const char *from_column, const char *to_column,
+		      const char *geom_column, const char *name_column,
+		      int a_star_supported, const double *a_star_coeffs,
+		      struct net_options *options)
+{
+/*
+/ creates a further NETWORK-DATA table [and VirtualNetwork, if
+/ required] for each alternative Cost profile, named by appending
+/ "_profile_" and the Cost column name; they all share the same
+/ already validated graph, only the Arc Costs being different
+/ the outcoming Arcs of each Node keep the order by primary Cost,
+/ which doesn't affect any shortest path
+*/
+    int k;
+    int ret;
+    char profile_table[1024];
+    char profile_virt[1024];
+    for (k = 0; k < options->n_costs; k++)
+      {
+	  sprintf (profile_table, "%s_profile_%s", out_table,
+		   options->cost_columns[k]);
+	  ret =
+	      create_network_data (handle, profile_table, force_creation,
+				   p_graph, table, from_column, to_column,
+				   geom_column, name_column, a_star_supported,
+				   a_star_coeffs ? a_star_coeffs[k] : DBL_MAX,
+				   p_graph->costs +
+				   ((size_t) k * p_graph->n_arcs), options);
+	  if (!ret)
+	    {
+		printf
+		    ("\n\nERROR: creating the NETWORK-DATA table '%s' was not possible\n",
+		     profile_table);
+		fprintf (stderr, "ERROR: table '%s' failure\n", profile_table);
+		continue;
+	    }
+	  printf ("\n\nOK: NETWORK-DATA table '%s' successfully created\n",
+		  profile_table);
+	  fprintf (stderr, "OK: table '%s' successfully created\n",
+		   profile_table);
+	  if (virt_table)
+	    {
+		sprintf (profile_virt, "%s_profile_%s", virt_table,
+			 options->cost_columns[k]);
+		if (create_virtual_network
+		    (handle, profile_table, profile_virt, force_creation))
+		    fprintf (stderr, "OK: table '%s' successfully created\n",
+			     profile_virt);
+		else
+		    fprintf (stderr, "ERROR: table '%s' failure\n",
+			     profile_virt);
+	    }
+      }
+}
+
+/*
+/ the binary graph snapshot file: a fixed 128 bytes header followed
+/ by plain arrays, each one starting at a SNAPSHOT_ALIGN boundary,
+/ so that it can be directly mmap()ed with no parsing at all
+/ - all values are stored in the producer's native byte order;
+/   byte_order always is 0x01020304 as seen by the producer
+/ - Nodes follow the NETWORK-DATA internal index order, and
+/   Arcs follow the same CSR order
+/ - a section offset of 0 means that the section is absent
+/   [e.g. Node coordinates for a NO-GEOMETRY graph]
+/ 
+/ sections:
+/  #0 Node IDs [int64 x n_nodes] or Node CODEs [char[code_length] x n_nodes]
+/  #1 Node X [double x n_nodes]
+/  #2 Node Y [double x n_nodes]
+/  #3 outcoming offsets [int32 x (n_nodes + 1)]
+/  #4 Arc FromNode [int32 x n_arcs]
+/  #5 Arc ToNode [int32 x n_arcs]
+/  #6 Arc Cost [double x n_arcs]
+/  #7 Arc ROWID [int64 x n_arcs]
+/  #8 incoming offsets [int32 x (n_nodes + 1)]
+/  #9 incoming Arcs [int32 x n_arcs; positions into the Arc arrays]
+/ 
+/ the alternative Cost profiles [if any] follow as a single further
+/ section at offset costs: n_costs arrays of n_arcs doubles, the
+/ k-th profile starting at costs + (k * n_arcs * 8)
+*/
+
+#define SNAPSHOT_MAGIC		"SLNETSNP"
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_ALIGN		64
+#define SNAPSHOT_SECTIONS	10
+#define SNAPSHOT_NODE_CODE	0x01
+#define SNAPSHOT_NODE_COORDS	0x02
+
+struct snapshot_header
+{
+/* the graph snapshot header [128 bytes] */
+    char magic[8];
+    unsigned int version;
+    unsigned int byte_order;
+    unsigned int flags;
+    unsigned int code_length;
+    unsigned int n_nodes;
+    unsigned int n_arcs;
+    sqlite3_int64 sections[SNAPSHOT_SECTIONS];
+    unsigned int n_costs;
+    unsigned int reserved;
+    sqlite3_int64 costs;
+};
+
+static int
+snapshot_section (FILE * out, sqlite3_int64 * offset, sqlite3_int64 * section,
+		  const void *data, sqlite3_int64 size)
+{
+/* appending an aligned section to the snapshot file */
+    static const unsigned char zeros[SNAPSHOT_ALIGN] = { 0 };
+    int pad = (int) (*offset % SNAPSHOT_ALIGN);
+    if (pad)
+      {
+	  pad = SNAPSHOT_ALIGN - pad;
+	  if (fwrite (zeros, 1, pad, out) != (size_t) pad)
+	      return 0;
+	  *offset += pad;
+      }
+    *section = *offset;
+    if (size > 0 && fwrite (data, 1, size, out) != (size_t) size)
+	return 0;
+    *offset += size;
+    return 1;
+}
+
+static int
+write_snapshot (const char *path, struct graph *p_graph, int coords)
+{
+/* 
+/ writing the binary graph snapshot; the file is first written
+/ under a temporary name and then renamed, so that readers will
+/ never map a partially written snapshot
+*/
+    struct snapshot_header hdr;
+    char *tmp_path;
+    FILE *out;
+    sqlite3_int64 offset = sizeof (struct snapshot_header);
+    sqlite3_int64 *int64_buf = NULL;
+    double *double_buf = NULL;
+    int *int_buf = NULL;
+    char *code_buf = NULL;
+    int n_nodes = p_graph->n_nodes;
+    int n_arcs = p_graph->n_arcs;
+    int i;
+    int ok = 0;
+    tmp_path = malloc (strlen (path) + 5);
+    if (!tmp_path)
+	return 0;
+    sprintf (tmp_path, "%s.tmp", path);
+    out = fopen (tmp_path, "wb");
+    if (!out)
+      {
+	  printf ("ERROR: unable to create the snapshot file '%s'\n", tmp_path);
+	  free (tmp_path);
+	  return 0;
+      }
+    memset (&hdr, 0, sizeof (struct snapshot_header));
+    memcpy (hdr.magic, SNAPSHOT_MAGIC, 8);
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.byte_order = 0x01020304;
+    if (p_graph->node_code)
+      {
+	  hdr.flags |= SNAPSHOT_NODE_CODE;
+	  hdr.code_length = p_graph->max_code_length;
+      }
+    if (coords)
+	hdr.flags |= SNAPSHOT_NODE_COORDS;
+    hdr.n_nodes = n_nodes;
+    hdr.n_arcs = n_arcs;
+/* the header will be rewritten once all section offsets are known */
+    if (fwrite (&hdr, sizeof (struct snapshot_header), 1, out) != 1)
+	goto stop;
+    i = (n_nodes > n_arcs) ? n_nodes : n_arcs;
+    int64_buf = malloc (sizeof (sqlite3_int64) * (i + 1));
+    double_buf = malloc (sizeof (double) * (i + 1));
+    int_buf = malloc (sizeof (int) * (i + 1));
+    if (!int64_buf || !double_buf || !int_buf)
+      {
+	  printf ("ERROR: insufficient memory [snapshot]\n");
+	  goto stop;
+      }
+/* the Nodes */
+    if (p_graph->node_code)
+      {
+	  code_buf = malloc ((size_t) n_nodes * p_graph->max_code_length);
+	  if (!code_buf)
+	    {
+		printf ("ERROR: insufficient memory [snapshot]\n");
+		goto stop;
+	    }
+	  memset (code_buf, 0, (size_t) n_nodes * p_graph->max_code_length);
+	  for (i = 0; i < n_nodes; i++)
+	      strcpy (code_buf + ((size_t) i * p_graph->max_code_length),
+		      p_graph->nodes[i].code);
+	  if (!snapshot_section
+	      (out, &offset, hdr.sections + 0, code_buf,
+	       (sqlite3_int64) n_nodes * p_graph->max_code_length))
+	      goto stop;
+      }
+    else
+      {
+	  for (i = 0; i < n_nodes; i++)
+	      int64_buf[i] = p_graph->nodes[i].id;
+	  if (!snapshot_section
+	      (out, &offset, hdr.sections + 0, int64_buf,
+	       (sqlite3_int64) sizeof (sqlite3_int64) * n_nodes))
+	      goto stop;
+      }
+    if (coords)
+      {
+	  for (i = 0; i < n_nodes; i++)
+	      double_buf[i] = p_graph->nodes[i].x;
+	  if (!snapshot_section
+	      (out, &offset, hdr.sections + 1, double_buf,
+	       (sqlite3_int64) sizeof (double) * n_nodes))
+	      goto stop;
+	  for (i = 0; i < n_nodes; i++)
+	      double_buf[i] = p_graph->nodes[i].y;
+	  if (!snapshot_section
+	      (out, &offset, hdr.sections + 2, double_buf,
+	       (sqlite3_int64) sizeof (double) * n_nodes))
+	      goto stop;
+      }
+/* the outcoming Arcs */
+    if (!snapshot_section
+	(out, &offset, hdr.sections + 3, p_graph->out_offsets,
+	 (sqlite3_int64) sizeof (int) * (n_nodes + 1)))
+	goto stop;
+    for (i = 0; i < n_arcs; i++)
+	int_buf[i] = p_graph->arcs[i].from;
+    if (!snapshot_section
+	(out, &offset, hdr.sections + 4, int_buf,
+	 (sqlite3_int64) sizeof (int) * n_arcs))
+	goto stop;
+    for (i = 0; i < n_arcs; i++)
+	int_buf[i] = p_graph->arcs[i].to;
+    if (!snapshot_section
+	(out, &offset, hdr.sections + 5, int_buf,
+	 (sqlite3_int64) sizeof (int) * n_arcs))
+	goto stop;
+    for (i = 0; i < n_arcs; i++)
+	double_buf[i] = p_graph->arcs[i].cost;
+    if (!snapshot_section
+	(out, &offset, hdr.sections + 6, double_buf,
+	 (sqlite3_int64) sizeof (double) * n_arcs))
+	goto stop;
+    for (i = 0; i < n_arcs; i++)
+	int64_buf[i] = p_graph->arcs[i].rowid;
+    if (!snapshot_section
+	(out, &offset, hdr.sections + 7, int64_buf,
+	 (sqlite3_int64) sizeof (sqlite3_int64) * n_arcs))
+	goto stop;
+/* the incoming Arcs */
+    if (!snapshot_section
+	(out, &offset, hdr.sections + 8, p_graph->in_offsets,
+	 (sqlite3_int64) sizeof (int) * (n_nodes + 1)))
+	goto stop;
+    if (!snapshot_section
+	(out, &offset, hdr.sections + 9, p_graph->in_arcs,
+	 (sqlite3_int64) sizeof (int) * n_arcs))
+	goto stop;
+/* the alternative Cost profiles, already laid out as a structure of arrays */
+    if (p_graph->n_costs)
+      {
+	  hdr.n_costs = p_graph->n_costs;
+	  if (!snapshot_section
+	      (out, &offset, &(hdr.costs), p_graph->costs,
+	       (sqlite3_int64) sizeof (double) * n_arcs * p_graph->n_costs))
+	      goto stop;
+      }
+/* rewriting the completed header */
+    if (fseek (out, 0, SEEK_SET) != 0)
+	goto stop;
+    if (fwrite (&hdr, sizeof (struct snapshot_header), 1, out) != 1)
+	goto stop;
+    ok = 1;
+  stop:
+    if (fclose (out) != 0)
+	ok = 0;
+    if (ok)
+      {
+#if defined(_WIN32)
+	  remove (path);
+#endif
+	  if (rename (tmp_path, path) != 0)
+	      ok = 0;
+      }
+    if (!ok)
+      {
+	  printf ("ERROR: unable to write the snapshot file '%s'\n", path);
+	  remove (tmp_path);
+      }
+    free (tmp_path);
+    if (int64_buf)
+	free (int64_buf);
+    if (double_buf)
+	free (double_buf);
+    if (int_buf)
+	free (int_buf);
+    if (code_buf)
+	free (code_buf);
+    return ok;
+}
+
+static int
+create_change_log (sqlite3 * handle, const char *table, const char *out_table,
+		   sqlite3_int64 * last_seq)
+{
+/* 
+/ creates the change log supporting --incremental [if not already
+/ existing]; a few triggers on the input table will record the
+/ ROWID of each inserted, updated or deleted Arc
+/ this is done before scanning the input table: last_seq marks the
+/ latest change already covered by the scan, so that any later
+/ change will survive reset_change_log()
+*/
+    int ret;
+    int i;
+    char sql[1024];
+    char *err_msg = NULL;
+    sqlite3_stmt *stmt = NULL;
+    for (i = 0; i < 4; i++)
+      {
+	  if (i == 0)
+	      sprintf (sql,
+		       "CREATE TABLE IF NOT EXISTS \"%s_changes\" ("
+		       "\"Seq\" INTEGER PRIMARY KEY AUTOINCREMENT, "
+		       "\"RowId\" INTEGER NOT NULL)", out_table);
+	  else if (i == 1)
+	      sprintf (sql,
+		       "CREATE TRIGGER IF NOT EXISTS \"%s_changes_ins\" AFTER INSERT ON \"%s\" "
+		       "BEGIN INSERT INTO \"%s_changes\" (\"RowId\") VALUES (NEW.ROWID); END",
+		       out_table, table, out_table);
+	  else if (i == 2)
+	      sprintf (sql,
+		       "CREATE TRIGGER IF NOT EXISTS \"%s_changes_upd\" AFTER UPDATE ON \"%s\" "
+		       "BEGIN INSERT INTO \"%s_changes\" (\"RowId\") VALUES (OLD.ROWID); "
+		       "INSERT INTO \"%s_changes\" (\"RowId\") VALUES (NEW.ROWID); END",
+		       out_table, table, out_table, out_table);
+	  else
+	      sprintf (sql,
+		       "CREATE TRIGGER IF NOT EXISTS \"%s_changes_del\" AFTER DELETE ON \"%s\" "
+		       "BEGIN INSERT INTO \"%s_changes\" (\"RowId\") VALUES (OLD.ROWID); END",
+		       out_table, table, out_table);
+	  ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+	  if (ret != SQLITE_OK)
+	    {
+		printf ("change log error: %s\n", err_msg);
+		sqlite3_free (err_msg);
+		return 0;
+	    }
+      }
+    *last_seq = 0;
+    sprintf (sql, "SELECT Max(\"Seq\") FROM \"%s_changes\"", out_table);
+    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &stmt, NULL);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("change log error: %s\n", sqlite3_errmsg (handle));
+	  return 0;
+      }
+    ret = sqlite3_step (stmt);
+    if (ret == SQLITE_ROW)
+	*last_seq = sqlite3_column_int64 (stmt, 0);
+    sqlite3_finalize (stmt);
+    if (ret != SQLITE_ROW)
+      {
+	  printf ("change log error: %s\n", sqlite3_errmsg (handle));
+	  return 0;
+      }
+    return 1;
+}
+
+static int
+reset_change_log (sqlite3 * handle, const char *out_table,
+		  sqlite3_int64 last_seq)
+{
+/* removing from the change log all changes covered by a full build */
+    int ret;
+    char sql[1024];
+    char *err_msg = NULL;
+    sprintf (sql, "DELETE FROM \"%s_changes\" WHERE \"Seq\" <= " FORMAT_64,
+	     out_table, last_seq);
+    ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("change log error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  return 0;
+      }
+    return 1;
+}
+
+struct ch_edge
+{
+/* an edge of the Contraction Hierarchy: a plain Arc or a shortcut */
+    int from;
+    int to;
+    int via;			/* the contracted Node; -1 for plain Arcs */
+    double cost;
+    int next_out;		/* next edge outcoming from the same Node */
+    int next_in;		/* next edge incoming into the same Node */
+};
+
+struct ch_heap_item
+{
+/* a binary heap item */
+    double key;
+    int node;
+};
+
+struct ch_heap
+{
+/* a binary min-heap */
+    struct ch_heap_item *items;
+    int count;
+    int max;
+};
+
+struct ch_graph
+{
+/*
+/ the working graph for the Contraction Hierarchy:
+/ - all edges [Arcs and shortcuts] are stored into a single arena,
+/   and are chained into per-Node outcoming and incoming lists
+/ - level[i] is the contraction order of the i-th Node,
+/   -1 while the Node is still uncontracted
+/ - dist[] and stamp[] support the witness searches; a distance
+/   is valid only if its stamp matches the current generation
+/ - witness is the heap shared by all witness searches, so to
+/   avoid reallocating it for each contracted Node
+*/
+    struct ch_edge *edges;
+    int n_edges;
+    int max_edges;
+    int n_nodes;
+    int *first_out;
+    int *first_in;
+    int *level;
+    int *deleted_neighbors;
+    double *dist;
+    int *stamp;
+    int generation;
+    struct ch_heap queue;
+    struct ch_heap witness;
+    int n_shortcuts;
+};
+
+#define CH_MAX_SETTLED	500
+
+static int
+ch_heap_push (struct ch_heap *heap, double key, int node)
+{
+/* inserting an item into the heap */
+    int i;
+    int parent;
+    struct ch_heap_item *items;
+    if (heap->count >= heap->max)
+      {
+	  int max = (heap->max == 0) ? 1024 : heap->max * 2;
+	  items = realloc (heap->items, sizeof (struct ch_heap_item) * max);
+	  if (items == NULL)
+	      return 0;
+	  heap->items = items;
+	  heap->max = max;
+      }
+    items = heap->items;
+    i = heap->count++;
+    while (i > 0)
+      {
+	  parent = (i - 1) / 2;
+	  if (items[parent].key <= key)
+	      break;
+	  items[i] = items[parent];
+	  i = parent;
+      }
+    items[i].key = key;
+    items[i].node = node;
+    return 1;
+}
+
+static void
+ch_heap_pop (struct ch_heap *heap, double *key, int *node)
+{
+/* removing the minimum item from the heap */
+    int i = 0;
+    int child;
+    struct ch_heap_item *items = heap->items;
+    struct ch_heap_item last;
+    *key = items[0].key;
+    *node = items[0].node;
+    last = items[--heap->count];
+    while (1)
+      {
+	  child = (i * 2) + 1;
+	  if (child >= heap->count)
+	      break;
+	  if (child + 1 < heap->count && items[child + 1].key < items[child].key)
+	      child++;
+	  if (last.key <= items[child].key)
+	      break;
+	  items[i] = items[child];
+	  i = child;
+      }
+    items[i] = last;
+}
+
+static void
+ch_free (struct ch_graph *ch)
+{
+/* memory cleanup - destroying the Contraction Hierarchy */
+    if (!ch)
+	return;
+    if (ch->edges)
+	free (ch->edges);
+    if (ch->first_out)
+	free (ch->first_out);
+    if (ch->first_in)
+	free (ch->first_in);
+    if (ch->level)
+	free (ch->level);
+    if (ch->deleted_neighbors)
+	free (ch->deleted_neighbors);
+    if (ch->dist)
+	free (ch->dist);
+    if (ch->stamp)
+	free (ch->stamp);
+    if (ch->queue.items)
+	free (ch->queue.items);
+    if (ch->witness.items)
+	free (ch->witness.items);
+    free (ch);
+}
+
+static int
+ch_add_edge (struct ch_graph *ch, int from, int to, int via, double cost)
+{
+/*
+/ inserting an edge; a shortcut is useless if some edge joining
+/ the same Nodes is already as cheap, and only replaces an older
+/ shortcut when strictly cheaper: plain Arcs are never overwritten
+*/
+    int i;
+    int shortcut = -1;
+    struct ch_edge *pE;
+    if (via >= 0)
+      {
+	  for (i = ch->first_out[from]; i >= 0; i = ch->edges[i].next_out)
+	    {
+		pE = ch->edges + i;
+		if (pE->to != to)
+		    continue;
+		if (pE->cost <= cost)
+		    return 1;
+		if (pE->via >= 0)
+		    shortcut = i;
+	    }
+	  if (shortcut >= 0)
+	    {
+		pE = ch->edges + shortcut;
+		pE->cost = cost;
+		pE->via = via;
+		return 1;
+	    }
+      }
+    if (ch->n_edges >= ch->max_edges)
+      {
+	  int max = ch->max_edges + (ch->max_edges / 2) + ARENA_CHUNK;
+	  pE = realloc (ch->edges, sizeof (struct ch_edge) * max);
+	  if (pE == NULL)
+	      return 0;
+	  ch->edges = pE;
+	  ch->max_edges = max;
+      }
+    i = ch->n_edges++;
+    pE = ch->edges + i;
+    pE->from = from;
+    pE->to = to;
+    pE->via = via;
+    pE->cost = cost;
+    pE->next_out = ch->first_out[from];
+    pE->next_in = ch->first_in[to];
+    ch->first_out[from] = i;
+    ch->first_in[to] = i;
+    if (via >= 0)
+	ch->n_shortcuts++;
+    return 1;
+}
+
+static struct ch_graph *
+ch_init (struct graph *p_graph)
+{
+/* creating the working graph for the Contraction Hierarchy */
+    int i;
+    struct arc *pA;
+    struct ch_graph *ch = malloc (sizeof (struct ch_graph));
+    if (ch == NULL)
+	return NULL;
+    memset (ch, 0, sizeof (struct ch_graph));
+    ch->n_nodes = p_graph->n_nodes;
+    ch->max_edges = p_graph->n_arcs + ARENA_CHUNK;
+    ch->edges = malloc (sizeof (struct ch_edge) * ch->max_edges);
+    ch->first_out = malloc (sizeof (int) * ch->n_nodes);
+    ch->first_in = malloc (sizeof (int) * ch->n_nodes);
+    ch->level = malloc (sizeof (int) * ch->n_nodes);
+    ch->deleted_neighbors = malloc (sizeof (int) * ch->n_nodes);
+    ch->dist = malloc (sizeof (double) * ch->n_nodes);
+    ch->stamp = malloc (sizeof (int) * ch->n_nodes);
+    if (ch->edges == NULL || ch->first_out == NULL || ch->first_in == NULL
+	|| ch->level == NULL || ch->deleted_neighbors == NULL
+	|| ch->dist == NULL || ch->stamp == NULL)
+      {
+	  ch_free (ch);
+	  return NULL;
+      }
+    for (i = 0; i < ch->n_nodes; i++)
+      {
+	  ch->first_out[i] = -1;
+	  ch->first_in[i] = -1;
+	  ch->level[i] = -1;
+	  ch->deleted_neighbors[i] = 0;
+	  ch->stamp[i] = 0;
+      }
+    for (i = 0; i < p_graph->n_arcs; i++)
+      {
+	  pA = p_graph->arcs + i;
+	  if (pA->from == pA->to)
+	      continue;		/* self-loops never belong to a shortest path */
+	  ch_add_edge (ch, pA->from, pA->to, -1, pA->cost);
+      }
+    return ch;
+}
+
+static double
+ch_distance (struct ch_graph *ch, int node)
+{
+/* returns the distance found by the latest witness search */
+    if (ch->stamp[node] == ch->generation)
+	return ch->dist[node];
+    return DBL_MAX;
+}
+
+static int
+ch_witness_search (struct ch_graph *ch, int source, int excluded,
+		   double max_cost)
+{
+/* 
+/ a local Dijkstra search from the source Node, ignoring both
+/ the Node to be contracted and all the already contracted Nodes
+/ and stopping as soon as max_cost or CH_MAX_SETTLED are reached
+*/
+    struct ch_heap *heap = &(ch->witness);
+    struct ch_edge *pE;
+    double d;
+    double nd;
+    int u;
+    int w;
+    int i;
+    int settled = 0;
+    heap->count = 0;
+    ch->generation++;
+    ch->dist[source] = 0.0;
+    ch->stamp[source] = ch->generation;
+    if (!ch_heap_push (heap, 0.0, source))
+	return 0;
+    while (heap->count > 0)
+      {
+	  ch_heap_pop (heap, &d, &u);
+	  if (d > ch->dist[u])
+	      continue;		/* stale item */
+	  if (d > max_cost || ++settled > CH_MAX_SETTLED)
+	      break;
+	  for (i = ch->first_out[u]; i >= 0; i = pE->next_out)
+	    {
+		pE = ch->edges + i;
+		w = pE->to;
+		if (w == excluded || ch->level[w] >= 0)
+		    continue;
+		nd = d + pE->cost;
+		if (nd < ch_distance (ch, w))
+		  {
+		      ch->dist[w] = nd;
+		      ch->stamp[w] = ch->generation;
+		      if (!ch_heap_push (heap, nd, w))
+			  return 0;
+		  }
+	    }
+      }
+    return 1;
+}
+
+static int
+ch_contract_node (struct ch_graph *ch, int v, int simulate)
+{
+/* 
+/ contracts a Node [or simply counts the required shortcuts
+/ when simulating]; returns -1 on failure
+*/
+    int ei;
+    int eo;
+    int u;
+    int w;
+    double c_uv;
+    double c_vw;
+    double max_out;
+    int any;
+    int shortcuts = 0;
+    for (ei = ch->first_in[v]; ei >= 0; ei = ch->edges[ei].next_in)
+      {
+	  u = ch->edges[ei].from;
+	  if (ch->level[u] >= 0)
+	      continue;
+	  c_uv = ch->edges[ei].cost;
+	  max_out = 0.0;
+	  any = 0;
+	  for (eo = ch->first_out[v]; eo >= 0; eo = ch->edges[eo].next_out)
+	    {
+		w = ch->edges[eo].to;
+		if (w == u || ch->level[w] >= 0)
+		    continue;
+		if (ch->edges[eo].cost > max_out)
+		    max_out = ch->edges[eo].cost;
+		any = 1;
+	    }
+	  if (!any)
+	      continue;
+	  if (!ch_witness_search (ch, u, v, c_uv + max_out))
+	      return -1;
+	  for (eo = ch->first_out[v]; eo >= 0; eo = ch->edges[eo].next_out)
+	    {
+		w = ch->edges[eo].to;
+		if (w == u || ch->level[w] >= 0)
+		    continue;
+		c_vw = ch->edges[eo].cost;
+		if (ch_distance (ch, w) <= c_uv + c_vw)
+		    continue;	/* a witness path exists */
+		shortcuts++;
+		if (!simulate)
+		  {
+		      if (!ch_add_edge (ch, u, w, v, c_uv + c_vw))
+			  return -1;
+		  }
+	    }
+      }
+    return shortcuts;
+}
+
+static int
+ch_priority (struct ch_graph *ch, int v, double *priority)
+{
+/* the edge difference of a Node plus its contracted neighbours */
+    int i;
+    int degree = 0;
+    int shortcuts;
+    for (i = ch->first_in[v]; i >= 0; i = ch->edges[i].next_in)
+      {
+	  if (ch->level[ch->edges[i].from] < 0)
+	      degree++;
+      }
+    for (i = ch->first_out[v]; i >= 0; i = ch->edges[i].next_out)
+      {
+	  if (ch->level[ch->edges[i].to] < 0)
+	      degree++;
+      }
+    shortcuts = ch_contract_node (ch, v, 1);
+    if (shortcuts < 0)
+	return 0;
+    *priority = (double) (shortcuts - degree + ch->deleted_neighbors[v]);
+    return 1;
+}
+
+static int
+ch_build (struct ch_graph *ch)
+{
+/* 
+/ contracting all Nodes one at each time; the Node order is
+/ driven by a priority queue supporting lazy updates
+*/
+    int i;
+    int v;
+    int level = 0;
+    double priority;
+    for (i = 0; i < ch->n_nodes; i++)
+      {
+	  if (!ch_priority (ch, i, &priority))
+	      return 0;
+	  if (!ch_heap_push (&(ch->queue), priority, i))
+	      return 0;
+      }
+    while (ch->queue.count > 0)
+      {
+	  ch_heap_pop (&(ch->queue), &priority, &v);
+	  if (!ch_priority (ch, v, &priority))
+	      return 0;
+	  if (ch->queue.count > 0 && priority > ch->queue.items[0].key)
+	    {
+		/* lazy update: this Node is no longer the best candidate */
+		if (!ch_heap_push (&(ch->queue), priority, v))
+		    return 0;
+		continue;
+	    }
+	  if (ch_contract_node (ch, v, 0) < 0)
+	      return 0;
+	  ch->level[v] = level++;
+	  for (i = ch->first_out[v]; i >= 0; i = ch->edges[i].next_out)
+	    {
+		if (ch->level[ch->edges[i].to] < 0)
+		    ch->deleted_neighbors[ch->edges[i].to] += 1;
+	    }
+	  for (i = ch->first_in[v]; i >= 0; i = ch->edges[i].next_in)
+	    {
+		if (ch->level[ch->edges[i].from] < 0)
+		    ch->deleted_neighbors[ch->edges[i].from] += 1;
+	    }
+      }
+    return 1;
+}
+
+static int
+create_ch_table (sqlite3 * handle, const char *ch_table, int force_creation,
+		 struct graph *p_graph)
+{
+/* 
+/ creates the Contraction Hierarchy companion tables:
+/ - "<ch_table>_nodes" contains the contraction Level of each Node
+/ - "<ch_table>" contains all shortcuts; each shortcut replaces
+/   the two edges FromNode -> ViaNode -> ToNode
+/ all Nodes are identified by the same internal index used
+/ by the NETWORK-DATA table
+*/
+    int ret;
+    int i;
+    char sql[1024];
+    char *err_msg = NULL;
+    sqlite3_stmt *stmt = NULL;
+    struct ch_graph *ch;
+    struct ch_edge *pE;
+    struct node *pN;
+    fprintf (stderr, "building the Contraction Hierarchy ... wait please\n");
+    ch = ch_init (p_graph);
+    if (ch == NULL)
+      {
+	  printf ("ERROR: insufficient memory [Contraction Hierarchy]\n");
+	  return 0;
+      }
+    if (!ch_build (ch))
+      {
+	  printf ("ERROR: insufficient memory [Contraction Hierarchy]\n");
+	  ch_free (ch);
+	  return 0;
+      }
+/* starts a transaction */
+    strcpy (sql, "BEGIN");
+    ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("BEGIN error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  goto stop;
+      }
+    if (force_creation)
+      {
+	  sprintf (sql, "DROP TABLE IF EXISTS \"%s\"", ch_table);
+	  ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+	  if (ret != SQLITE_OK)
+	    {
+		printf ("DROP TABLE error: %s\n", err_msg);
+		sqlite3_free (err_msg);
+		goto abort;
+	    }
+	  sprintf (sql, "DROP TABLE IF EXISTS \"%s_nodes\"", ch_table);
+	  ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+	  if (ret != SQLITE_OK)
+	    {
+		printf ("DROP TABLE error: %s\n", err_msg);
+		sqlite3_free (err_msg);
+		goto abort;
+	    }
+      }
+/* creating the Nodes table */
+    sprintf (sql, "CREATE TABLE \"%s_nodes\" (", ch_table);
+    strcat (sql, "\"NodeIndex\" INTEGER PRIMARY KEY, ");
+    if (p_graph->node_code)
+	strcat (sql, "\"NodeCode\" TEXT NOT NULL, ");
+    else
+	strcat (sql, "\"NodeId\" INTEGER NOT NULL, ");
+    strcat (sql, "\"Level\" INTEGER NOT NULL)");
+    ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("CREATE TABLE error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  goto abort;
+      }
+/* creating the Shortcuts table */
+    sprintf (sql, "CREATE TABLE \"%s\" (", ch_table);
+    strcat (sql, "\"Id\" INTEGER PRIMARY KEY, ");
+    strcat (sql, "\"NodeFrom\" INTEGER NOT NULL, ");
+    strcat (sql, "\"NodeTo\" INTEGER NOT NULL, ");
+    strcat (sql, "\"ViaNode\" INTEGER NOT NULL, ");
+    strcat (sql, "\"Cost\" DOUBLE NOT NULL)");
+    ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("CREATE TABLE error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  goto abort;
+      }
+/* inserting the Nodes */
+    sprintf (sql, "INSERT INTO \"%s_nodes\" VALUES (?, ?, ?)", ch_table);
+    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &stmt, NULL);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("INSERT error: %s\n", sqlite3_errmsg (handle));
+	  goto abort;
+      }
+    for (i = 0; i < p_graph->n_nodes; i++)
+      {
+	  pN = p_graph->nodes + i;
+	  sqlite3_reset (stmt);
+	  sqlite3_clear_bindings (stmt);
+	  sqlite3_bind_int (stmt, 1, pN->internal_index);
+	  if (p_graph->node_code)
+	      sqlite3_bind_text (stmt, 2, pN->code, strlen (pN->code),
+				 SQLITE_STATIC);
+	  else
+	      sqlite3_bind_int64 (stmt, 2, pN->id);
+	  sqlite3_bind_int (stmt, 3, ch->level[i]);
+	  ret = sqlite3_step (stmt);
+	  if (ret == SQLITE_DONE || ret == SQLITE_ROW)
+	      ;
+	  else
+	    {
+		printf ("sqlite3_step() error: %s\n", sqlite3_errmsg (handle));
+		goto abort;
+	    }
+      }
+    sqlite3_finalize (stmt);
+    stmt = NULL;
+/* inserting the Shortcuts */
+    sprintf (sql,
+	     "INSERT INTO \"%s\" (\"Id\", \"NodeFrom\", \"NodeTo\", \"ViaNode\", \"Cost\") "
+	     "VALUES (NULL, ?, ?, ?, ?)", ch_table);
+    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &stmt, NULL);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("INSERT error: %s\n", sqlite3_errmsg (handle));
+	  goto abort;
+      }
+    for (i = 0; i < ch->n_edges; i++)
+      {
+	  pE = ch->edges + i;
+	  if (pE->via < 0)
+	      continue;
+	  sqlite3_reset (stmt);
+	  sqlite3_clear_bindings (stmt);
+	  sqlite3_bind_int (stmt, 1, p_graph->nodes[pE->from].internal_index);
+	  sqlite3_bind_int (stmt, 2, p_graph->nodes[pE->to].internal_index);
+	  sqlite3_bind_int (stmt, 3, p_graph->nodes[pE->via].internal_index);
+	  sqlite3_bind_double (stmt, 4, pE->cost);
+	  ret = sqlite3_step (stmt);
+	  if (ret == SQLITE_DONE || ret == SQLITE_ROW)
+	      ;
+	  else
+	    {
+		printf ("sqlite3_step() error: %s\n", sqlite3_errmsg (handle));
+		goto abort;
+	    }
+      }
+    sqlite3_finalize (stmt);
+    stmt = NULL;
+/* commits the transaction */
+    strcpy (sql, "COMMIT");
+    ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("COMMIT error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  goto abort;
+      }
+    printf ("\n\nOK: Contraction Hierarchy table '%s' successfully created\n",
+	    ch_table);
+    printf ("\t%d Nodes, %d shortcuts\n", p_graph->n_nodes, ch->n_shortcuts);
+    ch_free (ch);
+    return 1;
+  abort:
+    if (stmt)
+	sqlite3_finalize (stmt);
+    sqlite3_exec (handle, "ROLLBACK", NULL, NULL, NULL);
+  stop:
+    ch_free (ch);
+    return 0;
+}
+
+static void
+spatialite_autocreate (sqlite3 * db)
+{
+/* attempting to perform self-initialization for a newly created DB */
+    int ret;
+    char sql[1024];
+    char *err_msg = NULL;
+    int count;
+    int i;
+    char **results;
+    int rows;
+    int columns;
+
+/* checking if this DB is really empty */
+    strcpy (sql, "SELECT Count(*) from sqlite_master");
+    ret = sqlite3_get_table (db, sql, &results, &rows, &columns, NULL);
+    if (ret != SQLITE_OK)
+	return;
+    if (rows < 1)
+	;
+    else
+      {
+	  for (i = 1; i <= rows; i++)
+	      count = atoi (results[(i * columns) + 0]);
+      }
+    sqlite3_free_table (results);
+
+    if (count > 0)
+	return;
+
+/* all right, it's empty: proceding to initialize */
+    strcpy (sql, "SELECT InitSpatialMetadataFull(1)");
+    ret = sqlite3_exec (db, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "InitSpatialMetadataFull() error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  return;
+      }
+}
+
+static void
+load_arc (struct graph *p_graph, int bidirectional, sqlite3_int64 rowid,
+	  sqlite3_int64 id_from, sqlite3_int64 id_to, const char *code_from,
+	  const char *code_to, double node_from_x, double node_from_y,
+	  double node_to_x, double node_to_y, double cost, int fromto,
+	  int tofrom)
+{
+/* checking an Arc and then inserting it into the graph */
+    char xRowid[128];
+    char xIdFrom[128];
+    char xIdTo[128];
+    sprintf (xRowid, FORMAT_64, rowid);
+    if (cost <= 0.0)
+      {
+	  printf
+	      ("ERROR: arc ROWID=%s has NEGATIVE or NULL cost [%1.6f]\n",
+	       xRowid, cost);
+	  p_graph->error = 1;
+      }
+    if (bidirectional)
+      {
+	  if (!fromto && !tofrom)
+	    {
+		if (p_graph->node_code)
+		    printf
+			("WARNING: arc forbidden in both directions; ROWID=%s From=%s To=%s\n",
+			 xRowid, code_from, code_to);
+		else
+		  {
+		      sprintf (xIdFrom, FORMAT_64, id_from);
+		      sprintf (xIdTo, FORMAT_64, id_to);
+		      printf
+			  ("WARNING: arc forbidden in both directions; ROWID=%s From=%s To=%s\n",
+			   xRowid, xIdFrom, xIdTo);
+		  }
+	    }
+	  if (fromto)
+	      add_arc (p_graph, rowid, id_from, id_to, code_from,
+		       code_to, node_from_x, node_from_y, node_to_x,
+		       node_to_y, cost);
+	  if (tofrom)
+	      add_arc (p_graph, rowid, id_to, id_from, code_to,
+		       code_from, node_to_x, node_to_y, node_from_x,
+		       node_from_y, cost);
+      }
+    else
+	add_arc (p_graph, rowid, id_from, id_to, code_from, code_to,
+		 node_from_x, node_from_y, node_to_x, node_to_y, cost);
+}
+
+struct snap_point
+{
+/* an Arc end point, located into the snapping grid */
+    sqlite3_int64 cell_x;
+    sqlite3_int64 cell_y;
+    double x;
+    double y;
+    int index;			/* 2 * Arc [StartPoint] or 2 * Arc + 1 [EndPoint] */
+};
+
+static int
+cmp_snap_points (const void *p1, const void *p2)
+{
+/* compares two end points by grid cell [qsort] */
+    const struct snap_point *pP1 = (const struct snap_point *) p1;
+    const struct snap_point *pP2 = (const struct snap_point *) p2;
+    if (pP1->cell_x != pP2->cell_x)
+	return (pP1->cell_x < pP2->cell_x) ? -1 : 1;
+    if (pP1->cell_y != pP2->cell_y)
+	return (pP1->cell_y < pP2->cell_y) ? -1 : 1;
+    return 0;
+}
+
+static int
+find_snap_cell (struct snap_point *points, int count, sqlite3_int64 cell_x,
+		sqlite3_int64 cell_y)
+{
+/* returns the position of the first end point falling into a grid cell */
+    struct snap_point key;
+    int lo = 0;
+    int hi = count;
+    int mid;
+    key.cell_x = cell_x;
+    key.cell_y = cell_y;
+    while (lo < hi)
+      {
+	  mid = lo + ((hi - lo) / 2);
+	  if (cmp_snap_points (points + mid, &key) < 0)
+	      lo = mid + 1;
+	  else
+	      hi = mid;
+      }
+    return lo;
+}
+
+static int
+has_column (sqlite3 * handle, const char *table, const char *column)
+{
+/* checks if some column exists; -1 on error */
+    int ret;
+    char sql[1024];
+    char **results;
+    int n_rows;
+    int n_columns;
+    int i;
+    int found = 0;
+    sprintf (sql, "PRAGMA table_info(\"%s\")", table);
+    ret = sqlite3_get_table (handle, sql, &results, &n_rows, &n_columns, NULL);
+    if (ret != SQLITE_OK)
+	return -1;
+    for (i = 1; i <= n_rows; i++)
+      {
+	  if (strcasecmp (column, results[(i * n_columns) + 1]) == 0)
+	      found = 1;
+      }
+    sqlite3_free_table (results);
+    return found;
+}
+
+static int
+assign_node_ids (sqlite3 * handle, const char *table,
+		 const char *from_column, const char *to_column,
+		 const char *geom_column, double tolerance)
+{
+/*
+/ creating the FromNode / ToNode columns when they are missing:
+/ all end points laying within tolerance are merged into the same
+/ Node [transitively], and each Node gets an automatic ID.
+/ end points are bucketed into a uniform grid of tolerance-sized
+/ cells, so that only the 9 neighbouring cells have to be searched
+/ Arcs collapsing into a self-loop [shorter than the tolerance]
+/ are reported, just as validation reports any other suspect Arc
+*/
+    int ret;
+    sqlite3_stmt *stmt = NULL;
+    char sql[1024];
+    char *err_msg = NULL;
+    sqlite3_int64 *rowids = NULL;
+    struct snap_point *points = NULL;
+    struct snap_point *pP;
+    struct snap_point *pQ;
+    int *parent = NULL;
+    int *ids = NULL;
+    int n_arcs = 0;
+    int max_arcs = 0;
+    int n_points;
+    int n_ids = 0;
+    int i;
+    int j;
+    int a;
+    int b;
+    int dx;
+    int dy;
+    int ok = 0;
+    int n_loops = 0;
+    double x;
+    double y;
+    double cell_x;
+    double cell_y;
+    char xRowid[128];
+    sprintf (sql,
+	     "SELECT ROWID, X(StartPoint(\"%s\")), Y(StartPoint(\"%s\")), X(EndPoint(\"%s\")), Y(EndPoint(\"%s\")) FROM \"%s\"",
+	     geom_column, geom_column, geom_column, geom_column, table);
+    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &stmt, NULL);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("SELECT error: %s\n", sqlite3_errmsg (handle));
+	  return 0;
+      }
+    while (1)
+      {
+	  ret = sqlite3_step (stmt);
+	  if (ret == SQLITE_DONE)
+	      break;
+	  if (ret != SQLITE_ROW)
+	    {
+		printf ("sqlite3_step() error: %s\n", sqlite3_errmsg (handle));
+		goto stop;
+	    }
+	  if (sqlite3_column_type (stmt, 1) == SQLITE_NULL
+	      || sqlite3_column_type (stmt, 3) == SQLITE_NULL)
+	    {
+		/* not a valid LINESTRING; validation will report it */
+		continue;
+	    }
+	  if (n_arcs >= max_arcs)
+	    {
+		int max = max_arcs + ARENA_CHUNK;
+		void *p = realloc (rowids, sizeof (sqlite3_int64) * max);
+		if (!p)
+		    goto no_memory;
+		rowids = p;
+		p = realloc (points, sizeof (struct snap_point) * 2 * max);
+		if (!p)
+		    goto no_memory;
+		points = p;
+		max_arcs = max;
+	    }
+	  rowids[n_arcs] = sqlite3_column_int64 (stmt, 0);
+	  for (i = 0; i < 2; i++)
+	    {
+		pP = points + (n_arcs * 2) + i;
+		pP->x = sqlite3_column_double (stmt, 1 + (i * 2));
+		pP->y = sqlite3_column_double (stmt, 2 + (i * 2));
+		cell_x = floor (pP->x / tolerance);
+		cell_y = floor (pP->y / tolerance);
+		if (!(fabs (cell_x) < MAX_SNAP_CELL)
+		    || !(fabs (cell_y) < MAX_SNAP_CELL))
+		  {
+		      /* the grid cell can't be represented as an integer */
+		      printf ("ERROR: snap tolerance %1.6f too small "
+			      "for coords [%1.6f %1.6f]\n", tolerance,
+			      pP->x, pP->y);
+		      goto stop;
+		  }
+		pP->cell_x = (sqlite3_int64) cell_x;
+		pP->cell_y = (sqlite3_int64) cell_y;
+		pP->index = (n_arcs * 2) + i;
+	    }
+	  n_arcs++;
+      }
+    sqlite3_finalize (stmt);
+    stmt = NULL;
+    n_points = n_arcs * 2;
+    parent = malloc (sizeof (int) * (n_points + 1));
+    ids = calloc (n_points + 1, sizeof (int));
+    if (!parent || !ids)
+	goto no_memory;
+/* merging all end points laying within tolerance */
+    for (i = 0; i < n_points; i++)
+	parent[i] = i;
+    if (n_points > 0)
+	qsort (points, n_points, sizeof (struct snap_point), cmp_snap_points);
+    for (i = 0; i < n_points; i++)
+      {
+	  pP = points + i;
+	  for (dx = -1; dx <= 1; dx++)
+	    {
+		for (dy = -1; dy <= 1; dy++)
+		  {
+		      j = find_snap_cell (points, n_points, pP->cell_x + dx,
+					  pP->cell_y + dy);
+		      for (; j < n_points; j++)
+			{
+			    pQ = points + j;
+			    if (pQ->cell_x != pP->cell_x + dx
+				|| pQ->cell_y != pP->cell_y + dy)
+				break;
+			    if (pQ->index <= pP->index)
+				continue;
+			    x = pQ->x - pP->x;
+			    y = pQ->y - pP->y;
+			    if (sqrt ((x * x) + (y * y)) > tolerance)
+				continue;
+			    a = find_island (parent, pP->index);
+			    b = find_island (parent, pQ->index);
+			    if (a != b)
+				parent[b] = a;
+			}
+		  }
+	    }
+      }
+/* assigning the Node IDs following the Arcs order */
+    for (i = 0; i < n_points; i++)
+      {
+	  a = find_island (parent, i);
+	  if (!ids[a])
+	      ids[a] = ++n_ids;
+	  ids[i] = ids[a];
+      }
+    for (i = 0; i < n_arcs; i++)
+      {
+	  if (ids[i * 2] != ids[(i * 2) + 1])
+	      continue;
+	  sprintf (xRowid, FORMAT_64, rowids[i]);
+	  printf ("WARNING: arc ROWID=%s collapses into a self-loop "
+		  "[shorter than the snap tolerance]\n", xRowid);
+	  n_loops++;
+      }
+/* writing the Node IDs into the table */
+    ret = sqlite3_exec (handle, "BEGIN", NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("BEGIN error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  goto stop;
+      }
+    sprintf (sql, "ALTER TABLE \"%s\" ADD COLUMN \"%s\" INTEGER", table,
+	     from_column);
+    ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+    if (ret == SQLITE_OK)
+      {
+	  sprintf (sql, "ALTER TABLE \"%s\" ADD COLUMN \"%s\" INTEGER", table,
+		   to_column);
+	  ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+      }
+    if (ret != SQLITE_OK)
+      {
+	  printf ("ALTER TABLE error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  goto rollback;
+      }
+    sprintf (sql, "UPDATE \"%s\" SET \"%s\" = ?, \"%s\" = ? WHERE ROWID = ?",
+	     table, from_column, to_column);
+    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &stmt, NULL);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("UPDATE error: %s\n", sqlite3_errmsg (handle));
+	  goto rollback;
+      }
+    for (i = 0; i < n_arcs; i++)
+      {
+	  sqlite3_reset (stmt);
+	  sqlite3_clear_bindings (stmt);
+	  sqlite3_bind_int (stmt, 1, ids[i * 2]);
+	  sqlite3_bind_int (stmt, 2, ids[(i * 2) + 1]);
+	  sqlite3_bind_int64 (stmt, 3, rowids[i]);
+	  ret = sqlite3_step (stmt);
+	  if (ret != SQLITE_DONE && ret != SQLITE_ROW)
+	    {
+		printf ("sqlite3_step() error: %s\n", sqlite3_errmsg (handle));
+		goto rollback;
+	    }
+      }
+    sqlite3_finalize (stmt);
+    stmt = NULL;
+    ret = sqlite3_exec (handle, "COMMIT", NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("COMMIT error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  goto rollback;
+      }
+    printf ("snapping: %d end points merged into %d Nodes [tolerance %1.6f]\n",
+	    n_points, n_ids, tolerance);
+    if (n_loops)
+	printf ("snapping: %d arcs collapsed into self-loops\n", n_loops);
+    printf ("columns \"%s\" and \"%s\" created\n\n", from_column, to_column);
+    ok = 1;
+    goto stop;
+  no_memory:
+    printf ("ERROR: insufficient memory [snapping]\n");
+    goto stop;
+  rollback:
+    if (stmt)
+	sqlite3_finalize (stmt);
+    stmt = NULL;
+    sqlite3_exec (handle, "ROLLBACK", NULL, NULL, NULL);
+  stop:
+    if (stmt)
+	sqlite3_finalize (stmt);
+    if (rowids)
+	free (rowids);
+    if (points)
+	free (points);
+    if (parent)
+	free (parent);
+    if (ids)
+	free (ids);
+    return ok;
+}
+
+static int
+check_cost_profiles (sqlite3 * handle, const char *table,
+		     struct net_options *options)
+{
+/* checking for the alternative Cost columns existence */
+    int ret;
+    char sql[1024];
+    char **results;
+    int n_rows;
+    int n_columns;
+    int i;
+    int k;
+    int ok = 1;
+    int found;
+    char *err_msg = NULL;
+    if (!(options->n_costs))
+	return 1;
+    sprintf (sql, "PRAGMA table_info(\"%s\")", table);
+    ret =
+	sqlite3_get_table (handle, sql, &results, &n_rows, &n_columns,
+			   &err_msg);
+    if (ret != SQLITE_OK)
+      {
+/* some error occurred */
+	  fprintf (stderr, "query#2 SQL error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  return 0;
+      }
+    for (k = 0; k < options->n_costs; k++)
+      {
+	  found = 0;
+	  for (i = 1; i <= n_rows; i++)
+	    {
+		if (strcasecmp
+		    (options->cost_columns[k],
+		     results[(i * n_columns) + 1]) == 0)
+		    found = 1;
+	    }
+	  if (!found)
+	    {
+		printf ("ERROR: column \"%s\".\"%s\" does not exists\n",
+			table, options->cost_columns[k]);
+		ok = 0;
+	    }
+      }
+    sqlite3_free_table (results);
+    return ok;
+}
+
+static void
+fetch_cost_profiles (sqlite3_stmt * stmt, int col_n, struct graph *p_graph,
+		     struct net_options *options, sqlite3_int64 rowid,
+		     double *costs)
+{
+/* fetching and checking the alternative Costs of an Arc */
+    int k;
+    int type;
+    char xRowid[128];
+    for (k = 0; k < options->n_costs; k++)
+      {
+	  type = sqlite3_column_type (stmt, col_n + k);
+	  costs[k] = sqlite3_column_double (stmt, col_n + k);
+	  if (type != SQLITE_INTEGER && type != SQLITE_FLOAT)
+	    {
+		sprintf (xRowid, FORMAT_64, rowid);
+		printf
+		    ("ERROR: arc ROWID=%s; column \"%s\" contains a not numeric cost\n",
+		     xRowid, options->cost_columns[k]);
+		p_graph->error = 1;
+	    }
+	  else if (costs[k] <= 0.0)
+	    {
+		sprintf (xRowid, FORMAT_64, rowid);
+		printf
+		    ("ERROR: arc ROWID=%s has NEGATIVE or NULL cost [%1.6f] in column \"%s\"\n",
+		     xRowid, costs[k], options->cost_columns[k]);
+		p_graph->error = 1;
+	    }
+      }
+    p_graph->arc_costs = costs;
+}
+
+static int
+cmp_rowids (const void *p1, const void *p2)
+{
+/* compares two ROWIDs [bsearch] */
+    sqlite3_int64 r1 = *((const sqlite3_int64 *) p1);
+    sqlite3_int64 r2 = *((const sqlite3_int64 *) p2);
+    if (r1 == r2)
+	return 0;
+    return (r1 < r2) ? -1 : 1;
+}
+
+static int
+load_network_header (const unsigned char *blob, int size, int endian_arch,
+		     struct graph *p_graph, const char **names,
+		     int *a_star_supported, double *a_star_coeff,
+		     int *compact)
+{
+/* 
+/ parsing the NETWORK-DATA Header block; returns 0 if the Header
+/ is invalid or if it doesn't match the current Table and columns
+/ [names can be NULL, so to accept any Table and columns]
+*/
+    static const unsigned char markers[5] = {
+	GAIA_NET_TABLE, GAIA_NET_FROM, GAIA_NET_TO, GAIA_NET_GEOM,
+	GAIA_NET_NAME
+    };
+    const unsigned char *in = blob;
+    const unsigned char *end = blob + size;
+    int len;
+    int i;
+    if (size < 9)
+	return 0;
+    *compact = COMPACT_NONE;
+    if (*in == GAIA_NET64_A_STAR_START || *in == NET_COMPACT_A_STAR_START)
+	*a_star_supported = 1;
+    else if (*in == GAIA_NET64_START || *in == NET_COMPACT_START)
+	*a_star_supported = 0;
+    else
+	return 0;
+    if (*in == NET_COMPACT_START || *in == NET_COMPACT_A_STAR_START)
+	*compact = COMPACT_LOSSLESS;
+    in++;
+    if (*in++ != GAIA_NET_HEADER)
+	return 0;
+    p_graph->n_nodes = gaiaImport32 (in, 1, endian_arch);
+    in += 4;
+    if (*in == GAIA_NET_CODE)
+	p_graph->node_code = 1;
+    else if (*in == GAIA_NET_ID)
+	p_graph->node_code = 0;
+    else
+	return 0;
+    in++;
+    p_graph->max_code_length = *in++;
+    if (p_graph->n_nodes <= 0 || p_graph->max_code_length > 32)
+	return 0;
+    for (i = 0; i < 5; i++)
+      {
+	  /* Table, NodeFrom, NodeTo, Geometry and Name columns */
+	  if (in + 3 > end || *in != markers[i])
+	      return 0;
+	  in++;
+	  len = gaiaImport16 (in, 1, endian_arch);
+	  in += 2;
+	  if (len < 1 || in + len > end || in[len - 1] != '\0')
+	      return 0;
+	  if (names
+	      && strcasecmp (names[i] ? names[i] : "",
+			     (const char *) in) != 0)
+	      return 0;
+	  in += len;
+      }
+    *a_star_coeff = 1.0;
+    if (*a_star_supported)
+      {
+	  if (in + 9 > end || *in != GAIA_NET_A_STAR_COEFF)
+	      return 0;
+	  in++;
+	  *a_star_coeff = gaiaImport64 (in, 1, endian_arch);
+	  in += 8;
+      }
+    if (*compact)
+      {
+	  /* the Cost width */
+	  if (in + 2 > end || *in != NET_COMPACT_COSTS)
+	      return 0;
+	  in++;
+	  if (*in == 4)
+	      *compact = COMPACT_FLOAT;
+	  else if (*in != 8)
+	      return 0;
+	  in++;
+      }
+    if (in >= end || *in != GAIA_NET_END)
+	return 0;
+    return 1;
+}
+
+static int
+load_compact_block (struct graph *p_graph, const unsigned char *blob,
+		    int size, int endian_arch, int a_star_supported,
+		    int compact, int block_no, int *node_block)
+{
+/* parsing a compact NETWORK-DATA block; returns 0 if the block is invalid */
+    const unsigned char *in = blob;
+    const unsigned char *end = blob + size;
+    int n_nodes;
+    int n_star;
+    int ind = 0;
+    int to;
+    int i;
+    int j;
+    sqlite3_uint64 value;
+    sqlite3_int64 id = 0;
+    sqlite3_int64 rowid;
+    double cost;
+    struct node *pN;
+    int cost_size = (compact == COMPACT_FLOAT) ? 4 : 8;
+    if (size < 3 || *in != GAIA_NET_BLOCK)
+	return 0;
+    in++;
+    n_nodes = gaiaImport16 (in, 1, endian_arch);
+    in += 2;
+    for (i = 0; i < n_nodes; i++)
+      {
+	  if (!(in = get_varint (in, end, &value)))
+	      return 0;
+	  ind += (int) unzigzag (value);
+	  if (ind < 0 || ind >= p_graph->n_nodes || node_block[ind] >= 0)
+	      return 0;
+	  node_block[ind] = block_no;
+	  pN = p_graph->nodes + ind;
+	  pN->internal_index = ind;
+	  if (!(in = get_varint (in, end, &value)))
+	      return 0;
+	  if (p_graph->node_code)
+	    {
+		if (value > 31 || in + value > end)
+		    return 0;
+		memcpy (pN->code, in, (size_t) value);
+		pN->code[value] = '\0';
+		pN->id = -1;
+		in += value;
+	    }
+	  else
+	    {
+		id += unzigzag (value);
+		*(pN->code) = '\0';
+		pN->id = id;
+	    }
+	  pN->x = DBL_MAX;
+	  pN->y = DBL_MAX;
+	  if (a_star_supported)
+	    {
+		if (in + 16 > end)
+		    return 0;
+		pN->x = gaiaImport64 (in, 1, endian_arch);
+		in += 8;
+		pN->y = gaiaImport64 (in, 1, endian_arch);
+		in += 8;
+	    }
+	  if (!(in = get_varint (in, end, &value)))
+	      return 0;
+	  n_star = (int) value;
+	  rowid = 0;
+	  for (j = 0; j < n_star; j++)
+	    {
+		/* the outcoming Arcs */
+		if (!(in = get_varint (in, end, &value)))
+		    return 0;
+		rowid += unzigzag (value);
+		if (!(in = get_varint (in, end, &value)))
+		    return 0;
+		to = ind + (int) unzigzag (value);
+		if (in + cost_size > end)
+		    return 0;
+		if (cost_size == 4)
+		    cost = gaiaImportF32 (in, 1, endian_arch);
+		else
+		    cost = gaiaImport64 (in, 1, endian_arch);
+		in += cost_size;
+		if (to < 0 || to >= p_graph->n_nodes)
+		    return 0;
+		push_arc (p_graph, rowid, ind, to, cost);
+		if (p_graph->error)
+		    return 0;
+	    }
+      }
+    return 1;
+}
+
+static int
+load_network_block (struct graph *p_graph, const unsigned char *blob,
+		    int size, int endian_arch, int a_star_supported,
+		    int compact, int block_no, int *node_block)
+{
+/* parsing a NETWORK-DATA block; returns 0 if the block is invalid */
+    const unsigned char *in = blob;
+    const unsigned char *end = blob + size;
+    int n_nodes;
+    int n_star;
+    int ind;
+    int to;
+    int i;
+    int j;
+    sqlite3_int64 rowid;
+    double cost;
+    struct node *pN;
+    int fixed = 1 + 4 + 2;	/* NODE marker, internal index, # of arcs */
+    if (p_graph->node_code)
+	fixed += p_graph->max_code_length;
+    else
+	fixed += 8;
+    if (a_star_supported)
+	fixed += 16;
+    if (compact)
+	return load_compact_block (p_graph, blob, size, endian_arch,
+				   a_star_supported, compact, block_no,
+				   node_block);
+    if (size < 3 || *in != GAIA_NET_BLOCK)
+	return 0;
+    in++;
+    n_nodes = gaiaImport16 (in, 1, endian_arch);
+    in += 2;
+    for (i = 0; i < n_nodes; i++)
+      {
+	  if (in + fixed > end || *in != GAIA_NET_NODE)
+	      return 0;
+	  in++;
+	  ind = gaiaImport32 (in, 1, endian_arch);
+	  in += 4;
+	  if (ind < 0 || ind >= p_graph->n_nodes || node_block[ind] >= 0)
+	      return 0;
+	  node_block[ind] = block_no;
+	  pN = p_graph->nodes + ind;
+	  pN->internal_index = ind;
+	  if (p_graph->node_code)
+	    {
+		memcpy (pN->code, in, p_graph->max_code_length);
+		pN->code[31] = '\0';
+		pN->id = -1;
+		in += p_graph->max_code_length;
+	    }
+	  else
+	    {
+		*(pN->code) = '\0';
+		pN->id = gaiaImportI64 (in, 1, endian_arch);
+		in += 8;
+	    }
+	  pN->x = DBL_MAX;
+	  pN->y = DBL_MAX;
+	  if (a_star_supported)
+	    {
+		pN->x = gaiaImport64 (in, 1, endian_arch);
+		in += 8;
+		pN->y = gaiaImport64 (in, 1, endian_arch);
+		in += 8;
+	    }
+	  n_star = gaiaImport16 (in, 1, endian_arch);
+	  in += 2;
+	  for (j = 0; j < n_star; j++)
+	    {
+		/* the outcoming Arcs */
+		if (in + 22 > end || *in != GAIA_NET_ARC)
+		    return 0;
+		in++;
+		rowid = gaiaImportI64 (in, 1, endian_arch);
+		in += 8;
+		to = gaiaImport32 (in, 1, endian_arch);
+		in += 4;
+		cost = gaiaImport64 (in, 1, endian_arch);
+		in += 8;
+		if (*in++ != GAIA_NET_END)
+		    return 0;
+		if (to < 0 || to >= p_graph->n_nodes)
+		    return 0;
+		push_arc (p_graph, rowid, ind, to, cost);
+		if (p_graph->error)
+		    return 0;
+	    }
+	  if (in >= end || *in++ != GAIA_NET_END)
+	      return 0;
+      }
+    return 1;
+}
+
+static int
+update_network (const char *path, const char *table, const char *from_column,
+		const char *to_column, const char *cost_column,
+		const char *geom_column, const char *name_column,
+		const char *oneway_tofrom, const char *oneway_fromto,
+		int bidirectional, const char *out_table,
+		int a_star_supported, struct net_options *options)
+{
+/* 
+/ incrementally updates an existing NETWORK-DATA table:
+/ - the whole graph is reloaded from NETWORK-DATA itself
+/ - all Arcs listed into the change log are removed, and
+/   then reloaded from the input table [if still existing]
+/ - only the blocks containing some affected Node are rewritten
+/ the internal indexes can't change, so a full rebuild is
+/ required [-1 is returned] whenever some Node is added or removed
+/ the whole update runs in a single IMMEDIATE transaction, so
+/ no change can be logged between reading and resetting the log
+*/
+    int ret;
+    int result = 0;
+    sqlite3 *handle;
+    sqlite3_stmt *stmt = NULL;
+    sqlite3_stmt *stmt_upd = NULL;
+    sqlite3_stmt *stmt_ins = NULL;
+    struct graph *p_graph = graph_init ();
+    struct net_blocks *list;
+    struct net_block *pB;
+    struct arc *pA;
+    char sql[1024];
+    char *err_msg = NULL;
+    char xRowid[128];
+    const char *names[5];
+    void *cache;
+    int endian_arch = gaiaEndianArch ();
+    int net_a_star;
+    int net_compact;
+    double a_star_coeff;
+    int header_changed = 0;
+    sqlite3_int64 *changes = NULL;
+    int n_changes = 0;
+    int max_changes = 0;
+    sqlite3_int64 *block_pks = NULL;
+    int n_blocks = 0;
+    int max_blocks = 0;
+    sqlite3_int64 next_pk = 1;
+    int *node_block = NULL;
+    int *block_start = NULL;
+    int *grouped = NULL;
+    int *order;
+    char *affected = NULL;
+    char *block_affected = NULL;
+    unsigned char *buf = NULL;
+    int buf_size = MAX_BLOCK;
+    int n_rewritten = 0;
+    int n_before;
+    int n_arcs;
+    int i;
+    int j;
+    int k;
+    int col_n;
+    int fromto_n = 0;
+    int tofrom_n = 0;
+    sqlite3_int64 rowid;
+    sqlite3_int64 id_from = -1;
+    sqlite3_int64 id_to = -1;
+    char code_from[1024];
+    char code_to[1024];
+    double node_from_x;
+    double node_from_y;
+    double node_to_x;
+    double node_to_y;
+    double cost;
+    double length;
+    int fromto;
+    int tofrom;
+
+    if (options->n_costs)
+      {
+	  /* the alternative Cost profiles aren't covered by the change log */
+	  printf ("alternative Cost profiles can't be incrementally updated\n");
+	  graph_free (p_graph);
+	  return -1;
+      }
+/* trying to connect the SpatiaLite DB  */
+    ret = sqlite3_open_v2 (path, &handle, SQLITE_OPEN_READWRITE, NULL);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "cannot open '%s': %s\n", path,
+		   sqlite3_errmsg (handle));
+	  sqlite3_close (handle);
+	  graph_free (p_graph);
+	  return 0;
+      }
+    cache = spatialite_alloc_connection ();
+    spatialite_init_ex (handle, cache, 0);
+    printf ("\nspatialite-network: incremental update\n\n");
+    printf
+	("==================================================================\n");
+    printf ("   SpatiaLite db: %s\n", path);
+    printf ("NETWORK-DATA table: %s\n\n", out_table);
+/* starts a transaction, locking out any other writer */
+    strcpy (sql, "BEGIN IMMEDIATE");
+    ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("BEGIN error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  goto abort;
+      }
+    fprintf (stderr, "Step   I - loading the change log\n");
+    sprintf (sql,
+	     "SELECT DISTINCT \"RowId\" FROM \"%s_changes\" ORDER BY \"RowId\"",
+	     out_table);
+    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &stmt, NULL);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("no change log found for '%s'\n", out_table);
+	  result = -1;
+	  goto abort;
+      }
+    while (1)
+      {
+	  ret = sqlite3_step (stmt);
+	  if (ret == SQLITE_DONE)
+	      break;
+	  if (ret != SQLITE_ROW)
+	    {
+		printf ("sqlite3_step() error: %s\n", sqlite3_errmsg (handle));
+		goto abort;
+	    }
+	  if (n_changes >= max_changes)
+	    {
+		sqlite3_int64 *p;
+		max_changes += ARENA_CHUNK;
+		p = realloc (changes, sizeof (sqlite3_int64) * max_changes);
+		if (!p)
+		  {
+		      printf ("ERROR: insufficient memory [change log]\n");
+		      goto abort;
+		  }
+		changes = p;
+	    }
+	  changes[n_changes++] = sqlite3_column_int64 (stmt, 0);
+      }
+    sqlite3_finalize (stmt);
+    stmt = NULL;
+    if (n_changes == 0)
+      {
+	  printf ("OK: no changed Arcs; NETWORK-DATA is already up to date\n");
+	  fprintf (stderr, "OK: nothing to update\n");
+	  result = 1;
+	  goto abort;
+      }
+    fprintf (stderr, "Step  II - loading NETWORK-DATA\n");
+    sprintf (sql,
+	     "SELECT \"Id\", \"NetworkData\" FROM \"%s\" ORDER BY \"Id\"",
+	     out_table);
+    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &stmt, NULL);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("NETWORK-DATA table '%s' not found\n", out_table);
+	  result = -1;
+	  goto abort;
+      }
+    names[0] = table;
+    names[1] = from_column;
+    names[2] = to_column;
+    names[3] = geom_column;
+    names[4] = name_column;
+    while (1)
+      {
+	  const unsigned char *blob;
+	  int size;
+	  ret = sqlite3_step (stmt);
+	  if (ret == SQLITE_DONE)
+	      break;
+	  if (ret != SQLITE_ROW)
+	    {
+		printf ("sqlite3_step() error: %s\n", sqlite3_errmsg (handle));
+		goto abort;
+	    }
+	  rowid = sqlite3_column_int64 (stmt, 0);
+	  blob = sqlite3_column_blob (stmt, 1);
+	  size = sqlite3_column_bytes (stmt, 1);
+	  if (sqlite3_column_type (stmt, 1) != SQLITE_BLOB)
+	    {
+		printf ("invalid NETWORK-DATA block [Id=" FORMAT_64 "]\n",
+			rowid);
+		result = -1;
+		goto abort;
+	    }
+	  if (node_block == NULL)
+	    {
+		/* the first block is expected to be the Header */
+		if (rowid != 0
+		    || !load_network_header (blob, size, endian_arch, p_graph,
+					     names, &net_a_star,
+					     &a_star_coeff, &net_compact))
+		  {
+		      printf
+			  ("NETWORK-DATA doesn't match the current arguments\n");
+		      result = -1;
+		      goto abort;
+		  }
+		if (net_a_star != a_star_supported)
+		  {
+		      printf
+			  ("NETWORK-DATA doesn't match the current A* setting\n");
+		      result = -1;
+		      goto abort;
+		  }
+		if (net_compact != options->compact)
+		  {
+		      printf
+			  ("NETWORK-DATA doesn't match the current encoding\n");
+		      result = -1;
+		      goto abort;
+		  }
+		p_graph->nodes = malloc (sizeof (struct node) * p_graph->n_nodes);
+		node_block = malloc (sizeof (int) * p_graph->n_nodes);
+		if (!(p_graph->nodes) || !node_block)
+		  {
+		      printf ("ERROR: insufficient memory [Nodes]\n");
+		      goto abort;
+		  }
+		for (i = 0; i < p_graph->n_nodes; i++)
+		    node_block[i] = -1;
+		continue;
+	    }
+	  if (n_blocks >= max_blocks)
+	    {
+		sqlite3_int64 *p;
+		max_blocks += 1024;
+		p = realloc (block_pks, sizeof (sqlite3_int64) * max_blocks);
+		if (!p)
+		  {
+		      printf ("ERROR: insufficient memory [NETWORK-DATA]\n");
+		      goto abort;
+		  }
+		block_pks = p;
+	    }
+	  block_pks[n_blocks] = rowid;
+	  if (!load_network_block
+	      (p_graph, blob, size, endian_arch, net_a_star, net_compact,
+	       n_blocks, node_block))
+	    {
+		printf ("invalid NETWORK-DATA block [Id=" FORMAT_64 "]\n",
+			rowid);
+		result = -1;
+		goto abort;
+	    }
+	  n_blocks++;
+	  next_pk = rowid + 1;
+      }
+    sqlite3_finalize (stmt);
+    stmt = NULL;
+    if (node_block == NULL)
+      {
+	  printf ("NETWORK-DATA table '%s' is empty\n", out_table);
+	  result = -1;
+	  goto abort;
+      }
+    for (i = 0; i < p_graph->n_nodes; i++)
+      {
+	  if (node_block[i] < 0)
+	    {
+		printf ("NETWORK-DATA is incomplete [missing Nodes]\n");
+		result = -1;
+		goto abort;
+	    }
+      }
+/* removing all changed Arcs */
+    affected = malloc (p_graph->n_nodes);
+    if (!affected)
+      {
+	  printf ("ERROR: insufficient memory [Nodes]\n");
+	  goto abort;
+      }
+    memset (affected, 0, p_graph->n_nodes);
+    n_arcs = 0;
+    for (i = 0; i < p_graph->n_arcs; i++)
+      {
+	  pA = p_graph->arcs + i;
+	  if (bsearch
+	      (&(pA->rowid), changes, n_changes, sizeof (sqlite3_int64),
+	       cmp_rowids))
+	    {
+		affected[pA->from] = 1;
+		continue;
+	    }
+	  p_graph->arcs[n_arcs++] = *pA;
+      }
+    p_graph->n_arcs = n_arcs;
+    build_node_index (p_graph);
+    fprintf (stderr, "Step III - reloading the changed Arcs\n");
+    if (geom_column)
+	sprintf (sql,
+		 "SELECT ROWID, \"%s\", \"%s\", X(StartPoint(\"%s\")), Y(StartPoint(\"%s\")), X(EndPoint(\"%s\")), Y(EndPoint(\"%s\"))",
+		 from_column, to_column, geom_column, geom_column, geom_column,
+		 geom_column);
+    else
+	sprintf (sql, "SELECT ROWID, \"%s\", \"%s\", NULL, NULL, NULL, NULL",
+		 from_column, to_column);
+    if (cost_column)
+	sprintf (sql + strlen (sql), ", \"%s\"", cost_column);
+    else
+	sprintf (sql + strlen (sql), ", GLength(\"%s\")", geom_column);
+    if (geom_column)
+	sprintf (sql + strlen (sql), ", GLength(\"%s\")", geom_column);
+    else
+	strcat (sql, ", NULL");
+    col_n = 9;
+    if (oneway_tofrom)
+      {
+	  sprintf (sql + strlen (sql), ", \"%s\"", oneway_tofrom);
+	  tofrom_n = col_n++;
+      }
+    if (oneway_fromto)
+      {
+	  sprintf (sql + strlen (sql), ", \"%s\"", oneway_fromto);
+	  fromto_n = col_n++;
+      }
+    sprintf (sql + strlen (sql),
+	     " FROM \"%s\" WHERE ROWID IN (SELECT \"RowId\" FROM \"%s_changes\")",
+	     table, out_table);
+    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &stmt, NULL);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("SQL error: %s\n", sqlite3_errmsg (handle));
+	  goto abort;
+      }
+    while (1)
+      {
+	  ret = sqlite3_step (stmt);
+	  if (ret == SQLITE_DONE)
+	      break;
+	  if (ret != SQLITE_ROW)
+	    {
+		printf ("sqlite3_step() error: %s\n", sqlite3_errmsg (handle));
+		goto abort;
+	    }
+	  rowid = sqlite3_column_int64 (stmt, 0);
+	  sprintf (xRowid, FORMAT_64, rowid);
+	  /* checking the value types; full validation will explain any error */
+	  ret = 1;
+	  for (i = 1; i <= 2; i++)
+	    {
+		if (sqlite3_column_type (stmt, i) !=
+		    (p_graph->node_code ? SQLITE_TEXT : SQLITE_INTEGER))
+		    ret = 0;
+	    }
+	  for (i = 3; i <= 8; i++)
+	    {
+		if (i != 7 && !geom_column)
+		    continue;
+		if (sqlite3_column_type (stmt, i) != SQLITE_FLOAT
+		    && sqlite3_column_type (stmt, i) != SQLITE_INTEGER)
+		    ret = 0;
+	    }
+	  for (i = 9; i < col_n; i++)
+	    {
+		if (sqlite3_column_type (stmt, i) != SQLITE_INTEGER)
+		    ret = 0;
+	    }
+	  if (!ret)
+	    {
+		printf ("arc ROWID=%s contains invalid values\n", xRowid);
+		result = -1;
+		goto abort;
+	    }
+	  if (p_graph->node_code)
+	    {
+		strcpy (code_from, (char *) sqlite3_column_text (stmt, 1));
+		strcpy (code_to, (char *) sqlite3_column_text (stmt, 2));
+	    }
+	  else
+	    {
+		*code_from = '\0';
+		*code_to = '\0';
+		id_from = sqlite3_column_int64 (stmt, 1);
+		id_to = sqlite3_column_int64 (stmt, 2);
+	    }
+	  if (!find_node (p_graph, id_from, code_from)
+	      || !find_node (p_graph, id_to, code_to))
+	    {
+		printf ("arc ROWID=%s references a new Node\n", xRowid);
+		result = -1;
+		goto abort;
+	    }
+	  node_from_x = DBL_MAX;
+	  node_from_y = DBL_MAX;
+	  node_to_x = DBL_MAX;
+	  node_to_y = DBL_MAX;
+	  if (geom_column)
+	    {
+		node_from_x = sqlite3_column_double (stmt, 3);
+		node_from_y = sqlite3_column_double (stmt, 4);
+		node_to_x = sqlite3_column_double (stmt, 5);
+		node_to_y = sqlite3_column_double (stmt, 6);
+	    }
+	  cost = sqlite3_column_double (stmt, 7);
+	  if (net_a_star && cost_column)
+	    {
+		/* supporting A* - the Heuristic Coeff can only decrease */
+		length = sqlite3_column_double (stmt, 8);
+		if (cost / length < a_star_coeff)
+		  {
+		      a_star_coeff = cost / length;
+		      header_changed = 1;
+		  }
+	    }
+	  fromto = 1;
+	  tofrom = 1;
+	  if (oneway_fromto)
+	      fromto = sqlite3_column_int (stmt, fromto_n);
+	  if (oneway_tofrom)
+	      tofrom = sqlite3_column_int (stmt, tofrom_n);
+	  n_before = p_graph->n_arcs;
+	  load_arc (p_graph, bidirectional, rowid, id_from, id_to, code_from,
+		    code_to, node_from_x, node_from_y, node_to_x, node_to_y,
+		    cost, fromto, tofrom);
+	  if (p_graph->error)
+	    {
+		result = -1;
+		goto abort;
+	    }
+	  for (i = n_before; i < p_graph->n_arcs; i++)
+	      affected[p_graph->arcs[i].from] = 1;
+      }
+    sqlite3_finalize (stmt);
+    stmt = NULL;
+/* 
+/ each Node is still expected to be referenced by the input table;
+/ a Node without Arcs [e.g. forbidden in both directions] must
+/ be explicitly checked
+*/
+    sprintf (sql,
+	     "SELECT ROWID FROM \"%s\" WHERE \"%s\" = ?1 OR \"%s\" = ?1 LIMIT 1",
+	     table, from_column, to_column);
+    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &stmt, NULL);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("SQL error: %s\n", sqlite3_errmsg (handle));
+	  goto abort;
+      }
+    block_start = malloc (sizeof (int) * (p_graph->n_nodes + 1));
+    if (!block_start)
+      {
+	  printf ("ERROR: insufficient memory [Nodes]\n");
+	  goto abort;
+      }
+    memset (block_start, 0, sizeof (int) * (p_graph->n_nodes + 1));
+    for (i = 0; i < p_graph->n_arcs; i++)
+      {
+	  block_start[p_graph->arcs[i].from] += 1;
+	  block_start[p_graph->arcs[i].to] += 1;
+      }
+    for (i = 0; i < p_graph->n_nodes; i++)
+      {
+	  if (block_start[i] > 0)
+	      continue;
+	  sqlite3_reset (stmt);
+	  sqlite3_clear_bindings (stmt);
+	  if (p_graph->node_code)
+	      sqlite3_bind_text (stmt, 1, p_graph->nodes[i].code,
+				 strlen (p_graph->nodes[i].code),
+				 SQLITE_STATIC);
+	  else
+	      sqlite3_bind_int64 (stmt, 1, p_graph->nodes[i].id);
+	  ret = sqlite3_step (stmt);
+	  if (ret == SQLITE_DONE)
+	    {
+		printf ("some Node is no longer referenced by any Arc\n");
+		result = -1;
+		goto abort;
+	    }
+	  if (ret != SQLITE_ROW)
+	    {
+		printf ("sqlite3_step() error: %s\n", sqlite3_errmsg (handle));
+		goto abort;
+	    }
+	  if (p_graph->nodes[i].x != DBL_MAX || p_graph->nodes[i].y != DBL_MAX)
+	    {
+		/* just as a full rebuild would do, coords are now undefined */
+		p_graph->nodes[i].x = DBL_MAX;
+		p_graph->nodes[i].y = DBL_MAX;
+		affected[i] = 1;
+	    }
+      }
+    sqlite3_finalize (stmt);
+    stmt = NULL;
+    free (block_start);
+    block_start = NULL;
+    if (!pack_arcs (p_graph))
+	goto abort;
+/* grouping the Nodes by block */
+    block_start = malloc (sizeof (int) * (n_blocks + 1));
+    grouped = malloc (sizeof (int) * p_graph->n_nodes);
+    block_affected = malloc (n_blocks);
+    buf = malloc (MAX_BLOCK);
+    if (!block_start || !grouped || !block_affected || !buf)
+      {
+	  printf ("ERROR: insufficient memory [NETWORK-DATA]\n");
+	  goto abort;
+      }
+    memset (block_start, 0, sizeof (int) * (n_blocks + 1));
+    memset (block_affected, 0, n_blocks);
+    for (i = 0; i < p_graph->n_nodes; i++)
+      {
+	  block_start[node_block[i] + 1] += 1;
+	  if (affected[i])
+	      block_affected[node_block[i]] = 1;
+      }
+    for (i = 0; i < n_blocks; i++)
+	block_start[i + 1] += block_start[i];
+    for (i = 0; i < p_graph->n_nodes; i++)
+	grouped[block_start[node_block[i]]++] = i;
+    for (i = n_blocks; i > 0; i--)
+	block_start[i] = block_start[i - 1];
+    block_start[0] = 0;
+    fprintf (stderr, "Step  IV - rewriting the affected blocks\n");
+    sprintf (sql, "UPDATE \"%s\" SET \"NetworkData\" = ?2 WHERE \"Id\" = ?1",
+	     out_table);
+    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &stmt_upd, NULL);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("UPDATE error: %s\n", sqlite3_errmsg (handle));
+	  goto abort;
+      }
+    sprintf (sql, "INSERT INTO \"%s\" (\"Id\", \"NetworkData\") VALUES (?, ?)",
+	     out_table);
+    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &stmt_ins, NULL);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("INSERT error: %s\n", sqlite3_errmsg (handle));
+	  goto abort;
+      }
+    for (i = 0; i < n_blocks; i++)
+      {
+	  if (!block_affected[i])
+	      continue;
+	  /* a block may now overflow; any excess goes into new blocks */
+	  k = block_start[i + 1] - block_start[i];
+	  order = malloc (sizeof (int) * k);
+	  if (!order)
+	    {
+		printf ("ERROR: insufficient memory [NETWORK-DATA]\n");
+		goto abort;
+	    }
+	  memcpy (order, grouped + block_start[i], sizeof (int) * k);
+	  list =
+	      plan_blocks (p_graph, order, k, endian_arch, net_a_star,
+			   options->block_size, net_compact);
+	  if (!list)
+	    {
+		free (order);
+		printf ("ERROR: insufficient memory [NETWORK-DATA]\n");
+		goto abort;
+	    }
+	  if (list->max_size > buf_size)
+	    {
+		/* a single Node may exceed the block size */
+		unsigned char *p = realloc (buf, list->max_size);
+		if (!p)
+		  {
+		      free_blocks (list);
+		      printf ("ERROR: insufficient memory [NETWORK-DATA]\n");
+		      goto abort;
+		  }
+		buf = p;
+		buf_size = list->max_size;
+	    }
+	  for (j = 0; j < list->n_blocks; j++)
+	    {
+		pB = list->blocks + j;
+		encode_block (list, pB, buf);
+		if (j == 0)
+		    ret =
+			insert_block (handle, stmt_upd, block_pks[i], buf,
+				      pB->size);
+		else
+		    ret = insert_block (handle, stmt_ins, next_pk++, buf,
+					pB->size);
+		if (!ret)
+		  {
+		      free_blocks (list);
+		      goto abort;
+		  }
+	    }
+	  free_blocks (list);
+	  n_rewritten++;
+      }
+    if (header_changed)
+      {
+	  /* the A* Heuristic Coeff has changed */
+	  k = encode_header (buf, p_graph, table, from_column, to_column,
+			     geom_column, name_column, net_a_star,
+			     a_star_coeff, endian_arch, net_compact);
+	  if (!insert_block (handle, stmt_upd, 0, buf, k))
+	      goto abort;
+      }
+    sqlite3_finalize (stmt_upd);
+    stmt_upd = NULL;
+    sqlite3_finalize (stmt_ins);
+    stmt_ins = NULL;
+/* resetting the change log */
+    sprintf (sql, "DELETE FROM \"%s_changes\"", out_table);
+    ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("DELETE error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  goto abort;
+      }
+/* commits the transaction */
+    strcpy (sql, "COMMIT");
+    ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("COMMIT error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  goto abort;
+      }
+    printf ("OK: NETWORK-DATA table '%s' successfully updated\n", out_table);
+    printf ("\t%d changed Arcs, %d of %d blocks rewritten\n", n_changes,
+	    n_rewritten, n_blocks);
+    fprintf (stderr, "OK: table '%s' successfully updated\n", out_table);
+    result = 1;
+    if (options->snapshot)
+      {
+	  if (write_snapshot (options->snapshot, p_graph, net_a_star))
+	      fprintf (stderr, "OK: snapshot '%s' successfully created\n",
+		       options->snapshot);
+	  else
+	      fprintf (stderr, "ERROR: snapshot '%s' failure\n",
+		       options->snapshot);
+      }
+    if (options->ch_table)
+      {
+	  /* the Contraction Hierarchy depends on the whole graph */
+	  if (create_ch_table (handle, options->ch_table, 1, p_graph))
+	      fprintf (stderr, "OK: table '%s' successfully created\n",
+		       options->ch_table);
+	  else
+	      fprintf (stderr, "ERROR: table '%s' failure\n",
+		       options->ch_table);
+      }
+  abort:
+    if (stmt)
+	sqlite3_finalize (stmt);
+    if (stmt_upd)
+	sqlite3_finalize (stmt_upd);
+    if (stmt_ins)
+	sqlite3_finalize (stmt_ins);
+    if (!sqlite3_get_autocommit (handle))
+	sqlite3_exec (handle, "ROLLBACK", NULL, NULL, NULL);
+    if (changes)
+	free (changes);
+    if (block_pks)
+	free (block_pks);
+    if (node_block)
+	free (node_block);
+    if (block_start)
+	free (block_start);
+    if (grouped)
+	free (grouped);
+    if (affected)
+	free (affected);
+    if (block_affected)
+	free (block_affected);
+    if (buf)
+	free (buf);
+/* disconnecting the SpatiaLite DB */
+    ret = sqlite3_close (handle);
+    if (ret != SQLITE_OK)
+	fprintf (stderr, "sqlite3_close() error: %s\n",
+		 sqlite3_errmsg (handle));
+    spatialite_cleanup_ex (cache);
+    graph_free (p_graph);
+    return result;
+}
+
+struct bench_context
+{
+/*
+/ the working areas shared by all benchmark searches:
+/ - node_block[i] is the NETWORK-DATA block containing the i-th Node
+/ - dist[] is valid only if stamp[] matches the current generation,
+/   and a Node has already been expanded if settled[] matches it
+/ - block_stamp[] marks the blocks touched by the current search
+*/
+    struct graph *p_graph;
+    int *node_block;
+    int n_blocks;
+    double *dist;
+    int *stamp;
+    int *settled;
+    int *block_stamp;
+    int generation;
+    struct ch_heap queue;
+};
+
+static double
+bench_now ()
+{
+/* returns the current time in milliseconds */
+#if defined(_WIN32) && !defined(__MINGW32__)
+    return ((double) clock () * 1000.0) / CLOCKS_PER_SEC;
+#else
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return ((double) tv.tv_sec * 1000.0) + ((double) tv.tv_usec / 1000.0);
+#endif
+}
+
+static unsigned int
+bench_random (unsigned int *state)
+{
+/* xorshift32: the same seed always generates the same workload */
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static double
+bench_heuristic (struct graph *p_graph, int node, int target, int a_star,
+		 double a_star_coeff)
+{
+/* the A* heuristic: the scaled euclidean distance [0 for Dijkstra] */
+    struct node *pN = p_graph->nodes + node;
+    struct node *pT = p_graph->nodes + target;
+    if (!a_star)
+	return 0.0;
+    return a_star_coeff *
+	sqrt (((pN->x - pT->x) * (pN->x - pT->x)) +
+	      ((pN->y - pT->y) * (pN->y - pT->y)));
+}
+
+static double
+bench_search (struct bench_context *ctx, int source, int target, int a_star,
+	      double a_star_coeff, int *expanded, int *touched)
+{
+/* 
+/ replaying a single Dijkstra [or A*] query on the loaded graph;
+/ returns the total Cost, -1.0 if the target is unreachable and
+/ -2.0 on insufficient memory
+*/
+    struct graph *p_graph = ctx->p_graph;
+    struct arc *pA;
+    double key;
+    double cost;
+    int node;
+    int next;
+    int i;
+    int gen = ++(ctx->generation);
+    *expanded = 0;
+    *touched = 0;
+    ctx->queue.count = 0;
+    ctx->dist[source] = 0.0;
+    ctx->stamp[source] = gen;
+    if (!ch_heap_push
+	(&(ctx->queue),
+	 bench_heuristic (p_graph, source, target, a_star, a_star_coeff),
+	 source))
+	return -2.0;
+    while (ctx->queue.count > 0)
+      {
+	  ch_heap_pop (&(ctx->queue), &key, &node);
+	  if (ctx->settled[node] == gen)
+	      continue;
+	  ctx->settled[node] = gen;
+	  *expanded += 1;
+	  if (ctx->block_stamp[ctx->node_block[node]] != gen)
+	    {
+		/* the first Node read from this block */
+		ctx->block_stamp[ctx->node_block[node]] = gen;
+		*touched += 1;
+	    }
+	  if (node == target)
+	      return ctx->dist[node];
+	  for (i = p_graph->out_offsets[node];
+	       i < p_graph->out_offsets[node + 1]; i++)
+	    {
+		pA = p_graph->arcs + i;
+		next = pA->to;
+		if (ctx->settled[next] == gen)
+		    continue;
+		cost = ctx->dist[node] + pA->cost;
+		if (ctx->stamp[next] == gen && ctx->dist[next] <= cost)
+		    continue;
+		ctx->dist[next] = cost;
+		ctx->stamp[next] = gen;
+		if (!ch_heap_push
+		    (&(ctx->queue),
+		     cost + bench_heuristic (p_graph, next, target, a_star,
+					     a_star_coeff), next))
+		    return -2.0;
+	    }
+      }
+    return -1.0;
+}
+
+static int
+cmp_doubles (const void *p1, const void *p2)
+{
+/* compares two doubles [qsort] */
+    double d1 = *((const double *) p1);
+    double d2 = *((const double *) p2);
+    if (d1 == d2)
+	return 0;
+    return (d1 < d2) ? -1 : 1;
+}
+
+static double
+bench_percentile (const double *sorted, int count, double q)
+{
+/* nearest-rank percentile of an already sorted array */
+    int i = (int) ceil (q * count) - 1;
+    if (i < 0)
+	i = 0;
+    if (i >= count)
+	i = count - 1;
+    return sorted[i];
+}
+
+static void
+print_distribution (const char *label, double *values, int count)
+{
+/* printing the distribution of a measure; values will be sorted */
+    int i;
+    double sum = 0.0;
+    if (count <= 0)
+	return;
+    qsort (values, count, sizeof (double), cmp_doubles);
+    for (i = 0; i < count; i++)
+	sum += values[i];
+    printf
+	("\t%-16s mean=%1.3f p50=%1.3f p95=%1.3f p99=%1.3f max=%1.3f\n",
+	 label, sum / count, bench_percentile (values, count, 0.50),
+	 bench_percentile (values, count, 0.95),
+	 bench_percentile (values, count, 0.99), values[count - 1]);
+}
+
+static int
+bench_replay (struct bench_context *ctx, const int *pairs, int n_queries,
+	      int a_star, double a_star_coeff, double *costs)
+{
+/* replaying the whole workload on the loaded graph */
+    int q;
+    int expanded;
+    int touched;
+    int found = 0;
+    double start;
+    double *latency = malloc (sizeof (double) * n_queries);
+    double *nodes = malloc (sizeof (double) * n_queries);
+    double *blocks = malloc (sizeof (double) * n_queries);
+    if (!latency || !nodes || !blocks)
+      {
+	  printf ("ERROR: insufficient memory [benchmark]\n");
+	  goto error;
+      }
+    for (q = 0; q < n_queries; q++)
+      {
+	  start = bench_now ();
+	  costs[q] =
+	      bench_search (ctx, pairs[q * 2], pairs[(q * 2) + 1], a_star,
+			    a_star_coeff, &expanded, &touched);
+	  latency[q] = bench_now () - start;
+	  if (costs[q] < -1.5)
+	    {
+		printf ("ERROR: insufficient memory [benchmark]\n");
+		goto error;
+	    }
+	  if (costs[q] >= 0.0)
+	      found++;
+	  nodes[q] = expanded;
+	  blocks[q] = touched;
+      }
+    printf ("\n%s [in-process model, not VirtualNetwork]: "
+	    "%d of %d destinations reached\n", a_star ? "A*" : "Dijkstra",
+	    found, n_queries);
+    print_distribution ("model [ms]", latency, n_queries);
+    print_distribution ("nodes expanded", nodes, n_queries);
+    print_distribution ("model blocks", blocks, n_queries);
+    free (latency);
+    free (nodes);
+    free (blocks);
+    return 1;
+  error:
+    if (latency)
+	free (latency);
+    if (nodes)
+	free (nodes);
+    if (blocks)
+	free (blocks);
+    return 0;
+}
+
+static int
+bench_virtual (sqlite3 * handle, const char *virt_table,
+	       struct graph *p_graph, const int *pairs, int n_queries,
+	       int a_star, const double *costs)
+{
+/* 
+/ timing the same workload through VirtualNetwork; each result
+/ is checked against the in-process replay
+*/
+    int ret;
+    int q;
+    int mismatches = 0;
+    int reached;
+    double cost;
+    double start;
+    char sql[1024];
+    char *err_msg = NULL;
+    sqlite3_stmt *stmt = NULL;
+    struct node *pN;
+    double *latency = malloc (sizeof (double) * n_queries);
+    if (!latency)
+      {
+	  printf ("ERROR: insufficient memory [benchmark]\n");
+	  return 0;
+      }
+    sprintf (sql, "UPDATE \"%s\" SET Algorithm = '%s'", virt_table,
+	     a_star ? "A*" : "Dijkstra");
+    ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("UPDATE error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  goto error;
+      }
+    sprintf (sql,
+	     "SELECT Cost FROM \"%s\" WHERE NodeFrom = ? AND NodeTo = ? LIMIT 1",
+	     virt_table);
+    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &stmt, NULL);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("SELECT error: %s\n", sqlite3_errmsg (handle));
+	  goto error;
+      }
+    for (q = 0; q < n_queries; q++)
+      {
+	  sqlite3_reset (stmt);
+	  sqlite3_clear_bindings (stmt);
+	  pN = p_graph->nodes + pairs[q * 2];
+	  if (p_graph->node_code)
+	      sqlite3_bind_text (stmt, 1, pN->code, strlen (pN->code),
+				 SQLITE_STATIC);
+	  else
+	      sqlite3_bind_int64 (stmt, 1, pN->id);
+	  pN = p_graph->nodes + pairs[(q * 2) + 1];
+	  if (p_graph->node_code)
+	      sqlite3_bind_text (stmt, 2, pN->code, strlen (pN->code),
+				 SQLITE_STATIC);
+	  else
+	      sqlite3_bind_int64 (stmt, 2, pN->id);
+	  start = bench_now ();
+	  ret = sqlite3_step (stmt);
+	  latency[q] = bench_now () - start;
+	  reached = 0;
+	  cost = 0.0;
+	  if (ret == SQLITE_ROW)
+	    {
+		/* a NULL Cost means that the destination is unreachable */
+		if (sqlite3_column_type (stmt, 0) != SQLITE_NULL)
+		  {
+		      reached = 1;
+		      cost = sqlite3_column_double (stmt, 0);
+		  }
+	    }
+	  else if (ret != SQLITE_DONE)
+	    {
+		printf ("sqlite3_step() error: %s\n", sqlite3_errmsg (handle));
+		goto error;
+	    }
+	  if (reached != (costs[q] >= 0.0))
+	      mismatches++;
+	  else if (reached
+		   && fabs (cost - costs[q]) > 1e-6 * (fabs (costs[q]) + 1.0))
+	      mismatches++;
+      }
+    sqlite3_finalize (stmt);
+    printf ("\n%s [VirtualNetwork '%s']: %d Cost mismatches\n",
+	    a_star ? "A*" : "Dijkstra", virt_table, mismatches);
+    print_distribution ("latency [ms]", latency, n_queries);
+    free (latency);
+    return 1;
+  error:
+    if (stmt)
+	sqlite3_finalize (stmt);
+    free (latency);
+    return 0;
+}
+
+static void
+benchmark_network (const char *path, const char *out_table,
+		   const char *virt_table, int n_queries, unsigned int seed)
+{
+/* 
+/ loads an existing NETWORK-DATA table and runs a seeded workload
+/ of random origin / destination pairs, so that different block
+/ layouts, Node orders and A* coefficients can be compared:
+/ - the workload is timed through VirtualNetwork; a temporary
+/   VirtualNetwork is created if none is given
+/ - the in-process model replays the same queries on the decoded
+/   graph, counting the expanded Nodes and the distinct blocks
+/   they belong to; it is not the VirtualNetwork code, and its
+/   figures only serve to compare layouts and to check Costs
+*/
+    int ret;
+    int i;
+    int a_star;
+    int compact;
+    double a_star_coeff;
+    sqlite3_int64 bytes = 0;
+    sqlite3 *handle;
+    sqlite3_stmt *stmt = NULL;
+    struct graph *p_graph = graph_init ();
+    struct bench_context ctx;
+    char sql[1024];
+    void *cache;
+    int *pairs = NULL;
+    double *costs = NULL;
+    char bench_virt[512];
+    int temp_virt = 0;
+    char *err_msg = NULL;
+    unsigned int state = seed ^ 0x9e3779b9;
+    memset (&ctx, 0, sizeof (struct bench_context));
+    ctx.p_graph = p_graph;
+/* trying to connect the SpatiaLite DB  */
+    ret = sqlite3_open_v2 (path, &handle, SQLITE_OPEN_READWRITE, NULL);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "cannot open '%s': %s\n", path,
+		   sqlite3_errmsg (handle));
+	  sqlite3_close (handle);
+	  graph_free (p_graph);
+	  return;
+      }
+    cache = spatialite_alloc_connection ();
+    spatialite_init_ex (handle, cache, 0);
+    printf ("\nspatialite-network: routing benchmark\n\n");
+    printf
+	("==================================================================\n");
+    printf ("   SpatiaLite db: %s\n", path);
+    printf ("NETWORK-DATA table: %s\n", out_table);
+    if (virt_table)
+	printf ("VirtualNetwork table: %s\n", virt_table);
+    printf ("%d queries, seed %u\n", n_queries, seed);
+    fprintf (stderr, "Step   I - loading NETWORK-DATA\n");
+    sprintf (sql,
+	     "SELECT \"Id\", \"NetworkData\" FROM \"%s\" ORDER BY \"Id\"",
+	     out_table);
+    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &stmt, NULL);
+    if (ret != SQLITE_OK)
+      {
+	  printf ("NETWORK-DATA table '%s' not found\n", out_table);
+	  goto abort;
+      }
+    while (1)
+      {
+	  const unsigned char *blob;
+	  int size;
+	  ret = sqlite3_step (stmt);
+	  if (ret == SQLITE_DONE)
+	      break;
+	  if (ret != SQLITE_ROW)
+	    {
+		printf ("sqlite3_step() error: %s\n", sqlite3_errmsg (handle));
+		goto abort;
+	    }
+	  blob = sqlite3_column_blob (stmt, 1);
+	  size = sqlite3_column_bytes (stmt, 1);
+	  if (ctx.node_block == NULL)
+	    {
+		/* the first block is expected to be the Header */
+		if (!load_network_header
+		    (blob, size, gaiaEndianArch (), p_graph, NULL, &a_star,
+		     &a_star_coeff, &compact))
+		  {
+		      printf ("invalid NETWORK-DATA Header\n");
+		      goto abort;
+		  }
+		if (p_graph->n_nodes <= 0)
+		  {
+		      printf ("empty NETWORK-DATA table '%s': no Nodes\n",
+			      out_table);
+		      goto abort;
+		  }
+		p_graph->nodes = malloc (sizeof (struct node) * p_graph->n_nodes);
+		ctx.node_block = malloc (sizeof (int) * p_graph->n_nodes);
+		if (!(p_graph->nodes) || !(ctx.node_block))
+		  {
+		      printf ("ERROR: insufficient memory [Nodes]\n");
+		      goto abort;
+		  }
+		for (i = 0; i < p_graph->n_nodes; i++)
+		    ctx.node_block[i] = -1;
+		continue;
+	    }
+	  if (!load_network_block
+	      (p_graph, blob, size, gaiaEndianArch (), a_star, compact,
+	       ctx.n_blocks, ctx.node_block))
+	    {
+		printf ("invalid NETWORK-DATA block [Id=" FORMAT_64 "]\n",
+			sqlite3_column_int64 (stmt, 0));
+		goto abort;
+	    }
+	  ctx.n_blocks += 1;
+	  bytes += size;
+      }
+    sqlite3_finalize (stmt);
+    stmt = NULL;
+    if (ctx.node_block == NULL)
+      {
+	  printf ("empty NETWORK-DATA table '%s'\n", out_table);
+	  goto abort;
+      }
+    for (i = 0; i < p_graph->n_nodes; i++)
+      {
+	  if (ctx.node_block[i] < 0)
+	    {
+		printf ("incomplete NETWORK-DATA: missing Node #%d\n", i);
+		goto abort;
+	    }
+      }
+    if (!pack_arcs (p_graph))
+	goto abort;
+    printf ("%d Nodes, %d Arcs, %d blocks [" FORMAT_64 " bytes, %s encoding]\n",
+	    p_graph->n_nodes, p_graph->n_arcs, ctx.n_blocks, bytes,
+	    (compact == COMPACT_FLOAT) ? "compact float" : (compact ==
+							    COMPACT_LOSSLESS)
+	    ? "compact" : "plain");
+    if (!virt_table && compact != COMPACT_NONE)
+	printf ("VirtualNetwork doesn't support compact encoding; "
+		"only the in-process model will run\n");
+    else if (!virt_table)
+      {
+	  /* a temporary VirtualNetwork, dropped at the end */
+	  sqlite3_snprintf (sizeof (bench_virt), bench_virt, "%s_benchmark",
+			    out_table);
+	  sprintf (sql,
+		   "CREATE VIRTUAL TABLE temp.\"%s\" USING VirtualNetwork(\"%s\")",
+		   bench_virt, out_table);
+	  ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+	  if (ret != SQLITE_OK)
+	    {
+		printf ("VirtualNetwork unavailable [%s]; "
+			"only the in-process model will run\n", err_msg);
+		sqlite3_free (err_msg);
+	    }
+	  else
+	    {
+		virt_table = bench_virt;
+		temp_virt = 1;
+	    }
+      }
+    printf
+	("==================================================================\n");
+    fprintf (stderr, "Step  II - running the workload\n");
+    ctx.dist = malloc (sizeof (double) * p_graph->n_nodes);
+    ctx.stamp = calloc (p_graph->n_nodes, sizeof (int));
+    ctx.settled = calloc (p_graph->n_nodes, sizeof (int));
+    ctx.block_stamp = calloc (ctx.n_blocks + 1, sizeof (int));
+    pairs = malloc (sizeof (int) * 2 * n_queries);
+    costs = malloc (sizeof (double) * n_queries);
+    if (!(ctx.dist) || !(ctx.stamp) || !(ctx.settled) || !(ctx.block_stamp)
+	|| !pairs || !costs)
+      {
+	  printf ("ERROR: insufficient memory [benchmark]\n");
+	  goto abort;
+      }
+    if (!state)
+	state = 1;
+    for (i = 0; i < n_queries; i++)
+      {
+	  /* the seeded origin / destination pairs */
+	  pairs[i * 2] = bench_random (&state) % p_graph->n_nodes;
+	  pairs[(i * 2) + 1] = bench_random (&state) % p_graph->n_nodes;
+      }
+    if (!bench_replay (&ctx, pairs, n_queries, 0, 1.0, costs))
+	goto abort;
+    if (virt_table)
       {
-	  for (i = 1; i <= rows; i++)
-	      count = atoi (results[(i * columns) + 0]);
+	  if (!bench_virtual
+	      (handle, virt_table, p_graph, pairs, n_queries, 0, costs))
+	      goto abort;
       }
-    sqlite3_free_table (results);
-
-    if (count > 0)
-	return;
-
-/* all right, it's empty: proceding to initialize */
-    strcpy (sql, "SELECT InitSpatialMetadataFull(1)");
-    ret = sqlite3_exec (db, sql, NULL, NULL, &err_msg);
-    if (ret != SQLITE_OK)
+    if (a_star)
       {
-	  fprintf (stderr, "InitSpatialMetadataFull() error: %s\n", err_msg);
-	  sqlite3_free (err_msg);
-	  return;
+	  if (!bench_replay (&ctx, pairs, n_queries, 1, a_star_coeff, costs))
+	      goto abort;
+	  if (virt_table)
+	    {
+		if (!bench_virtual
+		    (handle, virt_table, p_graph, pairs, n_queries, 1, costs))
+		    goto abort;
+	    }
+      }
+    printf
+	("==================================================================\n");
+    fprintf (stderr, "OK: benchmark completed\n");
+  abort:
+    if (stmt)
+	sqlite3_finalize (stmt);
+    if (ctx.node_block)
+	free (ctx.node_block);
+    if (ctx.dist)
+	free (ctx.dist);
+    if (ctx.stamp)
+	free (ctx.stamp);
+    if (ctx.settled)
+	free (ctx.settled);
+    if (ctx.block_stamp)
+	free (ctx.block_stamp);
+    if (ctx.queue.items)
+	free (ctx.queue.items);
+    if (pairs)
+	free (pairs);
+    if (costs)
+	free (costs);
+    if (temp_virt)
+      {
+	  sprintf (sql, "DROP TABLE temp.\"%s\"", bench_virt);
+	  sqlite3_exec (handle, sql, NULL, NULL, NULL);
       }
+/* disconnecting the SpatiaLite DB */
+    ret = sqlite3_close (handle);
+    if (ret != SQLITE_OK)
+	fprintf (stderr, "sqlite3_close() error: %s\n",
+		 sqlite3_errmsg (handle));
+    spatialite_cleanup_ex (cache);
+    graph_free (p_graph);
 }
 
-static void
+static int
 validate (const char *path, const char *table, const char *from_column,
 	  const char *to_column, const char *cost_column,
 	  const char *geom_column, const char *name_column,
 	  const char *oneway_tofrom, const char *oneway_fromto,
 	  int bidirectional, const char *out_table, const char *virt_table,
-	  int force_creation, int a_star_supported)
+	  int force_creation, int a_star_supported,
+	  struct net_options *options)
 {
-/* performs all the actual network validation */
+/* performs all the actual network validation; 1 if NETWORK-DATA was built */
     int ret;
+    int built = 0;
     sqlite3 *handle;
     sqlite3_stmt *stmt;
     struct graph *p_graph = NULL;
@@ -1138,6 +5312,7 @@ validate (const char *path, const char *table, const char *from_column,
     char **results;
     int n_rows;
     int n_columns;
+    int auto_ids = 0;
     int i;
     char *err_msg = NULL;
     char *col_name;
@@ -1173,9 +5348,10 @@ validate (const char *path, const char *table, const char *from_column,
     int geom_null = 0;
     int geom_not_linestring = 0;
     int col_n;
-    int fromto_n;
-    int tofrom_n;
+    int fromto_n = 0;
+    int tofrom_n = 0;
     sqlite3_int64 rowid;
+    sqlite3_int64 last_seq = 0;
     sqlite3_int64 id_from;
     sqlite3_int64 id_to;
     char code_from[1024];
@@ -1187,14 +5363,15 @@ validate (const char *path, const char *table, const char *from_column,
     double cost;
     int fromto;
     int tofrom;
-    char xRowid[128];
-    char xIdFrom[128];
-    char xIdTo[128];
     int aStarLength;
     double a_star_length;
     double a_star_coeff;
     double min_a_star_coeff = DBL_MAX;
     void *cache;
+    int costs_n = 0;
+    int k;
+    double profile_costs[MAX_COST_PROFILES];
+    double profile_coeffs[MAX_COST_PROFILES];
 
 /* showing the SQLite version */
     fprintf (stderr, "SQLite version: %s\n", sqlite3_libversion ());
@@ -1209,7 +5386,7 @@ validate (const char *path, const char *table, const char *from_column,
 	  fprintf (stderr, "cannot open '%s': %s\n", path,
 		   sqlite3_errmsg (handle));
 	  sqlite3_close (handle);
-	  return;
+	  return 0;
       }
     cache = spatialite_alloc_connection ();
     spatialite_init_ex (handle, cache, 0);
@@ -1231,6 +5408,8 @@ validate (const char *path, const char *table, const char *from_column,
 	printf ("    Cost: GLength(%s)\n", geom_column);
     else
 	printf ("    Cost: %s\n", cost_column);
+    for (k = 0; k < options->n_costs; k++)
+	printf (" Profile: %s\n", options->cost_columns[k]);
     if (!name_column)
 	printf ("    Name: *unused*\n");
     else
@@ -1247,6 +5426,9 @@ validate (const char *path, const char *table, const char *from_column,
       }
     else
 	printf ("assuming arcs to be UNIDIRECTIONAL\n");
+    if (options->snap_tolerance > 0.0)
+	printf ("snapping end points within %1.6f\n",
+		options->snap_tolerance);
     if (out_table)
       {
 	  printf ("\nNETWORK-DATA table creation required: '%s'\n", out_table);
@@ -1285,6 +5467,16 @@ validate (const char *path, const char *table, const char *from_column,
       }
     else
 	sqlite3_free_table (results);
+    if (options->write_node_ids && !has_column (handle, table, from_column)
+	&& !has_column (handle, table, to_column))
+      {
+	  /* creating the missing Node columns by snapping */
+	  if (!assign_node_ids
+	      (handle, table, from_column, to_column, geom_column,
+	       options->snap_tolerance))
+	      goto abort;
+	  auto_ids = 1;
+      }
 /* checking for columns existence */
     sprintf (sql, "PRAGMA table_info(\"%s\")", table);
     ret =
@@ -1364,9 +5556,21 @@ validate (const char *path, const char *table, const char *from_column,
 	goto abort;
     if (oneway_fromto && !ok_oneway_fromto)
 	goto abort;
+    if (!check_cost_profiles (handle, table, options))
+	goto abort;
+    if (out_table && options->track_changes)
+      {
+	  /* changes made while scanning will be logged */
+	  if (!create_change_log (handle, table, out_table, &last_seq))
+	      goto abort;
+      }
     fprintf (stderr, "Step  II - checking value types consistency\n");
 /* checking column types */
     p_graph = graph_init ();
+    p_graph->n_costs = options->n_costs;
+    p_graph->snap_tolerance = auto_ids ? DBL_MAX : options->snap_tolerance;
+    for (k = 0; k < options->n_costs; k++)
+	profile_coeffs[k] = DBL_MAX;
     sprintf (sql, "SELECT \"%s\", \"%s\", GeometryType(\"%s\")",
 	     from_column, to_column, geom_column);
     col_n = 3;
@@ -1649,6 +5853,8 @@ validate (const char *path, const char *table, const char *from_column,
 	  goto abort;
       }
     init_nodes (p_graph);
+    if (p_graph->error)
+	goto abort;
     fprintf (stderr, "Step III - checking topological consistency\n");
 /* checking topological consistency */
     sprintf (sql,
@@ -1704,6 +5910,13 @@ validate (const char *path, const char *table, const char *from_column,
 	  fromto_n = col_n;
 	  col_n++;
       }
+    costs_n = col_n;
+    for (k = 0; k < options->n_costs; k++)
+      {
+	  sprintf (sql2, ", \"%s\"", options->cost_columns[k]);
+	  strcat (sql, sql2);
+	  col_n++;
+      }
     sprintf (sql2, " FROM \"%s\"", table);
     strcat (sql, sql2);
     ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &stmt, NULL);
@@ -1772,44 +5985,24 @@ validate (const char *path, const char *table, const char *from_column,
 		      /* fetching the OneWay-ToFrom value */
 		      tofrom = sqlite3_column_int (stmt, tofrom_n);
 		  }
-		sprintf (xRowid, FORMAT_64, rowid);
-		if (cost <= 0.0)
-		  {
-		      printf
-			  ("ERROR: arc ROWID=%s has NEGATIVE or NULL cost [%1.6f]\n",
-			   xRowid, cost);
-		      p_graph->error = 1;
-		  }
-		if (bidirectional)
+		fetch_cost_profiles (stmt, costs_n, p_graph, options,
+				     rowid, profile_costs);
+		if (a_star_supported)
 		  {
-		      if (!fromto && !tofrom)
+		      /* supporting A* - the alternative Costs as well */
+		      if (!aStarLength)
+			  a_star_length = cost;
+		      for (k = 0; k < options->n_costs; k++)
 			{
-			    if (p_graph->node_code)
-				printf
-				    ("WARNING: arc forbidden in both directions; ROWID=%s From=%s To=%s\n",
-				     xRowid, code_from, code_to);
-			    else
-			      {
-				  sprintf (xIdFrom, FORMAT_64, id_from);
-				  sprintf (xIdTo, FORMAT_64, id_to);
-				  printf
-				      ("WARNING: arc forbidden in both directions; ROWID=%s From=%s To=%s\n",
-				       xRowid, xIdFrom, xIdTo);
-			      }
+			    if (profile_costs[k] / a_star_length <
+				profile_coeffs[k])
+				profile_coeffs[k] =
+				    profile_costs[k] / a_star_length;
 			}
-		      if (fromto)
-			  add_arc (p_graph, rowid, id_from, id_to, code_from,
-				   code_to, node_from_x, node_from_y, node_to_x,
-				   node_to_y, cost);
-		      if (tofrom)
-			  add_arc (p_graph, rowid, id_to, id_from, code_to,
-				   code_from, node_to_x, node_to_y, node_from_x,
-				   node_from_y, cost);
 		  }
-		else
-		    add_arc (p_graph, rowid, id_from, id_to, code_from, code_to,
-			     node_from_x, node_from_y, node_to_x, node_to_y,
-			     cost);
+		load_arc (p_graph, bidirectional, rowid, id_from, id_to,
+			  code_from, code_to, node_from_x, node_from_y,
+			  node_to_x, node_to_y, cost, fromto, tofrom);
 		if (p_graph->error)
 		  {
 		      printf ("\n\nERROR: network failed validation\n");
@@ -1827,6 +6020,8 @@ validate (const char *path, const char *table, const char *from_column,
 	    }
       }
     sqlite3_finalize (stmt);
+    if (!pack_arcs (p_graph))
+	goto abort;
     fprintf (stderr, "Step  IV - final evaluation\n");
 /* final printout */
     if (p_graph->error)
@@ -1839,25 +6034,67 @@ validate (const char *path, const char *table, const char *from_column,
     else
       {
 	  print_report (p_graph);
+	  print_components_report (p_graph);
 	  printf ("\n\nOK: network passed validation\n");
 	  printf
 	      ("\tyou can apply this configuration to build a valid VirtualNetwork\n");
 	  fprintf (stderr, "OK: validation passed\n");
       }
+    if (!(p_graph->error) && options->write_components
+	&& p_graph->components)
+      {
+	  if (write_components (handle, out_table, p_graph))
+	      fprintf (stderr,
+		       "OK: table '%s_components' successfully created\n",
+		       out_table);
+	  else
+	      fprintf (stderr, "ERROR: table '%s_components' failure\n",
+		       out_table);
+      }
+    if (!(p_graph->error) && options->snapshot)
+      {
+	  if (write_snapshot (options->snapshot, p_graph, a_star_supported))
+	      fprintf (stderr, "OK: snapshot '%s' successfully created\n",
+		       options->snapshot);
+	  else
+	      fprintf (stderr, "ERROR: snapshot '%s' failure\n",
+		       options->snapshot);
+      }
     if (out_table)
       {
 	  ret =
 	      create_network_data (handle, out_table, force_creation, p_graph,
 				   table, from_column, to_column, geom_column,
 				   name_column, a_star_supported,
-				   min_a_star_coeff);
+				   min_a_star_coeff, NULL, options);
 	  if (ret)
 	    {
+		built = 1;
 		printf
 		    ("\n\nOK: NETWORK-DATA table '%s' successfully created\n",
 		     out_table);
 		fprintf (stderr, "OK: table '%s' successfully created\n",
 			 out_table);
+		if (options->track_changes)
+		  {
+		      if (!reset_change_log (handle, out_table, last_seq))
+			  fprintf (stderr, "ERROR: change log failure\n");
+		  }
+		if (options->ch_table)
+		  {
+		      if (create_ch_table
+			  (handle, options->ch_table, force_creation, p_graph))
+			  fprintf (stderr, "OK: table '%s' successfully created\n",
+				   options->ch_table);
+		      else
+			  fprintf (stderr, "ERROR: table '%s' failure\n",
+				   options->ch_table);
+		  }
+		create_cost_profiles (handle, out_table, virt_table,
+				      force_creation, p_graph, table,
+				      from_column, to_column, geom_column,
+				      name_column, a_star_supported,
+				      profile_coeffs, options);
 	    }
 	  else
 	    {
@@ -1886,18 +6123,23 @@ validate (const char *path, const char *table, const char *from_column,
 		 sqlite3_errmsg (handle));
     spatialite_cleanup_ex (cache);
     graph_free (p_graph);
+    return built;
 }
 
-static void
+static int
 validate_no_geom (const char *path, const char *table, const char *from_column,
 		  const char *to_column, const char *cost_column,
 		  const char *name_column, const char *oneway_tofrom,
 		  const char *oneway_fromto, int bidirectional,
 		  const char *out_table, const char *virt_table,
-		  int force_creation)
+		  int force_creation, struct net_options *options)
 {
-/* performs all the actual network validation - NO-GEOMETRY */
+/* 
+/ performs all the actual network validation - NO-GEOMETRY;
+/ 1 if NETWORK-DATA was built
+*/
     int ret;
+    int built = 0;
     sqlite3 *handle;
     sqlite3_stmt *stmt;
     struct graph *p_graph = NULL;
@@ -1941,6 +6183,7 @@ validate_no_geom (const char *path, const char *table, const char *from_column,
     int fromto_n;
     int tofrom_n;
     sqlite3_int64 rowid;
+    sqlite3_int64 last_seq = 0;
     sqlite3_int64 id_from;
     sqlite3_int64 id_to;
     char code_from[1024];
@@ -1952,6 +6195,9 @@ validate_no_geom (const char *path, const char *table, const char *from_column,
     char xIdFrom[128];
     char xIdTo[128];
     void *cache;
+    int costs_n;
+    int k;
+    double profile_costs[MAX_COST_PROFILES];
 
 /* showing the SQLite version */
     fprintf (stderr, "SQLite version: %s\n", sqlite3_libversion ());
@@ -1966,7 +6212,7 @@ validate_no_geom (const char *path, const char *table, const char *from_column,
 	  fprintf (stderr, "cannot open '%s': %s\n", path,
 		   sqlite3_errmsg (handle));
 	  sqlite3_close (handle);
-	  return;
+	  return 0;
       }
     cache = spatialite_alloc_connection ();
     spatialite_init_ex (handle, cache, 0);
@@ -1985,6 +6231,8 @@ validate_no_geom (const char *path, const char *table, const char *from_column,
     printf ("FromNode: %s\n", from_column);
     printf ("  ToNode: %s\n", to_column);
     printf ("    Cost: %s\n", cost_column);
+    for (k = 0; k < options->n_costs; k++)
+	printf (" Profile: %s\n", options->cost_columns[k]);
     if (!name_column)
 	printf ("    Name: *unused*\n");
     else
@@ -2113,9 +6361,18 @@ validate_no_geom (const char *path, const char *table, const char *from_column,
 	goto abort;
     if (oneway_fromto && !ok_oneway_fromto)
 	goto abort;
+    if (!check_cost_profiles (handle, table, options))
+	goto abort;
+    if (out_table && options->track_changes)
+      {
+	  /* changes made while scanning will be logged */
+	  if (!create_change_log (handle, table, out_table, &last_seq))
+	      goto abort;
+      }
     fprintf (stderr, "Step  II - checking value types consistency\n");
 /* checking column types */
     p_graph = graph_init ();
+    p_graph->n_costs = options->n_costs;
     sprintf (sql, "SELECT \"%s\", \"%s\", \"%s\"", from_column, to_column,
 	     cost_column);
     col_n = 3;
@@ -2363,6 +6620,8 @@ validate_no_geom (const char *path, const char *table, const char *from_column,
 	  goto abort;
       }
     init_nodes (p_graph);
+    if (p_graph->error)
+	goto abort;
     fprintf (stderr, "Step III - checking topological consistency\n");
 /* checking topological consistency */
     sprintf (sql,
@@ -2383,6 +6642,13 @@ validate_no_geom (const char *path, const char *table, const char *from_column,
 	  fromto_n = col_n;
 	  col_n++;
       }
+    costs_n = col_n;
+    for (k = 0; k < options->n_costs; k++)
+      {
+	  sprintf (sql2, ", \"%s\"", options->cost_columns[k]);
+	  strcat (sql, sql2);
+	  col_n++;
+      }
     sprintf (sql2, " FROM \"%s\"", table);
     strcat (sql, sql2);
     ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &stmt, NULL);
@@ -2435,6 +6701,8 @@ validate_no_geom (const char *path, const char *table, const char *from_column,
 		      /* fetching the OneWay-ToFrom value */
 		      tofrom = sqlite3_column_int (stmt, tofrom_n);
 		  }
+		fetch_cost_profiles (stmt, costs_n, p_graph, options, rowid,
+				     profile_costs);
 		sprintf (xRowid, FORMAT_64, rowid);
 		if (cost <= 0.0)
 		  {
@@ -2489,6 +6757,8 @@ validate_no_geom (const char *path, const char *table, const char *from_column,
 	    }
       }
     sqlite3_finalize (stmt);
+    if (!pack_arcs (p_graph))
+	goto abort;
     fprintf (stderr, "Step  IV - final evaluation\n");
 /* final printout */
     if (p_graph->error)
@@ -2501,24 +6771,65 @@ validate_no_geom (const char *path, const char *table, const char *from_column,
     else
       {
 	  print_report (p_graph);
+	  print_components_report (p_graph);
 	  printf ("\n\nOK: network passed validation\n");
 	  printf
 	      ("\tyou can apply this configuration to build a valid VirtualNetwork\n");
 	  fprintf (stderr, "OK: validation passed\n");
       }
+    if (!(p_graph->error) && options->write_components
+	&& p_graph->components)
+      {
+	  if (write_components (handle, out_table, p_graph))
+	      fprintf (stderr,
+		       "OK: table '%s_components' successfully created\n",
+		       out_table);
+	  else
+	      fprintf (stderr, "ERROR: table '%s_components' failure\n",
+		       out_table);
+      }
+    if (!(p_graph->error) && options->snapshot)
+      {
+	  if (write_snapshot (options->snapshot, p_graph, 0))
+	      fprintf (stderr, "OK: snapshot '%s' successfully created\n",
+		       options->snapshot);
+	  else
+	      fprintf (stderr, "ERROR: snapshot '%s' failure\n",
+		       options->snapshot);
+      }
     if (out_table)
       {
 	  ret =
 	      create_network_data (handle, out_table, force_creation, p_graph,
 				   table, from_column, to_column, NULL,
-				   name_column, 0, DBL_MAX);
+				   name_column, 0, DBL_MAX, NULL, options);
 	  if (ret)
 	    {
+		built = 1;
 		printf
 		    ("\n\nOK: NETWORK-DATA table '%s' successfully created\n",
 		     out_table);
 		fprintf (stderr, "OK: table '%s' successfully created\n",
 			 out_table);
+		if (options->track_changes)
+		  {
+		      if (!reset_change_log (handle, out_table, last_seq))
+			  fprintf (stderr, "ERROR: change log failure\n");
+		  }
+		if (options->ch_table)
+		  {
+		      if (create_ch_table
+			  (handle, options->ch_table, force_creation, p_graph))
+			  fprintf (stderr, "OK: table '%s' successfully created\n",
+				   options->ch_table);
+		      else
+			  fprintf (stderr, "ERROR: table '%s' failure\n",
+				   options->ch_table);
+		  }
+		create_cost_profiles (handle, out_table, virt_table,
+				      force_creation, p_graph, table,
+				      from_column, to_column, NULL,
+				      name_column, 0, NULL, options);
 		if (virt_table)
 		  {
 		      ret =
@@ -2549,6 +6860,7 @@ validate_no_geom (const char *path, const char *table, const char *from_column,
 		 sqlite3_errmsg (handle));
     spatialite_cleanup_ex (cache);
     graph_free (p_graph);
+    return built;
 }
 
 static void
@@ -2609,11 +6921,85 @@ do_help ()
     fprintf (stderr,
 	     "1 means that the arc connection in the given direction is\n");
     fprintf (stderr, "valid, otherwise 0 means a forbidden connection\n\n");
+    fprintf (stderr, "in order to tolerate near-coincident end points of\n");
+    fprintf (stderr, "the same Node you can select the following option;\n");
+    fprintf (stderr, "distinct Node IDs are never merged, however near:\n");
+    fprintf (stderr, "--snap-tolerance dist\n");
+    fprintf (stderr, "if the FromNode and ToNode columns don't exist yet\n");
+    fprintf (stderr, "they can be added to the input table and filled with\n");
+    fprintf (stderr, "automatic Node IDs, merging all end points within\n");
+    fprintf (stderr, "the snap tolerance [self-loops will be reported]:\n");
+    fprintf (stderr,
+	     "--write-node-ids                  [default: NodeFrom/NodeTo]\n\n");
+    fprintf (stderr, "in order to mark islands and one-way traps you can\n");
+    fprintf (stderr, "write the Component of each arc into a separate\n");
+    fprintf (stderr,
+	     "\"<output-table>_components\" (RowId, Component) table:\n");
+    fprintf (stderr, "--write-components                [0 = largest; NULL\n");
+    fprintf (stderr,
+	     "                                  if crossing Components]\n\n");
     fprintf (stderr, "in order to create a permanent NETWORK-DATA table\n");
     fprintf (stderr, "you can select the following options:\n");
     fprintf (stderr, "-o or --output-table table_name\n");
     fprintf (stderr, "-vt or --virtual-table table_name\n");
     fprintf (stderr, "--overwrite-output\n\n");
+    fprintf (stderr, "in order to create further NETWORK-DATA tables sharing\n");
+    fprintf (stderr, "the same graph but using alternative Costs [e.g. by\n");
+    fprintf (stderr, "vehicle type or by time bucket] you can repeat:\n");
+    fprintf (stderr, "--cost-profile col_name           creates\n");
+    fprintf (stderr,
+	     "                                  <output-table>_profile_<col>\n");
+    fprintf (stderr,
+	     "                                  [and <virtual-table>_profile_<col>]\n");
+    fprintf (stderr,
+	     "                                  Arcs keep the primary Cost order\n\n");
+    fprintf (stderr, "in order to keep NETWORK-DATA in sync with later\n");
+    fprintf (stderr, "changes you can select the following options:\n");
+    fprintf (stderr,
+	     "--track-changes                   records changed Arcs into\n");
+    fprintf (stderr,
+	     "                                  a trigger-fed change log\n");
+    fprintf (stderr,
+	     "--incremental                     only applies the change log,\n");
+    fprintf (stderr,
+	     "                                  rewriting the affected blocks\n\n");
+    fprintf (stderr, "in order to write a binary graph snapshot file\n");
+    fprintf (stderr, "[CSR arrays, directly mmap-able] you can select:\n");
+    fprintf (stderr, "--snapshot pathname\n\n");
+    fprintf (stderr, "in order to precompute a Contraction Hierarchy\n");
+    fprintf (stderr, "[Node levels and shortcuts] you can select:\n");
+    fprintf (stderr, "--ch-table table_name\n\n");
+    fprintf (stderr, "in order to speed up the NETWORK-DATA creation\n");
+    fprintf (stderr, "you can select the following option as well:\n");
+    fprintf (stderr,
+	     "--threads num                     blocks encoding threads\n");
+    fprintf (stderr,
+	     "                                  [default: 1]\n\n");
+    fprintf (stderr, "in order to tune the NETWORK-DATA blocks you can\n");
+    fprintf (stderr, "select the following options as well:\n");
+    fprintf (stderr,
+	     "--block-size bytes                [default: 1048576]\n");
+    fprintf (stderr,
+	     "--compact-encoding {lossless|float} varint deltas; float\n");
+    fprintf (stderr,
+	     "                                  also stores 32-bit Costs\n");
+    fprintf (stderr,
+	     "                                  [not for VirtualNetwork]\n\n");
+    fprintf (stderr, "in order to store neighbouring Nodes into the same\n");
+    fprintf (stderr, "NETWORK-DATA blocks you can select:\n");
+    fprintf (stderr,
+	     "--node-order {id|hilbert|bfs}     [default: id]\n\n");
+    fprintf (stderr, "in order to measure the routing performance through\n");
+    fprintf (stderr, "VirtualNetwork [-vt, or a temporary one] you can\n");
+    fprintf (stderr, "select the following options; an in-process model\n");
+    fprintf (stderr, "of the search also reports expanded Nodes and blocks;\n");
+    fprintf (stderr, "-d and -o alone will benchmark an existing table:\n");
+    fprintf (stderr,
+	     "--benchmark num_queries           random origin/destination\n");
+    fprintf (stderr,
+	     "                                  pairs, Dijkstra and A*\n");
+    fprintf (stderr,
+	     "--seed num                        [default: 1]\n\n");
 }
 
 int
@@ -2621,6 +7007,7 @@ main (int argc, char *argv[])
 {
 /* the MAIN function simply perform arguments checking */
     int i;
+    int ret;
     int next_arg = ARG_NONE;
     char *path = NULL;
     char *table = NULL;
@@ -2637,6 +7024,24 @@ main (int argc, char *argv[])
     int force_creation = 0;
     int error = 0;
     int a_star_supported = 1;
+    int benchmark = 0;
+    int built = 0;
+    unsigned int seed = 1;
+    char profile_table[1024];
+    char ch_nodes[1024];
+    struct net_options options;
+    options.threads = 1;
+    options.ch_table = NULL;
+    options.node_order = NODE_ORDER_ID;
+    options.track_changes = 0;
+    options.write_components = 0;
+    options.write_node_ids = 0;
+    options.snapshot = NULL;
+    options.incremental = 0;
+    options.n_costs = 0;
+    options.block_size = MAX_BLOCK;
+    options.compact = COMPACT_NONE;
+    options.snap_tolerance = 0.0;
     for (i = 1; i < argc; i++)
       {
 	  /* parsing the invocation arguments */
@@ -2677,6 +7082,64 @@ main (int argc, char *argv[])
 		  case ARG_ONEWAY_FROMTO:
 		      oneway_fromto = argv[i];
 		      break;
+		  case ARG_THREADS:
+		      options.threads = atoi (argv[i]);
+		      break;
+		  case ARG_CH_TABLE:
+		      options.ch_table = argv[i];
+		      break;
+		  case ARG_SNAPSHOT:
+		      options.snapshot = argv[i];
+		      break;
+		  case ARG_BLOCK_SIZE:
+		      options.block_size = atoi (argv[i]);
+		      break;
+		  case ARG_SNAP_TOLERANCE:
+		      options.snap_tolerance = atof (argv[i]);
+		      break;
+		  case ARG_COMPACT:
+		      if (strcasecmp (argv[i], "lossless") == 0)
+			  options.compact = COMPACT_LOSSLESS;
+		      else if (strcasecmp (argv[i], "float") == 0)
+			  options.compact = COMPACT_FLOAT;
+		      else
+			{
+			    fprintf (stderr, "unknown --compact-encoding: %s\n",
+				     argv[i]);
+			    error = 1;
+			}
+		      break;
+		  case ARG_BENCHMARK:
+		      benchmark = atoi (argv[i]);
+		      break;
+		  case ARG_SEED:
+		      seed = (unsigned int) strtoul (argv[i], NULL, 10);
+		      break;
+		  case ARG_COST_PROFILE:
+		      if (options.n_costs < MAX_COST_PROFILES)
+			  options.cost_columns[options.n_costs++] = argv[i];
+		      else
+			{
+			    fprintf (stderr,
+				     "too many --cost-profile [max %d]\n",
+				     MAX_COST_PROFILES);
+			    error = 1;
+			}
+		      break;
+		  case ARG_NODE_ORDER:
+		      if (strcasecmp (argv[i], "id") == 0)
+			  options.node_order = NODE_ORDER_ID;
+		      else if (strcasecmp (argv[i], "hilbert") == 0)
+			  options.node_order = NODE_ORDER_HILBERT;
+		      else if (strcasecmp (argv[i], "bfs") == 0)
+			  options.node_order = NODE_ORDER_BFS;
+		      else
+			{
+			    fprintf (stderr, "unknown --node-order: %s\n",
+				     argv[i]);
+			    error = 1;
+			}
+		      break;
 		  };
 		next_arg = ARG_NONE;
 		continue;
@@ -2793,6 +7256,76 @@ main (int argc, char *argv[])
 		next_arg = ARG_ONEWAY_FROMTO;
 		continue;
 	    }
+	  if (strcasecmp (argv[i], "--threads") == 0)
+	    {
+		next_arg = ARG_THREADS;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--track-changes") == 0)
+	    {
+		options.track_changes = 1;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--incremental") == 0)
+	    {
+		options.incremental = 1;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--snapshot") == 0)
+	    {
+		next_arg = ARG_SNAPSHOT;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--snap-tolerance") == 0)
+	    {
+		next_arg = ARG_SNAP_TOLERANCE;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--block-size") == 0)
+	    {
+		next_arg = ARG_BLOCK_SIZE;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--compact-encoding") == 0)
+	    {
+		next_arg = ARG_COMPACT;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--benchmark") == 0)
+	    {
+		next_arg = ARG_BENCHMARK;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--seed") == 0)
+	    {
+		next_arg = ARG_SEED;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--cost-profile") == 0)
+	    {
+		next_arg = ARG_COST_PROFILE;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--write-components") == 0)
+	    {
+		options.write_components = 1;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--write-node-ids") == 0)
+	    {
+		options.write_node_ids = 1;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--ch-table") == 0)
+	    {
+		next_arg = ARG_CH_TABLE;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--node-order") == 0)
+	    {
+		next_arg = ARG_NODE_ORDER;
+		continue;
+	    }
 	  if (strcasecmp (argv[i], "--bidirectional") == 0)
 	    {
 		bidirectional = 1;
@@ -2826,7 +7359,29 @@ main (int argc, char *argv[])
 	  do_help ();
 	  return -1;
       }
+    if (benchmark > 0 && !table)
+      {
+	  /* only benchmarking an already existing NETWORK-DATA table */
+	  if (!path || !out_table)
+	    {
+		fprintf (stderr,
+			 "using --benchmark requires --db-path and --output-table\n");
+		do_help ();
+		return -1;
+	    }
+	  benchmark_network (path, out_table, virt_table, benchmark, seed);
+	  spatialite_shutdown ();
+	  return 0;
+      }
 /* checking the arguments */
+    if (options.write_node_ids)
+      {
+	  /* missing Node columns are going to be created */
+	  if (!from_column)
+	      from_column = "NodeFrom";
+	  if (!to_column)
+	      to_column = "NodeTo";
+      }
     if (!path)
       {
 	  fprintf (stderr, "did you forget setting the --db-path argument ?\n");
@@ -2876,6 +7431,71 @@ main (int argc, char *argv[])
 		error = 1;
 	    }
       }
+    if ((options.track_changes || options.incremental) && !out_table)
+      {
+	  fprintf (stderr,
+		   "using --track-changes or --incremental requires --output-table as well\n");
+	  error = 1;
+      }
+    if (options.ch_table && !out_table)
+      {
+	  fprintf (stderr, "using --ch-table requires --output-table as well\n");
+	  error = 1;
+      }
+    if (options.write_components && !out_table)
+      {
+	  fprintf (stderr,
+		   "using --write-components requires --output-table as well\n");
+	  error = 1;
+      }
+    for (i = 0; out_table && options.ch_table && i < options.n_costs; i++)
+      {
+	  /* a Cost profile table must not replace a CH table */
+	  sprintf (profile_table, "%s_profile_%s", out_table,
+		   options.cost_columns[i]);
+	  sprintf (ch_nodes, "%s_nodes", options.ch_table);
+	  if (strcasecmp (profile_table, options.ch_table) == 0
+	      || strcasecmp (profile_table, ch_nodes) == 0)
+	    {
+		fprintf (stderr,
+			 "--cost-profile %s conflicts with --ch-table %s\n",
+			 options.cost_columns[i], options.ch_table);
+		error = 1;
+	    }
+      }
+    if (options.block_size < 1024 || options.block_size > 64 * MAX_BLOCK)
+      {
+	  fprintf (stderr, "--block-size must be between 1024 and %d\n",
+		   64 * MAX_BLOCK);
+	  error = 1;
+      }
+    if (options.compact && virt_table)
+      {
+	  fprintf (stderr,
+		   "VirtualNetwork doesn't support --compact-encoding\n");
+	  error = 1;
+      }
+    if (options.snap_tolerance < 0.0)
+      {
+	  fprintf (stderr, "--snap-tolerance cannot be negative\n");
+	  error = 1;
+      }
+    if (options.write_node_ids && options.snap_tolerance <= 0.0)
+      {
+	  fprintf (stderr,
+		   "using --write-node-ids requires --snap-tolerance\n");
+	  error = 1;
+      }
+    if (options.threads < 1)
+	options.threads = 1;
+#ifndef NET_THREADS
+    if (options.threads > 1)
+      {
+	  fprintf (stderr,
+		   "WARNING: --threads is not supported on this platform\n");
+	  options.threads = 1;
+      }
+#endif
     if (error)
       {
 	  do_help ();
@@ -2896,15 +7516,51 @@ main (int argc, char *argv[])
 			 "NO-GEOMETRY strictly requires to specify some --cost-column argument\n");
 		return -1;
 	    }
+	  if (options.node_order == NODE_ORDER_HILBERT)
+	    {
+		fprintf (stderr,
+			 "--node-order hilbert strictly requires some Geometry\n");
+		return -1;
+	    }
+	  if (options.snap_tolerance > 0.0)
+	    {
+		fprintf (stderr,
+			 "--snap-tolerance strictly requires some Geometry\n");
+		return -1;
+	    }
+      }
+    if (options.incremental)
+      {
+	  ret =
+	      update_network (path, table, from_column, to_column, cost_column,
+			      geom_column, name_column, oneway_tofrom,
+			      oneway_fromto, bidirectional, out_table,
+			      a_star_supported, &options);
+	  if (ret >= 0)
+	    {
+		spatialite_shutdown ();
+		return 0;
+	    }
+	  /* falling back to a full rebuild */
+	  fprintf (stderr,
+		   "WARNING: incremental update not possible; full rebuild required\n");
+	  options.track_changes = 1;
+	  force_creation = 1;
       }
     if (geom_column == NULL)
-	validate_no_geom (path, table, from_column, to_column, cost_column,
-			  name_column, oneway_tofrom, oneway_fromto,
-			  bidirectional, out_table, virt_table, force_creation);
+	built =
+	    validate_no_geom (path, table, from_column, to_column, cost_column,
+			      name_column, oneway_tofrom, oneway_fromto,
+			      bidirectional, out_table, virt_table,
+			      force_creation, &options);
     else
-	validate (path, table, from_column, to_column, cost_column, geom_column,
-		  name_column, oneway_tofrom, oneway_fromto, bidirectional,
-		  out_table, virt_table, force_creation, a_star_supported);
+	built =
+	    validate (path, table, from_column, to_column, cost_column,
+		      geom_column, name_column, oneway_tofrom, oneway_fromto,
+		      bidirectional, out_table, virt_table, force_creation,
+		      a_star_supported, &options);
+    if (benchmark > 0 && built)
+	benchmark_network (path, out_table, virt_table, benchmark, seed);
     spatialite_shutdown ();
     return 0;
 }
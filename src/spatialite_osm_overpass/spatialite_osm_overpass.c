@@ -28,6 +28,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <float.h>
+#include <limits.h>
+#include <time.h>
+
+#if !defined(_WIN32) || defined(__MINGW32__)
+/* POSIX threads are available */
+#include <pthread.h>
+#define OSM_THREADS
+#endif
 
 #if defined(_WIN32) && !defined(__MINGW32__)
 #include "config-msvc.h"
@@ -38,8 +46,14 @@
 #ifdef ENABLE_LIBXML2		/* only if LIBXML2 is enabled */
 
 #include <libxml/parser.h>
+#include <libxml/xmlreader.h>
+#include <libxml/uri.h>
 #include <libxml/nanohttp.h>
 
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
 #include <sqlite3.h>
 #include <spatialite/gaiageo.h>
 #include <spatialite.h>
@@ -53,6 +67,10 @@
 #define ARG_DB_PATH		6
 #define ARG_MODE		7
 #define ARG_CACHE_SIZE	8
+#define ARG_JOBS		9
+#define ARG_TILE_CACHE	10
+#define ARG_OSM_FILE	11
+#define ARG_STATS		12
 
 #define MODE_RAW	1
 #define MODE_MAP	2
@@ -63,6 +81,15 @@
 #define OBJ_WAYS		2
 #define OBJ_RELATIONS	3
 
+#define PBF_UNKNOWN	0
+#define PBF_HEADER	1
+#define PBF_DATA	2
+
+#define OSM_BATCH_LEVELS	8
+#define OSM_BATCH	(1 << (OSM_BATCH_LEVELS - 1))	/* 128 rows, max 7 columns */
+
+#define MAP_CHUNK	1024	/* MAP features built by each worker at once */
+
 #if defined(_WIN32)
 #define atol_64		_atoi64
 #else
@@ -82,76 +109,78 @@ struct layers
     sqlite3_stmt *ins_polygon_stmt;
     sqlite3_stmt *ins_multi_linestring_stmt;
     sqlite3_stmt *ins_multi_polygon_stmt;
+    int features;		/* statistics: inserted features */
+    double seconds;		/* statistics: build and insert time */
 } base_layers[] =
 {
     {
-    "highway", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "highway", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "junction", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "junction", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "traffic_calming", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "traffic_calming", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "traffic_sign", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "traffic_sign", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "service", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "service", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "barrier", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "barrier", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "cycleway", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "cycleway", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "tracktype", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "tracktype", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "waterway", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "waterway", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "railway", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "railway", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "aeroway", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "aeroway", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "aerialway", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "aerialway", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "power", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "power", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "man_made", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "man_made", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "leisure", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "leisure", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "amenity", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "amenity", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "shop", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "shop", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "tourism", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "tourism", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "historic", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "historic", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "landuse", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "landuse", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "military", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "military", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "natural", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "natural", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "geological", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "geological", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "route", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "route", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "boundary", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "boundary", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "sport", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "sport", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "abutters", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "abutters", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "accessories", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "accessories", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "properties", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "properties", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "restrictions", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "restrictions", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "place", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "place", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "building", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "building", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-    "parking", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},
+    "parking", 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},
     {
-NULL, 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL},};
+NULL, 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0.0},};
 
 struct download_tile
 {
@@ -172,6 +201,360 @@ struct tiled_download
     struct download_tile *last;
 };
 
+struct download_job
+{
+/* a single Overpass request: one tile and one kind of objects */
+    struct download_tile *tile;
+    int object;
+    char *payload;		/* the downloaded XML payload */
+    int payload_size;
+    int cached;			/* loaded from the local tile cache */
+    double seconds;		/* time spent downloading */
+    int ready;
+};
+
+struct download_queue
+{
+/*
+/ all the Overpass requests in the expected order;
+/ download threads fetch and parse the XML payloads,
+/ while a single writer inserts them into the DBMS
+*/
+    struct aux_params *params;
+    struct download_job *jobs;
+    int count;
+    FILE *journal;		/* the progress journal [tile cache only] */
+    char *journal_path;
+    unsigned char *completed;	/* requests already recorded by the journal */
+#ifdef OSM_THREADS
+    int next_job;		/* the next job to be downloaded */
+    int written;		/* how many jobs have already been inserted */
+    int window;			/* max number of parsed payloads waiting to be inserted */
+    int abort;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
+};
+
+struct pbf_buffer
+{
+/* a protobuf message (or a packed array) being decoded */
+    const unsigned char *p;
+    const unsigned char *end;
+    int error;
+};
+
+struct pbf_node
+{
+/* a decoded PBF Node */
+    sqlite3_int64 id;
+    double x;
+    double y;
+    int version;
+    sqlite3_int64 timestamp;	/* seconds since the epoch, or -1 */
+    int uid;
+    sqlite3_int64 changeset;
+    int user_sid;
+    int first_tag;
+    int n_tags;
+};
+
+struct pbf_way
+{
+/* a decoded PBF Way */
+    sqlite3_int64 id;
+    int first_tag;
+    int n_tags;
+    int first_ref;
+    int n_refs;
+};
+
+struct pbf_relation
+{
+/* a decoded PBF Relation */
+    sqlite3_int64 id;
+    int first_tag;
+    int n_tags;
+    int first_member;
+    int n_members;
+};
+
+struct pbf_tag
+{
+/* a key/value pair, as indices into the string table */
+    int k;
+    int v;
+};
+
+struct pbf_member
+{
+/* a decoded Relation member */
+    sqlite3_int64 ref;
+    int type;			/* 0=node, 1=way, 2=relation */
+    int role;
+};
+
+struct pbf_batch
+{
+/*
+/ a decoded PBF PrimitiveBlock; tags and roles are indices
+/ into its own string table of NUL-terminated strings
+*/
+    char **strings;
+    char *string_data;
+    int n_strings;
+    sqlite3_int64 granularity;
+    sqlite3_int64 date_granularity;
+    sqlite3_int64 lat_offset;
+    sqlite3_int64 lon_offset;
+    struct pbf_node *nodes;
+    int n_nodes;
+    int max_nodes;
+    struct pbf_way *ways;
+    int n_ways;
+    int max_ways;
+    struct pbf_relation *relations;
+    int n_relations;
+    int max_relations;
+    struct pbf_tag *tags;
+    int n_tags;
+    int max_tags;
+    sqlite3_int64 *refs;
+    int n_refs;
+    int max_refs;
+    struct pbf_member *members;
+    int n_members;
+    int max_members;
+};
+
+struct pbf_block
+{
+/* a PBF fileblock: first read from the file, then decoded */
+    int type;
+    unsigned char *blob;
+    int blob_size;
+    struct pbf_batch batch;
+    int ok;
+    double seconds;		/* time spent decoding */
+    int ready;
+};
+
+struct pbf_queue
+{
+/*
+/ the fileblocks of a PBF file in their natural order; worker
+/ threads read, decompress and decode them, while a single
+/ writer inserts them into the DBMS
+*/
+    FILE *in;
+    struct pbf_block *blocks;	/* a ring buffer of 2 * jobs blocks */
+    int window;
+    int count;			/* how many fileblocks have been read so far */
+    int eof;
+    int error;
+#ifdef OSM_THREADS
+    int written;		/* how many blocks have already been inserted */
+    int abort;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
+};
+
+struct node_coord
+{
+/* the location of an OSM Node */
+    sqlite3_int64 node_id;
+    double x;
+    double y;
+};
+
+struct node_coord_cache
+{
+/*
+/ all Node locations inserted so far; kept in memory so that
+/ Way geometries can be built without querying osm_nodes; each
+/ Node takes 24 bytes and Nodes are referenced by an int index,
+/ so at most INT_MAX locations can be cached [a continent-sized
+/ .osm.pbf extract needs more and is rejected by MAP/ROAD/RAIL]
+*/
+    struct node_coord *items;
+    size_t count;
+    size_t max;
+    int sorted;
+    int failed;			/* unable to grow any further */
+};
+
+struct seen_ids
+{
+/*
+/ a sparse bitmap of the OSM IDs already inserted: a hash table
+/ of 64-bit blocks, each one covering 64 consecutive IDs
+*/
+    sqlite3_int64 *keys;
+    sqlite3_uint64 *bits;
+    unsigned char *used;
+    unsigned int size;		/* always a power of 2 */
+    unsigned int count;
+    int duplicates;
+};
+
+struct way_refs_cache
+{
+/*
+/ all Way-Node refs sorted by Way ID and sequence; used for
+/ detecting junctions and splitting Road/Rail arcs in memory
+*/
+    sqlite3_int64 *way_ids;
+    int *node_idx;		/* index into the Node locations cache, or -1 */
+    int count;
+    int max;
+    int *way_count;		/* how many refs point to each cached Node */
+    unsigned char *inserted;	/* Nodes already inserted into the graph */
+};
+
+struct rel_members_cache
+{
+/* all Relation-Way members sorted by Relation ID and sequence */
+    sqlite3_int64 *rel_ids;
+    sqlite3_int64 *way_ids;
+    int count;
+    int max;
+};
+
+struct mp_segment
+{
+/* a member Way of some multipolygon, as a range of Way-Node refs */
+    int first;
+    int count;
+    int used;
+};
+
+struct mp_ring
+{
+/* a closed ring assembled by chaining one or more member Ways */
+    int first;			/* position of the first vertex */
+    int count;
+    double minx;
+    double miny;
+    double maxx;
+    double maxy;
+    double area;
+    int parent;			/* the smallest enclosing ring, or -1 */
+    int depth;
+    int n_interiors;
+};
+
+struct map_feature
+{
+/* a MAP feature: fetched by the writer, then built by a worker */
+    sqlite3_int64 id;
+    char *layer;
+    char *type;
+    char *name;
+    int polygon;
+    int geom_type;		/* GAIA_UNKNOWN if unresolved */
+    unsigned char *blob;
+    int blob_size;
+    double seconds;		/* time spent building */
+};
+
+struct map_chunk
+{
+/* a chunk of consecutive MAP features */
+    struct map_feature *features;	/* MAP_CHUNK items */
+    int count;
+    int ready;
+};
+
+struct map_queue
+{
+/*
+/ the MAP features of Ways or Relations in their query order; the
+/ writer fetches them in chunks, worker threads build the Geometry
+/ BLOBs from the in-memory caches, and the writer inserts them
+*/
+    sqlite3_stmt *stmt;
+    int relations;
+    struct node_coord_cache *coords;
+    struct way_refs_cache *refs;
+    struct rel_members_cache *members;
+    int *linestrings;
+    int *polygons;
+    int *multi_linestrings;
+    int *multi_polygons;
+    struct map_chunk *chunks;	/* a ring buffer of 2 * jobs chunks */
+    int window;
+    int count;			/* how many chunks have been fetched so far */
+    int eof;
+#ifdef OSM_THREADS
+    int next;			/* the next chunk to be built */
+    int written;		/* how many chunks have already been inserted */
+    int abort;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
+};
+
+struct batch_value
+{
+/* a buffered column value */
+    int type;			/* SQLITE_INTEGER, SQLITE_TEXT, SQLITE_BLOB or SQLITE_NULL */
+    sqlite3_int64 int_value;
+    int offset;			/* TEXT or BLOB: offset into the batch arena */
+    int size;
+};
+
+struct insert_batch
+{
+/*
+/ the rows buffered for a single raw table; they are inserted
+/ by a single multi-row INSERT as soon as OSM_BATCH rows are ready
+*/
+    sqlite3_stmt *stmts[OSM_BATCH_LEVELS];	/* INSERTing 1, 2, 4 ... OSM_BATCH rows */
+    int columns;
+    int rows;
+    struct batch_value *values;	/* rows * columns values */
+    char *arena;		/* TEXT and BLOB values, reused by each batch */
+    int arena_size;
+    int arena_max;
+    double *coords;		/* osm_nodes [not RAW]: the Node locations */
+    int *counter;		/* the inserted rows statistic */
+    struct insert_batch *parent;	/* always flushed before [FOREIGN KEY] */
+    const char *what;		/* ROAD/RAIL: reporting any failed row */
+};
+
+struct osm_stats
+{
+/*
+/ per-stage timings and throughput counters [--stats]; download
+/ and parse times are summed over all worker threads
+*/
+    int requests;
+    sqlite3_int64 download_bytes;
+    double download_seconds;
+    sqlite3_int64 parse_elements;
+    double parse_seconds;
+    double insert_seconds;
+    double load_seconds;
+    double commit_seconds;
+    double index_seconds;
+    double populate_seconds;
+    double rtree_seconds;
+    double cleanup_seconds;
+    double export_seconds;
+    double total_seconds;
+    int graph_nodes;
+    int graph_arcs;
+    double graph_insert_seconds;
+};
+
+struct osm_http_stream
+{
+/* an Overpass response streamed straight into the XML reader */
+    void *ctxt;
+    struct osm_stats *stats;
+};
+
 struct aux_params
 {
 /* an auxiliary struct used for XML parsing */
@@ -185,6 +568,14 @@ struct aux_params
     sqlite3_stmt *ins_relations_stmt;
     sqlite3_stmt *ins_relation_tags_stmt;
     sqlite3_stmt *ins_relation_refs_stmt;
+    struct insert_batch nodes_batch;
+    struct insert_batch node_tags_batch;
+    struct insert_batch ways_batch;
+    struct insert_batch way_tags_batch;
+    struct insert_batch way_refs_batch;
+    struct insert_batch relations_batch;
+    struct insert_batch relation_tags_batch;
+    struct insert_batch relation_refs_batch;
     int wr_nodes;
     int wr_node_tags;
     int wr_ways;
@@ -194,6 +585,8 @@ struct aux_params
     int wr_rel_tags;
     int wr_rel_refs;
     const char *osm_url;
+    const char *tile_cache_dir;
+    int cached_tiles;
     int mode;
     sqlite3_int64 current_node_id;
     int current_node_tag_sub;
@@ -203,6 +596,14 @@ struct aux_params
     sqlite3_int64 current_rel_id;
     int current_rel_tag_sub;
     int current_rel_ref_sub;
+    struct node_coord_cache node_coords;
+    struct seen_ids seen_nodes;
+    struct seen_ids seen_ways;
+    struct seen_ids seen_relations;
+    const char *filter_key;	/* local files, ROAD/RAIL: the relevant Ways' tag */
+    int collecting;		/* local files: first pass, collecting the wanted Nodes */
+    struct seen_ids wanted_nodes;
+    struct osm_stats stats;
 };
 
 struct aux_arc
@@ -210,8 +611,8 @@ struct aux_arc
 /* an helper struct used to build Road/Rail arcs */
     sqlite3_int64 node_from;
     sqlite3_int64 node_to;
-    gaiaGeomCollPtr geom_from;
-    gaiaGeomCollPtr geom_to;
+    int idx_from;		/* index into the Node locations cache */
+    int idx_to;
     gaiaGeomCollPtr geom;
     struct aux_arc *next;
 };
@@ -223,6 +624,19 @@ struct aux_arc_container
     struct aux_arc *last;
 };
 
+static double
+osm_clock (void)
+{
+/* a monotonic wall-clock time, in seconds */
+#if defined(_WIN32)
+    return (double) clock () / CLOCKS_PER_SEC;
+#else
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + ((double) ts.tv_nsec / 1000000000.0);
+#endif
+}
+
 static void
 finalize_map_stmts ()
 {
@@ -283,252 +697,735 @@ downloader_cleanup (struct tiled_download *obj)
       }
 }
 
-static int
-insert_node_tag (struct aux_params *params, const char *k, const char *v)
+static void
+node_coords_cleanup (struct node_coord_cache *cache)
 {
-/* inserting a raw <node><tag> into the DBMS */
-    int ret;
-    sqlite3_reset (params->ins_node_tags_stmt);
-    sqlite3_clear_bindings (params->ins_node_tags_stmt);
-    sqlite3_bind_int64 (params->ins_node_tags_stmt, 1, params->current_node_id);
-    sqlite3_bind_int (params->ins_node_tags_stmt, 2,
-		      params->current_node_tag_sub);
-    sqlite3_bind_text (params->ins_node_tags_stmt, 3, k, strlen (k),
-		       SQLITE_STATIC);
-    sqlite3_bind_text (params->ins_node_tags_stmt, 4, v, strlen (v),
-		       SQLITE_STATIC);
-    ret = sqlite3_step (params->ins_node_tags_stmt);
-    if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-	params->wr_node_tags += 1;
-    params->current_node_tag_sub += 1;
-    return 1;
+/* freeing the Node locations cache */
+    if (cache->items != NULL)
+	free (cache->items);
+    cache->items = NULL;
+    cache->count = 0;
+    cache->max = 0;
+    cache->sorted = 1;
+    cache->failed = 0;
 }
 
 static int
-insert_way_ref (struct aux_params *params, sqlite3_int64 node_id)
+add_node_coord (struct node_coord_cache *cache, sqlite3_int64 id, double x,
+		double y)
 {
-/* inserting a raw <way><nd> into the DBMS */
-    int ret;
-    sqlite3_reset (params->ins_way_refs_stmt);
-    sqlite3_clear_bindings (params->ins_way_refs_stmt);
-    sqlite3_bind_int64 (params->ins_way_refs_stmt, 1, params->current_way_id);
-    sqlite3_bind_int (params->ins_way_refs_stmt, 2,
-		      params->current_way_ref_sub);
-    sqlite3_bind_int64 (params->ins_way_refs_stmt, 3, node_id);
-    ret = sqlite3_step (params->ins_way_refs_stmt);
-    if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-	params->wr_way_refs += 1;
-    params->current_way_ref_sub += 1;
+/* caching the location of a further Node; 0 if it can't be cached */
+    struct node_coord *item;
+    if (cache->failed)
+	return 0;
+    if (cache->count == cache->max)
+      {
+	  struct node_coord *items;
+	  size_t limit = INT_MAX;
+	  size_t max = (cache->max == 0) ? 65536 : cache->max * 2;
+	  if (limit > ((size_t) -1) / sizeof (struct node_coord))
+	      limit = ((size_t) -1) / sizeof (struct node_coord);
+	  if (max > limit)
+	      max = limit;
+	  if (cache->count >= max)
+	    {
+		fprintf (stderr,
+			 "ERROR: too many Nodes; no more than %lu Node locations can be cached\n",
+			 (unsigned long) limit);
+		cache->failed = 1;
+		return 0;
+	    }
+	  items = realloc (cache->items, sizeof (struct node_coord) * max);
+	  if (items == NULL)
+	    {
+		fprintf (stderr,
+			 "ERROR: insufficient memory for caching %lu Node locations\n",
+			 (unsigned long) max);
+		cache->failed = 1;
+		return 0;
+	    }
+	  cache->items = items;
+	  cache->max = max;
+      }
+    if (cache->count > 0 && cache->items[cache->count - 1].node_id > id)
+	cache->sorted = 0;
+    item = cache->items + cache->count;
+    item->node_id = id;
+    item->x = x;
+    item->y = y;
+    cache->count += 1;
     return 1;
 }
 
 static int
-insert_way_tag (struct aux_params *params, const char *k, const char *v)
+cmp_node_coords (const void *p1, const void *p2)
 {
-/* inserting a raw <way><tag> into the DBMS */
-    int ret;
-    sqlite3_reset (params->ins_way_tags_stmt);
-    sqlite3_clear_bindings (params->ins_way_tags_stmt);
-    sqlite3_bind_int64 (params->ins_way_tags_stmt, 1, params->current_way_id);
-    sqlite3_bind_int (params->ins_way_tags_stmt, 2,
-		      params->current_way_tag_sub);
-    sqlite3_bind_text (params->ins_way_tags_stmt, 3, k, strlen (k),
-		       SQLITE_STATIC);
-    sqlite3_bind_text (params->ins_way_tags_stmt, 4, v, strlen (v),
-		       SQLITE_STATIC);
-    ret = sqlite3_step (params->ins_way_tags_stmt);
-    if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-	params->wr_way_tags += 1;
-    params->current_way_tag_sub += 1;
-    return 1;
+/* comparison function for QSort and BSearch */
+    const struct node_coord *n1 = (const struct node_coord *) p1;
+    const struct node_coord *n2 = (const struct node_coord *) p2;
+    if (n1->node_id == n2->node_id)
+	return 0;
+    if (n1->node_id > n2->node_id)
+	return 1;
+    return -1;
 }
 
 static int
-insert_relation_ref (struct aux_params *params, const char *type,
-		     sqlite3_int64 ref, const char *role)
+find_node_index (struct node_coord_cache *cache, sqlite3_int64 id)
 {
-/* inserting a raw <relation><member> into the DBMS */
-    int ret;
-    sqlite3_reset (params->ins_relation_refs_stmt);
-    sqlite3_clear_bindings (params->ins_relation_refs_stmt);
-    sqlite3_bind_int64 (params->ins_relation_refs_stmt, 1,
-			params->current_rel_id);
-    sqlite3_bind_int (params->ins_relation_refs_stmt, 2,
-		      params->current_rel_ref_sub);
-    sqlite3_bind_text (params->ins_relation_refs_stmt, 3, type, strlen (type),
-		       SQLITE_STATIC);
-    sqlite3_bind_int64 (params->ins_relation_refs_stmt, 4, ref);
-    sqlite3_bind_text (params->ins_relation_refs_stmt, 5, role, strlen (role),
-		       SQLITE_STATIC);
-    ret = sqlite3_step (params->ins_relation_refs_stmt);
-    if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-	params->wr_rel_refs += 1;
-    params->current_rel_ref_sub += 1;
-    return 1;
+/* retrieving the position of some Node within the cache; -1 if missing */
+    struct node_coord key;
+    struct node_coord *found;
+    if (cache->count == 0)
+	return -1;
+    if (!(cache->sorted))
+      {
+	  /* the first lookup: sorting the cache by Node ID */
+	  qsort (cache->items, cache->count, sizeof (struct node_coord),
+		 cmp_node_coords);
+	  cache->sorted = 1;
+      }
+    key.node_id = id;
+    found =
+	bsearch (&key, cache->items, cache->count, sizeof (struct node_coord),
+		 cmp_node_coords);
+    if (found == NULL)
+	return -1;
+    return found - cache->items;
 }
 
-static int
-insert_relation_tag (struct aux_params *params, const char *k, const char *v)
+static void
+seen_ids_cleanup (struct seen_ids *set)
 {
-/* inserting a raw <relation><tag> into the DBMS */
-    int ret;
-    sqlite3_reset (params->ins_relation_tags_stmt);
-    sqlite3_clear_bindings (params->ins_relation_tags_stmt);
-    sqlite3_bind_int64 (params->ins_relation_tags_stmt, 1,
-			params->current_rel_id);
-    sqlite3_bind_int (params->ins_relation_tags_stmt, 2,
-		      params->current_rel_tag_sub);
-    sqlite3_bind_text (params->ins_relation_tags_stmt, 3, k, strlen (k),
-		       SQLITE_STATIC);
-    sqlite3_bind_text (params->ins_relation_tags_stmt, 4, v, strlen (v),
-		       SQLITE_STATIC);
-    ret = sqlite3_step (params->ins_relation_tags_stmt);
-    if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-	params->wr_rel_tags += 1;
-    params->current_rel_tag_sub += 1;
-    return 1;
+/* freeing a set of already seen IDs */
+    if (set->keys != NULL)
+	free (set->keys);
+    if (set->bits != NULL)
+	free (set->bits);
+    if (set->used != NULL)
+	free (set->used);
+    set->keys = NULL;
+    set->bits = NULL;
+    set->used = NULL;
+    set->size = 0;
+    set->count = 0;
+}
+
+static unsigned int
+seen_ids_slot (struct seen_ids *set, sqlite3_int64 key)
+{
+/* locating the hash slot of some block [linear probing] */
+    sqlite3_uint64 hash = (sqlite3_uint64) key * 0x9e3779b97f4a7c15ULL;
+    unsigned int slot = (unsigned int) (hash >> 32) & (set->size - 1);
+    while (set->used[slot] && set->keys[slot] != key)
+	slot = (slot + 1) & (set->size - 1);
+    return slot;
 }
 
 static int
-insert_node (struct aux_params *params, sqlite3_int64 id, double x, double y,
-	     int version, const char *timestamp, int uid, int changeset,
-	     const char *user)
+seen_ids_grow (struct seen_ids *set)
 {
-/* inserting a raw <node> into the DBMS */
-    int ret;
-    unsigned char *blob;
-    int blob_size;
-    gaiaGeomCollPtr geom = gaiaAllocGeomColl ();
-    geom->Srid = 4326;
-    gaiaAddPointToGeomColl (geom, x, y);
-    sqlite3_reset (params->ins_nodes_stmt);
-    sqlite3_clear_bindings (params->ins_nodes_stmt);
-    if (params->mode == MODE_RAW)
-      {
-	  sqlite3_bind_int64 (params->ins_nodes_stmt, 1, id);
-	  sqlite3_bind_int (params->ins_nodes_stmt, 2, version);
-	  if (timestamp == NULL)
-	      sqlite3_bind_null (params->ins_nodes_stmt, 3);
-	  else
-	      sqlite3_bind_text (params->ins_nodes_stmt, 3, timestamp,
-				 strlen (timestamp), SQLITE_STATIC);
-	  sqlite3_bind_int (params->ins_nodes_stmt, 4, uid);
-	  if (user == NULL)
-	      sqlite3_bind_null (params->ins_nodes_stmt, 5);
-	  else
-	      sqlite3_bind_text (params->ins_nodes_stmt, 5, user, strlen (user),
-				 SQLITE_STATIC);
-	  sqlite3_bind_int (params->ins_nodes_stmt, 6, changeset);
-	  if (!geom)
-	      sqlite3_bind_null (params->ins_nodes_stmt, 7);
-	  else
-	    {
-		gaiaToSpatiaLiteBlobWkb (geom, &blob, &blob_size);
-		gaiaFreeGeomColl (geom);
-		sqlite3_bind_blob (params->ins_nodes_stmt, 7, blob, blob_size,
-				   free);
-	    }
+/* doubling the hash table */
+    unsigned int i;
+    struct seen_ids grown;
+    grown.size = (set->size == 0) ? 4096 : set->size * 2;
+    grown.count = set->count;
+    grown.keys = malloc (sizeof (sqlite3_int64) * grown.size);
+    grown.bits = malloc (sizeof (sqlite3_uint64) * grown.size);
+    grown.used = calloc (grown.size, 1);
+    if (grown.keys == NULL || grown.bits == NULL || grown.used == NULL)
+      {
+	  seen_ids_cleanup (&grown);
+	  return 0;
       }
-    else
+    for (i = 0; i < set->size; i++)
       {
-	  sqlite3_bind_int64 (params->ins_nodes_stmt, 1, id);
-	  if (!geom)
-	      sqlite3_bind_null (params->ins_nodes_stmt, 2);
-	  else
-	    {
-		gaiaToSpatiaLiteBlobWkb (geom, &blob, &blob_size);
-		gaiaFreeGeomColl (geom);
-		sqlite3_bind_blob (params->ins_nodes_stmt, 2, blob, blob_size,
-				   free);
-	    }
+	  unsigned int slot;
+	  if (!(set->used[i]))
+	      continue;
+	  slot = seen_ids_slot (&grown, set->keys[i]);
+	  grown.used[slot] = 1;
+	  grown.keys[slot] = set->keys[i];
+	  grown.bits[slot] = set->bits[i];
       }
-    ret = sqlite3_step (params->ins_nodes_stmt);
-    if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-	params->wr_nodes += 1;
-    params->current_node_id = id;
-    params->current_node_tag_sub = 0;
+    grown.duplicates = set->duplicates;
+    seen_ids_cleanup (set);
+    *set = grown;
     return 1;
 }
 
 static int
-insert_way (struct aux_params *params, sqlite3_int64 id)
+check_seen_id (struct seen_ids *set, sqlite3_int64 id)
 {
-/* inserting a raw <way> into the DBMS */
-    int ret;
-    sqlite3_reset (params->ins_ways_stmt);
-    sqlite3_clear_bindings (params->ins_ways_stmt);
-    sqlite3_bind_int64 (params->ins_ways_stmt, 1, id);
-    ret = sqlite3_step (params->ins_ways_stmt);
-    if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-	params->wr_ways += 1;
-    params->current_way_id = id;
-    params->current_way_ref_sub = 0;
-    params->current_way_tag_sub = 0;
-    return 1;
+/*
+/ checking if some OSM ID has already been inserted; returns 1
+/ for duplicates, otherwise marks the ID as seen and returns 0
+*/
+    unsigned int slot;
+    sqlite3_int64 key = id >> 6;
+    sqlite3_uint64 bit = (sqlite3_uint64) 1 << (id & 63);
+    if (set->count * 2 >= set->size)
+      {
+	  if (!seen_ids_grow (set))
+	      return 0;
+      }
+    slot = seen_ids_slot (set, key);
+    if (!(set->used[slot]))
+      {
+	  set->used[slot] = 1;
+	  set->keys[slot] = key;
+	  set->bits[slot] = 0;
+	  set->count += 1;
+      }
+    if (set->bits[slot] & bit)
+      {
+	  set->duplicates += 1;
+	  return 1;
+      }
+    set->bits[slot] |= bit;
+    return 0;
 }
 
 static int
-insert_relation (struct aux_params *params, sqlite3_int64 id)
+test_seen_id (struct seen_ids *set, sqlite3_int64 id)
 {
-/* inserting a raw <relation> into the DBMS */
-    int ret;
-    sqlite3_reset (params->ins_relations_stmt);
-    sqlite3_clear_bindings (params->ins_relations_stmt);
-    sqlite3_bind_int64 (params->ins_relations_stmt, 1, id);
-    ret = sqlite3_step (params->ins_relations_stmt);
-    if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-	params->wr_relations += 1;
-    params->current_rel_id = id;
-    params->current_rel_ref_sub = 0;
-    params->current_rel_tag_sub = 0;
-    return 1;
+/* checking if some OSM ID belongs to the set, without marking it */
+    unsigned int slot;
+    if (set->size == 0)
+	return 0;
+    slot = seen_ids_slot (set, id >> 6);
+    if (!(set->used[slot]))
+	return 0;
+    if (set->bits[slot] & ((sqlite3_uint64) 1 << (id & 63)))
+	return 1;
+    return 0;
 }
 
-const char *
-parse_attribute_value (xmlNodePtr node)
+static void
+batch_cleanup (struct insert_batch *batch)
 {
-/* parsing a string argument */
-    if (node != NULL)
-      {
-	  if (node->type == XML_TEXT_NODE)
-	      return (const char *) (node->content);
-      }
-    return NULL;
+/* freeing a batch of buffered rows */
+    int level;
+    for (level = 1; level < OSM_BATCH_LEVELS; level++)
+      {
+	  /* the single-row INSERT isn't owned by the batch */
+	  if (batch->stmts[level] != NULL)
+	      sqlite3_finalize (batch->stmts[level]);
+      }
+    if (batch->values != NULL)
+	free (batch->values);
+    if (batch->arena != NULL)
+	free (batch->arena);
+    if (batch->coords != NULL)
+	free (batch->coords);
+    memset (batch, 0, sizeof (struct insert_batch));
 }
 
 static int
-parse_osm_nd_ref (struct _xmlAttr *attr, sqlite3_int64 * node_id)
+prepare_batch (struct insert_batch *batch, sqlite3_stmt * stmt, int *counter,
+	       struct insert_batch *parent)
 {
-/* parsing the OSM <node> attributes */
-    const char *attr_ref = NULL;
-    while (attr != NULL)
-      {
-	  if (attr->name != NULL)
+/* initializing a batch of rows for some single-row INSERT */
+    memset (batch, 0, sizeof (struct insert_batch));
+    batch->stmts[0] = stmt;
+    batch->counter = counter;
+    batch->parent = parent;
+    batch->columns = sqlite3_bind_parameter_count (stmt);
+    batch->values =
+	malloc (sizeof (struct batch_value) * OSM_BATCH * batch->columns);
+    if (batch->values == NULL)
+	return 0;
+    return 1;
+}
+
+static sqlite3_stmt *
+batch_stmt (struct aux_params *params, struct insert_batch *batch, int level)
+{
+/* lazily preparing the INSERT for 2^level rows at once */
+    const char *sql = sqlite3_sql (batch->stmts[0]);
+    const char *values = strstr (sql, "VALUES");
+    int rows = 1 << level;
+    char *multi;
+    char *p;
+    int row;
+    int col;
+    int ret;
+    if (batch->stmts[level] != NULL || values == NULL)
+	return batch->stmts[level];
+    multi = malloc ((values - sql) + 8 + (rows * (batch->columns * 2 + 3)));
+    if (multi == NULL)
+	return NULL;
+    memcpy (multi, sql, values - sql);
+    p = multi + (values - sql);
+    strcpy (p, "VALUES ");
+    p += 7;
+    for (row = 0; row < rows; row++)
+      {
+	  if (row > 0)
+	      *p++ = ',';
+	  *p++ = '(';
+	  for (col = 0; col < batch->columns; col++)
 	    {
-		if (strcmp ((const char *) (attr->name), "ref") == 0)
-		    attr_ref = parse_attribute_value (attr->children);
+		if (col > 0)
+		    *p++ = ',';
+		*p++ = '?';
 	    }
-	  attr = attr->next;
+	  *p++ = ')';
       }
-    if (attr_ref == NULL)
+    *p = '\0';
+    ret =
+	sqlite3_prepare_v2 (params->db_handle, multi, strlen (multi),
+			    &(batch->stmts[level]), NULL);
+    free (multi);
+    if (ret != SQLITE_OK)
       {
-	  fprintf (stderr, "Invalid OSM <nd>: ref=%s\n", attr_ref);
-	  return 0;
+	  /* e.g. too many SQL variables: inserting one row at a time */
+	  batch->stmts[level] = NULL;
       }
-    *node_id = atol_64 (attr_ref);
-    return 1;
+    return batch->stmts[level];
 }
 
-static int
-parse_osm_member (struct _xmlAttr *attr, const char **type, sqlite3_int64 * ref,
-		  const char **role)
+static struct batch_value *
+batch_row (struct insert_batch *batch)
 {
-/* parsing the OSM <member> attributes */
-    const char *attr_type = NULL;
-    const char *attr_ref = NULL;
-    const char *attr_role = NULL;
-    while (attr != NULL)
-      {
+/* the column values of the next buffered row */
+    return batch->values + (batch->rows * batch->columns);
+}
+
+static void
+batch_int (struct batch_value *value, sqlite3_int64 int_value)
+{
+/* buffering an INTEGER value */
+    value->type = SQLITE_INTEGER;
+    value->int_value = int_value;
+}
+
+static unsigned char *
+batch_alloc (struct insert_batch *batch, struct batch_value *value,
+	     int type, int size)
+{
+/* reserving room for a TEXT or BLOB value into the batch arena */
+    if (batch->arena_size + size > batch->arena_max)
+      {
+	  int max = (batch->arena_size + size) * 2 + 4096;
+	  char *arena = realloc (batch->arena, max);
+	  if (arena == NULL)
+	      return NULL;
+	  batch->arena = arena;
+	  batch->arena_max = max;
+      }
+    value->type = type;
+    value->offset = batch->arena_size;
+    value->size = size;
+    batch->arena_size += size;
+    return (unsigned char *) (batch->arena + value->offset);
+}
+
+static int
+batch_text (struct insert_batch *batch, struct batch_value *value,
+	    const char *text)
+{
+/* buffering a TEXT value [copied, the source won't last that long] */
+    int len;
+    unsigned char *p;
+    if (text == NULL)
+      {
+	  value->type = SQLITE_NULL;
+	  return 1;
+      }
+    len = strlen (text);
+    p = batch_alloc (batch, value, SQLITE_TEXT, len);
+    if (p == NULL)
+	return 0;
+    memcpy (p, text, len);
+    return 1;
+}
+
+static void
+batch_column_int (struct batch_value *value, sqlite3_stmt * stmt, int col)
+{
+/* buffering an INTEGER result column [NULL if missing] */
+    if (sqlite3_column_type (stmt, col) == SQLITE_NULL)
+	value->type = SQLITE_NULL;
+    else
+	batch_int (value, sqlite3_column_int (stmt, col));
+}
+
+static int
+batch_geometry (struct insert_batch *batch, struct batch_value *value,
+		gaiaGeomCollPtr geom)
+{
+/* buffering a Geometry as a SpatiaLite BLOB value */
+    unsigned char *blob;
+    int blob_size;
+    unsigned char *p;
+    gaiaToSpatiaLiteBlobWkb (geom, &blob, &blob_size);
+    if (blob == NULL)
+	return 0;
+    p = batch_alloc (batch, value, SQLITE_BLOB, blob_size);
+    if (p != NULL)
+	memcpy (p, blob, blob_size);
+    free (blob);
+    return (p != NULL);
+}
+
+static void
+bind_batch_row (struct insert_batch *batch, sqlite3_stmt * stmt, int row,
+		int first)
+{
+/* binding all values of a buffered row, starting at the Nth parameter */
+    int col;
+    struct batch_value *value = batch->values + (row * batch->columns);
+    for (col = 0; col < batch->columns; col++, value++)
+      {
+	  if (value->type == SQLITE_INTEGER)
+	      sqlite3_bind_int64 (stmt, first + col, value->int_value);
+	  else if (value->type == SQLITE_TEXT)
+	      sqlite3_bind_text (stmt, first + col,
+				 batch->arena + value->offset, value->size,
+				 SQLITE_STATIC);
+	  else if (value->type == SQLITE_BLOB)
+	      sqlite3_bind_blob (stmt, first + col,
+				 batch->arena + value->offset, value->size,
+				 SQLITE_STATIC);
+	  else
+	      sqlite3_bind_null (stmt, first + col);
+      }
+}
+
+static int
+batch_row_inserted (struct aux_params *params, struct insert_batch *batch,
+		    int row)
+{
+/* a buffered row has been successfully inserted */
+    *(batch->counter) += 1;
+    if (batch->coords != NULL)
+	return add_node_coord (&(params->node_coords),
+			       batch->values[row * batch->columns].int_value,
+			       batch->coords[row * 2],
+			       batch->coords[row * 2 + 1]);
+    return 1;
+}
+
+static void
+report_failed_row (struct aux_params *params, struct insert_batch *batch,
+		   int row)
+{
+/* reporting a row that couldn't be inserted [its first column is the OSM id] */
+    sqlite3_int64 id = batch->values[row * batch->columns].int_value;
+#if defined(_WIN32) || defined(__MINGW32__)
+    /* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
+    fprintf (stderr, "ERROR: unable to insert %s id=%I64d: %s\n", batch->what,
+	     id, sqlite3_errmsg (params->db_handle));
+#else
+    fprintf (stderr, "ERROR: unable to insert %s id=%lld: %s\n", batch->what,
+	     id, sqlite3_errmsg (params->db_handle));
+#endif
+}
+
+static void
+report_batch_error (struct aux_params *params, struct insert_batch *batch)
+{
+/* a batch couldn't be buffered or inserted: reporting the real cause */
+    int err = sqlite3_errcode (params->db_handle);
+    if (err != SQLITE_OK && err != SQLITE_ROW && err != SQLITE_DONE)
+	fprintf (stderr, "ERROR: unable to insert the %s network: %s\n",
+		 batch->what, sqlite3_errmsg (params->db_handle));
+    else
+	fprintf (stderr, "ERROR: insufficient memory\n");
+}
+
+static int
+insert_batch_rows (struct aux_params *params, struct insert_batch *batch,
+		   int first, int level)
+{
+/*
+/ inserting 2^level buffered rows by a single statement; should it
+/ fail they are inserted one at a time, so to exactly preserve the
+/ outcome of each row [0 if the Node locations can't be cached]
+*/
+    int row;
+    int ret;
+    int rows = 1 << level;
+    sqlite3_stmt *stmt = batch_stmt (params, batch, level);
+    if (stmt != NULL)
+      {
+	  sqlite3_reset (stmt);
+	  sqlite3_clear_bindings (stmt);
+	  for (row = 0; row < rows; row++)
+	      bind_batch_row (batch, stmt, first + row,
+			      (row * batch->columns) + 1);
+	  ret = sqlite3_step (stmt);
+	  if (ret == SQLITE_DONE || ret == SQLITE_ROW)
+	    {
+		for (row = first; row < first + rows; row++)
+		  {
+		      if (!batch_row_inserted (params, batch, row))
+			  return 0;
+		  }
+		return 1;
+	    }
+	  if (level == 0)
+	    {
+		if (batch->what != NULL)
+		    report_failed_row (params, batch, first);
+		return 1;
+	    }
+      }
+    for (row = first; row < first + rows; row++)
+      {
+	  if (!insert_batch_rows (params, batch, row, 0))
+	      return 0;
+      }
+    return 1;
+}
+
+static int
+flush_batch (struct aux_params *params, struct insert_batch *batch)
+{
+/*
+/ inserting all buffered rows [parent rows first]; a partial
+/ batch is split into chunks of 64, 32, 16 ... rows
+*/
+    int row = 0;
+    int level = OSM_BATCH_LEVELS - 1;
+    int ok = 1;
+    double t0;
+    if (batch->rows == 0)
+	return 1;
+    if (batch->parent != NULL)
+      {
+	  if (!flush_batch (params, batch->parent))
+	      return 0;
+      }
+    t0 = osm_clock ();
+    while (row < batch->rows)
+      {
+	  if (batch->rows - row < (1 << level))
+	    {
+		level--;
+		continue;
+	    }
+	  if (!insert_batch_rows (params, batch, row, level))
+	    {
+		ok = 0;
+		break;
+	    }
+	  row += 1 << level;
+      }
+    params->stats.insert_seconds += osm_clock () - t0;
+    batch->rows = 0;
+    batch->arena_size = 0;
+    return ok;
+}
+
+static int
+end_batch_row (struct aux_params *params, struct insert_batch *batch)
+{
+/* a new row is ready; flushing the batch as soon as it's full */
+    batch->rows += 1;
+    if (batch->rows == OSM_BATCH)
+	return flush_batch (params, batch);
+    return 1;
+}
+
+static void
+encode_point_blob (unsigned char *blob, double x, double y)
+{
+/* directly encoding a SpatiaLite POINT BLOB [SRID 4326] */
+    int endian_arch = gaiaEndianArch ();
+    *(blob + 0) = GAIA_MARK_START;
+    *(blob + 1) = GAIA_LITTLE_ENDIAN;
+    gaiaExport32 (blob + 2, 4326, 1, endian_arch);	/* the SRID */
+    gaiaExport64 (blob + 6, x, 1, endian_arch);	/* MBR - minimum X */
+    gaiaExport64 (blob + 14, y, 1, endian_arch);	/* MBR - minimum Y */
+    gaiaExport64 (blob + 22, x, 1, endian_arch);	/* MBR - maximum X */
+    gaiaExport64 (blob + 30, y, 1, endian_arch);	/* MBR - maximum Y */
+    *(blob + 38) = GAIA_MARK_MBR;
+    gaiaExport32 (blob + 39, GAIA_POINT, 1, endian_arch);	/* class type */
+    gaiaExport64 (blob + 43, x, 1, endian_arch);	/* X */
+    gaiaExport64 (blob + 51, y, 1, endian_arch);	/* Y */
+    *(blob + 59) = GAIA_MARK_END;
+}
+
+static int
+insert_node_tag (struct aux_params *params, const char *k, const char *v)
+{
+/* buffering a raw <node><tag> */
+    struct insert_batch *batch = &(params->node_tags_batch);
+    struct batch_value *row = batch_row (batch);
+    batch_int (row, params->current_node_id);
+    batch_int (row + 1, params->current_node_tag_sub);
+    if (!batch_text (batch, row + 2, k) || !batch_text (batch, row + 3, v))
+	return 0;
+    params->current_node_tag_sub += 1;
+    return end_batch_row (params, batch);
+}
+
+static int
+insert_way_ref (struct aux_params *params, sqlite3_int64 node_id)
+{
+/* buffering a raw <way><nd> */
+    struct insert_batch *batch = &(params->way_refs_batch);
+    struct batch_value *row = batch_row (batch);
+    batch_int (row, params->current_way_id);
+    batch_int (row + 1, params->current_way_ref_sub);
+    batch_int (row + 2, node_id);
+    params->current_way_ref_sub += 1;
+    return end_batch_row (params, batch);
+}
+
+static int
+insert_way_tag (struct aux_params *params, const char *k, const char *v)
+{
+/* buffering a raw <way><tag> */
+    struct insert_batch *batch = &(params->way_tags_batch);
+    struct batch_value *row = batch_row (batch);
+    batch_int (row, params->current_way_id);
+    batch_int (row + 1, params->current_way_tag_sub);
+    if (!batch_text (batch, row + 2, k) || !batch_text (batch, row + 3, v))
+	return 0;
+    params->current_way_tag_sub += 1;
+    return end_batch_row (params, batch);
+}
+
+static int
+insert_relation_ref (struct aux_params *params, const char *type,
+		     sqlite3_int64 ref, const char *role)
+{
+/* buffering a raw <relation><member> */
+    struct insert_batch *batch = &(params->relation_refs_batch);
+    struct batch_value *row = batch_row (batch);
+    batch_int (row, params->current_rel_id);
+    batch_int (row + 1, params->current_rel_ref_sub);
+    if (!batch_text (batch, row + 2, type))
+	return 0;
+    batch_int (row + 3, ref);
+    if (!batch_text (batch, row + 4, role))
+	return 0;
+    params->current_rel_ref_sub += 1;
+    return end_batch_row (params, batch);
+}
+
+static int
+insert_relation_tag (struct aux_params *params, const char *k, const char *v)
+{
+/* buffering a raw <relation><tag> */
+    struct insert_batch *batch = &(params->relation_tags_batch);
+    struct batch_value *row = batch_row (batch);
+    batch_int (row, params->current_rel_id);
+    batch_int (row + 1, params->current_rel_tag_sub);
+    if (!batch_text (batch, row + 2, k) || !batch_text (batch, row + 3, v))
+	return 0;
+    params->current_rel_tag_sub += 1;
+    return end_batch_row (params, batch);
+}
+
+static int
+insert_node (struct aux_params *params, sqlite3_int64 id, double x, double y,
+	     int version, const char *timestamp, int uid, int changeset,
+	     const char *user)
+{
+/* buffering a raw <node> */
+    struct insert_batch *batch = &(params->nodes_batch);
+    struct batch_value *row = batch_row (batch);
+    unsigned char *blob;
+    batch_int (row, id);
+    if (params->mode == MODE_RAW)
+      {
+	  batch_int (row + 1, version);
+	  if (!batch_text (batch, row + 2, timestamp))
+	      return 0;
+	  batch_int (row + 3, uid);
+	  if (!batch_text (batch, row + 4, user))
+	      return 0;
+	  batch_int (row + 5, changeset);
+	  blob = batch_alloc (batch, row + 6, SQLITE_BLOB, 60);
+      }
+    else
+	blob = batch_alloc (batch, row + 1, SQLITE_BLOB, 60);
+    if (blob == NULL)
+	return 0;
+    encode_point_blob (blob, x, y);
+    if (batch->coords != NULL)
+      {
+	  batch->coords[batch->rows * 2] = x;
+	  batch->coords[batch->rows * 2 + 1] = y;
+      }
+    params->current_node_id = id;
+    params->current_node_tag_sub = 0;
+    return end_batch_row (params, batch);
+}
+
+static int
+insert_way (struct aux_params *params, sqlite3_int64 id)
+{
+/* buffering a raw <way> */
+    struct insert_batch *batch = &(params->ways_batch);
+    batch_int (batch_row (batch), id);
+    params->current_way_id = id;
+    params->current_way_ref_sub = 0;
+    params->current_way_tag_sub = 0;
+    return end_batch_row (params, batch);
+}
+
+static int
+insert_relation (struct aux_params *params, sqlite3_int64 id)
+{
+/* buffering a raw <relation> */
+    struct insert_batch *batch = &(params->relations_batch);
+    batch_int (batch_row (batch), id);
+    params->current_rel_id = id;
+    params->current_rel_ref_sub = 0;
+    params->current_rel_tag_sub = 0;
+    return end_batch_row (params, batch);
+}
+
+const char *
+parse_attribute_value (xmlNodePtr node)
+{
+/* parsing a string argument */
+    if (node != NULL)
+      {
+	  if (node->type == XML_TEXT_NODE)
+	      return (const char *) (node->content);
+      }
+    return NULL;
+}
+
+static int
+parse_osm_nd_ref (struct _xmlAttr *attr, sqlite3_int64 * node_id)
+{
+/* parsing the OSM <node> attributes */
+    const char *attr_ref = NULL;
+    while (attr != NULL)
+      {
+	  if (attr->name != NULL)
+	    {
+		if (strcmp ((const char *) (attr->name), "ref") == 0)
+		    attr_ref = parse_attribute_value (attr->children);
+	    }
+	  attr = attr->next;
+      }
+    if (attr_ref == NULL)
+      {
+	  fprintf (stderr, "Invalid OSM <nd>: ref=%s\n", attr_ref);
+	  return 0;
+      }
+    *node_id = atol_64 (attr_ref);
+    return 1;
+}
+
+static int
+parse_osm_member (struct _xmlAttr *attr, const char **type, sqlite3_int64 * ref,
+		  const char **role)
+{
+/* parsing the OSM <member> attributes */
+    const char *attr_type = NULL;
+    const char *attr_ref = NULL;
+    const char *attr_role = NULL;
+    while (attr != NULL)
+      {
 	  if (attr->name != NULL)
 	    {
 		if (strcmp ((const char *) (attr->name), "type") == 0)
@@ -864,74 +1761,217 @@ parse_osm_relation (xmlNodePtr node, struct aux_params *params)
 }
 
 static int
-parse_osm_items (xmlNodePtr node, struct aux_params *params)
+skip_osm_item (xmlTextReaderPtr reader, struct aux_params *params,
+	       const char *name)
 {
-/* recursively parsing the OSM payload */
-    int error = 0;
-    xmlNodePtr cur_node = NULL;
-
-    for (cur_node = node; cur_node; cur_node = cur_node->next)
+/*
+/ local files in ROAD/RAIL mode: only the relevant Ways and their
+/ Nodes are loaded, just as the Overpass query would return them
+*/
+    xmlChar *value;
+    xmlNodePtr node;
+    xmlNodePtr child;
+    int relevant = 0;
+    if (strcmp (name, "relation") == 0)
+	return 1;
+    if (strcmp (name, "node") == 0)
       {
-	  if (cur_node->type == XML_ELEMENT_NODE)
-	    {
-		xmlNodePtr child;
-		for (child = cur_node->children; child; child = child->next)
-		  {
-		      if (child->type == XML_ELEMENT_NODE)
-			{
-			    const char *name = (const char *) (child->name);
-			    if (name != NULL)
-			      {
-				  int ret = 1;
-				  if (strcmp (name, "node") == 0)
-				      ret = parse_osm_node (child, params);
-				  if (strcmp (name, "way") == 0)
-				      ret = parse_osm_way (child, params);
-				  if (strcmp (name, "relation") == 0)
-				      ret = parse_osm_relation (child, params);
-				  if (!ret)
-				      error = 1;
-			      }
-			}
-		  }
-	    }
-      }
-    if (error)
+	  if (params->collecting)
+	      return 1;
+	  value = xmlTextReaderGetAttribute (reader, BAD_CAST "id");
+	  if (value == NULL)
+	      return 0;
+	  relevant =
+	      test_seen_id (&(params->wanted_nodes),
+			    atol_64 ((const char *) value));
+	  xmlFree (value);
+	  return !relevant;
+      }
+    node = xmlTextReaderExpand (reader);
+    if (node == NULL)
+	return 0;
+    for (child = node->children; child; child = child->next)
+      {
+	  if (child->type != XML_ELEMENT_NODE
+	      || strcmp ((const char *) (child->name), "tag") != 0)
+	      continue;
+	  value = xmlGetProp (child, BAD_CAST "k");
+	  if (value == NULL)
+	      continue;
+	  if (strcmp ((const char *) value, params->filter_key) == 0)
+	      relevant = 1;
+	  xmlFree (value);
+      }
+    if (!relevant)
+	return 1;
+    if (!params->collecting)
 	return 0;
+    for (child = node->children; child; child = child->next)
+      {
+	  /* first pass: collecting the Nodes referenced by this Way */
+	  if (child->type != XML_ELEMENT_NODE
+	      || strcmp ((const char *) (child->name), "nd") != 0)
+	      continue;
+	  value = xmlGetProp (child, BAD_CAST "ref");
+	  if (value == NULL)
+	      continue;
+	  check_seen_id (&(params->wanted_nodes),
+			 atol_64 ((const char *) value));
+	  xmlFree (value);
+      }
     return 1;
 }
 
 static int
-osm_parse (struct aux_params *params, struct download_tile *tile, int object)
+parse_osm_stream (xmlTextReaderPtr reader, struct aux_params *params)
 {
-    xmlDocPtr xml_doc = NULL;
-    xmlNodePtr root;
-    char *url;
+/*
+/ parsing the OSM payload as a stream: each <node>, <way> or
+/ <relation> is expanded, inserted and then immediately released,
+/ so the whole document is never held in memory at once
+*/
     int error = 0;
-
-    if (params->mode == MODE_ROAD)
-      {
-	  /* downloading only the ROAD network */
-	  url =
-	      sqlite3_mprintf
-	      ("%s/interpreter?data=[timeout:600];(way[highway](%1.12f,%1.12f,%1.12f,%1.12f);>;);out body;",
-	       params->osm_url, tile->miny, tile->minx, tile->maxy, tile->maxx);
-      }
-    else if (params->mode == MODE_RAIL)
-      {
-	  /* downloading only the RAILWAY network */
-	  url =
-	      sqlite3_mprintf
-	      ("%s/interpreter?data=[timeout:600];(way[railway](%1.12f,%1.12f,%1.12f,%1.12f);>;);out body;",
-	       params->osm_url, tile->miny, tile->minx, tile->maxy, tile->maxx);
-      }
-    else if (params->mode == MODE_MAP)
-      {
-	  /* downloading a full MAP */
-	  if (object == OBJ_NODES)
-	      url =
-		  sqlite3_mprintf
-		  ("%s/interpreter?data=[timeout:600];(node(%1.12f,%1.12f,%1.12f,%1.12f););out body;",
+    int ret;
+    double t0 = osm_clock ();
+    double inserts = params->stats.insert_seconds;
+    double downloads = params->stats.download_seconds;
+
+    ret = xmlTextReaderRead (reader);
+    while (ret == 1)
+      {
+	  const char *name;
+	  xmlChar *id;
+	  xmlNodePtr node;
+	  if (xmlTextReaderNodeType (reader) != XML_READER_TYPE_ELEMENT
+	      || xmlTextReaderDepth (reader) != 1)
+	    {
+		ret = xmlTextReaderRead (reader);
+		continue;
+	    }
+	  name = (const char *) xmlTextReaderConstName (reader);
+	  if (name != NULL && strcmp (name, "remark") == 0)
+	    {
+		/*
+		/ Overpass reports a failed query [e.g. a timeout or an
+		/ out of memory] as a <remark> within an HTTP 200 reply;
+		/ any data returned so far is incomplete
+		*/
+		xmlChar *remark = xmlTextReaderReadString (reader);
+		const char *msg = (const char *) remark;
+		if (msg != NULL && strstr (msg, "runtime error") != NULL)
+		  {
+		      while (*msg == ' ' || *msg == '\t' || *msg == '\n')
+			  msg++;
+		      fprintf (stderr, "ERROR: Overpass %s\n", msg);
+		      error = 1;
+		  }
+		if (remark != NULL)
+		    xmlFree (remark);
+		ret = xmlTextReaderNext (reader);
+		continue;
+	    }
+	  if (name == NULL
+	      || (strcmp (name, "node") != 0 && strcmp (name, "way") != 0
+		  && strcmp (name, "relation") != 0))
+	    {
+		/* skipping any other item, e.g. <note> or <meta> */
+		ret = xmlTextReaderNext (reader);
+		continue;
+	    }
+	  params->stats.parse_elements += 1;
+	  if (params->filter_key != NULL
+	      && skip_osm_item (reader, params, name))
+	    {
+		ret = xmlTextReaderNext (reader);
+		continue;
+	    }
+	  id = xmlTextReaderGetAttribute (reader, BAD_CAST "id");
+	  if (id != NULL)
+	    {
+		/* skipping duplicate items (overlapping tiles) before parsing */
+		struct seen_ids *seen = &(params->seen_relations);
+		int duplicate;
+		if (strcmp (name, "node") == 0)
+		    seen = &(params->seen_nodes);
+		else if (strcmp (name, "way") == 0)
+		    seen = &(params->seen_ways);
+		duplicate = check_seen_id (seen, atol_64 ((const char *) id));
+		xmlFree (id);
+		if (duplicate)
+		  {
+		      ret = xmlTextReaderNext (reader);
+		      continue;
+		  }
+	    }
+	  node = xmlTextReaderExpand (reader);
+	  if (node == NULL)
+	    {
+		ret = -1;
+		break;
+	    }
+	  if (strcmp (name, "node") == 0)
+	    {
+		if (!parse_osm_node (node, params))
+		    error = 1;
+	    }
+	  else if (strcmp (name, "way") == 0)
+	    {
+		if (!parse_osm_way (node, params))
+		    error = 1;
+	    }
+	  else
+	    {
+		if (!parse_osm_relation (node, params))
+		    error = 1;
+	    }
+	  /* moving past the current item; the expanded subtree will be freed */
+	  ret = xmlTextReaderNext (reader);
+      }
+    /* the time spent inserting or streaming isn't accounted as parsing */
+    params->stats.parse_seconds +=
+	(osm_clock () - t0) - (params->stats.insert_seconds - inserts) -
+	(params->stats.download_seconds - downloads);
+    if (ret != 0)
+      {
+	  /* parsing error; not a well-formed XML */
+	  fprintf (stderr, "ERROR: unable to download the OSM dataset\n");
+	  return 0;
+      }
+    if (error)
+	return 0;
+    return 1;
+}
+
+static char *
+osm_url (struct aux_params *params, struct download_tile *tile, int object)
+{
+/* building the Overpass request URL for a tile */
+    char *url;
+    xmlChar *escaped;
+
+    if (params->mode == MODE_ROAD)
+      {
+	  /* downloading only the ROAD network */
+	  url =
+	      sqlite3_mprintf
+	      ("%s/interpreter?data=[timeout:600];(way[highway](%1.12f,%1.12f,%1.12f,%1.12f);>;);out body;",
+	       params->osm_url, tile->miny, tile->minx, tile->maxy, tile->maxx);
+      }
+    else if (params->mode == MODE_RAIL)
+      {
+	  /* downloading only the RAILWAY network */
+	  url =
+	      sqlite3_mprintf
+	      ("%s/interpreter?data=[timeout:600];(way[railway](%1.12f,%1.12f,%1.12f,%1.12f);>;);out body;",
+	       params->osm_url, tile->miny, tile->minx, tile->maxy, tile->maxx);
+      }
+    else if (params->mode == MODE_MAP)
+      {
+	  /* downloading a full MAP */
+	  if (object == OBJ_NODES)
+	      url =
+		  sqlite3_mprintf
+		  ("%s/interpreter?data=[timeout:600];(node(%1.12f,%1.12f,%1.12f,%1.12f););out body;",
 		   params->osm_url, tile->miny, tile->minx, tile->maxy,
 		   tile->maxx);
 	  else if (object == OBJ_WAYS)
@@ -970,35 +2010,1843 @@ osm_parse (struct aux_params *params, struct download_tile *tile, int object)
 		   tile->maxx);
       }
 
-    xml_doc = xmlReadFile (url, NULL, 0);
-    if (xml_doc == NULL)
+/* the streaming reader expects an already escaped URL */
+    escaped = xmlCanonicPath ((const xmlChar *) url);
+    if (escaped != NULL)
+      {
+	  sqlite3_free (url);
+	  url = sqlite3_mprintf ("%s", (const char *) escaped);
+	  xmlFree (escaped);
+      }
+    return url;
+}
+
+static int
+osm_download (struct aux_params *params, struct download_job *job)
+{
+/* downloading a tile into a memory buffer; no XML parsing at all */
+    void *ctxt;
+    char *payload = NULL;
+    int size = 0;
+    int max = 0;
+    int rd;
+    double t0 = osm_clock ();
+    char *url = osm_url (params, job->tile, job->object);
+    ctxt = xmlNanoHTTPOpen (url, NULL);
+    sqlite3_free (url);
+    if (ctxt == NULL)
+	return 0;
+    if (xmlNanoHTTPReturnCode (ctxt) != 200)
+      {
+	  xmlNanoHTTPClose (ctxt);
+	  return 0;
+      }
+    while (1)
+      {
+	  if (max - size < 65536)
+	    {
+		char *grown;
+		max = (max == 0) ? 1024 * 1024 : max * 2;
+		grown = realloc (payload, max);
+		if (grown == NULL)
+		  {
+		      rd = -1;
+		      break;
+		  }
+		payload = grown;
+	    }
+	  rd = xmlNanoHTTPRead (ctxt, payload + size, max - size);
+	  if (rd <= 0)
+	      break;
+	  size += rd;
+      }
+    xmlNanoHTTPClose (ctxt);
+    if (rd < 0)
+      {
+	  free (payload);
+	  return 0;
+      }
+    job->payload = payload;
+    job->payload_size = size;
+    job->seconds = osm_clock () - t0;
+    return 1;
+}
+
+static sqlite3_uint64
+fnv_hash (sqlite3_uint64 hash, const char *str)
+{
+/* updating a 64 bit FNV-1a hash */
+    const unsigned char *p = (const unsigned char *) str;
+    while (*p != '\0')
+      {
+	  hash ^= *p++;
+	  hash *= 0x100000001b3ULL;
+      }
+    return hash;
+}
+
+static char *
+tile_cache_path (struct aux_params *params, struct download_job *job)
+{
+/* the cached copy of a tile is addressed by hashing its request URL */
+    char *path;
+    char *url = osm_url (params, job->tile, job->object);
+    sqlite3_uint64 hash = fnv_hash (0xcbf29ce484222325ULL, url);
+    sqlite3_free (url);
+    path =
+	sqlite3_mprintf ("%s/%016llx.osm", params->tile_cache_dir, hash);
+    return path;
+}
+
+static int
+load_cached_tile (const char *path, struct download_job *job)
+{
+/* attempting to load a tile from the local cache */
+    long size;
+    char *payload;
+    FILE *in = fopen (path, "rb");
+    if (in == NULL)
+	return 0;
+    if (fseek (in, 0, SEEK_END) != 0)
+	goto error;
+    size = ftell (in);
+    if (size <= 0 || fseek (in, 0, SEEK_SET) != 0)
+	goto error;
+    payload = malloc (size);
+    if (payload == NULL)
+	goto error;
+    if (fread (payload, 1, size, in) != (size_t) size)
+      {
+	  free (payload);
+	  goto error;
+      }
+    fclose (in);
+    job->payload = payload;
+    job->payload_size = size;
+    return 1;
+
+  error:
+    fclose (in);
+    return 0;
+}
+
+static void
+save_cached_tile (const char *path, struct download_job *job)
+{
+/* saving a tile into the local cache [write and rename] */
+    int ok = 1;
+    char *tmp_path = sqlite3_mprintf ("%s.tmp", path);
+    FILE *out = fopen (tmp_path, "wb");
+    if (out == NULL)
+      {
+	  fprintf (stderr, "WARNING: unable to write the tile cache \"%s\"\n",
+		   tmp_path);
+	  sqlite3_free (tmp_path);
+	  return;
+      }
+    if (fwrite (job->payload, 1, job->payload_size, out) !=
+	(size_t) (job->payload_size))
+	ok = 0;
+    if (fclose (out) != 0)
+	ok = 0;
+    if (ok)
+      {
+	  remove (path);
+	  if (rename (tmp_path, path) != 0)
+	      ok = 0;
+      }
+    if (!ok)
+      {
+	  fprintf (stderr, "WARNING: unable to write the tile cache \"%s\"\n",
+		   path);
+	  remove (tmp_path);
+      }
+    sqlite3_free (tmp_path);
+}
+
+static int
+osm_fetch (struct aux_params *params, struct download_job *job)
+{
+/* retrieving a tile from the local cache, or else from the Overpass server */
+    char *path;
+    int ret;
+    if (params->tile_cache_dir == NULL)
+	return osm_download (params, job);
+    path = tile_cache_path (params, job);
+    ret = load_cached_tile (path, job);
+    sqlite3_free (path);
+    if (ret)
+      {
+	  job->cached = 1;
+	  return 1;
+      }
+    return osm_download (params, job);
+}
+
+static int
+find_journal_job (struct download_queue *queue, int tile_no, int object)
+{
+/* retrieving the request recorded by a journal line; -1 if unknown */
+    int lo = 0;
+    int hi = queue->count - 1;
+    while (lo <= hi)
+      {
+	  /* the requests are sorted by tile and object */
+	  int mid = (lo + hi) / 2;
+	  struct download_job *job = queue->jobs + mid;
+	  if (job->tile->tile_no == tile_no && job->object == object)
+	      return mid;
+	  if (job->tile->tile_no < tile_no
+	      || (job->tile->tile_no == tile_no && job->object < object))
+	      lo = mid + 1;
+	  else
+	      hi = mid - 1;
+      }
+    return -1;
+}
+
+static void
+open_journal (struct download_queue *queue)
+{
+/*
+/ opening the progress journal; each completed request is
+/ recorded once, so an interrupted download can be detected and
+/ resumed by simply running the same command again
+*/
+    int i;
+    int k;
+    int tile_no;
+    int object;
+    int done = 0;
+    char line[128];
+    FILE *in;
+    struct aux_params *params = queue->params;
+    sqlite3_uint64 hash = 0xcbf29ce484222325ULL;
+    for (i = 0; i < queue->count; i++)
+      {
+	  /* the journal is identified by the whole list of requests */
+	  struct download_job *job = queue->jobs + i;
+	  char *url = osm_url (params, job->tile, job->object);
+	  hash = fnv_hash (hash, url);
+	  sqlite3_free (url);
+      }
+    queue->completed = calloc (queue->count, sizeof (unsigned char));
+    if (queue->completed == NULL)
+      {
+	  fprintf (stderr, "WARNING: unable to open the journal\n");
+	  return;
+      }
+    queue->journal_path =
+	sqlite3_mprintf ("%s/%016llx.journal", params->tile_cache_dir, hash);
+    in = fopen (queue->journal_path, "r");
+    if (in != NULL)
+      {
+	  while (fgets (line, sizeof (line), in) != NULL)
+	    {
+		/* each request is only counted once */
+		if (sscanf (line, "%d %d", &tile_no, &object) != 2)
+		    continue;
+		k = find_journal_job (queue, tile_no, object);
+		if (k < 0 || queue->completed[k])
+		    continue;
+		queue->completed[k] = 1;
+		done++;
+	    }
+	  fclose (in);
+	  if (done > 0)
+	      printf
+		  ("resuming an interrupted download: %d of %d requests already completed\n",
+		   done, queue->count);
+      }
+    queue->journal = fopen (queue->journal_path, "a");
+    if (queue->journal == NULL)
+	fprintf (stderr, "WARNING: unable to open the journal \"%s\"\n",
+		 queue->journal_path);
+}
+
+static void
+close_journal (struct download_queue *queue, int completed)
+{
+/* closing the progress journal; a completed download needs no journal */
+    if (queue->journal != NULL)
+	fclose (queue->journal);
+    if (completed)
+	remove (queue->journal_path);
+    else
+	fprintf (stderr,
+		 "\nall completed requests are preserved in the tile cache: "
+		 "the download can be\nresumed by running again the same "
+		 "command [on a new output DB]\n");
+    sqlite3_free (queue->journal_path);
+    free (queue->completed);
+    queue->journal = NULL;
+    queue->journal_path = NULL;
+    queue->completed = NULL;
+}
+
+static void
+tile_done (struct download_queue *queue, struct download_job *job)
+{
+/* a tile has been inserted: updating the tile cache and the journal */
+    struct aux_params *params = queue->params;
+    if (params->tile_cache_dir == NULL)
+	return;
+    if (job->cached)
+	params->cached_tiles += 1;
+    else
+      {
+	  char *path = tile_cache_path (params, job);
+	  save_cached_tile (path, job);
+	  sqlite3_free (path);
+      }
+    if (queue->journal != NULL && !(queue->completed[job - queue->jobs]))
+      {
+	  /* already completed requests aren't recorded twice */
+	  queue->completed[job - queue->jobs] = 1;
+	  fprintf (queue->journal, "%d %d\n", job->tile->tile_no, job->object);
+	  fflush (queue->journal);
+      }
+}
+
+static int
+osm_insert (struct aux_params *params, struct download_job *job)
+{
+/* parsing an already downloaded tile and inserting it into the DBMS */
+    int ret;
+    xmlTextReaderPtr reader = NULL;
+    if (job->payload != NULL && !(job->cached))
+      {
+	  params->stats.requests += 1;
+	  params->stats.download_bytes += job->payload_size;
+	  params->stats.download_seconds += job->seconds;
+      }
+    if (job->payload != NULL)
+	reader =
+	    xmlReaderForMemory (job->payload, job->payload_size, NULL, NULL,
+				0);
+    if (reader == NULL)
+      {
+	  fprintf (stderr, "ERROR: unable to download the OSM dataset\n");
+	  return 0;
+      }
+    ret = parse_osm_stream (reader, params);
+    xmlFreeTextReader (reader);
+    return ret;
+}
+
+static int
+osm_http_read (void *context, char *buffer, int len)
+{
+/* reading the next chunk of a streamed response; timing the transfer */
+    struct osm_http_stream *stream = (struct osm_http_stream *) context;
+    double t0 = osm_clock ();
+    int rd = xmlNanoHTTPRead (stream->ctxt, buffer, len);
+    stream->stats->download_seconds += osm_clock () - t0;
+    if (rd > 0)
+	stream->stats->download_bytes += rd;
+    return rd;
+}
+
+static int
+osm_http_close (void *context)
+{
+/* closing a streamed response */
+    struct osm_http_stream *stream = (struct osm_http_stream *) context;
+    xmlNanoHTTPClose (stream->ctxt);
+    return 0;
+}
+
+static int
+osm_parse (struct aux_params *params, struct download_tile *tile, int object)
+{
+/* downloading, parsing and inserting a tile as a single stream */
+    int ret;
+    xmlTextReaderPtr reader;
+    struct osm_http_stream stream;
+    double t0 = osm_clock ();
+    char *url = osm_url (params, tile, object);
+    stream.ctxt = xmlNanoHTTPOpen (url, NULL);
+    stream.stats = &(params->stats);
+    params->stats.requests += 1;
+    params->stats.download_seconds += osm_clock () - t0;
+    reader = NULL;
+    if (stream.ctxt != NULL && xmlNanoHTTPReturnCode (stream.ctxt) != 200)
+      {
+	  /* an HTTP error page isn't an OSM dataset */
+	  xmlNanoHTTPClose (stream.ctxt);
+	  stream.ctxt = NULL;
+      }
+    if (stream.ctxt != NULL)
+	reader =
+	    xmlReaderForIO (osm_http_read, osm_http_close, &stream, url, NULL,
+			    0);
+    sqlite3_free (url);
+    if (reader == NULL)
+      {
+	  fprintf (stderr, "ERROR: unable to download the OSM dataset\n");
+	  return 0;
+      }
+    ret = parse_osm_stream (reader, params);
+    xmlFreeTextReader (reader);
+    return ret;
+}
+
+static int
+osm_parse_file (struct aux_params *params, const char *path)
+{
+/* parsing and inserting a local .osm file as a single stream */
+    int ret;
+    xmlTextReaderPtr reader = xmlReaderForFile (path, NULL, 0);
+    if (reader == NULL)
+      {
+	  fprintf (stderr, "ERROR: unable to open \"%s\"\n", path);
+	  return 0;
+      }
+    ret = parse_osm_stream (reader, params);
+    xmlFreeTextReader (reader);
+    return ret;
+}
+
+static void
+print_progress (struct download_job *job, int count)
+{
+/* printing the download progress */
+    if (job->object == OBJ_NODES)
+	printf
+	    ("Downloading and parsing OSM tile %d of %d - Nodes        \r",
+	     job->tile->tile_no, count);
+    else if (job->object == OBJ_WAYS)
+	printf
+	    ("Downloading and parsing OSM tile %d of %d - Ways          \r",
+	     job->tile->tile_no, count);
+    else if (job->object == OBJ_RELATIONS)
+	printf
+	    ("Downloading and parsing OSM tile %d of %d - Relations     \r",
+	     job->tile->tile_no, count);
+    else
+	printf ("Downloading and parsing OSM tile %d of %d\r",
+		job->tile->tile_no, count);
+}
+
+static int
+download_tiles (struct download_queue *queue, int tiles)
+{
+/* sequentially downloading and inserting all tiles */
+    int i;
+    struct download_job *job;
+    int ret;
+    for (i = 0; i < queue->count; i++)
+      {
+	  job = queue->jobs + i;
+	  print_progress (job, tiles);
+	  if (queue->params->tile_cache_dir == NULL)
+	    {
+		/* directly streaming from the Overpass server */
+		if (!osm_parse (queue->params, job->tile, job->object))
+		    return 0;
+		continue;
+	    }
+	  osm_fetch (queue->params, job);
+	  ret = osm_insert (queue->params, job);
+	  if (ret)
+	      tile_done (queue, job);
+	  free (job->payload);
+	  job->payload = NULL;
+	  if (!ret)
+	      return 0;
+      }
+    return 1;
+}
+
+#ifdef OSM_THREADS
+static void *
+download_worker (void *arg)
+{
+/* worker thread: downloading OSM tiles */
+    struct download_queue *queue = (struct download_queue *) arg;
+    struct download_job *job;
+    int k;
+    pthread_mutex_lock (&(queue->mutex));
+    while (!(queue->abort) && queue->next_job < queue->count)
+      {
+	  k = queue->next_job++;
+	  while (!(queue->abort) && k - queue->written >= queue->window)
+	      pthread_cond_wait (&(queue->cond), &(queue->mutex));
+	  if (queue->abort)
+	      break;
+	  pthread_mutex_unlock (&(queue->mutex));
+	  job = queue->jobs + k;
+	  osm_fetch (queue->params, job);
+	  pthread_mutex_lock (&(queue->mutex));
+	  job->ready = 1;
+	  pthread_cond_broadcast (&(queue->cond));
+      }
+    pthread_mutex_unlock (&(queue->mutex));
+    return NULL;
+}
+
+static int
+download_tiles_threaded (struct download_queue *queue, int tiles, int jobs)
+{
+/*
+/ downloading several tiles at once on a pool of worker threads;
+/ the main thread acts as the single SQLite writer, parsing and
+/ inserting each tile in the expected order as soon as it's
+/ ready [at most 2 * jobs downloaded tiles are buffered]
+*/
+    int i;
+    int ok = 1;
+    int n_workers = 0;
+    struct download_job *job;
+    pthread_t *workers = malloc (sizeof (pthread_t) * jobs);
+    if (!workers)
+	return download_tiles (queue, tiles);
+    queue->next_job = 0;
+    queue->written = 0;
+    queue->window = jobs * 2;
+    queue->abort = 0;
+    pthread_mutex_init (&(queue->mutex), NULL);
+    pthread_cond_init (&(queue->cond), NULL);
+/* libxml2 must be initialized before going multithreaded */
+    xmlInitParser ();
+    xmlNanoHTTPInit ();
+    for (i = 0; i < jobs; i++)
+      {
+	  if (pthread_create (workers + n_workers, NULL, download_worker, queue)
+	      == 0)
+	      n_workers++;
+      }
+    if (!n_workers)
+      {
+	  /* unable to start any thread; falling back to sequential mode */
+	  pthread_cond_destroy (&(queue->cond));
+	  pthread_mutex_destroy (&(queue->mutex));
+	  free (workers);
+	  return download_tiles (queue, tiles);
+      }
+    for (i = 0; i < queue->count && ok; i++)
+      {
+	  job = queue->jobs + i;
+	  pthread_mutex_lock (&(queue->mutex));
+	  while (!(job->ready))
+	      pthread_cond_wait (&(queue->cond), &(queue->mutex));
+	  pthread_mutex_unlock (&(queue->mutex));
+	  print_progress (job, tiles);
+	  if (osm_insert (queue->params, job))
+	      tile_done (queue, job);
+	  else
+	      ok = 0;
+	  free (job->payload);
+	  job->payload = NULL;
+	  pthread_mutex_lock (&(queue->mutex));
+	  queue->written += 1;
+	  if (!ok)
+	      queue->abort = 1;
+	  pthread_cond_broadcast (&(queue->cond));
+	  pthread_mutex_unlock (&(queue->mutex));
+      }
+    for (i = 0; i < n_workers; i++)
+	pthread_join (workers[i], NULL);
+    for (i = 0; i < queue->count; i++)
+      {
+	  /* freeing any payload left behind by an aborted run */
+	  job = queue->jobs + i;
+	  free (job->payload);
+	  job->payload = NULL;
+      }
+    pthread_cond_destroy (&(queue->cond));
+    pthread_mutex_destroy (&(queue->mutex));
+    free (workers);
+    return ok;
+}
+#endif
+
+static int
+download_all (struct aux_params *params, struct tiled_download *downloader,
+	      int jobs)
+{
+/* downloading and inserting all tiles [possibly in parallel] */
+    struct download_queue queue;
+    struct download_tile *tile;
+    int per_tile = 3;
+    int ret;
+    int i;
+    if (params->mode == MODE_ROAD || params->mode == MODE_RAIL)
+	per_tile = 1;
+    queue.params = params;
+    queue.count = 0;
+    queue.jobs =
+	malloc (sizeof (struct download_job) * downloader->count * per_tile);
+    if (queue.jobs == NULL)
+      {
+	  fprintf (stderr, "ERROR: insufficient memory\n");
+	  return 0;
+      }
+    tile = downloader->first;
+    while (tile != NULL)
+      {
+	  for (i = 0; i < per_tile; i++)
+	    {
+		struct download_job *job = queue.jobs + queue.count++;
+		job->tile = tile;
+		if (per_tile == 1)
+		    job->object = 0;
+		else
+		    job->object = OBJ_NODES + i;
+		job->payload = NULL;
+		job->payload_size = 0;
+		job->cached = 0;
+		job->ready = 0;
+	    }
+	  tile = tile->next;
+      }
+    queue.journal = NULL;
+    queue.journal_path = NULL;
+    queue.completed = NULL;
+    if (params->tile_cache_dir != NULL)
+	open_journal (&queue);
+#ifdef OSM_THREADS
+    if (jobs > 1)
+	ret = download_tiles_threaded (&queue, downloader->count, jobs);
+    else
+	ret = download_tiles (&queue, downloader->count);
+#else
+    ret = download_tiles (&queue, downloader->count);
+#endif
+    if (queue.journal_path != NULL)
+	close_journal (&queue, ret);
+    free (queue.jobs);
+    return ret;
+}
+
+#ifdef HAVE_ZLIB_H		/* only if ZLIB is available */
+
+static sqlite3_uint64
+pbf_varint (struct pbf_buffer *buf)
+{
+/* decoding a base-128 varint */
+    sqlite3_uint64 value = 0;
+    int shift = 0;
+    while (buf->p < buf->end && shift < 64)
+      {
+	  unsigned char c = *(buf->p++);
+	  value |= (sqlite3_uint64) (c & 0x7f) << shift;
+	  if (!(c & 0x80))
+	      return value;
+	  shift += 7;
+      }
+    buf->error = 1;
+    return 0;
+}
+
+static sqlite3_int64
+pbf_zigzag (sqlite3_uint64 value)
+{
+/* decoding a zigzag-encoded signed integer */
+    return (sqlite3_int64) (value >> 1) ^ -(sqlite3_int64) (value & 1);
+}
+
+static int
+pbf_next (struct pbf_buffer *buf, int *field, int *wire)
+{
+/* fetching the next field key; 0 at the end of the message */
+    sqlite3_uint64 key;
+    if (buf->error || buf->p >= buf->end)
+	return 0;
+    key = pbf_varint (buf);
+    *field = (int) (key >> 3);
+    *wire = (int) (key & 7);
+    return !(buf->error);
+}
+
+static void
+pbf_sub (struct pbf_buffer *buf, int wire, struct pbf_buffer *sub)
+{
+/* a length-delimited field: a nested message, a string or a packed array */
+    sqlite3_uint64 len = 0;
+    if (wire != 2)
+	buf->error = 1;
+    else
+	len = pbf_varint (buf);
+    if (!(buf->error) && len > (sqlite3_uint64) (buf->end - buf->p))
+	buf->error = 1;
+    sub->error = buf->error;
+    sub->p = buf->p;
+    if (buf->error)
+      {
+	  sub->end = buf->p;
+	  return;
+      }
+    sub->end = buf->p + len;
+    buf->p += len;
+}
+
+static void
+pbf_skip (struct pbf_buffer *buf, int wire)
+{
+/* skipping some unsupported field */
+    struct pbf_buffer sub;
+    switch (wire)
+      {
+      case 0:
+	  pbf_varint (buf);
+	  break;
+      case 1:
+	  if (buf->end - buf->p < 8)
+	      buf->error = 1;
+	  else
+	      buf->p += 8;
+	  break;
+      case 2:
+	  pbf_sub (buf, wire, &sub);
+	  break;
+      case 5:
+	  if (buf->end - buf->p < 4)
+	      buf->error = 1;
+	  else
+	      buf->p += 4;
+	  break;
+      default:
+	  buf->error = 1;
+	  break;
+      };
+}
+
+static void
+pbf_empty (struct pbf_buffer *buf)
+{
+/* initializing an empty (missing) field */
+    buf->p = NULL;
+    buf->end = NULL;
+    buf->error = 0;
+}
+
+static void *
+pbf_grow (void *items, int *max, int count, size_t size)
+{
+/* making room for one more item into a dynamic array */
+    void *grown;
+    int n;
+    if (count < *max)
+	return items;
+    n = (*max == 0) ? 1024 : *max * 2;
+    grown = realloc (items, size * n);
+    if (grown == NULL)
+	return NULL;
+    *max = n;
+    return grown;
+}
+
+static struct pbf_node *
+pbf_add_node (struct pbf_batch *batch)
+{
+/* appending a Node to a decoded block */
+    struct pbf_node *node;
+    void *items =
+	pbf_grow (batch->nodes, &(batch->max_nodes), batch->n_nodes,
+		  sizeof (struct pbf_node));
+    if (items == NULL)
+	return NULL;
+    batch->nodes = items;
+    node = batch->nodes + batch->n_nodes++;
+    node->version = -1;
+    node->timestamp = -1;
+    node->uid = -1;
+    node->changeset = -1;
+    node->user_sid = 0;
+    node->first_tag = batch->n_tags;
+    node->n_tags = 0;
+    return node;
+}
+
+static int
+pbf_add_tag (struct pbf_batch *batch, sqlite3_uint64 k, sqlite3_uint64 v)
+{
+/* appending a key/value pair to a decoded block */
+    void *items;
+    if (k >= (sqlite3_uint64) (batch->n_strings)
+	|| v >= (sqlite3_uint64) (batch->n_strings))
+	return 0;
+    items =
+	pbf_grow (batch->tags, &(batch->max_tags), batch->n_tags,
+		  sizeof (struct pbf_tag));
+    if (items == NULL)
+	return 0;
+    batch->tags = items;
+    batch->tags[batch->n_tags].k = (int) k;
+    batch->tags[batch->n_tags].v = (int) v;
+    batch->n_tags += 1;
+    return 1;
+}
+
+static int
+pbf_add_ref (struct pbf_batch *batch, sqlite3_int64 ref)
+{
+/* appending a Node ref to a decoded block */
+    void *items =
+	pbf_grow (batch->refs, &(batch->max_refs), batch->n_refs,
+		  sizeof (sqlite3_int64));
+    if (items == NULL)
+	return 0;
+    batch->refs = items;
+    batch->refs[batch->n_refs++] = ref;
+    return 1;
+}
+
+static int
+pbf_decode_tags (struct pbf_batch *batch, struct pbf_buffer *keys,
+		 struct pbf_buffer *vals, int *count)
+{
+/* decoding the parallel keys/vals arrays of a Node, Way or Relation */
+    while (keys->p < keys->end)
+      {
+	  sqlite3_uint64 k = pbf_varint (keys);
+	  sqlite3_uint64 v = pbf_varint (vals);
+	  if (keys->error || vals->error)
+	      return 0;
+	  if (!pbf_add_tag (batch, k, v))
+	      return 0;
+	  *count += 1;
+      }
+    return 1;
+}
+
+static sqlite3_int64
+pbf_timestamp (struct pbf_batch *batch, sqlite3_int64 timestamp)
+{
+/* converting a timestamp into seconds since the epoch */
+    return timestamp * batch->date_granularity / 1000;
+}
+
+static double
+pbf_degrees (struct pbf_batch *batch, sqlite3_int64 offset,
+	     sqlite3_int64 value)
+{
+/* converting a coordinate into degrees [correctly rounded] */
+    return (double) (offset + batch->granularity * value) / 1000000000.0;
+}
+
+static int
+pbf_decode_info (struct pbf_batch *batch, struct pbf_buffer *buf,
+		 struct pbf_node *node)
+{
+/* decoding the metadata of a (not dense) Node */
+    int field;
+    int wire;
+    while (pbf_next (buf, &field, &wire))
+      {
+	  if (field == 1 && wire == 0)
+	      node->version = (int) pbf_varint (buf);
+	  else if (field == 2 && wire == 0)
+	      node->timestamp =
+		  pbf_timestamp (batch, (sqlite3_int64) pbf_varint (buf));
+	  else if (field == 3 && wire == 0)
+	      node->changeset = (sqlite3_int64) pbf_varint (buf);
+	  else if (field == 4 && wire == 0)
+	      node->uid = (int) pbf_varint (buf);
+	  else if (field == 5 && wire == 0)
+	      node->user_sid = (int) pbf_varint (buf);
+	  else
+	      pbf_skip (buf, wire);
+      }
+    if (buf->error || node->user_sid < 0 || node->user_sid >= batch->n_strings)
+	return 0;
+    return 1;
+}
+
+static int
+pbf_decode_node (struct pbf_batch *batch, struct pbf_buffer *buf)
+{
+/* decoding a (not dense) Node */
+    struct pbf_buffer keys;
+    struct pbf_buffer vals;
+    struct pbf_buffer info;
+    sqlite3_int64 lat = 0;
+    sqlite3_int64 lon = 0;
+    int field;
+    int wire;
+    struct pbf_node *node = pbf_add_node (batch);
+    if (node == NULL)
+	return 0;
+    pbf_empty (&keys);
+    pbf_empty (&vals);
+    while (pbf_next (buf, &field, &wire))
+      {
+	  if (field == 1 && wire == 0)
+	      node->id = pbf_zigzag (pbf_varint (buf));
+	  else if (field == 2)
+	      pbf_sub (buf, wire, &keys);
+	  else if (field == 3)
+	      pbf_sub (buf, wire, &vals);
+	  else if (field == 4)
+	    {
+		pbf_sub (buf, wire, &info);
+		if (!pbf_decode_info (batch, &info, node))
+		    return 0;
+	    }
+	  else if (field == 8 && wire == 0)
+	      lat = pbf_zigzag (pbf_varint (buf));
+	  else if (field == 9 && wire == 0)
+	      lon = pbf_zigzag (pbf_varint (buf));
+	  else
+	      pbf_skip (buf, wire);
+      }
+    if (buf->error)
+	return 0;
+    node->x = pbf_degrees (batch, batch->lon_offset, lon);
+    node->y = pbf_degrees (batch, batch->lat_offset, lat);
+    return pbf_decode_tags (batch, &keys, &vals, &(node->n_tags));
+}
+
+static int
+pbf_decode_dense (struct pbf_batch *batch, struct pbf_buffer *buf)
+{
+/* decoding a DenseNodes group: all values are delta-encoded */
+    struct pbf_buffer ids;
+    struct pbf_buffer lats;
+    struct pbf_buffer lons;
+    struct pbf_buffer keys_vals;
+    struct pbf_buffer info;
+    struct pbf_buffer versions;
+    struct pbf_buffer timestamps;
+    struct pbf_buffer changesets;
+    struct pbf_buffer uids;
+    struct pbf_buffer user_sids;
+    sqlite3_int64 id = 0;
+    sqlite3_int64 lat = 0;
+    sqlite3_int64 lon = 0;
+    sqlite3_int64 timestamp = 0;
+    sqlite3_int64 changeset = 0;
+    sqlite3_int64 uid = 0;
+    sqlite3_int64 user_sid = 0;
+    int field;
+    int wire;
+    pbf_empty (&ids);
+    pbf_empty (&lats);
+    pbf_empty (&lons);
+    pbf_empty (&keys_vals);
+    pbf_empty (&versions);
+    pbf_empty (&timestamps);
+    pbf_empty (&changesets);
+    pbf_empty (&uids);
+    pbf_empty (&user_sids);
+    while (pbf_next (buf, &field, &wire))
+      {
+	  if (field == 1)
+	      pbf_sub (buf, wire, &ids);
+	  else if (field == 5)
+	    {
+		pbf_sub (buf, wire, &info);
+		while (pbf_next (&info, &field, &wire))
+		  {
+		      if (field == 1)
+			  pbf_sub (&info, wire, &versions);
+		      else if (field == 2)
+			  pbf_sub (&info, wire, &timestamps);
+		      else if (field == 3)
+			  pbf_sub (&info, wire, &changesets);
+		      else if (field == 4)
+			  pbf_sub (&info, wire, &uids);
+		      else if (field == 5)
+			  pbf_sub (&info, wire, &user_sids);
+		      else
+			  pbf_skip (&info, wire);
+		  }
+		if (info.error)
+		    return 0;
+	    }
+	  else if (field == 8)
+	      pbf_sub (buf, wire, &lats);
+	  else if (field == 9)
+	      pbf_sub (buf, wire, &lons);
+	  else if (field == 10)
+	      pbf_sub (buf, wire, &keys_vals);
+	  else
+	      pbf_skip (buf, wire);
+      }
+    if (buf->error)
+	return 0;
+    while (ids.p < ids.end)
+      {
+	  struct pbf_node *node = pbf_add_node (batch);
+	  if (node == NULL)
+	      return 0;
+	  id += pbf_zigzag (pbf_varint (&ids));
+	  lat += pbf_zigzag (pbf_varint (&lats));
+	  lon += pbf_zigzag (pbf_varint (&lons));
+	  node->id = id;
+	  node->x = pbf_degrees (batch, batch->lon_offset, lon);
+	  node->y = pbf_degrees (batch, batch->lat_offset, lat);
+	  if (versions.p < versions.end)
+	    {
+		/* optional metadata */
+		timestamp += pbf_zigzag (pbf_varint (&timestamps));
+		changeset += pbf_zigzag (pbf_varint (&changesets));
+		uid += pbf_zigzag (pbf_varint (&uids));
+		user_sid += pbf_zigzag (pbf_varint (&user_sids));
+		node->version = (int) pbf_varint (&versions);
+		node->timestamp = pbf_timestamp (batch, timestamp);
+		node->changeset = changeset;
+		node->uid = (int) uid;
+		node->user_sid = (int) user_sid;
+		if (user_sid < 0 || user_sid >= batch->n_strings)
+		    return 0;
+	    }
+	  while (keys_vals.p < keys_vals.end)
+	    {
+		/* tags are encoded as key/value pairs ending by a 0 */
+		sqlite3_uint64 k = pbf_varint (&keys_vals);
+		sqlite3_uint64 v;
+		if (k == 0)
+		    break;
+		v = pbf_varint (&keys_vals);
+		if (!pbf_add_tag (batch, k, v))
+		    return 0;
+		node->n_tags += 1;
+	    }
+      }
+    if (ids.error || lats.error || lons.error || keys_vals.error
+	|| versions.error || timestamps.error || changesets.error
+	|| uids.error || user_sids.error)
+	return 0;
+    return 1;
+}
+
+static int
+pbf_decode_way (struct pbf_batch *batch, struct pbf_buffer *buf)
+{
+/* decoding a Way: Node refs are delta-encoded */
+    struct pbf_way *way;
+    struct pbf_buffer keys;
+    struct pbf_buffer vals;
+    struct pbf_buffer refs;
+    sqlite3_int64 ref = 0;
+    int field;
+    int wire;
+    void *items =
+	pbf_grow (batch->ways, &(batch->max_ways), batch->n_ways,
+		  sizeof (struct pbf_way));
+    if (items == NULL)
+	return 0;
+    batch->ways = items;
+    way = batch->ways + batch->n_ways++;
+    way->id = 0;
+    way->first_tag = batch->n_tags;
+    way->n_tags = 0;
+    way->first_ref = batch->n_refs;
+    way->n_refs = 0;
+    pbf_empty (&keys);
+    pbf_empty (&vals);
+    pbf_empty (&refs);
+    while (pbf_next (buf, &field, &wire))
+      {
+	  if (field == 1 && wire == 0)
+	      way->id = (sqlite3_int64) pbf_varint (buf);
+	  else if (field == 2)
+	      pbf_sub (buf, wire, &keys);
+	  else if (field == 3)
+	      pbf_sub (buf, wire, &vals);
+	  else if (field == 8)
+	      pbf_sub (buf, wire, &refs);
+	  else
+	      pbf_skip (buf, wire);
+      }
+    if (buf->error)
+	return 0;
+    while (refs.p < refs.end)
+      {
+	  ref += pbf_zigzag (pbf_varint (&refs));
+	  if (!pbf_add_ref (batch, ref))
+	      return 0;
+	  way->n_refs += 1;
+      }
+    if (refs.error)
+	return 0;
+    return pbf_decode_tags (batch, &keys, &vals, &(way->n_tags));
+}
+
+static int
+pbf_decode_relation (struct pbf_batch *batch, struct pbf_buffer *buf)
+{
+/* decoding a Relation: member refs are delta-encoded */
+    struct pbf_relation *rel;
+    struct pbf_buffer keys;
+    struct pbf_buffer vals;
+    struct pbf_buffer roles;
+    struct pbf_buffer memids;
+    struct pbf_buffer types;
+    sqlite3_int64 ref = 0;
+    int field;
+    int wire;
+    void *items =
+	pbf_grow (batch->relations, &(batch->max_relations),
+		  batch->n_relations, sizeof (struct pbf_relation));
+    if (items == NULL)
+	return 0;
+    batch->relations = items;
+    rel = batch->relations + batch->n_relations++;
+    rel->id = 0;
+    rel->first_tag = batch->n_tags;
+    rel->n_tags = 0;
+    rel->first_member = batch->n_members;
+    rel->n_members = 0;
+    pbf_empty (&keys);
+    pbf_empty (&vals);
+    pbf_empty (&roles);
+    pbf_empty (&memids);
+    pbf_empty (&types);
+    while (pbf_next (buf, &field, &wire))
+      {
+	  if (field == 1 && wire == 0)
+	      rel->id = (sqlite3_int64) pbf_varint (buf);
+	  else if (field == 2)
+	      pbf_sub (buf, wire, &keys);
+	  else if (field == 3)
+	      pbf_sub (buf, wire, &vals);
+	  else if (field == 8)
+	      pbf_sub (buf, wire, &roles);
+	  else if (field == 9)
+	      pbf_sub (buf, wire, &memids);
+	  else if (field == 10)
+	      pbf_sub (buf, wire, &types);
+	  else
+	      pbf_skip (buf, wire);
+      }
+    if (buf->error)
+	return 0;
+    while (memids.p < memids.end)
+      {
+	  struct pbf_member *member;
+	  sqlite3_uint64 role = pbf_varint (&roles);
+	  sqlite3_uint64 type = pbf_varint (&types);
+	  ref += pbf_zigzag (pbf_varint (&memids));
+	  if (roles.error || types.error || memids.error)
+	      return 0;
+	  if (role >= (sqlite3_uint64) (batch->n_strings) || type > 2)
+	      return 0;
+	  items =
+	      pbf_grow (batch->members, &(batch->max_members),
+			batch->n_members, sizeof (struct pbf_member));
+	  if (items == NULL)
+	      return 0;
+	  batch->members = items;
+	  member = batch->members + batch->n_members++;
+	  member->ref = ref;
+	  member->type = (int) type;
+	  member->role = (int) role;
+	  rel->n_members += 1;
+      }
+    return pbf_decode_tags (batch, &keys, &vals, &(rel->n_tags));
+}
+
+static int
+pbf_decode_strings (struct pbf_batch *batch, struct pbf_buffer *buf)
+{
+/* decoding the StringTable into NUL-terminated strings */
+    struct pbf_buffer scan = *buf;
+    struct pbf_buffer str;
+    int field;
+    int wire;
+    int count = 0;
+    size_t len = 0;
+    char *out;
+    while (pbf_next (&scan, &field, &wire))
+      {
+	  if (field == 1)
+	    {
+		pbf_sub (&scan, wire, &str);
+		count++;
+		len += (str.end - str.p) + 1;
+	    }
+	  else
+	      pbf_skip (&scan, wire);
+      }
+    if (scan.error)
+	return 0;
+    batch->strings = malloc (sizeof (char *) * (count + 1));
+    batch->string_data = malloc (len + 1);
+    if (batch->strings == NULL || batch->string_data == NULL)
+	return 0;
+    out = batch->string_data;
+    while (pbf_next (buf, &field, &wire))
+      {
+	  if (field == 1)
+	    {
+		pbf_sub (buf, wire, &str);
+		memcpy (out, str.p, str.end - str.p);
+		batch->strings[batch->n_strings++] = out;
+		out += str.end - str.p;
+		*out++ = '\0';
+	    }
+	  else
+	      pbf_skip (buf, wire);
+      }
+    return !(buf->error);
+}
+
+static int
+pbf_decode_block (struct pbf_batch *batch, const unsigned char *data,
+		  size_t size)
+{
+/* decoding a PrimitiveBlock */
+    struct pbf_buffer buf;
+    struct pbf_buffer sub;
+    int field;
+    int wire;
+    int has_strings = 0;
+
+/* first pass: the StringTable and the coordinates encoding */
+    buf.p = data;
+    buf.end = data + size;
+    buf.error = 0;
+    while (pbf_next (&buf, &field, &wire))
+      {
+	  if (field == 1 && !has_strings)
+	    {
+		pbf_sub (&buf, wire, &sub);
+		if (!pbf_decode_strings (batch, &sub))
+		    return 0;
+		has_strings = 1;
+	    }
+	  else if (field == 17 && wire == 0)
+	      batch->granularity = (sqlite3_int64) pbf_varint (&buf);
+	  else if (field == 18 && wire == 0)
+	      batch->date_granularity = (sqlite3_int64) pbf_varint (&buf);
+	  else if (field == 19 && wire == 0)
+	      batch->lat_offset = (sqlite3_int64) pbf_varint (&buf);
+	  else if (field == 20 && wire == 0)
+	      batch->lon_offset = (sqlite3_int64) pbf_varint (&buf);
+	  else
+	      pbf_skip (&buf, wire);
+      }
+    if (buf.error || !has_strings)
+	return 0;
+
+/* second pass: the PrimitiveGroups */
+    buf.p = data;
+    while (pbf_next (&buf, &field, &wire))
+      {
+	  struct pbf_buffer group;
+	  int ret = 1;
+	  if (field != 2)
+	    {
+		pbf_skip (&buf, wire);
+		continue;
+	    }
+	  pbf_sub (&buf, wire, &group);
+	  while (ret && pbf_next (&group, &field, &wire))
+	    {
+		if (field < 1 || field > 4)
+		  {
+		      pbf_skip (&group, wire);
+		      continue;
+		  }
+		pbf_sub (&group, wire, &sub);
+		if (group.error)
+		    break;
+		if (field == 1)
+		    ret = pbf_decode_node (batch, &sub);
+		else if (field == 2)
+		    ret = pbf_decode_dense (batch, &sub);
+		else if (field == 3)
+		    ret = pbf_decode_way (batch, &sub);
+		else
+		    ret = pbf_decode_relation (batch, &sub);
+	    }
+	  if (!ret || group.error)
+	      return 0;
+      }
+    return !(buf.error);
+}
+
+static int
+pbf_check_header (const unsigned char *data, size_t size)
+{
+/* checking the HeaderBlock for any unsupported required feature */
+    struct pbf_buffer buf;
+    struct pbf_buffer str;
+    int field;
+    int wire;
+    buf.p = data;
+    buf.end = data + size;
+    buf.error = 0;
+    while (pbf_next (&buf, &field, &wire))
+      {
+	  if (field == 4)
+	    {
+		pbf_sub (&buf, wire, &str);
+		if (buf.error)
+		    break;
+		if ((str.end - str.p == 14
+		     && memcmp (str.p, "OsmSchema-V0.6", 14) == 0)
+		    || (str.end - str.p == 10
+			&& memcmp (str.p, "DenseNodes", 10) == 0))
+		    continue;
+		fprintf (stderr,
+			 "ERROR: unsupported PBF required feature \"%.*s\"\n",
+			 (int) (str.end - str.p), (const char *) (str.p));
+		return 0;
+	    }
+	  else
+	      pbf_skip (&buf, wire);
+      }
+    return !(buf.error);
+}
+
+static void
+pbf_batch_cleanup (struct pbf_batch *batch)
+{
+/* freeing a decoded block */
+    free (batch->strings);
+    free (batch->string_data);
+    free (batch->nodes);
+    free (batch->ways);
+    free (batch->relations);
+    free (batch->tags);
+    free (batch->refs);
+    free (batch->members);
+    memset (batch, 0, sizeof (struct pbf_batch));
+}
+
+static int
+pbf_read_blob (FILE * in, struct pbf_block *block)
+{
+/*
+/ reading the next fileblock (a BlobHeader followed by its Blob);
+/ returns 0 at the end of the file and -1 on errors
+*/
+    unsigned char len[4];
+    unsigned char header[65536];
+    struct pbf_buffer buf;
+    struct pbf_buffer type;
+    int field;
+    int wire;
+    size_t header_size;
+    sqlite3_uint64 data_size = 0;
+    size_t rd = fread (len, 1, 4, in);
+    if (rd == 0 && feof (in))
+	return 0;
+    if (rd != 4)
+	goto error;
+    header_size =
+	((size_t) len[0] << 24) | ((size_t) len[1] << 16) |
+	((size_t) len[2] << 8) | len[3];
+    if (header_size > sizeof (header))
+	goto error;
+    if (fread (header, 1, header_size, in) != header_size)
+	goto error;
+    buf.p = header;
+    buf.end = header + header_size;
+    buf.error = 0;
+    pbf_empty (&type);
+    while (pbf_next (&buf, &field, &wire))
+      {
+	  if (field == 1)
+	      pbf_sub (&buf, wire, &type);
+	  else if (field == 3 && wire == 0)
+	      data_size = pbf_varint (&buf);
+	  else
+	      pbf_skip (&buf, wire);
+      }
+    if (buf.error || data_size > 32 * 1024 * 1024)
+	goto error;
+    block->type = PBF_UNKNOWN;
+    if (type.end - type.p == 9 && memcmp (type.p, "OSMHeader", 9) == 0)
+	block->type = PBF_HEADER;
+    else if (type.end - type.p == 7 && memcmp (type.p, "OSMData", 7) == 0)
+	block->type = PBF_DATA;
+    block->blob = malloc (data_size + 1);
+    if (block->blob == NULL)
+	goto error;
+    block->blob_size = (int) data_size;
+    if (fread (block->blob, 1, data_size, in) != data_size)
+	goto error;
+    return 1;
+
+  error:
+    fprintf (stderr, "ERROR: invalid or truncated PBF file\n");
+    free (block->blob);
+    block->blob = NULL;
+    return -1;
+}
+
+static int
+pbf_decode_blob (struct pbf_block *block)
+{
+/* decompressing and decoding a fileblock */
+    struct pbf_buffer buf;
+    struct pbf_buffer raw;
+    struct pbf_buffer zlib_data;
+    int field;
+    int wire;
+    sqlite3_uint64 raw_size = 0;
+    unsigned char *inflated = NULL;
+    const unsigned char *data;
+    size_t size;
+    int ret = 0;
+
+    pbf_empty (&raw);
+    pbf_empty (&zlib_data);
+    buf.p = block->blob;
+    buf.end = block->blob + block->blob_size;
+    buf.error = 0;
+    while (pbf_next (&buf, &field, &wire))
+      {
+	  if (field == 1)
+	      pbf_sub (&buf, wire, &raw);
+	  else if (field == 2 && wire == 0)
+	      raw_size = pbf_varint (&buf);
+	  else if (field == 3)
+	      pbf_sub (&buf, wire, &zlib_data);
+	  else if (field >= 4 && field <= 7)
+	    {
+		fprintf (stderr,
+			 "ERROR: unsupported PBF compression (only zlib)\n");
+		goto stop;
+	    }
+	  else
+	      pbf_skip (&buf, wire);
+      }
+    if (buf.error)
+	goto error;
+    if (zlib_data.p != NULL)
+      {
+	  uLongf inflated_size = (uLongf) raw_size;
+	  if (raw_size > 32 * 1024 * 1024)
+	      goto error;
+	  inflated = malloc (raw_size + 1);
+	  if (inflated == NULL)
+	      goto error;
+	  if (uncompress
+	      (inflated, &inflated_size, zlib_data.p,
+	       (uLong) (zlib_data.end - zlib_data.p)) != Z_OK
+	      || inflated_size != raw_size)
+	      goto error;
+	  data = inflated;
+	  size = inflated_size;
+      }
+    else
+      {
+	  data = raw.p;
+	  size = raw.end - raw.p;
+      }
+    if (block->type == PBF_HEADER)
+	ret = pbf_check_header (data, size);
+    else if (block->type == PBF_DATA)
+      {
+	  block->batch.granularity = 100;
+	  block->batch.date_granularity = 1000;
+	  ret = pbf_decode_block (&(block->batch), data, size);
+	  if (!ret)
+	      goto error;
+      }
+    else
+	ret = 1;
+    goto stop;
+
+  error:
+    fprintf (stderr, "ERROR: invalid PBF fileblock\n");
+    ret = 0;
+  stop:
+    free (inflated);
+    free (block->blob);
+    block->blob = NULL;
+    return ret;
+}
+
+static int
+pbf_has_key (struct pbf_batch *batch, int first_tag, int n_tags,
+	     const char *key)
+{
+/* checking if some object has a tag with the given key */
+    int i;
+    for (i = first_tag; i < first_tag + n_tags; i++)
+      {
+	  if (strcmp (batch->strings[batch->tags[i].k], key) == 0)
+	      return 1;
+      }
+    return 0;
+}
+
+static int
+pbf_insert_batch (struct aux_params *params, struct pbf_batch *batch)
+{
+/* inserting a decoded block into the DBMS */
+    static const char *member_types[] = { "node", "way", "relation" };
+    int i;
+    int j;
+    params->stats.parse_elements +=
+	batch->n_nodes + batch->n_ways + batch->n_relations;
+    for (i = 0; i < batch->n_nodes; i++)
+      {
+	  struct pbf_node *node = batch->nodes + i;
+	  struct pbf_tag *tag;
+	  char timestamp[64];
+	  const char *ts = NULL;
+	  const char *user = NULL;
+	  if (params->filter_key != NULL
+	      && (params->collecting
+		  || !test_seen_id (&(params->wanted_nodes), node->id)))
+	      continue;
+	  if (check_seen_id (&(params->seen_nodes), node->id))
+	      continue;
+	  if (params->mode == MODE_RAW)
+	    {
+		/* formatting the metadata just as the XML <node> attributes */
+		if (node->timestamp >= 0)
+		  {
+		      time_t t = (time_t) (node->timestamp);
+		      struct tm *tm = gmtime (&t);
+		      if (tm != NULL
+			  && strftime (timestamp, sizeof (timestamp),
+				       "%Y-%m-%dT%H:%M:%SZ", tm) > 0)
+			  ts = timestamp;
+		  }
+		if (node->user_sid > 0)
+		    user = batch->strings[node->user_sid];
+	    }
+	  if (!insert_node
+	      (params, node->id, node->x, node->y, node->version, ts,
+	       node->uid, (int) (node->changeset), user))
+	      return 0;
+	  for (j = 0; j < node->n_tags; j++)
+	    {
+		tag = batch->tags + node->first_tag + j;
+		if (!insert_node_tag
+		    (params, batch->strings[tag->k], batch->strings[tag->v]))
+		    return 0;
+	    }
+      }
+    for (i = 0; i < batch->n_ways; i++)
+      {
+	  struct pbf_way *way = batch->ways + i;
+	  struct pbf_tag *tag;
+	  if (params->filter_key != NULL)
+	    {
+		/* ROAD/RAIL: only the relevant Ways */
+		if (!pbf_has_key
+		    (batch, way->first_tag, way->n_tags, params->filter_key))
+		    continue;
+		if (params->collecting)
+		  {
+		      for (j = 0; j < way->n_refs; j++)
+			  check_seen_id (&(params->wanted_nodes),
+					 batch->refs[way->first_ref + j]);
+		      continue;
+		  }
+	    }
+	  if (check_seen_id (&(params->seen_ways), way->id))
+	      continue;
+	  if (!insert_way (params, way->id))
+	      return 0;
+	  for (j = 0; j < way->n_refs; j++)
+	    {
+		if (!insert_way_ref (params, batch->refs[way->first_ref + j]))
+		    return 0;
+	    }
+	  for (j = 0; j < way->n_tags; j++)
+	    {
+		tag = batch->tags + way->first_tag + j;
+		if (!insert_way_tag
+		    (params, batch->strings[tag->k], batch->strings[tag->v]))
+		    return 0;
+	    }
+      }
+    if (params->filter_key != NULL)
+	return 1;
+    for (i = 0; i < batch->n_relations; i++)
+      {
+	  struct pbf_relation *rel = batch->relations + i;
+	  struct pbf_member *member;
+	  struct pbf_tag *tag;
+	  if (check_seen_id (&(params->seen_relations), rel->id))
+	      continue;
+	  if (!insert_relation (params, rel->id))
+	      return 0;
+	  for (j = 0; j < rel->n_members; j++)
+	    {
+		member = batch->members + rel->first_member + j;
+		if (!insert_relation_ref
+		    (params, member_types[member->type], member->ref,
+		     batch->strings[member->role]))
+		    return 0;
+	    }
+	  for (j = 0; j < rel->n_tags; j++)
+	    {
+		tag = batch->tags + rel->first_tag + j;
+		if (!insert_relation_tag
+		    (params, batch->strings[tag->k], batch->strings[tag->v]))
+		    return 0;
+	    }
+      }
+    return 1;
+}
+
+static int
+pbf_load_sequential (struct aux_params *params, struct pbf_queue *queue)
+{
+/* sequentially reading, decoding and inserting all fileblocks */
+    struct pbf_block *block = queue->blocks;
+    int ok;
+    int ret;
+    double t0;
+    while (1)
+      {
+	  ret = pbf_read_blob (queue->in, block);
+	  if (ret <= 0)
+	      return (ret == 0) ? 1 : 0;
+	  queue->count += 1;
+	  printf ("Parsing OSM file: block %d\r", queue->count);
+	  t0 = osm_clock ();
+	  ok = pbf_decode_blob (block);
+	  params->stats.parse_seconds += osm_clock () - t0;
+	  if (ok)
+	      ok = pbf_insert_batch (params, &(block->batch));
+	  pbf_batch_cleanup (&(block->batch));
+	  if (!ok)
+	      return 0;
+      }
+}
+
+#ifdef OSM_THREADS
+static void *
+pbf_worker (void *arg)
+{
+/* worker thread: reading and decoding PBF fileblocks */
+    struct pbf_queue *queue = (struct pbf_queue *) arg;
+    struct pbf_block *block;
+    int ret;
+    double t0;
+    pthread_mutex_lock (&(queue->mutex));
+    while (1)
+      {
+	  while (!(queue->abort) && !(queue->eof)
+		 && queue->count - queue->written >= queue->window)
+	      pthread_cond_wait (&(queue->cond), &(queue->mutex));
+	  if (queue->abort || queue->eof)
+	      break;
+	  /* fileblocks are sequentially read while holding the lock */
+	  block = queue->blocks + (queue->count % queue->window);
+	  ret = pbf_read_blob (queue->in, block);
+	  if (ret <= 0)
+	    {
+		if (ret < 0)
+		    queue->error = 1;
+		queue->eof = 1;
+		pthread_cond_broadcast (&(queue->cond));
+		break;
+	    }
+	  queue->count += 1;
+	  pthread_mutex_unlock (&(queue->mutex));
+	  t0 = osm_clock ();
+	  block->ok = pbf_decode_blob (block);
+	  block->seconds = osm_clock () - t0;
+	  pthread_mutex_lock (&(queue->mutex));
+	  block->ready = 1;
+	  pthread_cond_broadcast (&(queue->cond));
+      }
+    pthread_mutex_unlock (&(queue->mutex));
+    return NULL;
+}
+
+static int
+pbf_load_threaded (struct aux_params *params, struct pbf_queue *queue,
+		   int jobs)
+{
+/*
+/ decompressing and decoding several fileblocks at once on a pool
+/ of worker threads; the main thread acts as the single SQLite
+/ writer, inserting each block in the file order as soon as it's
+/ ready [at most 2 * jobs decoded blocks are buffered]
+*/
+    int i;
+    int k;
+    int ok = 1;
+    int done;
+    int n_workers = 0;
+    struct pbf_block *block;
+    pthread_t *workers = malloc (sizeof (pthread_t) * jobs);
+    if (!workers)
+	return pbf_load_sequential (params, queue);
+    queue->written = 0;
+    queue->abort = 0;
+    pthread_mutex_init (&(queue->mutex), NULL);
+    pthread_cond_init (&(queue->cond), NULL);
+    for (i = 0; i < jobs; i++)
+      {
+	  if (pthread_create (workers + n_workers, NULL, pbf_worker, queue)
+	      == 0)
+	      n_workers++;
+      }
+    if (!n_workers)
+      {
+	  /* unable to start any thread; falling back to sequential mode */
+	  pthread_cond_destroy (&(queue->cond));
+	  pthread_mutex_destroy (&(queue->mutex));
+	  free (workers);
+	  return pbf_load_sequential (params, queue);
+      }
+    for (k = 0; ok; k++)
+      {
+	  block = queue->blocks + (k % queue->window);
+	  pthread_mutex_lock (&(queue->mutex));
+	  while (!(k < queue->count && block->ready)
+		 && !(queue->eof && k >= queue->count))
+	      pthread_cond_wait (&(queue->cond), &(queue->mutex));
+	  done = (k >= queue->count);
+	  pthread_mutex_unlock (&(queue->mutex));
+	  if (done)
+	      break;
+	  printf ("Parsing OSM file: block %d\r", k + 1);
+	  params->stats.parse_seconds += block->seconds;
+	  if (!(block->ok) || !pbf_insert_batch (params, &(block->batch)))
+	      ok = 0;
+	  pbf_batch_cleanup (&(block->batch));
+	  pthread_mutex_lock (&(queue->mutex));
+	  block->ready = 0;
+	  queue->written += 1;
+	  if (!ok)
+	      queue->abort = 1;
+	  pthread_cond_broadcast (&(queue->cond));
+	  pthread_mutex_unlock (&(queue->mutex));
+      }
+    for (i = 0; i < n_workers; i++)
+	pthread_join (workers[i], NULL);
+    if (queue->error)
+	ok = 0;
+    pthread_cond_destroy (&(queue->cond));
+    pthread_mutex_destroy (&(queue->mutex));
+    free (workers);
+    return ok;
+}
+#endif
+
+static int
+load_pbf_file (struct aux_params *params, const char *path, int jobs)
+{
+/* loading a local .osm.pbf file [possibly decoding in parallel] */
+    struct pbf_queue queue;
+    int ret;
+    int i;
+    queue.in = fopen (path, "rb");
+    if (queue.in == NULL)
+      {
+	  fprintf (stderr, "ERROR: unable to open \"%s\"\n", path);
+	  return 0;
+      }
+    queue.window = jobs * 2;
+    queue.count = 0;
+    queue.eof = 0;
+    queue.error = 0;
+    queue.blocks = calloc (queue.window, sizeof (struct pbf_block));
+    if (queue.blocks == NULL)
+      {
+	  fprintf (stderr, "ERROR: insufficient memory\n");
+	  fclose (queue.in);
+	  return 0;
+      }
+#ifdef OSM_THREADS
+    if (jobs > 1)
+	ret = pbf_load_threaded (params, &queue, jobs);
+    else
+	ret = pbf_load_sequential (params, &queue);
+#else
+    ret = pbf_load_sequential (params, &queue);
+#endif
+    for (i = 0; i < queue.window; i++)
+      {
+	  /* freeing any block left behind by an aborted run */
+	  free (queue.blocks[i].blob);
+	  pbf_batch_cleanup (&(queue.blocks[i].batch));
+      }
+    free (queue.blocks);
+    fclose (queue.in);
+    return ret;
+}
+
+#else /* ZLIB isn't available */
+
+static int
+load_pbf_file (struct aux_params *params, const char *path, int jobs)
+{
+/* PBF support requires ZLIB */
+    fprintf (stderr,
+	     "ERROR: \"%s\": this build doesn't support .osm.pbf files\n",
+	     path);
+    return 0;
+}
+
+#endif /* end ZLIB conditional */
+
+static int
+load_osm_file (struct aux_params *params, const char *path, int jobs)
+{
+/*
+/ loading a local .osm or .osm.pbf file; in ROAD/RAIL mode a first
+/ pass collects the Nodes referenced by the relevant Ways, so that
+/ the very same objects an Overpass query would return get loaded
+*/
+    int len = strlen (path);
+    int pbf = 0;
+    int ret;
+    if (len > 4 && strcasecmp (path + len - 4, ".pbf") == 0)
+	pbf = 1;
+    if (params->mode == MODE_ROAD)
+	params->filter_key = "highway";
+    else if (params->mode == MODE_RAIL)
+	params->filter_key = "railway";
+    if (params->filter_key != NULL)
       {
-	  /* parsing error; not a well-formed XML */
-	  fprintf (stderr, "ERROR: unable to download the OSM dataset\n");
-	  error = 1;
-	  goto end;
+	  params->collecting = 1;
+	  if (pbf)
+	      ret = load_pbf_file (params, path, jobs);
+	  else
+	      ret = osm_parse_file (params, path);
+	  params->collecting = 0;
+	  if (!ret)
+	      return 0;
       }
-
-/* parsing the OSM payload */
-    root = xmlDocGetRootElement (xml_doc);
-    if (!parse_osm_items (root, params))
-	error = 1;
-
-  end:
-    sqlite3_free (url);
-    if (xml_doc != NULL)
-	xmlFreeDoc (xml_doc);
-    if (error)
-	return 0;
-    return 1;
+    if (pbf)
+	ret = load_pbf_file (params, path, jobs);
+    else
+	ret = osm_parse_file (params, path);
+    seen_ids_cleanup (&(params->wanted_nodes));
+    return ret;
 }
 
-static void
+static int
 finalize_sql_stmts (struct aux_params *params)
 {
     int ret;
+    int ok = 1;
     char *sql_err = NULL;
 
+/* inserting any still buffered row */
+    if (!flush_batch (params, &(params->nodes_batch)))
+	ok = 0;
+    if (!flush_batch (params, &(params->node_tags_batch)))
+	ok = 0;
+    if (!flush_batch (params, &(params->ways_batch)))
+	ok = 0;
+    if (!flush_batch (params, &(params->way_tags_batch)))
+	ok = 0;
+    if (!flush_batch (params, &(params->way_refs_batch)))
+	ok = 0;
+    if (!flush_batch (params, &(params->relations_batch)))
+	ok = 0;
+    if (!flush_batch (params, &(params->relation_tags_batch)))
+	ok = 0;
+    if (!flush_batch (params, &(params->relation_refs_batch)))
+	ok = 0;
+    batch_cleanup (&(params->nodes_batch));
+    batch_cleanup (&(params->node_tags_batch));
+    batch_cleanup (&(params->ways_batch));
+    batch_cleanup (&(params->way_tags_batch));
+    batch_cleanup (&(params->way_refs_batch));
+    batch_cleanup (&(params->relations_batch));
+    batch_cleanup (&(params->relation_tags_batch));
+    batch_cleanup (&(params->relation_refs_batch));
+
     if (params->ins_nodes_stmt != NULL)
 	sqlite3_finalize (params->ins_nodes_stmt);
     if (params->ins_node_tags_stmt != NULL)
@@ -1022,13 +3870,15 @@ finalize_sql_stmts (struct aux_params *params)
       {
 	  fprintf (stderr, "COMMIT TRANSACTION error: %s\n", sql_err);
 	  sqlite3_free (sql_err);
-	  return;
+	  return 0;
       }
+    return ok;
 }
 
-static void
+static int
 create_sql_stmts (struct aux_params *params, int journal_off)
 {
+/* creating the prepared statements and the batches; 0 on failure */
     sqlite3_stmt *ins_nodes_stmt;
     sqlite3_stmt *ins_node_tags_stmt;
     sqlite3_stmt *ins_ways_stmt;
@@ -1052,7 +3902,7 @@ create_sql_stmts (struct aux_params *params, int journal_off)
 		fprintf (stderr, "PRAGMA journal_mode=OFF error: %s\n",
 			 sql_err);
 		sqlite3_free (sql_err);
-		return;
+		return 0;
 	    }
       }
 
@@ -1062,7 +3912,7 @@ create_sql_stmts (struct aux_params *params, int journal_off)
       {
 	  fprintf (stderr, "BEGIN TRANSACTION error: %s\n", sql_err);
 	  sqlite3_free (sql_err);
-	  return;
+	  return 0;
       }
     if (params->mode == MODE_RAW)
       {
@@ -1080,7 +3930,7 @@ create_sql_stmts (struct aux_params *params, int journal_off)
 	  fprintf (stderr, "SQL error: %s\n%s\n", sql,
 		   sqlite3_errmsg (params->db_handle));
 	  finalize_sql_stmts (params);
-	  return;
+	  return 0;
       }
     strcpy (sql, "INSERT INTO osm_node_tags (node_id, sub, k, v) ");
     strcat (sql, "VALUES (?, ?, ?, ?)");
@@ -1092,7 +3942,7 @@ create_sql_stmts (struct aux_params *params, int journal_off)
 	  fprintf (stderr, "SQL error: %s\n%s\n", sql,
 		   sqlite3_errmsg (params->db_handle));
 	  finalize_sql_stmts (params);
-	  return;
+	  return 0;
       }
     strcpy (sql, "INSERT INTO osm_ways (way_id) VALUES (?)");
     ret =
@@ -1103,7 +3953,7 @@ create_sql_stmts (struct aux_params *params, int journal_off)
 	  fprintf (stderr, "SQL error: %s\n%s\n", sql,
 		   sqlite3_errmsg (params->db_handle));
 	  finalize_sql_stmts (params);
-	  return;
+	  return 0;
       }
     strcpy (sql, "INSERT INTO osm_way_tags (way_id, sub, k, v) ");
     strcat (sql, "VALUES (?, ?, ?, ?)");
@@ -1115,7 +3965,7 @@ create_sql_stmts (struct aux_params *params, int journal_off)
 	  fprintf (stderr, "SQL error: %s\n%s\n", sql,
 		   sqlite3_errmsg (params->db_handle));
 	  finalize_sql_stmts (params);
-	  return;
+	  return 0;
       }
     strcpy (sql, "INSERT INTO osm_way_refs (way_id, sub, node_id) ");
     strcat (sql, "VALUES (?, ?, ?)");
@@ -1127,7 +3977,7 @@ create_sql_stmts (struct aux_params *params, int journal_off)
 	  fprintf (stderr, "SQL error: %s\n%s\n", sql,
 		   sqlite3_errmsg (params->db_handle));
 	  finalize_sql_stmts (params);
-	  return;
+	  return 0;
       }
     strcpy (sql, "INSERT INTO osm_relations (rel_id) VALUES (?)");
     ret =
@@ -1138,7 +3988,7 @@ create_sql_stmts (struct aux_params *params, int journal_off)
 	  fprintf (stderr, "SQL error: %s\n%s\n", sql,
 		   sqlite3_errmsg (params->db_handle));
 	  finalize_sql_stmts (params);
-	  return;
+	  return 0;
       }
     strcpy (sql, "INSERT INTO osm_relation_tags (rel_id, sub, k, v) ");
     strcat (sql, "VALUES (?, ?, ?, ?)");
@@ -1150,7 +4000,7 @@ create_sql_stmts (struct aux_params *params, int journal_off)
 	  fprintf (stderr, "SQL error: %s\n%s\n", sql,
 		   sqlite3_errmsg (params->db_handle));
 	  finalize_sql_stmts (params);
-	  return;
+	  return 0;
       }
     strcpy (sql,
 	    "INSERT INTO osm_relation_refs (rel_id, sub, type, ref, role) ");
@@ -1163,7 +4013,7 @@ create_sql_stmts (struct aux_params *params, int journal_off)
 	  fprintf (stderr, "SQL error: %s\n%s\n", sql,
 		   sqlite3_errmsg (params->db_handle));
 	  finalize_sql_stmts (params);
-	  return;
+	  return 0;
       }
 
     params->ins_nodes_stmt = ins_nodes_stmt;
@@ -1174,6 +4024,43 @@ create_sql_stmts (struct aux_params *params, int journal_off)
     params->ins_relations_stmt = ins_relations_stmt;
     params->ins_relation_tags_stmt = ins_relation_tags_stmt;
     params->ins_relation_refs_stmt = ins_relation_refs_stmt;
+
+/* preparing the batched INSERTs */
+    if (!prepare_batch
+	(&(params->nodes_batch), ins_nodes_stmt, &(params->wr_nodes), NULL)
+	|| !prepare_batch (&(params->node_tags_batch), ins_node_tags_stmt,
+			   &(params->wr_node_tags), &(params->nodes_batch))
+	|| !prepare_batch (&(params->ways_batch), ins_ways_stmt,
+			   &(params->wr_ways), NULL)
+	|| !prepare_batch (&(params->way_tags_batch), ins_way_tags_stmt,
+			   &(params->wr_way_tags), &(params->ways_batch))
+	|| !prepare_batch (&(params->way_refs_batch), ins_way_refs_stmt,
+			   &(params->wr_way_refs), &(params->ways_batch))
+	|| !prepare_batch (&(params->relations_batch), ins_relations_stmt,
+			   &(params->wr_relations), NULL)
+	|| !prepare_batch (&(params->relation_tags_batch),
+			   ins_relation_tags_stmt, &(params->wr_rel_tags),
+			   &(params->relations_batch))
+	|| !prepare_batch (&(params->relation_refs_batch),
+			   ins_relation_refs_stmt, &(params->wr_rel_refs),
+			   &(params->relations_batch)))
+      {
+	  fprintf (stderr, "ERROR: insufficient memory\n");
+	  finalize_sql_stmts (params);
+	  return 0;
+      }
+    if (params->mode != MODE_RAW)
+      {
+	  /* Node locations are cached as soon as they get inserted */
+	  params->nodes_batch.coords = malloc (sizeof (double) * OSM_BATCH * 2);
+	  if (params->nodes_batch.coords == NULL)
+	    {
+		fprintf (stderr, "ERROR: insufficient memory\n");
+		finalize_sql_stmts (params);
+		return 0;
+	    }
+      }
+    return 1;
 }
 
 static void
@@ -1226,32 +4113,6 @@ create_road_tables (struct aux_params *params)
     char sql[1024];
     char *err_msg = NULL;
 
-/* creating OSM helper nodes */
-    strcpy (sql, "CREATE TABLE osm_helper_nodes (\n");
-    strcat (sql, "node_id INTEGER NOT NULL PRIMARY KEY,\n");
-    strcat (sql, "way_count INTEGER NOT NULL)\n");
-    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "CREATE TABLE 'osm_helper_nodes' error: %s\n",
-		   err_msg);
-	  sqlite3_free (err_msg);
-	  return 0;
-      }
-/* populating OSM helper nodes */
-    strcpy (sql, "INSERT INTO osm_helper_nodes (node_id, way_count) ");
-    strcat (sql, "SELECT n.node_id, Count(*) FROM osm_nodes AS n ");
-    strcat (sql, "JOIN osm_way_refs AS w ON (w.node_id = n.node_id) ");
-    strcat (sql, "GROUP BY n.node_id");
-    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "INSERT INTO 'osm_helper_nodes' error: %s\n",
-		   err_msg);
-	  sqlite3_free (err_msg);
-	  return 0;
-      }
-
 /* creating ROAD nodes */
     strcpy (sql, "CREATE TABLE road_nodes (\n");
     strcat (sql, "node_id INTEGER NOT NULL PRIMARY KEY)\n");
@@ -1356,26 +4217,141 @@ create_road_rtrees (struct aux_params *params)
 }
 
 static void
-add_arc (struct aux_arc_container *arcs, sqlite3_int64 nd_first,
-	 sqlite3_int64 nd_last, double x_ini, double y_ini, double x_end,
-	 double y_end, gaiaDynamicLinePtr dyn_line, int count)
+way_refs_cleanup (struct way_refs_cache *refs)
+{
+/* freeing the Way-Node refs cache */
+    if (refs->way_ids != NULL)
+	free (refs->way_ids);
+    if (refs->node_idx != NULL)
+	free (refs->node_idx);
+    if (refs->way_count != NULL)
+	free (refs->way_count);
+    if (refs->inserted != NULL)
+	free (refs->inserted);
+    refs->way_ids = NULL;
+    refs->node_idx = NULL;
+    refs->way_count = NULL;
+    refs->inserted = NULL;
+    refs->count = 0;
+    refs->max = 0;
+}
+
+static int
+load_way_refs (struct aux_params *params, struct way_refs_cache *refs)
+{
+/*
+/ loading all Way-Node refs in a single pass, and counting
+/ how many refs point to each Node [junctions have more than one]
+*/
+    int ret;
+    sqlite3_stmt *stmt = NULL;
+    const char *sql;
+    struct node_coord_cache *coords = &(params->node_coords);
+    size_t n = (coords->count > 0) ? coords->count : 1;
+
+    refs->way_count = calloc (n, sizeof (int));
+    refs->inserted = calloc (n, sizeof (unsigned char));
+    if (refs->way_count == NULL || refs->inserted == NULL)
+	goto no_memory;
+    sql = "SELECT way_id, node_id FROM osm_way_refs ORDER BY way_id, sub";
+    ret =
+	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql), &stmt,
+			    NULL);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "SQL error: %s\n",
+		   sqlite3_errmsg (params->db_handle));
+	  return 0;
+      }
+    while (1)
+      {
+	  /* scrolling the result set */
+	  int idx;
+	  ret = sqlite3_step (stmt);
+	  if (ret == SQLITE_DONE)
+	    {
+		/* there are no more rows to fetch - we can stop looping */
+		break;
+	    }
+	  if (ret != SQLITE_ROW)
+	    {
+		/* some unexpected error occurred */
+		fprintf (stderr, "sqlite3_step() error: %s\n",
+			 sqlite3_errmsg (params->db_handle));
+		sqlite3_finalize (stmt);
+		return 0;
+	    }
+	  if (refs->count == refs->max)
+	    {
+		int max = (refs->max == 0) ? 65536 : refs->max * 2;
+		sqlite3_int64 *way_ids =
+		    realloc (refs->way_ids, sizeof (sqlite3_int64) * max);
+		int *node_idx;
+		if (way_ids == NULL)
+		    goto no_memory;
+		refs->way_ids = way_ids;
+		node_idx = realloc (refs->node_idx, sizeof (int) * max);
+		if (node_idx == NULL)
+		    goto no_memory;
+		refs->node_idx = node_idx;
+		refs->max = max;
+	    }
+	  idx = find_node_index (coords, sqlite3_column_int64 (stmt, 1));
+	  refs->way_ids[refs->count] = sqlite3_column_int64 (stmt, 0);
+	  refs->node_idx[refs->count] = idx;
+	  refs->count += 1;
+	  if (idx >= 0)
+	      refs->way_count[idx] += 1;
+      }
+    sqlite3_finalize (stmt);
+    return 1;
+
+  no_memory:
+    fprintf (stderr, "ERROR: insufficient memory\n");
+    if (stmt != NULL)
+	sqlite3_finalize (stmt);
+    return 0;
+}
+
+static int
+find_way_refs (struct way_refs_cache *refs, sqlite3_int64 way_id)
+{
+/* retrieving the position of the first ref of some Way; -1 if missing */
+    int lo = 0;
+    int hi = refs->count;
+    while (lo < hi)
+      {
+	  int mid = lo + (hi - lo) / 2;
+	  if (refs->way_ids[mid] < way_id)
+	      lo = mid + 1;
+	  else
+	      hi = mid;
+      }
+    if (lo < refs->count && refs->way_ids[lo] == way_id)
+	return lo;
+    return -1;
+}
+
+static void
+add_arc (struct aux_arc_container *arcs, struct node_coord_cache *coords,
+	 int idx_first, int idx_last, gaiaDynamicLinePtr dyn_line, int count)
 {
 /* adding a further Arc to the container */
     int iv;
     gaiaGeomCollPtr g;
     gaiaPointPtr pt;
     gaiaLinestringPtr ln;
-    struct aux_arc *arc = malloc (sizeof (struct aux_arc));
-    arc->node_from = nd_first;
-    arc->node_to = nd_last;
-    g = gaiaAllocGeomColl ();
-    gaiaAddPointToGeomColl (g, x_ini, y_ini);
-    g->Srid = 4326;
-    arc->geom_from = g;
-    g = gaiaAllocGeomColl ();
-    gaiaAddPointToGeomColl (g, x_end, y_end);
-    g->Srid = 4326;
-    arc->geom_to = g;
+    struct aux_arc *arc;
+    if (idx_first < 0 || idx_last < 0 || count < 2)
+      {
+	  /* not a valid Arc: less than two resolved Nodes */
+	  return;
+      }
+    arc = malloc (sizeof (struct aux_arc));
+    arc->node_from = coords->items[idx_first].node_id;
+    arc->node_to = coords->items[idx_last].node_id;
+    arc->idx_from = idx_first;
+    arc->idx_to = idx_last;
     g = gaiaAllocGeomColl ();
     ln = gaiaAddLinestringToGeomColl (g, count);
     iv = 0;
@@ -1397,85 +4373,164 @@ add_arc (struct aux_arc_container *arcs, sqlite3_int64 nd_first,
     arcs->last = arc;
 }
 
-static int
-build_arc (sqlite3 * sqlite, sqlite3_stmt * query_nodes_stmt, sqlite3_int64 id,
-	   struct aux_arc_container *arcs)
+static void
+build_arc (struct node_coord_cache *coords, struct way_refs_cache *refs,
+	   sqlite3_int64 id, struct aux_arc_container *arcs)
 {
-/* building an Arc */
-    int ret;
-    sqlite3_int64 nd_first;
-    sqlite3_int64 nd_last;
+/* building an Arc, split on every junction */
+    int i;
+    int idx_first = -1;
+    int idx_last = -1;
     int count = 0;
-    double x_ini;
-    double y_ini;
-    double x_end;
-    double y_end;
-    gaiaDynamicLinePtr dyn_line = gaiaAllocDynamicLine ();
+    gaiaDynamicLinePtr dyn_line;
 
-    sqlite3_reset (query_nodes_stmt);
-    sqlite3_clear_bindings (query_nodes_stmt);
-    sqlite3_bind_int64 (query_nodes_stmt, 1, id);
-    while (1)
+    i = find_way_refs (refs, id);
+    if (i < 0)
+	return;
+    dyn_line = gaiaAllocDynamicLine ();
+    for (; i < refs->count && refs->way_ids[i] == id; i++)
       {
-	  /* scrolling the main result set */
-	  ret = sqlite3_step (query_nodes_stmt);
-	  if (ret == SQLITE_DONE)
+	  int idx = refs->node_idx[i];
+	  struct node_coord *node;
+	  if (idx < 0)
 	    {
-		/* there are no more rows to fetch - we can stop looping */
-		break;
+		/* not downloaded Node */
+		continue;
 	    }
-	  if (ret == SQLITE_ROW)
+	  node = coords->items + idx;
+	  gaiaAppendPointToDynamicLine (dyn_line, node->x, node->y);
+	  count++;
+	  if (count == 1)
 	    {
-		/* ok, we've just fetched a valid row */
-		sqlite3_int64 node_id =
-		    sqlite3_column_int64 (query_nodes_stmt, 0);
-		double x = sqlite3_column_double (query_nodes_stmt, 1);
-		double y = sqlite3_column_double (query_nodes_stmt, 2);
-		int way_count = sqlite3_column_int (query_nodes_stmt, 3);
-		if (count == 0)
-		  {
-		      nd_first = node_id;
-		      x_ini = x;
-		      y_ini = y;
-		      count++;
-		      gaiaAppendPointToDynamicLine (dyn_line, x, y);
-		  }
-		else
-		  {
-		      nd_last = node_id;
-		      x_end = x;
-		      y_end = y;
-		      count++;
-		      gaiaAppendPointToDynamicLine (dyn_line, x, y);
-		      if (way_count > 1)
-			{
-			    /* break: splitting the current arc on some junction */
-			    add_arc (arcs, nd_first, nd_last, x_ini, y_ini,
-				     x_end, y_end, dyn_line, count);
-			    /* beginning a new arc */
-			    gaiaFreeDynamicLine (dyn_line);
-			    dyn_line = gaiaAllocDynamicLine ();
-			    count = 1;
-			    nd_first = node_id;
-			    x_ini = x;
-			    y_ini = y;
-			    gaiaAppendPointToDynamicLine (dyn_line, x, y);
-			}
-		  }
+		idx_first = idx;
+		continue;
 	    }
-	  else
+	  idx_last = idx;
+	  if (refs->way_count[idx] > 1)
 	    {
-		/* some unexpected error occurred */
-		fprintf (stderr, "sqlite3_step() error: %s\n",
-			 sqlite3_errmsg (sqlite));
-		return 0;
+		/* break: splitting the current arc on some junction */
+		add_arc (arcs, coords, idx_first, idx_last, dyn_line, count);
+		/* beginning a new arc */
+		gaiaFreeDynamicLine (dyn_line);
+		dyn_line = gaiaAllocDynamicLine ();
+		count = 1;
+		idx_first = idx;
+		gaiaAppendPointToDynamicLine (dyn_line, node->x, node->y);
 	    }
       }
     if (count > 1)
-	add_arc (arcs, nd_first, nd_last, x_ini, y_ini, x_end, y_end, dyn_line,
-		 count);
+	add_arc (arcs, coords, idx_first, idx_last, dyn_line, count);
     gaiaFreeDynamicLine (dyn_line);
-    return 1;
+}
+
+static int
+insert_graph_node (struct aux_params *params, struct insert_batch *batch,
+		   struct way_refs_cache *refs, int idx)
+{
+/* buffering a Road/Rail Node [just once] */
+    struct batch_value *row;
+    unsigned char *blob;
+    struct node_coord *node = params->node_coords.items + idx;
+    if (refs->inserted[idx])
+	return 1;
+    refs->inserted[idx] = 1;
+    row = batch_row (batch);
+    batch_int (row, node->node_id);
+    blob = batch_alloc (batch, row + 1, SQLITE_BLOB, 60);
+    if (blob == NULL)
+	return 0;
+    encode_point_blob (blob, node->x, node->y);
+    return end_batch_row (params, batch);
+}
+
+static int
+insert_road_arc (struct aux_params *params, struct insert_batch *batch,
+		 sqlite3_stmt * stmt, sqlite3_int64 id, struct aux_arc *arc)
+{
+/* buffering a Road Arc */
+    int oneway_ft = 1;
+    int oneway_tf = 1;
+    const char *p_oneway = "";
+    const char *p_roundabout = "";
+    const char *p_motorway = "";
+    struct batch_value *row = batch_row (batch);
+    batch_int (row, id);
+    batch_int (row + 1, arc->node_from);
+    batch_int (row + 2, arc->node_to);
+    if (!batch_text
+	(batch, row + 3, (const char *) sqlite3_column_text (stmt, 1))
+	|| !batch_text (batch, row + 4,
+			(const char *) sqlite3_column_text (stmt, 2)))
+	return 0;
+    batch_column_int (row + 5, stmt, 3);
+    batch_column_int (row + 6, stmt, 4);
+    if (sqlite3_column_type (stmt, 5) != SQLITE_NULL)
+	p_oneway = (const char *) sqlite3_column_text (stmt, 5);
+    if (sqlite3_column_type (stmt, 6) != SQLITE_NULL)
+	p_roundabout = (const char *) sqlite3_column_text (stmt, 6);
+    if (sqlite3_column_type (stmt, 1) != SQLITE_NULL)
+	p_motorway = (const char *) sqlite3_column_text (stmt, 1);
+    if (strcmp (p_roundabout, "roundabout") == 0)
+      {
+	  /* all roundabouts are always implicitly oneway */
+	  oneway_ft = 1;
+	  oneway_tf = 0;
+      }
+    if (strcmp (p_motorway, "motorway") == 0)
+      {
+	  /* all motorways are always implicitly oneway */
+	  oneway_ft = 1;
+	  oneway_tf = 0;
+      }
+    if (strcmp (p_oneway, "1") == 0 || strcmp (p_oneway, "yes") == 0)
+      {
+	  /* declared to be oneway From -> To */
+	  oneway_ft = 1;
+	  oneway_tf = 0;
+      }
+    if (strcmp (p_oneway, "-1") == 0 || strcmp (p_oneway, "reverse") == 0)
+      {
+	  /* declared to be oneway To -> From */
+	  oneway_ft = 0;
+	  oneway_tf = 1;
+      }
+    batch_int (row + 7, oneway_ft);
+    batch_int (row + 8, oneway_tf);
+    if (!batch_geometry (batch, row + 9, arc->geom))
+	return 0;
+    return end_batch_row (params, batch);
+}
+
+static int
+insert_rail_arc (struct aux_params *params, struct insert_batch *batch,
+		 sqlite3_stmt * stmt, sqlite3_int64 id, struct aux_arc *arc)
+{
+/* buffering a Rail Arc */
+    struct batch_value *row = batch_row (batch);
+    batch_int (row, id);
+    batch_int (row + 1, arc->node_from);
+    batch_int (row + 2, arc->node_to);
+    if (!batch_text
+	(batch, row + 3, (const char *) sqlite3_column_text (stmt, 1))
+	|| !batch_text (batch, row + 4,
+			(const char *) sqlite3_column_text (stmt, 2)))
+	return 0;
+    batch_column_int (row + 5, stmt, 3);
+    batch_column_int (row + 6, stmt, 4);
+    if (!batch_text
+	(batch, row + 7, (const char *) sqlite3_column_text (stmt, 5)))
+	return 0;
+    batch_column_int (row + 8, stmt, 6);
+    row[9].type = SQLITE_NULL;
+    if (sqlite3_column_type (stmt, 6) != SQLITE_NULL)
+      {
+	  if (!batch_text
+	      (batch, row + 9, (const char *) sqlite3_column_text (stmt, 7)))
+	      return 0;
+      }
+    if (!batch_geometry (batch, row + 10, arc->geom))
+	return 0;
+    return end_batch_row (params, batch);
 }
 
 static int
@@ -1484,11 +4539,24 @@ populate_road_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs)
 /* populating the ROAD tables */
     int ret;
     sqlite3_stmt *query_main_stmt = NULL;
-    sqlite3_stmt *query_nodes_stmt = NULL;
     sqlite3_stmt *ins_nodes_stmt = NULL;
     sqlite3_stmt *ins_arcs_stmt = NULL;
     const char *sql;
     char *sql_err = NULL;
+    struct way_refs_cache refs;
+    struct insert_batch nodes_batch;
+    struct insert_batch arcs_batch;
+    int ok = 1;
+    double inserts = params->stats.insert_seconds;
+
+    refs.way_ids = NULL;
+    refs.node_idx = NULL;
+    refs.count = 0;
+    refs.max = 0;
+    refs.way_count = NULL;
+    refs.inserted = NULL;
+    memset (&nodes_batch, 0, sizeof (struct insert_batch));
+    memset (&arcs_batch, 0, sizeof (struct insert_batch));
 
 /* main SQL query extracting all Arcs */
     sql = "SELECT w1.way_id AS osm_id, w1.v AS class, w2.v AS name, "
@@ -1510,21 +4578,9 @@ populate_road_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs)
 	  goto error;
       }
 
-/* aux SQL query extracting Node refs */
-    sql = "SELECT w.node_id, ST_X(n.geometry), ST_Y(n.geometry), h.way_count "
-	"FROM osm_way_refs AS w "
-	"JOIN osm_nodes AS n ON (n.node_id = w.node_id) "
-	"JOIN osm_helper_nodes AS h ON (n.node_id = h.node_id) "
-	"WHERE w.way_id = ? ORDER BY w.sub";
-    ret =
-	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql),
-			    &query_nodes_stmt, NULL);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n",
-		   sqlite3_errmsg (params->db_handle));
-	  goto error;
-      }
+/* loading all Way-Node refs: junctions are detected in memory */
+    if (!load_way_refs (params, &refs))
+	goto error;
 
 /* INSERT INTO nodes statement */
     sql = "INSERT INTO road_nodes (node_id, geometry) VALUES (?, ?)";
@@ -1540,8 +4596,8 @@ populate_road_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs)
 
 /* INSERT INTO arcs statement */
     sql =
-	"INSERT INTO road_arcs (arc_id, osm_id, node_from, node_to, type, name, lanes, "
-	"maxspeed, oneway_ft, oneway_tf, geometry) VALUES (NULL, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+	"INSERT INTO road_arcs (osm_id, node_from, node_to, type, name, lanes, "
+	"maxspeed, oneway_ft, oneway_tf, geometry) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
     ret =
 	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql),
 			    &ins_arcs_stmt, NULL);
@@ -1552,6 +4608,15 @@ populate_road_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs)
 	  goto error;
       }
 
+/* Nodes and Arcs are inserted in batches [Nodes first: FOREIGN KEY] */
+    if (!prepare_batch (&nodes_batch, ins_nodes_stmt, cnt_nodes, NULL)
+	|| !prepare_batch (&arcs_batch, ins_arcs_stmt, cnt_arcs, &nodes_batch))
+      {
+	  fprintf (stderr, "ERROR: insufficient memory\n");
+	  goto error;
+      }
+    arcs_batch.what = "ROAD";
+
 /* the complete operation is handled as an unique SQL Transaction */
     ret = sqlite3_exec (params->db_handle, "BEGIN", NULL, NULL, &sql_err);
     if (ret != SQLITE_OK)
@@ -1576,164 +4641,32 @@ populate_road_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs)
 		struct aux_arc_container arcs;
 		struct aux_arc *arc;
 		struct aux_arc *arc_n;
-		unsigned char *blob;
-		int blob_size;
 		sqlite3_int64 id = sqlite3_column_int64 (query_main_stmt, 0);
 		arcs.first = NULL;
 		arcs.last = NULL;
-		if (!build_arc (params->db_handle, query_nodes_stmt, id, &arcs))
-		  {
-#if defined(_WIN32) || defined(__MINGW32__)
-		      /* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
-		      fprintf (stderr,
-			       "ERROR: unable to resolve ROAD id=%I64d\n", id);
-#else
-		      fprintf (stderr,
-			       "ERROR: unable to resolve ROAD id=%lld\n", id);
-#endif
-		      goto error;
-		  }
+		build_arc (&(params->node_coords), &refs, id, &arcs);
 		arc = arcs.first;
 		while (arc != NULL)
 		  {
-		      int oneway_ft = 1;
-		      int oneway_tf = 1;
-		      const char *p_oneway = "";
-		      const char *p_roundabout = "";
-		      const char *p_motorway = "";
 		      /* looping on split arcs */
 		      arc_n = arc->next;
-		      /* inserting NODE From */
-		      sqlite3_reset (ins_nodes_stmt);
-		      sqlite3_clear_bindings (ins_nodes_stmt);
-		      sqlite3_bind_int64 (ins_nodes_stmt, 1, arc->node_from);
-		      gaiaToSpatiaLiteBlobWkb (arc->geom_from, &blob,
-					       &blob_size);
-		      gaiaFreeGeomColl (arc->geom_from);
-		      sqlite3_bind_blob (ins_nodes_stmt, 2, blob, blob_size,
-					 free);
-		      ret = sqlite3_step (ins_nodes_stmt);
-		      if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-			  *cnt_nodes += 1;
-		      /* inserting NODE To */
-		      sqlite3_reset (ins_nodes_stmt);
-		      sqlite3_clear_bindings (ins_nodes_stmt);
-		      sqlite3_bind_int64 (ins_nodes_stmt, 1, arc->node_to);
-		      gaiaToSpatiaLiteBlobWkb (arc->geom_to, &blob, &blob_size);
-		      gaiaFreeGeomColl (arc->geom_to);
-		      sqlite3_bind_blob (ins_nodes_stmt, 2, blob, blob_size,
-					 free);
-		      ret = sqlite3_step (ins_nodes_stmt);
-		      if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-			  *cnt_nodes += 1;
-		      /* inserting the Arc itself */
-		      sqlite3_reset (ins_arcs_stmt);
-		      sqlite3_clear_bindings (ins_arcs_stmt);
-		      sqlite3_bind_int64 (ins_arcs_stmt, 1, id);
-		      sqlite3_bind_int64 (ins_arcs_stmt, 2, arc->node_from);
-		      sqlite3_bind_int64 (ins_arcs_stmt, 3, arc->node_to);
-		      if (sqlite3_column_type (query_main_stmt, 1) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 4);
-		      else
-			  sqlite3_bind_text (ins_arcs_stmt, 4,
-					     (const char *)
-					     sqlite3_column_text
-					     (query_main_stmt, 1),
-					     sqlite3_column_bytes
-					     (query_main_stmt, 1),
-					     SQLITE_STATIC);
-		      if (sqlite3_column_type (query_main_stmt, 2) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 5);
-		      else
-			  sqlite3_bind_text (ins_arcs_stmt, 5,
-					     (const char *)
-					     sqlite3_column_text
-					     (query_main_stmt, 2),
-					     sqlite3_column_bytes
-					     (query_main_stmt, 2),
-					     SQLITE_STATIC);
-		      if (sqlite3_column_type (query_main_stmt, 3) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 6);
-		      else
-			  sqlite3_bind_int (ins_arcs_stmt, 6,
-					    sqlite3_column_int (query_main_stmt,
-								3));
-		      if (sqlite3_column_type (query_main_stmt, 4) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 7);
-		      else
-			  sqlite3_bind_int (ins_arcs_stmt, 7,
-					    sqlite3_column_int (query_main_stmt,
-								4));
-		      if (sqlite3_column_type (query_main_stmt, 5) !=
-			  SQLITE_NULL)
-			  p_oneway =
-			      (const char *)
-			      sqlite3_column_text (query_main_stmt, 5);
-		      if (sqlite3_column_type (query_main_stmt, 6) !=
-			  SQLITE_NULL)
-			  p_roundabout =
-			      (const char *)
-			      sqlite3_column_text (query_main_stmt, 6);
-		      if (sqlite3_column_type (query_main_stmt, 1) !=
-			  SQLITE_NULL)
-			  p_motorway =
-			      (const char *)
-			      sqlite3_column_text (query_main_stmt, 1);
-		      if (strcmp (p_roundabout, "roundabout") == 0)
-			{
-			    /* all roundabouts are always implicitly oneway */
-			    oneway_ft = 1;
-			    oneway_tf = 0;
-			}
-		      if (strcmp (p_motorway, "motorway") == 0)
-			{
-			    /* all motorways are always implicitly oneway */
-			    oneway_ft = 1;
-			    oneway_tf = 0;
-			}
-		      if (strcmp (p_oneway, "1") == 0
-			  || strcmp (p_oneway, "yes") == 0)
-			{
-			    /* declared to be oneway From -> To */
-			    oneway_ft = 1;
-			    oneway_tf = 0;
-			}
-		      if (strcmp (p_oneway, "-1") == 0
-			  || strcmp (p_oneway, "reverse") == 0)
-			{
-			    /* declared to be oneway To -> From */
-			    oneway_ft = 0;
-			    oneway_tf = 1;
-			}
-		      sqlite3_bind_int (ins_arcs_stmt, 8, oneway_ft);
-		      sqlite3_bind_int (ins_arcs_stmt, 9, oneway_tf);
-		      gaiaToSpatiaLiteBlobWkb (arc->geom, &blob, &blob_size);
+		      /* buffering NODE From, NODE To and the Arc itself */
+		      if (ok)
+			  ok = insert_graph_node (params, &nodes_batch, &refs,
+						  arc->idx_from)
+			      && insert_graph_node (params, &nodes_batch, &refs,
+						    arc->idx_to)
+			      && insert_road_arc (params, &arcs_batch,
+						  query_main_stmt, id, arc);
 		      gaiaFreeGeomColl (arc->geom);
-		      sqlite3_bind_blob (ins_arcs_stmt, 10, blob, blob_size,
-					 free);
-		      ret = sqlite3_step (ins_arcs_stmt);
-		      if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-			  *cnt_arcs += 1;
-		      else
-			{
-#if defined(_WIN32) || defined(__MINGW32__)
-			    /* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
-			    fprintf (stderr,
-				     "ERROR: unable to insert ROAD id=%I64d: %s\n",
-				     id, sqlite3_errmsg (params->db_handle));
-#else
-			    fprintf (stderr,
-				     "ERROR: unable to insert ROAD id=%lld: %s\n",
-				     id, sqlite3_errmsg (params->db_handle));
-#endif
-			}
 		      free (arc);
 		      arc = arc_n;
 		  }
+		if (!ok)
+		  {
+		      report_batch_error (params, &arcs_batch);
+		      goto rollback;
+		  }
 	    }
 	  else
 	    {
@@ -1755,6 +4688,18 @@ populate_road_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs)
 	    }
       }
 
+/* inserting any still buffered Node or Arc */
+    if (!flush_batch (params, &nodes_batch)
+	|| !flush_batch (params, &arcs_batch))
+      {
+	  report_batch_error (params, &arcs_batch);
+	  goto rollback;
+      }
+/* the graph INSERTs are accounted to the graph stage, not to the raw load */
+    inserts = params->stats.insert_seconds - inserts;
+    params->stats.graph_insert_seconds += inserts;
+    params->stats.insert_seconds -= inserts;
+
 /* committing the still pending SQL Transaction */
     ret = sqlite3_exec (params->db_handle, "COMMIT", NULL, NULL, &sql_err);
     if (ret != SQLITE_OK)
@@ -1765,58 +4710,43 @@ populate_road_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs)
       }
 
     sqlite3_finalize (query_main_stmt);
-    sqlite3_finalize (query_nodes_stmt);
     sqlite3_finalize (ins_nodes_stmt);
     sqlite3_finalize (ins_arcs_stmt);
+    batch_cleanup (&nodes_batch);
+    batch_cleanup (&arcs_batch);
+    way_refs_cleanup (&refs);
 
     return 1;
 
+  rollback:
+    ret = sqlite3_exec (params->db_handle, "ROLLBACK", NULL, NULL, &sql_err);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "ROLLBACK TRANSACTION error: %s\n", sql_err);
+	  sqlite3_free (sql_err);
+      }
+
   error:
+    batch_cleanup (&nodes_batch);
+    batch_cleanup (&arcs_batch);
     if (query_main_stmt != NULL)
 	sqlite3_finalize (query_main_stmt);
-    if (query_nodes_stmt != NULL)
-	sqlite3_finalize (query_nodes_stmt);
     if (ins_nodes_stmt != NULL)
 	sqlite3_finalize (ins_nodes_stmt);
     if (ins_arcs_stmt != NULL)
 	sqlite3_finalize (ins_arcs_stmt);
+    way_refs_cleanup (&refs);
     return 0;
 }
 
-static int
-create_rail_tables (struct aux_params *params)
-{
-/* creating the RAIL tables */
-    sqlite3 *db_handle = params->db_handle;
-    int ret;
-    char sql[1024];
-    char *err_msg = NULL;
-
-/* creating OSM helper nodes */
-    strcpy (sql, "CREATE TABLE osm_helper_nodes (\n");
-    strcat (sql, "node_id INTEGER NOT NULL PRIMARY KEY,\n");
-    strcat (sql, "way_count INTEGER NOT NULL)\n");
-    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "CREATE TABLE 'osm_helper_nodes' error: %s\n",
-		   err_msg);
-	  sqlite3_free (err_msg);
-	  return 0;
-      }
-/* populating OSM helper nodes */
-    strcpy (sql, "INSERT INTO osm_helper_nodes (node_id, way_count) ");
-    strcat (sql, "SELECT n.node_id, Count(*) FROM osm_nodes AS n ");
-    strcat (sql, "JOIN osm_way_refs AS w ON (w.node_id = n.node_id) ");
-    strcat (sql, "GROUP BY n.node_id");
-    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "INSERT INTO 'osm_helper_nodes' error: %s\n",
-		   err_msg);
-	  sqlite3_free (err_msg);
-	  return 0;
-      }
+static int
+create_rail_tables (struct aux_params *params)
+{
+/* creating the RAIL tables */
+    sqlite3 *db_handle = params->db_handle;
+    int ret;
+    char sql[1024];
+    char *err_msg = NULL;
 
 /* creating RAIL nodes */
     strcpy (sql, "CREATE TABLE rail_nodes (\n");
@@ -1960,13 +4890,26 @@ populate_rail_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs,
 /* populating the RAIL tables */
     int ret;
     sqlite3_stmt *query_main_stmt = NULL;
-    sqlite3_stmt *query_nodes_stmt = NULL;
     sqlite3_stmt *query_stations_stmt = NULL;
     sqlite3_stmt *ins_nodes_stmt = NULL;
     sqlite3_stmt *ins_arcs_stmt = NULL;
     sqlite3_stmt *ins_stations_stmt = NULL;
     const char *sql;
     char *sql_err = NULL;
+    struct way_refs_cache refs;
+    struct insert_batch nodes_batch;
+    struct insert_batch arcs_batch;
+    int ok = 1;
+    double inserts = params->stats.insert_seconds;
+
+    refs.way_ids = NULL;
+    refs.node_idx = NULL;
+    refs.count = 0;
+    refs.max = 0;
+    refs.way_count = NULL;
+    refs.inserted = NULL;
+    memset (&nodes_batch, 0, sizeof (struct insert_batch));
+    memset (&arcs_batch, 0, sizeof (struct insert_batch));
 
 /* main SQL query extracting all Arcs */
     sql =
@@ -1990,21 +4933,9 @@ populate_rail_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs,
 	  goto error;
       }
 
-/* aux SQL query extracting Node refs */
-    sql = "SELECT w.node_id, ST_X(n.geometry), ST_Y(n.geometry), h.way_count "
-	"FROM osm_way_refs AS w "
-	"JOIN osm_nodes AS n ON (n.node_id = w.node_id) "
-	"JOIN osm_helper_nodes AS h ON (n.node_id = h.node_id) "
-	"WHERE w.way_id = ? ORDER BY w.sub";
-    ret =
-	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql),
-			    &query_nodes_stmt, NULL);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n",
-		   sqlite3_errmsg (params->db_handle));
-	  goto error;
-      }
+/* loading all Way-Node refs: junctions are detected in memory */
+    if (!load_way_refs (params, &refs))
+	goto error;
 
 /* main SQL query extracting all Stations */
     sql =
@@ -2038,9 +4969,9 @@ populate_rail_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs,
 
 /* INSERT INTO arcs statement */
     sql =
-	"INSERT INTO rail_arcs (arc_id, osm_id, node_from, node_to, type, name, "
+	"INSERT INTO rail_arcs (osm_id, node_from, node_to, type, name, "
 	"gauge, tracks, electrified, voltage, operator, geometry) VALUES "
-	"(NULL, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+	"(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
     ret =
 	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql),
 			    &ins_arcs_stmt, NULL);
@@ -2064,6 +4995,15 @@ populate_rail_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs,
 	  goto error;
       }
 
+/* Nodes and Arcs are inserted in batches [Nodes first: FOREIGN KEY] */
+    if (!prepare_batch (&nodes_batch, ins_nodes_stmt, cnt_nodes, NULL)
+	|| !prepare_batch (&arcs_batch, ins_arcs_stmt, cnt_arcs, &nodes_batch))
+      {
+	  fprintf (stderr, "ERROR: insufficient memory\n");
+	  goto error;
+      }
+    arcs_batch.what = "RAIL";
+
 /* the complete operation is handled as an unique SQL Transaction */
     ret = sqlite3_exec (params->db_handle, "BEGIN", NULL, NULL, &sql_err);
     if (ret != SQLITE_OK)
@@ -2088,145 +5028,32 @@ populate_rail_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs,
 		struct aux_arc_container arcs;
 		struct aux_arc *arc;
 		struct aux_arc *arc_n;
-		unsigned char *blob;
-		int blob_size;
 		sqlite3_int64 id = sqlite3_column_int64 (query_main_stmt, 0);
 		arcs.first = NULL;
 		arcs.last = NULL;
-		if (!build_arc (params->db_handle, query_nodes_stmt, id, &arcs))
-		  {
-#if defined(_WIN32) || defined(__MINGW32__)
-		      /* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
-		      fprintf (stderr,
-			       "ERROR: unable to resolve RAIL id=%I64d\n", id);
-#else
-		      fprintf (stderr,
-			       "ERROR: unable to resolve RAIL id=%lld\n", id);
-#endif
-		      goto error;
-		  }
+		build_arc (&(params->node_coords), &refs, id, &arcs);
 		arc = arcs.first;
 		while (arc != NULL)
 		  {
 		      /* looping on split arcs */
 		      arc_n = arc->next;
-		      /* inserting NODE From */
-		      sqlite3_reset (ins_nodes_stmt);
-		      sqlite3_clear_bindings (ins_nodes_stmt);
-		      sqlite3_bind_int64 (ins_nodes_stmt, 1, arc->node_from);
-		      gaiaToSpatiaLiteBlobWkb (arc->geom_from, &blob,
-					       &blob_size);
-		      gaiaFreeGeomColl (arc->geom_from);
-		      sqlite3_bind_blob (ins_nodes_stmt, 2, blob, blob_size,
-					 free);
-		      ret = sqlite3_step (ins_nodes_stmt);
-		      if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-			  *cnt_nodes += 1;
-		      /* inserting NODE To */
-		      sqlite3_reset (ins_nodes_stmt);
-		      sqlite3_clear_bindings (ins_nodes_stmt);
-		      sqlite3_bind_int64 (ins_nodes_stmt, 1, arc->node_to);
-		      gaiaToSpatiaLiteBlobWkb (arc->geom_to, &blob, &blob_size);
-		      gaiaFreeGeomColl (arc->geom_to);
-		      sqlite3_bind_blob (ins_nodes_stmt, 2, blob, blob_size,
-					 free);
-		      ret = sqlite3_step (ins_nodes_stmt);
-		      if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-			  *cnt_nodes += 1;
-		      /* inserting the Arc itself */
-		      sqlite3_reset (ins_arcs_stmt);
-		      sqlite3_clear_bindings (ins_arcs_stmt);
-		      sqlite3_bind_int64 (ins_arcs_stmt, 1, id);
-		      sqlite3_bind_int64 (ins_arcs_stmt, 2, arc->node_from);
-		      sqlite3_bind_int64 (ins_arcs_stmt, 3, arc->node_to);
-		      if (sqlite3_column_type (query_main_stmt, 1) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 4);
-		      else
-			  sqlite3_bind_text (ins_arcs_stmt, 4,
-					     (const char *)
-					     sqlite3_column_text
-					     (query_main_stmt, 1),
-					     sqlite3_column_bytes
-					     (query_main_stmt, 1),
-					     SQLITE_STATIC);
-		      if (sqlite3_column_type (query_main_stmt, 2) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 5);
-		      else
-			  sqlite3_bind_text (ins_arcs_stmt, 5,
-					     (const char *)
-					     sqlite3_column_text
-					     (query_main_stmt, 2),
-					     sqlite3_column_bytes
-					     (query_main_stmt, 2),
-					     SQLITE_STATIC);
-		      if (sqlite3_column_type (query_main_stmt, 3) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 6);
-		      else
-			  sqlite3_bind_int (ins_arcs_stmt, 6,
-					    sqlite3_column_int (query_main_stmt,
-								3));
-		      if (sqlite3_column_type (query_main_stmt, 4) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 7);
-		      else
-			  sqlite3_bind_int (ins_arcs_stmt, 7,
-					    sqlite3_column_int (query_main_stmt,
-								4));
-		      if (sqlite3_column_type (query_main_stmt, 5) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 8);
-		      else
-			  sqlite3_bind_text (ins_arcs_stmt, 8,
-					     (const char *)
-					     sqlite3_column_text
-					     (query_main_stmt, 5),
-					     sqlite3_column_bytes
-					     (query_main_stmt, 5),
-					     SQLITE_STATIC);
-		      if (sqlite3_column_type (query_main_stmt, 6) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 9);
-		      else
-			  sqlite3_bind_int (ins_arcs_stmt, 9,
-					    sqlite3_column_int (query_main_stmt,
-								6));
-		      if (sqlite3_column_type (query_main_stmt, 6) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 10);
-		      else
-			  sqlite3_bind_text (ins_arcs_stmt, 10,
-					     (const char *)
-					     sqlite3_column_text
-					     (query_main_stmt, 7),
-					     sqlite3_column_bytes
-					     (query_main_stmt, 7),
-					     SQLITE_STATIC);
-		      gaiaToSpatiaLiteBlobWkb (arc->geom, &blob, &blob_size);
+		      /* buffering NODE From, NODE To and the Arc itself */
+		      if (ok)
+			  ok = insert_graph_node (params, &nodes_batch, &refs,
+						  arc->idx_from)
+			      && insert_graph_node (params, &nodes_batch, &refs,
+						    arc->idx_to)
+			      && insert_rail_arc (params, &arcs_batch,
+						  query_main_stmt, id, arc);
 		      gaiaFreeGeomColl (arc->geom);
-		      sqlite3_bind_blob (ins_arcs_stmt, 11, blob, blob_size,
-					 free);
-		      ret = sqlite3_step (ins_arcs_stmt);
-		      if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-			  *cnt_arcs += 1;
-		      else
-			{
-#if defined(_WIN32) || defined(__MINGW32__)
-			    /* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
-			    fprintf (stderr,
-				     "ERROR: unable to insert RAIL id=%I64d: %s\n",
-				     id, sqlite3_errmsg (params->db_handle));
-#else
-			    fprintf (stderr,
-				     "ERROR: unable to insert RAIL id=%lld: %s\n",
-				     id, sqlite3_errmsg (params->db_handle));
-#endif
-			}
 		      free (arc);
 		      arc = arc_n;
 		  }
+		if (!ok)
+		  {
+		      report_batch_error (params, &arcs_batch);
+		      goto rollback;
+		  }
 	    }
 	  else
 	    {
@@ -2328,6 +5155,18 @@ populate_rail_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs,
 	    }
       }
 
+/* inserting any still buffered Node or Arc */
+    if (!flush_batch (params, &nodes_batch)
+	|| !flush_batch (params, &arcs_batch))
+      {
+	  report_batch_error (params, &arcs_batch);
+	  goto rollback;
+      }
+/* the graph INSERTs are accounted to the graph stage, not to the raw load */
+    inserts = params->stats.insert_seconds - inserts;
+    params->stats.graph_insert_seconds += inserts;
+    params->stats.insert_seconds -= inserts;
+
 /* committing the still pending SQL Transaction */
     ret = sqlite3_exec (params->db_handle, "COMMIT", NULL, NULL, &sql_err);
     if (ret != SQLITE_OK)
@@ -2338,17 +5177,27 @@ populate_rail_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs,
       }
 
     sqlite3_finalize (query_main_stmt);
-    sqlite3_finalize (query_nodes_stmt);
     sqlite3_finalize (ins_nodes_stmt);
     sqlite3_finalize (ins_arcs_stmt);
+    batch_cleanup (&nodes_batch);
+    batch_cleanup (&arcs_batch);
+    way_refs_cleanup (&refs);
 
     return 1;
 
+  rollback:
+    ret = sqlite3_exec (params->db_handle, "ROLLBACK", NULL, NULL, &sql_err);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "ROLLBACK TRANSACTION error: %s\n", sql_err);
+	  sqlite3_free (sql_err);
+      }
+
   error:
+    batch_cleanup (&nodes_batch);
+    batch_cleanup (&arcs_batch);
     if (query_main_stmt != NULL)
 	sqlite3_finalize (query_main_stmt);
-    if (query_nodes_stmt != NULL)
-	sqlite3_finalize (query_nodes_stmt);
     if (query_stations_stmt != NULL)
 	sqlite3_finalize (query_stations_stmt);
     if (ins_nodes_stmt != NULL)
@@ -2357,51 +5206,10 @@ populate_rail_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs,
 	sqlite3_finalize (ins_arcs_stmt);
     if (ins_stations_stmt != NULL)
 	sqlite3_finalize (ins_stations_stmt);
+    way_refs_cleanup (&refs);
     return 0;
 }
 
-static int
-create_map_indices (struct aux_params *params)
-{
-/* creating the MAP helper indices */
-    sqlite3 *db_handle = params->db_handle;
-    int ret;
-    char sql[1024];
-    char *err_msg = NULL;
-
-/* creating OSM helper idx_node_tags */
-    strcpy (sql, "CREATE INDEX idx_node_tags ON osm_node_tags (k)\n");
-    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "CREATE INDEX 'osm_node_tags' error: %s\n", err_msg);
-	  sqlite3_free (err_msg);
-	  return 0;
-      }
-
-/* creating OSM helper idx_way_tags */
-    strcpy (sql, "CREATE INDEX idx_way_tags ON osm_node_tags (k)\n");
-    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "CREATE INDEX 'osm_way_tags' error: %s\n", err_msg);
-	  sqlite3_free (err_msg);
-	  return 0;
-      }
-
-/* creating OSM helper idx_relation_tags */
-    strcpy (sql, "CREATE INDEX idx_relation_tags ON osm_node_tags (k)\n");
-    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "CREATE INDEX 'osm_relation_tags' error: %s\n",
-		   err_msg);
-	  sqlite3_free (err_msg);
-	  return 0;
-      }
-    return 1;
-}
-
 static void
 do_create_point_table (struct aux_params *params, struct layers *layer)
 {
@@ -2568,7 +5376,8 @@ do_create_linestring_table (struct aux_params *params, struct layers *layer)
 static int
 do_insert_linestring (struct aux_params *params, sqlite3_int64 id,
 		      const char *layer_name, const char *type,
-		      const char *name, gaiaGeomCollPtr geom)
+		      const char *name, const unsigned char *blob,
+		      int blob_size)
 {
 /* inserting a Linestring Geometry */
     struct layers *p_layer;
@@ -2599,8 +5408,6 @@ do_insert_linestring (struct aux_params *params, sqlite3_int64 id,
 
     if (layer->ok_linestring && layer->ins_linestring_stmt != NULL)
       {
-	  unsigned char *blob;
-	  int blob_size;
 	  sqlite3_reset (layer->ins_linestring_stmt);
 	  sqlite3_clear_bindings (layer->ins_linestring_stmt);
 	  sqlite3_bind_int64 (layer->ins_linestring_stmt, 1, id);
@@ -2614,12 +5421,11 @@ do_insert_linestring (struct aux_params *params, sqlite3_int64 id,
 	  else
 	      sqlite3_bind_text (layer->ins_linestring_stmt, 3, name,
 				 strlen (name), SQLITE_STATIC);
-	  gaiaToSpatiaLiteBlobWkb (geom, &blob, &blob_size);
 	  if (blob == NULL)
 	      sqlite3_bind_null (layer->ins_linestring_stmt, 4);
 	  else
 	      sqlite3_bind_blob (layer->ins_linestring_stmt, 4, blob, blob_size,
-				 free);
+				 SQLITE_STATIC);
 	  ret = sqlite3_step (layer->ins_linestring_stmt);
 	  if (ret == SQLITE_DONE || ret == SQLITE_ROW)
 	      return 1;
@@ -2683,7 +5489,7 @@ do_create_polygon_table (struct aux_params *params, struct layers *layer)
 static int
 do_insert_polygon (struct aux_params *params, sqlite3_int64 id,
 		   const char *layer_name, const char *type, const char *name,
-		   gaiaGeomCollPtr geom)
+		   const unsigned char *blob, int blob_size)
 {
 /* inserting a Polygon Geometry */
     struct layers *p_layer;
@@ -2714,8 +5520,6 @@ do_insert_polygon (struct aux_params *params, sqlite3_int64 id,
 
     if (layer->ok_polygon && layer->ins_polygon_stmt != NULL)
       {
-	  unsigned char *blob;
-	  int blob_size;
 	  sqlite3_reset (layer->ins_polygon_stmt);
 	  sqlite3_clear_bindings (layer->ins_polygon_stmt);
 	  sqlite3_bind_int64 (layer->ins_polygon_stmt, 1, id);
@@ -2729,12 +5533,11 @@ do_insert_polygon (struct aux_params *params, sqlite3_int64 id,
 	  else
 	      sqlite3_bind_text (layer->ins_polygon_stmt, 3, name,
 				 strlen (name), SQLITE_STATIC);
-	  gaiaToSpatiaLiteBlobWkb (geom, &blob, &blob_size);
 	  if (blob == NULL)
 	      sqlite3_bind_null (layer->ins_polygon_stmt, 4);
 	  else
 	      sqlite3_bind_blob (layer->ins_polygon_stmt, 4, blob, blob_size,
-				 free);
+				 SQLITE_STATIC);
 	  ret = sqlite3_step (layer->ins_polygon_stmt);
 	  if (ret == SQLITE_DONE || ret == SQLITE_ROW)
 	      return 1;
@@ -2799,7 +5602,8 @@ do_create_multi_linestring_table (struct aux_params *params,
 static int
 do_insert_multi_linestring (struct aux_params *params, sqlite3_int64 id,
 			    const char *layer_name, const char *type,
-			    const char *name, gaiaGeomCollPtr geom)
+			    const char *name, const unsigned char *blob,
+			    int blob_size)
 {
 /* inserting a MultiLinestring Geometry */
     struct layers *p_layer;
@@ -2830,8 +5634,6 @@ do_insert_multi_linestring (struct aux_params *params, sqlite3_int64 id,
 
     if (layer->ok_multi_linestring && layer->ins_multi_linestring_stmt != NULL)
       {
-	  unsigned char *blob;
-	  int blob_size;
 	  sqlite3_reset (layer->ins_multi_linestring_stmt);
 	  sqlite3_clear_bindings (layer->ins_multi_linestring_stmt);
 	  sqlite3_bind_int64 (layer->ins_multi_linestring_stmt, 1, id);
@@ -2845,12 +5647,11 @@ do_insert_multi_linestring (struct aux_params *params, sqlite3_int64 id,
 	  else
 	      sqlite3_bind_text (layer->ins_multi_linestring_stmt, 3, name,
 				 strlen (name), SQLITE_STATIC);
-	  gaiaToSpatiaLiteBlobWkb (geom, &blob, &blob_size);
 	  if (blob == NULL)
 	      sqlite3_bind_null (layer->ins_multi_linestring_stmt, 4);
 	  else
 	      sqlite3_bind_blob (layer->ins_multi_linestring_stmt, 4, blob,
-				 blob_size, free);
+				 blob_size, SQLITE_STATIC);
 	  ret = sqlite3_step (layer->ins_multi_linestring_stmt);
 	  if (ret == SQLITE_DONE || ret == SQLITE_ROW)
 	      return 1;
@@ -2914,7 +5715,8 @@ do_create_multi_polygon_table (struct aux_params *params, struct layers *layer)
 static int
 do_insert_multi_polygon (struct aux_params *params, sqlite3_int64 id,
 			 const char *layer_name, const char *type,
-			 const char *name, gaiaGeomCollPtr geom)
+			 const char *name, const unsigned char *blob,
+			 int blob_size)
 {
 /* inserting a MultiPolygon Geometry */
     struct layers *p_layer;
@@ -2945,8 +5747,6 @@ do_insert_multi_polygon (struct aux_params *params, sqlite3_int64 id,
 
     if (layer->ok_multi_polygon && layer->ins_multi_polygon_stmt != NULL)
       {
-	  unsigned char *blob;
-	  int blob_size;
 	  sqlite3_reset (layer->ins_multi_polygon_stmt);
 	  sqlite3_clear_bindings (layer->ins_multi_polygon_stmt);
 	  sqlite3_bind_int64 (layer->ins_multi_polygon_stmt, 1, id);
@@ -2960,12 +5760,11 @@ do_insert_multi_polygon (struct aux_params *params, sqlite3_int64 id,
 	  else
 	      sqlite3_bind_text (layer->ins_multi_polygon_stmt, 3, name,
 				 strlen (name), SQLITE_STATIC);
-	  gaiaToSpatiaLiteBlobWkb (geom, &blob, &blob_size);
 	  if (blob == NULL)
 	      sqlite3_bind_null (layer->ins_multi_polygon_stmt, 4);
 	  else
 	      sqlite3_bind_blob (layer->ins_multi_polygon_stmt, 4, blob,
-				 blob_size, free);
+				 blob_size, SQLITE_STATIC);
 	  ret = sqlite3_step (layer->ins_multi_polygon_stmt);
 	  if (ret == SQLITE_DONE || ret == SQLITE_ROW)
 	      return 1;
@@ -2976,12 +5775,12 @@ do_insert_multi_polygon (struct aux_params *params, sqlite3_int64 id,
 }
 
 static int
-build_way_geom (sqlite3 * sqlite, sqlite3_stmt * query_nodes_stmt,
+build_way_geom (struct node_coord_cache *coords, struct way_refs_cache *refs,
 		sqlite3_int64 id, const char *layer_name, int polygon,
 		gaiaGeomCollPtr * p_geom)
 {
 /* building a Way Geometry */
-    int ret;
+    int pos;
     int areal_layer = 0;
     int is_closed = 0;
     int count = 0;
@@ -3024,43 +5823,28 @@ build_way_geom (sqlite3 * sqlite, sqlite3_stmt * query_nodes_stmt,
 	      areal_layer = 1;
       }
 
-    sqlite3_reset (query_nodes_stmt);
-    sqlite3_clear_bindings (query_nodes_stmt);
-    sqlite3_bind_int64 (query_nodes_stmt, 1, id);
-    while (1)
+    pos = find_way_refs (refs, id);
+    for (; pos >= 0 && pos < refs->count && refs->way_ids[pos] == id; pos++)
       {
-	  /* scrolling the main result set */
-	  ret = sqlite3_step (query_nodes_stmt);
-	  if (ret == SQLITE_DONE)
-	    {
-		/* there are no more rows to fetch - we can stop looping */
-		break;
-	    }
-	  if (ret == SQLITE_ROW)
+	  /* scrolling the Way-Node refs */
+	  double x;
+	  double y;
+	  if (refs->node_idx[pos] < 0)
+	      continue;
+	  x = coords->items[refs->node_idx[pos]].x;
+	  y = coords->items[refs->node_idx[pos]].y;
+	  gaiaAppendPointToDynamicLine (dyn_line, x, y);
+	  if (count == 0)
 	    {
-		/* ok, we've just fetched a valid row */
-		double x = sqlite3_column_double (query_nodes_stmt, 0);
-		double y = sqlite3_column_double (query_nodes_stmt, 1);
-		gaiaAppendPointToDynamicLine (dyn_line, x, y);
-		if (count == 0)
-		  {
-		      x0 = x;
-		      y0 = y;
-		  }
-		else
-		  {
-		      xN = x;
-		      yN = y;
-		  }
-		count++;
+		x0 = x;
+		y0 = y;
 	    }
 	  else
 	    {
-		/* some unexpected error occurred */
-		fprintf (stderr, "sqlite3_step() error: %s\n",
-			 sqlite3_errmsg (sqlite));
-		return 0;
+		xN = x;
+		yN = y;
 	    }
+	  count++;
       }
 
 /* testing for a closed ring */
@@ -3082,66 +5866,542 @@ build_way_geom (sqlite3 * sqlite, sqlite3_stmt * query_nodes_stmt,
 		iv++;
 		pt = pt->Next;
 	    }
-	  geom->DeclaredType = GAIA_POLYGON;
+	  geom->DeclaredType = GAIA_POLYGON;
+      }
+    else
+      {
+	  /* building a Linestring Geometry */
+	  ln = gaiaAddLinestringToGeomColl (geom, count);
+	  iv = 0;
+	  pt = dyn_line->First;
+	  while (pt)
+	    {
+		/* inserting any POINT into LINESTRING */
+		gaiaSetPoint (ln->Coords, iv, pt->X, pt->Y);
+		iv++;
+		pt = pt->Next;
+	    }
+	  geom->DeclaredType = GAIA_LINESTRING;
+      }
+    geom->Srid = 4326;
+    gaiaFreeDynamicLine (dyn_line);
+    *p_geom = geom;
+    return 1;
+}
+
+static void
+rel_members_cleanup (struct rel_members_cache *members)
+{
+/* freeing the Relation-Way members cache */
+    if (members->rel_ids != NULL)
+	free (members->rel_ids);
+    if (members->way_ids != NULL)
+	free (members->way_ids);
+    members->rel_ids = NULL;
+    members->way_ids = NULL;
+    members->count = 0;
+    members->max = 0;
+}
+
+static int
+load_rel_members (struct aux_params *params, struct rel_members_cache *members)
+{
+/* loading all Relation-Way members in a single pass */
+    int ret;
+    sqlite3_stmt *stmt = NULL;
+    const char *sql;
+
+    sql = "SELECT rel_id, ref FROM osm_relation_refs "
+	"WHERE type = 'way' ORDER BY rel_id, sub";
+    ret =
+	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql), &stmt,
+			    NULL);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "SQL error: %s\n",
+		   sqlite3_errmsg (params->db_handle));
+	  return 0;
+      }
+    while (1)
+      {
+	  /* scrolling the result set */
+	  ret = sqlite3_step (stmt);
+	  if (ret == SQLITE_DONE)
+	    {
+		/* there are no more rows to fetch - we can stop looping */
+		break;
+	    }
+	  if (ret != SQLITE_ROW)
+	    {
+		/* some unexpected error occurred */
+		fprintf (stderr, "sqlite3_step() error: %s\n",
+			 sqlite3_errmsg (params->db_handle));
+		sqlite3_finalize (stmt);
+		return 0;
+	    }
+	  if (members->count == members->max)
+	    {
+		int max = (members->max == 0) ? 4096 : members->max * 2;
+		sqlite3_int64 *ids =
+		    realloc (members->rel_ids, sizeof (sqlite3_int64) * max);
+		if (ids == NULL)
+		    goto no_memory;
+		members->rel_ids = ids;
+		ids = realloc (members->way_ids, sizeof (sqlite3_int64) * max);
+		if (ids == NULL)
+		    goto no_memory;
+		members->way_ids = ids;
+		members->max = max;
+	    }
+	  members->rel_ids[members->count] = sqlite3_column_int64 (stmt, 0);
+	  members->way_ids[members->count] = sqlite3_column_int64 (stmt, 1);
+	  members->count += 1;
+      }
+    sqlite3_finalize (stmt);
+    return 1;
+
+  no_memory:
+    fprintf (stderr, "ERROR: insufficient memory\n");
+    sqlite3_finalize (stmt);
+    return 0;
+}
+
+static int
+cmp_way_ids (const void *p1, const void *p2)
+{
+/* comparing two Way IDs [qsort] */
+    sqlite3_int64 id1 = *((const sqlite3_int64 *) p1);
+    sqlite3_int64 id2 = *((const sqlite3_int64 *) p2);
+    if (id1 < id2)
+	return -1;
+    if (id1 > id2)
+	return 1;
+    return 0;
+}
+
+static int
+find_rel_members (struct rel_members_cache *members, sqlite3_int64 rel_id,
+		  int in_sequence, sqlite3_int64 ** way_ids)
+{
+/*
+/ retrieving the distinct member Ways of some Relation, either
+/ sorted by ID [ring assembly] or in their sequence order; returns
+/ how many, the IDs must be freed by the caller
+*/
+    int lo = 0;
+    int hi = members->count;
+    int first;
+    int n;
+    int i;
+    int count = 0;
+    sqlite3_int64 *sorted;
+    unsigned char *used;
+    *way_ids = NULL;
+    while (lo < hi)
+      {
+	  int mid = lo + (hi - lo) / 2;
+	  if (members->rel_ids[mid] < rel_id)
+	      lo = mid + 1;
+	  else
+	      hi = mid;
+      }
+    first = lo;
+    while (lo < members->count && members->rel_ids[lo] == rel_id)
+	lo++;
+    n = lo - first;
+    if (n == 0)
+	return 0;
+    *way_ids = malloc (sizeof (sqlite3_int64) * n);
+    if (*way_ids == NULL)
+	return 0;
+    memcpy (*way_ids, members->way_ids + first, sizeof (sqlite3_int64) * n);
+    qsort (*way_ids, n, sizeof (sqlite3_int64), cmp_way_ids);
+    for (i = 0; i < n; i++)
+      {
+	  if (count > 0 && (*way_ids)[count - 1] == (*way_ids)[i])
+	      continue;
+	  (*way_ids)[count++] = (*way_ids)[i];
+      }
+    if (!in_sequence)
+	return count;
+
+/* restoring the sequence order, each Way being kept just once */
+    sorted = *way_ids;
+    used = calloc (count, sizeof (unsigned char));
+    *way_ids = malloc (sizeof (sqlite3_int64) * count);
+    if (used == NULL || *way_ids == NULL)
+      {
+	  free (sorted);
+	  free (used);
+	  free (*way_ids);
+	  *way_ids = NULL;
+	  return 0;
+      }
+    n = 0;
+    for (i = first; i < lo; i++)
+      {
+	  sqlite3_int64 *p =
+	      bsearch (members->way_ids + i, sorted, count,
+		       sizeof (sqlite3_int64), cmp_way_ids);
+	  if (used[p - sorted])
+	      continue;
+	  used[p - sorted] = 1;
+	  (*way_ids)[n++] = members->way_ids[i];
+      }
+    free (sorted);
+    free (used);
+    return count;
+}
+
+static int
+cmp_rings_area (const void *p1, const void *p2)
+{
+/* sorting rings by decreasing area [qsort] */
+    const struct mp_ring *r1 = *((const struct mp_ring **) p1);
+    const struct mp_ring *r2 = *((const struct mp_ring **) p2);
+    if (r1->area > r2->area)
+	return -1;
+    if (r1->area < r2->area)
+	return 1;
+    return 0;
+}
+
+static int
+ring_has_node (struct mp_ring *ring, const int *ring_nodes, int idx)
+{
+/* checking if some Node is a vertex of the ring */
+    int i;
+    for (i = 0; i < ring->count; i++)
+      {
+	  if (ring_nodes[ring->first + i] == idx)
+	      return 1;
+      }
+    return 0;
+}
+
+static int
+ring_contains (struct node_coord_cache *coords, const int *ring_nodes,
+	       struct mp_ring *outer, struct mp_ring *inner)
+{
+/* checking if a ring lies within another one */
+    int i;
+    int j;
+    int inside = 0;
+    double x;
+    double y;
+    int test = -1;
+    if (inner->minx < outer->minx || inner->maxx > outer->maxx
+	|| inner->miny < outer->miny || inner->maxy > outer->maxy)
+	return 0;
+    for (i = 0; i < inner->count - 1; i++)
+      {
+	  /* testing a vertex not shared by both rings */
+	  int idx = ring_nodes[inner->first + i];
+	  if (!ring_has_node (outer, ring_nodes, idx))
+	    {
+		test = idx;
+		break;
+	    }
+      }
+    if (test < 0)
+	return 0;
+    x = coords->items[test].x;
+    y = coords->items[test].y;
+    for (i = 0, j = outer->count - 1; i < outer->count; j = i++)
+      {
+	  /* ray casting */
+	  struct node_coord *pi = coords->items + ring_nodes[outer->first + i];
+	  struct node_coord *pj = coords->items + ring_nodes[outer->first + j];
+	  if (((pi->y > y) != (pj->y > y))
+	      && (x < (pj->x - pi->x) * (y - pi->y) / (pj->y - pi->y) + pi->x))
+	      inside = !inside;
+      }
+    return inside;
+}
+
+static void
+set_ring_coords (struct node_coord_cache *coords, const int *ring_nodes,
+		 struct mp_ring *ring, gaiaRingPtr rng)
+{
+/* copying the ring vertices into a Geometry ring */
+    int iv;
+    for (iv = 0; iv < ring->count; iv++)
+      {
+	  struct node_coord *pt = coords->items + ring_nodes[ring->first + iv];
+	  gaiaSetPoint (rng->Coords, iv, pt->x, pt->y);
+      }
+}
+
+static gaiaGeomCollPtr
+assemble_multi_polygon (struct node_coord_cache *coords,
+			struct way_refs_cache *refs,
+			const sqlite3_int64 * way_ids, int n_ways)
+{
+/*
+/ assembling a multipolygon Relation in memory: the member Ways
+/ are chained into closed rings by hashing their end Nodes, then
+/ rings are nested by decreasing area [MBR filter first]; rings at
+/ even depth become exteriors and rings at odd depth interiors of
+/ their enclosing ring. NULL if the Ways don't close into rings
+*/
+    struct mp_segment *segs = NULL;
+    struct mp_ring *rings = NULL;
+    struct mp_ring **sorted = NULL;
+    int *ring_nodes = NULL;
+    int *heads = NULL;
+    int *chain_node = NULL;
+    int *chain_seg = NULL;
+    int *chain_next = NULL;
+    int n_segs = 0;
+    int n_rings = 0;
+    int n_nodes = 0;
+    int total = 0;
+    int hash_size = 16;
+    int i;
+    int j;
+    gaiaGeomCollPtr geom = NULL;
+
+/* collecting the member Ways; each one must be fully resolved */
+    segs = malloc (sizeof (struct mp_segment) * n_ways);
+    if (segs == NULL)
+	goto stop;
+    for (i = 0; i < n_ways; i++)
+      {
+	  int pos = find_way_refs (refs, way_ids[i]);
+	  int end;
+	  if (pos < 0)
+	      goto stop;
+	  for (end = pos; end < refs->count; end++)
+	    {
+		if (refs->way_ids[end] != way_ids[i])
+		    break;
+		if (refs->node_idx[end] < 0)
+		    goto stop;
+	    }
+	  if (end - pos < 2)
+	      goto stop;
+	  segs[n_segs].first = pos;
+	  segs[n_segs].count = end - pos;
+	  segs[n_segs].used = 0;
+	  n_segs++;
+	  total += end - pos;
+      }
+    if (n_segs == 0)
+	goto stop;
+    rings = malloc (sizeof (struct mp_ring) * n_segs);
+    ring_nodes = malloc (sizeof (int) * total);
+    while (hash_size < n_segs * 4)
+	hash_size *= 2;
+    heads = malloc (sizeof (int) * hash_size);
+    chain_node = malloc (sizeof (int) * n_segs * 2);
+    chain_seg = malloc (sizeof (int) * n_segs * 2);
+    chain_next = malloc (sizeof (int) * n_segs * 2);
+    if (rings == NULL || ring_nodes == NULL || heads == NULL
+	|| chain_node == NULL || chain_seg == NULL || chain_next == NULL)
+	goto stop;
+
+/* hashing the end Nodes of all Ways */
+    for (i = 0; i < hash_size; i++)
+	heads[i] = -1;
+    for (i = 0; i < n_segs; i++)
+      {
+	  for (j = 0; j < 2; j++)
+	    {
+		int k = i * 2 + j;
+		int idx = refs->node_idx[segs[i].first +
+					 (j ? segs[i].count - 1 : 0)];
+		int slot = (unsigned int) (idx * 2654435761u) & (hash_size - 1);
+		chain_node[k] = idx;
+		chain_seg[k] = i;
+		chain_next[k] = heads[slot];
+		heads[slot] = k;
+	    }
+      }
+
+/* chaining the Ways into closed rings */
+    for (i = 0; i < n_segs; i++)
+      {
+	  struct mp_ring *ring;
+	  struct mp_segment *seg = segs + i;
+	  int start;
+	  int last;
+	  if (seg->used)
+	      continue;
+	  seg->used = 1;
+	  ring = rings + n_rings++;
+	  ring->first = n_nodes;
+	  for (j = 0; j < seg->count; j++)
+	      ring_nodes[n_nodes++] = refs->node_idx[seg->first + j];
+	  start = ring_nodes[ring->first];
+	  last = ring_nodes[n_nodes - 1];
+	  while (last != start)
+	    {
+		/* searching an unused Way starting or ending at the last Node */
+		int slot =
+		    (unsigned int) (last * 2654435761u) & (hash_size - 1);
+		int k;
+		struct mp_segment *next = NULL;
+		int reversed = 0;
+		for (k = heads[slot]; k >= 0; k = chain_next[k])
+		  {
+		      if (chain_node[k] == last && !(segs[chain_seg[k]].used))
+			{
+			    next = segs + chain_seg[k];
+			    reversed = k % 2;
+			    break;
+			}
+		  }
+		if (next == NULL)
+		    goto stop;	/* unclosed ring */
+		next->used = 1;
+		for (j = 1; j < next->count; j++)
+		  {
+		      int p = reversed ? next->count - 1 - j : j;
+		      ring_nodes[n_nodes++] = refs->node_idx[next->first + p];
+		  }
+		last = ring_nodes[n_nodes - 1];
+	    }
+	  ring->count = n_nodes - ring->first;
+	  if (ring->count < 4)
+	      goto stop;
+      }
+
+/* computing the MBR and the area of each ring */
+    sorted = malloc (sizeof (struct mp_ring *) * n_rings);
+    if (sorted == NULL)
+	goto stop;
+    for (i = 0; i < n_rings; i++)
+      {
+	  struct mp_ring *ring = rings + i;
+	  double area = 0.0;
+	  ring->minx = DBL_MAX;
+	  ring->miny = DBL_MAX;
+	  ring->maxx = -DBL_MAX;
+	  ring->maxy = -DBL_MAX;
+	  for (j = 0; j < ring->count; j++)
+	    {
+		struct node_coord *pt =
+		    coords->items + ring_nodes[ring->first + j];
+		if (pt->x < ring->minx)
+		    ring->minx = pt->x;
+		if (pt->x > ring->maxx)
+		    ring->maxx = pt->x;
+		if (pt->y < ring->miny)
+		    ring->miny = pt->y;
+		if (pt->y > ring->maxy)
+		    ring->maxy = pt->y;
+		if (j > 0)
+		  {
+		      struct node_coord *prev =
+			  coords->items + ring_nodes[ring->first + j - 1];
+		      area += (prev->x * pt->y) - (pt->x * prev->y);
+		  }
+	    }
+	  ring->area = (area < 0.0) ? -area / 2.0 : area / 2.0;
+	  ring->parent = -1;
+	  ring->depth = 0;
+	  ring->n_interiors = 0;
+	  sorted[i] = ring;
       }
-    else
+    qsort (sorted, n_rings, sizeof (struct mp_ring *), cmp_rings_area);
+
+/* nesting each ring into the smallest enclosing one */
+    for (i = 0; i < n_rings; i++)
       {
-	  /* building a Linestring Geometry */
-	  ln = gaiaAddLinestringToGeomColl (geom, count);
-	  iv = 0;
-	  pt = dyn_line->First;
-	  while (pt)
+	  struct mp_ring *ring = sorted[i];
+	  for (j = i - 1; j >= 0; j--)
 	    {
-		/* inserting any POINT into LINESTRING */
-		gaiaSetPoint (ln->Coords, iv, pt->X, pt->Y);
-		iv++;
-		pt = pt->Next;
+		if (ring_contains (coords, ring_nodes, sorted[j], ring))
+		  {
+		      ring->parent = sorted[j] - rings;
+		      ring->depth = sorted[j]->depth + 1;
+		      break;
+		  }
 	    }
-	  geom->DeclaredType = GAIA_LINESTRING;
+	  if (ring->depth % 2)
+	      rings[ring->parent].n_interiors += 1;
       }
+
+/* building the MultiPolygon */
+    geom = gaiaAllocGeomColl ();
     geom->Srid = 4326;
-    gaiaFreeDynamicLine (dyn_line);
-    *p_geom = geom;
-    return 1;
+    geom->DeclaredType = GAIA_MULTIPOLYGON;
+    for (i = 0; i < n_rings; i++)
+      {
+	  struct mp_ring *ring = sorted[i];
+	  gaiaPolygonPtr pg;
+	  int ib = 0;
+	  if (ring->depth % 2)
+	      continue;
+	  pg = gaiaAddPolygonToGeomColl (geom, ring->count,
+					 ring->n_interiors);
+	  set_ring_coords (coords, ring_nodes, ring, pg->Exterior);
+	  for (j = i + 1; j < n_rings && ib < ring->n_interiors; j++)
+	    {
+		struct mp_ring *hole = sorted[j];
+		if (hole->depth % 2 && hole->parent == ring - rings)
+		    set_ring_coords (coords, ring_nodes, hole,
+				     gaiaAddInteriorRing (pg, ib++,
+							  hole->count));
+	    }
+      }
+
+  stop:
+    if (segs != NULL)
+	free (segs);
+    if (rings != NULL)
+	free (rings);
+    if (sorted != NULL)
+	free (sorted);
+    if (ring_nodes != NULL)
+	free (ring_nodes);
+    if (heads != NULL)
+	free (heads);
+    if (chain_node != NULL)
+	free (chain_node);
+    if (chain_seg != NULL)
+	free (chain_seg);
+    if (chain_next != NULL)
+	free (chain_next);
+    return geom;
 }
 
 static int
-build_rel_way_geom (void *cache, sqlite3 * sqlite,
-		    sqlite3_stmt * query_nodes_stmt, sqlite3_int64 id,
+build_rel_way_geom (void *cache, struct node_coord_cache *coords,
+		    struct way_refs_cache *refs,
+		    struct rel_members_cache *members, sqlite3_int64 id,
 		    gaiaGeomCollPtr * p_geom)
 {
 /* building a complex Relation-Way Geometry */
-    int ret;
     int count = 0;
     gaiaPointPtr pt;
     gaiaLinestringPtr ln;
     int iv;
+    int i;
     int first = 1;
     sqlite3_int64 current_id;
+    sqlite3_int64 *way_ids;
+    int n_ways;
     gaiaGeomCollPtr geom;
     gaiaDynamicLinePtr dyn_line = gaiaAllocDynamicLine ();
     gaiaGeomCollPtr aggregate_geom = gaiaAllocGeomColl ();
     aggregate_geom->Srid = 4326;
 
-    sqlite3_reset (query_nodes_stmt);
-    sqlite3_clear_bindings (query_nodes_stmt);
-    sqlite3_bind_int64 (query_nodes_stmt, 1, id);
-    while (1)
+    n_ways = find_rel_members (members, id, 1, &way_ids);
+    for (i = 0; i < n_ways; i++)
       {
-	  /* scrolling the main result set */
-	  ret = sqlite3_step (query_nodes_stmt);
-	  if (ret == SQLITE_DONE)
+	  /* scrolling the member Ways, in their sequence order */
+	  sqlite3_int64 way_id = way_ids[i];
+	  int pos = find_way_refs (refs, way_id);
+	  if (pos < 0)
+	      continue;
+	  for (; pos < refs->count && refs->way_ids[pos] == way_id; pos++)
 	    {
-		/* there are no more rows to fetch - we can stop looping */
-		break;
-	    }
-	  if (ret == SQLITE_ROW)
-	    {
-		/* ok, we've just fetched a valid row */
-		sqlite3_int64 way_id =
-		    sqlite3_column_int64 (query_nodes_stmt, 0);
-		double x = sqlite3_column_double (query_nodes_stmt, 1);
-		double y = sqlite3_column_double (query_nodes_stmt, 2);
+		/* scrolling the Way-Node refs */
+		struct node_coord *node;
+		if (refs->node_idx[pos] < 0)
+		    continue;
+		node = coords->items + refs->node_idx[pos];
 		if (first)
 		  {
 		      current_id = way_id;
@@ -3165,17 +6425,12 @@ build_rel_way_geom (void *cache, sqlite3 * sqlite,
 		      count = 0;
 		      current_id = way_id;
 		  }
-		gaiaAppendPointToDynamicLine (dyn_line, x, y);
+		gaiaAppendPointToDynamicLine (dyn_line, node->x, node->y);
 		count++;
 	    }
-	  else
-	    {
-		/* some unexpected error occurred */
-		fprintf (stderr, "sqlite3_step() error: %s\n",
-			 sqlite3_errmsg (sqlite));
-		return 0;
-	    }
       }
+    if (way_ids != NULL)
+	free (way_ids);
 
 /* saving the last Way Linestring */
     ln = gaiaAddLinestringToGeomColl (aggregate_geom, count);
@@ -3218,23 +6473,454 @@ build_rel_way_geom (void *cache, sqlite3 * sqlite,
     return 1;
 }
 
+static void
+update_layer_stats (const char *layer_name, int inserted, double seconds)
+{
+/* accounting a feature and its build/insert time to its MAP layer */
+    struct layers *layer;
+    int i = 0;
+    if (layer_name == NULL)
+	return;
+    while (1)
+      {
+	  layer = &(base_layers[i++]);
+	  if (layer->name == NULL)
+	      break;
+	  if (strcmp (layer->name, layer_name) == 0)
+	    {
+		layer->features += inserted;
+		layer->seconds += seconds;
+		break;
+	    }
+      }
+}
+
+static char *
+map_column_text (sqlite3_stmt * stmt, int col)
+{
+/* copying a TEXT column value [NULL if missing] */
+    char *text;
+    int len;
+    if (sqlite3_column_type (stmt, col) == SQLITE_NULL)
+	return NULL;
+    len = sqlite3_column_bytes (stmt, col);
+    text = malloc (len + 1);
+    if (text != NULL)
+	memcpy (text, sqlite3_column_text (stmt, col), len + 1);
+    return text;
+}
+
+static void
+map_chunk_cleanup (struct map_chunk *chunk)
+{
+/* freeing all features of a chunk */
+    int i;
+    for (i = 0; i < chunk->count; i++)
+      {
+	  struct map_feature *feature = chunk->features + i;
+	  if (feature->layer != NULL)
+	      free (feature->layer);
+	  if (feature->type != NULL)
+	      free (feature->type);
+	  if (feature->name != NULL)
+	      free (feature->name);
+	  if (feature->blob != NULL)
+	      free (feature->blob);
+      }
+    memset (chunk->features, 0, sizeof (struct map_feature) * MAP_CHUNK);
+    chunk->count = 0;
+    chunk->ready = 0;
+}
+
+static int
+map_fetch_chunk (struct aux_params *params, struct map_queue *queue,
+		 struct map_chunk *chunk)
+{
+/*
+/ fetching the next chunk of features from the Ways or Relations
+/ result set; returns how many, or -1 on failure
+*/
+    int ret;
+    sqlite3_stmt *stmt = queue->stmt;
+    while (chunk->count < MAP_CHUNK)
+      {
+	  struct map_feature *feature;
+	  ret = sqlite3_step (stmt);
+	  if (ret == SQLITE_DONE)
+	    {
+		/* there are no more rows to fetch - we can stop looping */
+		break;
+	    }
+	  if (ret != SQLITE_ROW)
+	    {
+		/* some unexpected error occurred */
+		fprintf (stderr, "sqlite3_step() error: %s\n",
+			 sqlite3_errmsg (params->db_handle));
+		return -1;
+	    }
+	  feature = chunk->features + chunk->count++;
+	  feature->id = sqlite3_column_int64 (stmt, 0);
+	  feature->layer = map_column_text (stmt, 1);
+	  feature->type = map_column_text (stmt, 2);
+	  feature->name = map_column_text (stmt, 3);
+	  if (queue->relations)
+	    {
+		/* multipolygon Relations are assembled in memory */
+		const char *rel_type = (const char *) sqlite3_column_text (stmt,
+									   5);
+		if (rel_type != NULL && (strcmp (rel_type, "multipolygon") == 0
+					 || strcmp (rel_type, "boundary") == 0))
+		    feature->polygon = 1;
+	    }
+	  else
+	    {
+		const char *area = (const char *) sqlite3_column_text (stmt, 4);
+		if (area != NULL && strcmp (area, "yes") == 0)
+		    feature->polygon = 1;
+	    }
+      }
+    return chunk->count;
+}
+
+static void
+map_build_chunk (struct map_queue *queue, void *cache,
+		 struct map_chunk *chunk)
+{
+/*
+/ building the Geometry BLOBs of all features of a chunk; any feature
+/ left unresolved keeps geom_type == 0 and is reported by the writer
+*/
+    int i;
+    for (i = 0; i < chunk->count; i++)
+      {
+	  struct map_feature *feature = chunk->features + i;
+	  gaiaGeomCollPtr geom = NULL;
+	  double t0 = osm_clock ();
+	  if (queue->relations)
+	    {
+		if (feature->polygon)
+		  {
+		      /* attempting to assemble the rings in memory */
+		      sqlite3_int64 *way_ids;
+		      int n_ways =
+			  find_rel_members (queue->members, feature->id, 0,
+					    &way_ids);
+		      if (n_ways > 0)
+			  geom =
+			      assemble_multi_polygon (queue->coords,
+						      queue->refs, way_ids,
+						      n_ways);
+		      if (way_ids != NULL)
+			  free (way_ids);
+		  }
+		if (geom == NULL)
+		    build_rel_way_geom (cache, queue->coords, queue->refs,
+					queue->members, feature->id, &geom);
+	    }
+	  else
+	      build_way_geom (queue->coords, queue->refs, feature->id,
+			      feature->layer, feature->polygon, &geom);
+	  if (geom == NULL)
+	      continue;
+	  feature->geom_type = geom->DeclaredType;
+	  gaiaToSpatiaLiteBlobWkb (geom, &(feature->blob),
+				   &(feature->blob_size));
+	  gaiaFreeGeomColl (geom);
+	  feature->seconds = osm_clock () - t0;
+      }
+}
+
+static int
+map_write_chunk (struct aux_params *params, struct map_queue *queue,
+		 struct map_chunk *chunk)
+{
+/*
+/ inserting all features of a chunk into the MAP layers, stopping at
+/ the first feature whose Geometry could not be resolved
+*/
+    int i;
+    for (i = 0; i < chunk->count; i++)
+      {
+	  struct map_feature *feature = chunk->features + i;
+	  int inserted;
+	  double t0 = osm_clock ();
+	  if (feature->geom_type == 0)
+	    {
+		const char *what = queue->relations ? "RELATION-WAY" : "WAY";
+#if defined(_WIN32) || defined(__MINGW32__)
+		/* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
+		fprintf (stderr, "ERROR: unable to resolve %s id=%I64d\n",
+			 what, feature->id);
+#else
+		fprintf (stderr, "ERROR: unable to resolve %s id=%lld\n",
+			 what, feature->id);
+#endif
+		return 0;
+	    }
+	  switch (feature->geom_type)
+	    {
+	    case GAIA_LINESTRING:
+		inserted =
+		    do_insert_linestring (params, feature->id, feature->layer,
+					  feature->type, feature->name,
+					  feature->blob, feature->blob_size);
+		*(queue->linestrings) += inserted;
+		break;
+	    case GAIA_POLYGON:
+		inserted =
+		    do_insert_polygon (params, feature->id, feature->layer,
+				       feature->type, feature->name,
+				       feature->blob, feature->blob_size);
+		*(queue->polygons) += inserted;
+		break;
+	    case GAIA_MULTILINESTRING:
+		inserted =
+		    do_insert_multi_linestring (params, feature->id,
+						feature->layer, feature->type,
+						feature->name, feature->blob,
+						feature->blob_size);
+		*(queue->multi_linestrings) += inserted;
+		break;
+	    default:
+		inserted =
+		    do_insert_multi_polygon (params, feature->id,
+					     feature->layer, feature->type,
+					     feature->name, feature->blob,
+					     feature->blob_size);
+		*(queue->multi_polygons) += inserted;
+		break;
+	    }
+	  update_layer_stats (feature->layer, inserted,
+			      feature->seconds + (osm_clock () - t0));
+      }
+    return 1;
+}
+
+static int
+map_populate_sequential (struct aux_params *params, struct map_queue *queue)
+{
+/* sequentially fetching, building and inserting all features */
+    struct map_chunk *chunk = queue->chunks;
+    int ret;
+    int ok;
+    while (1)
+      {
+	  ret = map_fetch_chunk (params, queue, chunk);
+	  if (ret <= 0)
+	    {
+		map_chunk_cleanup (chunk);
+		return (ret == 0) ? 1 : 0;
+	    }
+	  map_build_chunk (queue, params->cache, chunk);
+	  ok = map_write_chunk (params, queue, chunk);
+	  ret = chunk->count;
+	  map_chunk_cleanup (chunk);
+	  if (!ok)
+	      return 0;
+	  if (ret < MAP_CHUNK)
+	      return 1;
+      }
+}
+
+#ifdef OSM_THREADS
+static void *
+map_worker (void *arg)
+{
+/* worker thread: building the Geometries of MAP features */
+    struct map_queue *queue = (struct map_queue *) arg;
+    struct map_chunk *chunk;
+    void *cache = spatialite_alloc_connection ();
+    pthread_mutex_lock (&(queue->mutex));
+    while (1)
+      {
+	  while (!(queue->abort) && !(queue->eof)
+		 && queue->next >= queue->count)
+	      pthread_cond_wait (&(queue->cond), &(queue->mutex));
+	  if (queue->abort || queue->next >= queue->count)
+	      break;
+	  chunk = queue->chunks + (queue->next % queue->window);
+	  queue->next += 1;
+	  pthread_mutex_unlock (&(queue->mutex));
+	  map_build_chunk (queue, cache, chunk);
+	  pthread_mutex_lock (&(queue->mutex));
+	  chunk->ready = 1;
+	  pthread_cond_broadcast (&(queue->cond));
+      }
+    pthread_mutex_unlock (&(queue->mutex));
+    spatialite_cleanup_ex (cache);
+    return NULL;
+}
+
+static int
+map_populate_threaded (struct aux_params *params, struct map_queue *queue,
+		       int jobs)
+{
+/*
+/ building the Geometries of several chunks of features at once on
+/ a pool of worker threads; the main thread fetches the features
+/ and acts as the single SQLite writer, inserting each chunk in the
+/ query order as soon as it's ready [at most 2 * jobs chunks are
+/ buffered]
+*/
+    int i;
+    int k;
+    int ok = 1;
+    int ret;
+    int n_workers = 0;
+    struct map_chunk *chunk;
+    pthread_t *workers = malloc (sizeof (pthread_t) * jobs);
+    if (!workers)
+	return map_populate_sequential (params, queue);
+    queue->next = 0;
+    queue->written = 0;
+    queue->eof = 0;
+    queue->abort = 0;
+    pthread_mutex_init (&(queue->mutex), NULL);
+    pthread_cond_init (&(queue->cond), NULL);
+    for (i = 0; i < jobs; i++)
+      {
+	  if (pthread_create (workers + n_workers, NULL, map_worker, queue)
+	      == 0)
+	      n_workers++;
+      }
+    if (!n_workers)
+      {
+	  /* unable to start any thread; falling back to sequential mode */
+	  pthread_cond_destroy (&(queue->cond));
+	  pthread_mutex_destroy (&(queue->mutex));
+	  free (workers);
+	  return map_populate_sequential (params, queue);
+      }
+    for (k = 0; ok; k++)
+      {
+	  /* fetching more chunks while there is room in the window */
+	  while (!(queue->eof) && queue->count - queue->written < queue->window)
+	    {
+		chunk = queue->chunks + (queue->count % queue->window);
+		ret = map_fetch_chunk (params, queue, chunk);
+		pthread_mutex_lock (&(queue->mutex));
+		if (ret < 0)
+		  {
+		      ok = 0;
+		      queue->abort = 1;
+		  }
+		if (ret > 0)
+		    queue->count += 1;
+		if (ret < MAP_CHUNK)
+		    queue->eof = 1;
+		pthread_cond_broadcast (&(queue->cond));
+		pthread_mutex_unlock (&(queue->mutex));
+	    }
+	  if (!ok || k >= queue->count)
+	      break;
+	  chunk = queue->chunks + (k % queue->window);
+	  pthread_mutex_lock (&(queue->mutex));
+	  while (!(chunk->ready))
+	      pthread_cond_wait (&(queue->cond), &(queue->mutex));
+	  pthread_mutex_unlock (&(queue->mutex));
+	  if (!map_write_chunk (params, queue, chunk))
+	      ok = 0;
+	  map_chunk_cleanup (chunk);
+	  pthread_mutex_lock (&(queue->mutex));
+	  queue->written += 1;
+	  if (!ok)
+	      queue->abort = 1;
+	  pthread_cond_broadcast (&(queue->cond));
+	  pthread_mutex_unlock (&(queue->mutex));
+      }
+    for (i = 0; i < n_workers; i++)
+	pthread_join (workers[i], NULL);
+    pthread_cond_destroy (&(queue->cond));
+    pthread_mutex_destroy (&(queue->mutex));
+    free (workers);
+    return ok;
+}
+#endif
+
+static int
+populate_map_features (struct aux_params *params, sqlite3_stmt * stmt,
+		       int relations, struct way_refs_cache *refs,
+		       struct rel_members_cache *members, int jobs,
+		       int *linestrings, int *polygons,
+		       int *multi_linestrings, int *multi_polygons)
+{
+/* populating the MAP layers from Ways or Relations [possibly in parallel] */
+    struct map_queue queue;
+    int ret;
+    int i;
+    memset (&queue, 0, sizeof (struct map_queue));
+    queue.stmt = stmt;
+    queue.relations = relations;
+    queue.coords = &(params->node_coords);
+    queue.refs = refs;
+    queue.members = members;
+    queue.linestrings = linestrings;
+    queue.polygons = polygons;
+    queue.multi_linestrings = multi_linestrings;
+    queue.multi_polygons = multi_polygons;
+    queue.window = jobs * 2;
+    queue.chunks = calloc (queue.window, sizeof (struct map_chunk));
+    if (queue.chunks == NULL)
+	goto no_memory;
+    for (i = 0; i < queue.window; i++)
+      {
+	  queue.chunks[i].features =
+	      calloc (MAP_CHUNK, sizeof (struct map_feature));
+	  if (queue.chunks[i].features == NULL)
+	      goto no_memory;
+      }
+#ifdef OSM_THREADS
+    if (jobs > 1)
+	ret = map_populate_threaded (params, &queue, jobs);
+    else
+	ret = map_populate_sequential (params, &queue);
+#else
+    ret = map_populate_sequential (params, &queue);
+#endif
+    for (i = 0; i < queue.window; i++)
+      {
+	  /* freeing any chunk left behind by an aborted run */
+	  map_chunk_cleanup (queue.chunks + i);
+	  free (queue.chunks[i].features);
+      }
+    free (queue.chunks);
+    return ret;
+
+  no_memory:
+    fprintf (stderr, "ERROR: insufficient memory\n");
+    if (queue.chunks != NULL)
+      {
+	  for (i = 0; i < queue.window; i++)
+	    {
+		if (queue.chunks[i].features != NULL)
+		    free (queue.chunks[i].features);
+	    }
+	  free (queue.chunks);
+      }
+    return 0;
+}
+
 static int
-populate_map_layers (struct aux_params *params, int *points, int *linestrings,
-		     int *polygons, int *multi_linestrings, int *multi_polygons)
+populate_map_layers (struct aux_params *params, int jobs, int *points,
+		     int *linestrings, int *polygons, int *multi_linestrings,
+		     int *multi_polygons)
 {
 /* populating the MAP layers aka tables */
     int ret;
     sqlite3_stmt *query_nodes_stmt = NULL;
     sqlite3_stmt *query_ways_stmt = NULL;
     sqlite3_stmt *query_rel_ways_stmt = NULL;
-    sqlite3_stmt *query_way_nodes_stmt = NULL;
-    sqlite3_stmt *query_rel_way_nodes_stmt = NULL;
+    struct way_refs_cache refs;
+    struct rel_members_cache members;
     char *layers;
     char *sql;
     char *sql_err = NULL;
     struct layers *layer;
     int i = 0;
 
+    memset (&refs, 0, sizeof (struct way_refs_cache));
+    memset (&members, 0, sizeof (struct rel_members_cache));
+
 /* preparing the list of well known layers */
     while (1)
       {
@@ -3290,8 +6976,10 @@ populate_map_layers (struct aux_params *params, int *points, int *linestrings,
 
 /* main SQL query extracting all relevant Relations-Ways */
     sql = sqlite3_mprintf ("SELECT r1.rel_id, r1.k AS class, r1.v AS subclass, "
-			   "r2.v AS name, count(rr.ref) AS cnt FROM osm_relation_tags AS r1 "
+			   "r2.v AS name, count(rr.ref) AS cnt, r3.v AS rel_type "
+			   "FROM osm_relation_tags AS r1 "
 			   "LEFT JOIN osm_relation_tags AS r2 ON (r2.rel_id = r1.rel_id AND r2.k = 'name') "
+			   "LEFT JOIN osm_relation_tags AS r3 ON (r3.rel_id = r1.rel_id AND r3.k = 'type') "
 			   "LEFT JOIN osm_relation_refs AS rr ON (rr.rel_id = r1.rel_id AND rr.type = 'way') "
 			   "WHERE r1.k IN (%s) GROUP BY r1.rel_id", layers);
     ret =
@@ -3306,111 +6994,25 @@ populate_map_layers (struct aux_params *params, int *points, int *linestrings,
       }
     sqlite3_free (layers);
 
-/* aux SQL query extracting Way-Node refs */
-    sql = "SELECT ST_X(n.geometry), ST_Y(n.geometry) "
-	"FROM osm_way_refs AS w "
-	"JOIN osm_nodes AS n ON (n.node_id = w.node_id) "
-	"WHERE w.way_id = ? ORDER BY w.sub";
-    ret =
-	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql),
-			    &query_way_nodes_stmt, NULL);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n",
-		   sqlite3_errmsg (params->db_handle));
-	  goto error;
-      }
-
-/* aux SQL query extracting Relation-Way-Node refs */
-    sql = "SELECT w.way_id, ST_X(n.geometry), ST_Y(n.geometry) "
-	"FROM osm_way_refs AS w "
-	"JOIN osm_nodes AS n ON (n.node_id = w.node_id) "
-	"WHERE w.way_id IN (SELECT ref FROM osm_relation_refs "
-	"WHERE rel_id = ? AND type = 'way') " "ORDER BY w.way_id, w.sub";
-    ret =
-	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql),
-			    &query_rel_way_nodes_stmt, NULL);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n",
-		   sqlite3_errmsg (params->db_handle));
-	  goto error;
-      }
+/* loading all Way-Node refs and Relation-Way members in memory */
+    if (!load_way_refs (params, &refs))
+	goto error;
+    if (!load_rel_members (params, &members))
+	goto error;
 
 /* the complete operation is handled as an unique SQL Transaction */
     ret = sqlite3_exec (params->db_handle, "BEGIN", NULL, NULL, &sql_err);
     if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "BEGIN TRANSACTION error: %s\n", sql_err);
-	  sqlite3_free (sql_err);
-	  goto error;
-      }
-
-    while (1)
-      {
-	  /* scrolling the Nodes result set */
-	  ret = sqlite3_step (query_nodes_stmt);
-	  if (ret == SQLITE_DONE)
-	    {
-		/* there are no more rows to fetch - we can stop looping */
-		break;
-	    }
-	  if (ret == SQLITE_ROW)
-	    {
-		/* ok, we've just fetched a valid row */
-		const char *layer = NULL;
-		const char *type = NULL;
-		const char *name = NULL;
-		const unsigned char *blob = NULL;
-		int blob_size;
-		sqlite3_int64 id = sqlite3_column_int64 (query_nodes_stmt, 0);
-		if (sqlite3_column_type (query_nodes_stmt, 1) != SQLITE_NULL)
-		    layer =
-			(const char *) sqlite3_column_text (query_nodes_stmt,
-							    1);
-		if (sqlite3_column_type (query_nodes_stmt, 2) != SQLITE_NULL)
-		    type =
-			(const char *) sqlite3_column_text (query_nodes_stmt,
-							    2);
-		if (sqlite3_column_type (query_nodes_stmt, 3) != SQLITE_NULL)
-		    name =
-			(const char *) sqlite3_column_text (query_nodes_stmt,
-							    3);
-		if (sqlite3_column_type (query_nodes_stmt, 4) == SQLITE_BLOB)
-		  {
-		      blob =
-			  (const unsigned char *)
-			  sqlite3_column_blob (query_nodes_stmt, 4);
-		      blob_size = sqlite3_column_bytes (query_nodes_stmt, 4);
-		  }
-		if (do_insert_point
-		    (params, id, layer, type, name, blob, blob_size))
-		    *points += 1;
-	    }
-	  else
-	    {
-		/* some unexpected error occurred */
-		fprintf (stderr, "sqlite3_step() error: %s\n",
-			 sqlite3_errmsg (params->db_handle));
-		/* ROLLBACK */
-		ret =
-		    sqlite3_exec (params->db_handle, "ROLLBACK", NULL, NULL,
-				  &sql_err);
-		if (ret != SQLITE_OK)
-		  {
-		      fprintf (stderr, "ROLLBACK TRANSACTION error: %s\n",
-			       sql_err);
-		      sqlite3_free (sql_err);
-		      goto error;
-		  }
-		goto error;
-	    }
+      {
+	  fprintf (stderr, "BEGIN TRANSACTION error: %s\n", sql_err);
+	  sqlite3_free (sql_err);
+	  goto error;
       }
 
     while (1)
       {
-	  /* scrolling the Ways result set */
-	  ret = sqlite3_step (query_ways_stmt);
+	  /* scrolling the Nodes result set */
+	  ret = sqlite3_step (query_nodes_stmt);
 	  if (ret == SQLITE_DONE)
 	    {
 		/* there are no more rows to fetch - we can stop looping */
@@ -3422,53 +7024,35 @@ populate_map_layers (struct aux_params *params, int *points, int *linestrings,
 		const char *layer = NULL;
 		const char *type = NULL;
 		const char *name = NULL;
-		int polygon = 0;
-		gaiaGeomCollPtr geom = NULL;
-		sqlite3_int64 id = sqlite3_column_int64 (query_ways_stmt, 0);
-		if (sqlite3_column_type (query_ways_stmt, 1) != SQLITE_NULL)
+		const unsigned char *blob = NULL;
+		int blob_size;
+		int inserted;
+		double t0 = osm_clock ();
+		sqlite3_int64 id = sqlite3_column_int64 (query_nodes_stmt, 0);
+		if (sqlite3_column_type (query_nodes_stmt, 1) != SQLITE_NULL)
 		    layer =
-			(const char *) sqlite3_column_text (query_ways_stmt, 1);
-		if (sqlite3_column_type (query_ways_stmt, 2) != SQLITE_NULL)
+			(const char *) sqlite3_column_text (query_nodes_stmt,
+							    1);
+		if (sqlite3_column_type (query_nodes_stmt, 2) != SQLITE_NULL)
 		    type =
-			(const char *) sqlite3_column_text (query_ways_stmt, 2);
-		if (sqlite3_column_type (query_ways_stmt, 3) != SQLITE_NULL)
+			(const char *) sqlite3_column_text (query_nodes_stmt,
+							    2);
+		if (sqlite3_column_type (query_nodes_stmt, 3) != SQLITE_NULL)
 		    name =
-			(const char *) sqlite3_column_text (query_ways_stmt, 3);
-		if (sqlite3_column_type (query_ways_stmt, 4) != SQLITE_NULL)
-		  {
-		      if (strcmp
-			  ((const char *)
-			   sqlite3_column_text (query_ways_stmt, 4),
-			   "yes") == 0)
-			  polygon = 1;
-		  }
-		if (!build_way_geom
-		    (params->db_handle, query_way_nodes_stmt, id, layer,
-		     polygon, &geom))
-		  {
-#if defined(_WIN32) || defined(__MINGW32__)
-		      /* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
-		      fprintf (stderr,
-			       "ERROR: unable to resolve WAY id=%I64d\n", id);
-#else
-		      fprintf (stderr,
-			       "ERROR: unable to resolve WAY id=%lld\n", id);
-#endif
-		      goto error;
-		  }
-		if (geom->DeclaredType == GAIA_LINESTRING)
-		  {
-		      if (do_insert_linestring
-			  (params, id, layer, type, name, geom))
-			  *linestrings += 1;
-		  }
-		else
+			(const char *) sqlite3_column_text (query_nodes_stmt,
+							    3);
+		if (sqlite3_column_type (query_nodes_stmt, 4) == SQLITE_BLOB)
 		  {
-		      if (do_insert_polygon
-			  (params, id, layer, type, name, geom))
-			  *polygons += 1;
+		      blob =
+			  (const unsigned char *)
+			  sqlite3_column_blob (query_nodes_stmt, 4);
+		      blob_size = sqlite3_column_bytes (query_nodes_stmt, 4);
 		  }
-		gaiaFreeGeomColl (geom);
+		inserted =
+		    do_insert_point (params, id, layer, type, name, blob,
+				     blob_size);
+		*points += inserted;
+		update_layer_stats (layer, inserted, osm_clock () - t0);
 	    }
 	  else
 	    {
@@ -3489,84 +7073,25 @@ populate_map_layers (struct aux_params *params, int *points, int *linestrings,
 		goto error;
 	    }
       }
-    while (1)
+
+/* building and inserting the Ways and Relations features */
+    if (!populate_map_features
+	(params, query_ways_stmt, 0, &refs, &members, jobs, linestrings,
+	 polygons, multi_linestrings, multi_polygons)
+	|| !populate_map_features (params, query_rel_ways_stmt, 1, &refs,
+				   &members, jobs, linestrings, polygons,
+				   multi_linestrings, multi_polygons))
       {
-	  /* scrolling the Relations-Ways result set */
-	  ret = sqlite3_step (query_rel_ways_stmt);
-	  if (ret == SQLITE_DONE)
-	    {
-		/* there are no more rows to fetch - we can stop looping */
-		break;
-	    }
-	  if (ret == SQLITE_ROW)
-	    {
-		/* ok, we've just fetched a valid row */
-		const char *layer = NULL;
-		const char *type = NULL;
-		const char *name = NULL;
-		gaiaGeomCollPtr geom = NULL;
-		sqlite3_int64 id =
-		    sqlite3_column_int64 (query_rel_ways_stmt, 0);
-		if (sqlite3_column_type (query_rel_ways_stmt, 1) != SQLITE_NULL)
-		    layer =
-			(const char *) sqlite3_column_text (query_rel_ways_stmt,
-							    1);
-		if (sqlite3_column_type (query_rel_ways_stmt, 2) != SQLITE_NULL)
-		    type =
-			(const char *) sqlite3_column_text (query_rel_ways_stmt,
-							    2);
-		if (sqlite3_column_type (query_rel_ways_stmt, 3) != SQLITE_NULL)
-		    name =
-			(const char *) sqlite3_column_text (query_rel_ways_stmt,
-							    3);
-		if (!build_rel_way_geom
-		    (params->cache, params->db_handle, query_rel_way_nodes_stmt,
-		     id, &geom))
-		  {
-#if defined(_WIN32) || defined(__MINGW32__)
-		      /* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
-		      fprintf (stderr,
-			       "ERROR: unable to resolve RELATION-WAY id=%I64d\n",
-			       id);
-#else
-		      fprintf (stderr,
-			       "ERROR: unable to resolve RELATION-WAY id=%lld\n",
-			       id);
-#endif
-		      goto error;
-		  }
-		if (geom->DeclaredType == GAIA_MULTILINESTRING)
-		  {
-		      if (do_insert_multi_linestring
-			  (params, id, layer, type, name, geom))
-			  *multi_linestrings += 1;
-		  }
-		else
-		  {
-		      if (do_insert_multi_polygon
-			  (params, id, layer, type, name, geom))
-			  *multi_polygons += 1;
-		  }
-		gaiaFreeGeomColl (geom);
-	    }
-	  else
+	  /* ROLLBACK */
+	  ret =
+	      sqlite3_exec (params->db_handle, "ROLLBACK", NULL, NULL,
+			    &sql_err);
+	  if (ret != SQLITE_OK)
 	    {
-		/* some unexpected error occurred */
-		fprintf (stderr, "sqlite3_step() error: %s\n",
-			 sqlite3_errmsg (params->db_handle));
-		/* ROLLBACK */
-		ret =
-		    sqlite3_exec (params->db_handle, "ROLLBACK", NULL, NULL,
-				  &sql_err);
-		if (ret != SQLITE_OK)
-		  {
-		      fprintf (stderr, "ROLLBACK TRANSACTION error: %s\n",
-			       sql_err);
-		      sqlite3_free (sql_err);
-		      goto error;
-		  }
-		goto error;
+		fprintf (stderr, "ROLLBACK TRANSACTION error: %s\n", sql_err);
+		sqlite3_free (sql_err);
 	    }
+	  goto error;
       }
 
 /* committing the still pending SQL Transaction */
@@ -3580,8 +7105,9 @@ populate_map_layers (struct aux_params *params, int *points, int *linestrings,
 
     sqlite3_finalize (query_nodes_stmt);
     sqlite3_finalize (query_ways_stmt);
-    sqlite3_finalize (query_way_nodes_stmt);
-    sqlite3_finalize (query_rel_way_nodes_stmt);
+    sqlite3_finalize (query_rel_ways_stmt);
+    way_refs_cleanup (&refs);
+    rel_members_cleanup (&members);
 
     return 1;
 
@@ -3590,10 +7116,10 @@ populate_map_layers (struct aux_params *params, int *points, int *linestrings,
 	sqlite3_finalize (query_nodes_stmt);
     if (query_ways_stmt != NULL)
 	sqlite3_finalize (query_ways_stmt);
-    if (query_way_nodes_stmt != NULL)
-	sqlite3_finalize (query_way_nodes_stmt);
-    if (query_rel_way_nodes_stmt != NULL)
-	sqlite3_finalize (query_rel_way_nodes_stmt);
+    if (query_rel_ways_stmt != NULL)
+	sqlite3_finalize (query_rel_ways_stmt);
+    way_refs_cleanup (&refs);
+    rel_members_cleanup (&members);
     return 0;
 }
 
@@ -3603,7 +7129,6 @@ do_clean_roads (struct aux_params *params)
 /* ROAD post-processing: DB cleanup */
     sqlite3 *db_handle = params->db_handle;
     printf ("\nFinal DBMS cleanup\n");
-    sqlite3_exec (db_handle, "DROP TABLE osm_helper_nodes", NULL, NULL, NULL);
     sqlite3_exec (db_handle, "DROP TABLE osm_relation_refs", NULL, NULL, NULL);
     sqlite3_exec (db_handle, "DROP TABLE osm_relation_tags", NULL, NULL, NULL);
     sqlite3_exec (db_handle, "DROP TABLE osm_relations", NULL, NULL, NULL);
@@ -3625,7 +7150,6 @@ do_clean_rails (struct aux_params *params)
 /* ROAD post-processing: DB cleanup */
     sqlite3 *db_handle = params->db_handle;
     printf ("\nFinal DBMS cleanup\n");
-    sqlite3_exec (db_handle, "DROP TABLE osm_helper_nodes", NULL, NULL, NULL);
     sqlite3_exec (db_handle, "DROP TABLE osm_relation_refs", NULL, NULL, NULL);
     sqlite3_exec (db_handle, "DROP TABLE osm_relation_tags", NULL, NULL, NULL);
     sqlite3_exec (db_handle, "DROP TABLE osm_relations", NULL, NULL, NULL);
@@ -3760,16 +7284,6 @@ create_osm_raw_tables (struct aux_params *params)
 	  sqlite3_free (err_msg);
 	  return 0;
       }
-/* creating an index supporting osm_way_refs.node_id */
-    strcpy (sql, "CREATE INDEX idx_osm_ref_way ON osm_way_refs (node_id)");
-    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "CREATE INDEX 'idx_osm_node_way' error: %s\n",
-		   err_msg);
-	  sqlite3_free (err_msg);
-	  return 0;
-      }
 /* creating the OSM "raw" relations */
     strcpy (sql, "CREATE TABLE osm_relations (\n");
     strcat (sql, "rel_id INTEGER NOT NULL PRIMARY KEY)\n");
@@ -3815,6 +7329,32 @@ create_osm_raw_tables (struct aux_params *params)
 	  sqlite3_free (err_msg);
 	  return 0;
       }
+    return 1;
+}
+
+static int
+create_osm_raw_indices (struct aux_params *params)
+{
+/*
+/ creating the secondary indices on the raw OSM tables
+/ [bulk-load: all indices are created only after the
+/ whole dataset has been inserted]
+*/
+    sqlite3 *db_handle = params->db_handle;
+    int ret;
+    char sql[1024];
+    char *err_msg = NULL;
+
+/* creating an index supporting osm_way_refs.node_id */
+    strcpy (sql, "CREATE INDEX idx_osm_ref_way ON osm_way_refs (node_id)");
+    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "CREATE INDEX 'idx_osm_node_way' error: %s\n",
+		   err_msg);
+	  sqlite3_free (err_msg);
+	  return 0;
+      }
 /* creating an index supporting osm_relation_refs.ref */
     strcpy (sql,
 	    "CREATE INDEX idx_osm_ref_relation ON osm_relation_refs (type, ref)");
@@ -3826,6 +7366,39 @@ create_osm_raw_tables (struct aux_params *params)
 	  sqlite3_free (err_msg);
 	  return 0;
       }
+    if (params->mode == MODE_RAW)
+	return 1;
+
+/* creating OSM helper idx_node_tags */
+    strcpy (sql, "CREATE INDEX idx_node_tags ON osm_node_tags (k)\n");
+    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "CREATE INDEX 'osm_node_tags' error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  return 0;
+      }
+
+/* creating OSM helper idx_way_tags */
+    strcpy (sql, "CREATE INDEX idx_way_tags ON osm_way_tags (k)\n");
+    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "CREATE INDEX 'osm_way_tags' error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  return 0;
+      }
+
+/* creating OSM helper idx_relation_tags */
+    strcpy (sql, "CREATE INDEX idx_relation_tags ON osm_relation_tags (k)\n");
+    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "CREATE INDEX 'osm_relation_tags' error: %s\n",
+		   err_msg);
+	  sqlite3_free (err_msg);
+	  return 0;
+      }
     return 1;
 }
 
@@ -4020,6 +7593,133 @@ do_version ()
     fprintf (stderr, "\n");
 }
 
+static double
+stats_rate (double count, double seconds)
+{
+/* computing a throughput; zero if no time was measured at all */
+    if (seconds <= 0.0)
+	return 0.0;
+    return count / seconds;
+}
+
+static void
+write_stats (const char *path, struct aux_params *params, int mode, int jobs,
+	     double t_start, const char *status)
+{
+/*
+/ writing the per-stage timings as a machine-readable JSON summary;
+/ an aborted run reports the stages it went through
+*/
+    struct osm_stats *stats = &(params->stats);
+    struct layers *layer;
+    const char *mode_name = "MAP";
+    char bytes[64];
+    char elements[64];
+    int rows;
+    int features = 0;
+    int first = 1;
+    int i = 0;
+    FILE *out;
+    if (path == NULL)
+	return;
+    stats->total_seconds = osm_clock () - t_start;
+    out = fopen (path, "w");
+    if (out == NULL)
+      {
+	  fprintf (stderr, "ERROR: unable to create \"%s\"\n", path);
+	  return;
+      }
+    if (mode == MODE_RAW)
+	mode_name = "RAW";
+    else if (mode == MODE_ROAD)
+	mode_name = "ROAD";
+    else if (mode == MODE_RAIL)
+	mode_name = "RAIL";
+    rows = params->wr_nodes + params->wr_node_tags + params->wr_ways +
+	params->wr_way_tags + params->wr_way_refs + params->wr_relations +
+	params->wr_rel_tags + params->wr_rel_refs;
+    /* the SQLite printf is portable for 64 bits integers */
+    sqlite3_snprintf (sizeof (bytes), bytes, "%lld", stats->download_bytes);
+    sqlite3_snprintf (sizeof (elements), elements, "%lld",
+		      stats->parse_elements);
+
+    fprintf (out, "{\n");
+    fprintf (out, "  \"status\": \"%s\",\n", status);
+    fprintf (out, "  \"mode\": \"%s\",\n", mode_name);
+    fprintf (out, "  \"jobs\": %d,\n", jobs);
+    fprintf (out,
+	     "  \"download\": {\"requests\": %d, \"cached\": %d, \"bytes\": %s, "
+	     "\"seconds\": %1.6f, \"bytes_per_sec\": %1.1f},\n",
+	     stats->requests, params->cached_tiles, bytes,
+	     stats->download_seconds,
+	     stats_rate ((double) stats->download_bytes,
+			 stats->download_seconds));
+    fprintf (out,
+	     "  \"parse\": {\"elements\": %s, \"seconds\": %1.6f, "
+	     "\"elements_per_sec\": %1.1f},\n", elements,
+	     stats->parse_seconds,
+	     stats_rate ((double) stats->parse_elements,
+			 stats->parse_seconds));
+    fprintf (out,
+	     "  \"insert\": {\"rows\": %d, \"seconds\": %1.6f, "
+	     "\"rows_per_sec\": %1.1f},\n", rows, stats->insert_seconds,
+	     stats_rate ((double) rows, stats->insert_seconds));
+    fprintf (out, "  \"load\": {\"seconds\": %1.6f},\n", stats->load_seconds);
+    fprintf (out, "  \"commit\": {\"seconds\": %1.6f},\n",
+	     stats->commit_seconds);
+    fprintf (out, "  \"indices\": {\"seconds\": %1.6f},\n",
+	     stats->index_seconds);
+    if (mode == MODE_MAP)
+      {
+	  /* MAP layers */
+	  while (1)
+	    {
+		layer = &(base_layers[i++]);
+		if (layer->name == NULL)
+		    break;
+		features += layer->features;
+	    }
+	  fprintf (out,
+		   "  \"populate\": {\"seconds\": %1.6f, \"features\": %d, "
+		   "\"features_per_sec\": %1.1f, \"layers\": [",
+		   stats->populate_seconds, features,
+		   stats_rate ((double) features, stats->populate_seconds));
+	  i = 0;
+	  while (1)
+	    {
+		layer = &(base_layers[i++]);
+		if (layer->name == NULL)
+		    break;
+		if (layer->features == 0 && layer->seconds == 0.0)
+		    continue;
+		fprintf (out,
+			 "%s\n    {\"name\": \"%s\", \"features\": %d, "
+			 "\"seconds\": %1.6f}", first ? "" : ",", layer->name,
+			 layer->features, layer->seconds);
+		first = 0;
+	    }
+	  fprintf (out, "%s]},\n", first ? "" : "\n  ");
+      }
+    else if (mode == MODE_ROAD || mode == MODE_RAIL)
+      {
+	  /* ROAD or RAIL network */
+	  fprintf (out,
+		   "  \"graph\": {\"seconds\": %1.6f, \"nodes\": %d, "
+		   "\"arcs\": %d, \"insert_seconds\": %1.6f, "
+		   "\"rtree_seconds\": %1.6f},\n",
+		   stats->populate_seconds, stats->graph_nodes,
+		   stats->graph_arcs, stats->graph_insert_seconds,
+		   stats->rtree_seconds);
+      }
+    fprintf (out, "  \"cleanup\": {\"seconds\": %1.6f},\n",
+	     stats->cleanup_seconds);
+    fprintf (out, "  \"export\": {\"seconds\": %1.6f},\n",
+	     stats->export_seconds);
+    fprintf (out, "  \"total_seconds\": %1.6f\n", stats->total_seconds);
+    fprintf (out, "}\n");
+    fclose (out);
+}
+
 static void
 do_help ()
 {
@@ -4057,8 +7757,22 @@ do_help ()
 	     "-m or --in-memory               using IN-MEMORY database\n");
     fprintf (stderr,
 	     "-jo or --journal-off            unsafe [but faster] mode\n");
+    fprintf (stderr,
+	     "-j or --jobs          num       parallel worker threads (default 1)\n");
+    fprintf (stderr,
+	     "-tc or --tile-cache   dir       local cache of downloaded tiles\n");
+    fprintf (stderr,
+	     "-f or --osm-file      path      local .osm or .osm.pbf input file\n");
+    fprintf (stderr,
+	     "                                MAP/ROAD/RAIL keep all Node locations in RAM\n");
+    fprintf (stderr,
+	     "                                (24 bytes each, at most 2147483647 Nodes)\n");
+    fprintf (stderr,
+	     "-st or --stats        path      per-stage timings as JSON at exit\n");
     fprintf (stderr,
 	     "-p or --preserve                skipping final cleanup (preserving OSM tables)\n");
+    fprintf (stderr,
+	     "                                [ROAD/RAIL no longer create osm_helper_nodes]\n");
 }
 
 #endif /* end LIBXML2 conditional */
@@ -4076,28 +7790,35 @@ main (int argc, char *argv[])
 #else
     sqlite3 *handle;
     int i;
+    int ret;
     int next_arg = ARG_NONE;
     const char *osm_url = "http://overpass-api.de/api";
     const char *db_path = NULL;
     int in_memory = 0;
     int cache_size = 0;
     int journal_off = 0;
+    int jobs = 1;
+    const char *tile_cache = NULL;
+    const char *osm_file = NULL;
+    const char *stats_path = NULL;
+    double t_start;
+    double t0;
+    double inserts;
     int error = 0;
     void *cache;
-    double minx;
+    double minx = 0.0;
     int ok_minx = 0;
-    double miny;
+    double miny = 0.0;
     int ok_miny = 0;
-    double maxx;
+    double maxx = 0.0;
     int ok_maxx = 0;
-    double maxy;
+    double maxy = 0.0;
     int ok_maxy = 0;
     int bbox = 1;
     int mode = MODE_MAP;
     int preserve_osm_tables = 0;
     struct aux_params params;
     struct tiled_download downloader;
-    struct download_tile *tile;
     double extent_h;
     double extent_v;
     double step_v;
@@ -4123,6 +7844,14 @@ main (int argc, char *argv[])
     params.ins_relations_stmt = NULL;
     params.ins_relation_tags_stmt = NULL;
     params.ins_relation_refs_stmt = NULL;
+    memset (&(params.nodes_batch), 0, sizeof (struct insert_batch));
+    memset (&(params.node_tags_batch), 0, sizeof (struct insert_batch));
+    memset (&(params.ways_batch), 0, sizeof (struct insert_batch));
+    memset (&(params.way_tags_batch), 0, sizeof (struct insert_batch));
+    memset (&(params.way_refs_batch), 0, sizeof (struct insert_batch));
+    memset (&(params.relations_batch), 0, sizeof (struct insert_batch));
+    memset (&(params.relation_tags_batch), 0, sizeof (struct insert_batch));
+    memset (&(params.relation_refs_batch), 0, sizeof (struct insert_batch));
     params.wr_nodes = 0;
     params.wr_node_tags = 0;
     params.wr_ways = 0;
@@ -4132,6 +7861,20 @@ main (int argc, char *argv[])
     params.wr_rel_tags = 0;
     params.wr_rel_refs = 0;
     params.osm_url = NULL;
+    params.tile_cache_dir = NULL;
+    params.cached_tiles = 0;
+    params.node_coords.items = NULL;
+    params.node_coords.count = 0;
+    params.node_coords.max = 0;
+    params.node_coords.sorted = 1;
+    params.node_coords.failed = 0;
+    memset (&(params.seen_nodes), 0, sizeof (struct seen_ids));
+    memset (&(params.seen_ways), 0, sizeof (struct seen_ids));
+    memset (&(params.seen_relations), 0, sizeof (struct seen_ids));
+    params.filter_key = NULL;
+    params.collecting = 0;
+    memset (&(params.wanted_nodes), 0, sizeof (struct seen_ids));
+    memset (&(params.stats), 0, sizeof (struct osm_stats));
 
     for (i = 1; i < argc; i++)
       {
@@ -4149,6 +7892,18 @@ main (int argc, char *argv[])
 		  case ARG_CACHE_SIZE:
 		      cache_size = atoi (argv[i]);
 		      break;
+		  case ARG_JOBS:
+		      jobs = atoi (argv[i]);
+		      break;
+		  case ARG_TILE_CACHE:
+		      tile_cache = argv[i];
+		      break;
+		  case ARG_OSM_FILE:
+		      osm_file = argv[i];
+		      break;
+		  case ARG_STATS:
+		      stats_path = argv[i];
+		      break;
 		  case ARG_MINX:
 		      minx = atof (argv[i]);
 		      ok_minx = 1;
@@ -4249,6 +8004,30 @@ main (int argc, char *argv[])
 		next_arg = ARG_CACHE_SIZE;
 		continue;
 	    }
+	  if (strcasecmp (argv[i], "--tile-cache") == 0
+	      || strcmp (argv[i], "-tc") == 0)
+	    {
+		next_arg = ARG_TILE_CACHE;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--osm-file") == 0
+	      || strcmp (argv[i], "-f") == 0)
+	    {
+		next_arg = ARG_OSM_FILE;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--stats") == 0
+	      || strcmp (argv[i], "-st") == 0)
+	    {
+		next_arg = ARG_STATS;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--jobs") == 0
+	      || strcmp (argv[i], "-j") == 0)
+	    {
+		next_arg = ARG_JOBS;
+		continue;
+	    }
 	  if (strcasecmp (argv[i], "-m") == 0)
 	    {
 		in_memory = 1;
@@ -4288,34 +8067,36 @@ main (int argc, char *argv[])
 	  fprintf (stderr, "did you forget setting the --db-path argument ?\n");
 	  error = 1;
       }
-    if (!ok_minx)
+    if (!ok_minx && osm_file == NULL)
       {
 	  fprintf (stderr,
 		   "did you forget setting the --bbox-minx argument ?\n");
 	  error = 1;
 	  bbox = 0;
       }
-    if (!ok_miny)
+    if (!ok_miny && osm_file == NULL)
       {
 	  fprintf (stderr,
 		   "did you forget setting the --bbox-miny argument ?\n");
 	  error = 1;
 	  bbox = 0;
       }
-    if (!ok_maxx)
+    if (!ok_maxx && osm_file == NULL)
       {
 	  fprintf (stderr,
 		   "did you forget setting the --bbox-maxx argument ?\n");
 	  error = 1;
 	  bbox = 0;
       }
-    if (!ok_maxy)
+    if (!ok_maxy && osm_file == NULL)
       {
 	  fprintf (stderr,
 		   "did you forget setting the --bbox-maxy argument ?\n");
 	  error = 1;
 	  bbox = 0;
       }
+    if (osm_file != NULL)
+	bbox = 0;
     if (bbox)
       {
 	  if (!check_bbox (&minx, &miny, &maxx, &maxy))
@@ -4328,13 +8109,28 @@ main (int argc, char *argv[])
 	    }
       }
 
+    if (jobs < 1)
+	jobs = 1;
+#ifndef OSM_THREADS
+    if (jobs > 1)
+      {
+	  fprintf (stderr,
+		   "WARNING: --jobs is not supported on this platform\n");
+	  jobs = 1;
+      }
+#endif
+
     if (error)
       {
 	  do_help ();
 	  return -1;
       }
 
+    t_start = osm_clock ();
+
 /* preparing individual download tiles */
+    if (osm_file != NULL)
+	goto open;
     extent_h = maxx - minx;
     extent_v = maxy - miny;
     step_h = extent_h;
@@ -4370,12 +8166,16 @@ main (int argc, char *argv[])
       }
 
 /* opening the DB */
+  open:
     if (in_memory)
 	cache_size = 0;
     cache = spatialite_alloc_connection ();
     open_db (db_path, &handle, cache_size, cache);
     if (!handle)
-	return -1;
+      {
+	  write_stats (stats_path, &params, mode, jobs, t_start, "aborted");
+	  return -1;
+      }
     if (in_memory)
       {
 	  /* loading the DB in-memory */
@@ -4391,6 +8191,8 @@ main (int argc, char *argv[])
 		fprintf (stderr, "cannot open 'MEMORY-DB': %s\n",
 			 sqlite3_errmsg (mem_db_handle));
 		sqlite3_close (mem_db_handle);
+		write_stats (stats_path, &params, mode, jobs, t_start,
+			     "aborted");
 		return -1;
 	    }
 	  backup = sqlite3_backup_init (mem_db_handle, "main", handle, "main");
@@ -4399,6 +8201,8 @@ main (int argc, char *argv[])
 		fprintf (stderr, "cannot load 'MEMORY-DB'\n");
 		sqlite3_close (handle);
 		sqlite3_close (mem_db_handle);
+		write_stats (stats_path, &params, mode, jobs, t_start,
+			     "aborted");
 		return -1;
 	    }
 	  while (1)
@@ -4418,76 +8222,71 @@ main (int argc, char *argv[])
     params.db_handle = handle;
     params.cache = cache;
     params.osm_url = osm_url;
+    params.tile_cache_dir = tile_cache;
     params.mode = mode;
 
 /* creating the OSM raw tables */
     if (!create_osm_raw_tables (&params))
       {
 	  sqlite3_close (handle);
+	  write_stats (stats_path, &params, mode, jobs, t_start, "aborted");
 	  return -1;
       }
 /* creating the  SQL prepared statements */
-    create_sql_stmts (&params, journal_off);
+    if (!create_sql_stmts (&params, journal_off))
+      {
+	  sqlite3_close (handle);
+	  write_stats (stats_path, &params, mode, jobs, t_start, "aborted");
+	  return -1;
+      }
 
-    tile = downloader.first;
-    while (tile != NULL)
+/* downloading and parsing an input OSM dataset (tiled) */
+    t0 = osm_clock ();
+    if (osm_file != NULL)
+	ret = load_osm_file (&params, osm_file, jobs);
+    else
+	ret = download_all (&params, &downloader, jobs);
+    params.stats.load_seconds = osm_clock () - t0;
+    if (!ret)
       {
-	  /* downloading and parsing an input OSM dataset (tiled) */
-	  if (mode == MODE_ROAD || mode == MODE_RAIL)
-	    {
-		printf ("Downloading and parsing OSM tile %d of %d\r",
-			tile->tile_no, downloader.count);
-		if (!osm_parse (&params, tile, 0))
-		  {
-		      fprintf (stderr,
-			       "\noperation aborted due to unrecoverable errors\n\n");
-		      finalize_sql_stmts (&params);
-		      sqlite3_close (handle);
-		      return -1;
-		  }
-	    }
-	  else
-	    {
-		printf
-		    ("Downloading and parsing OSM tile %d of %d - Nodes        \r",
-		     tile->tile_no, downloader.count);
-		if (!osm_parse (&params, tile, OBJ_NODES))
-		  {
-		      fprintf (stderr,
-			       "\noperation aborted due to unrecoverable errors\n\n");
-		      finalize_sql_stmts (&params);
-		      sqlite3_close (handle);
-		      return -1;
-		  }
-		printf
-		    ("Downloading and parsing OSM tile %d of %d - Ways          \r",
-		     tile->tile_no, downloader.count);
-		if (!osm_parse (&params, tile, OBJ_WAYS))
-		  {
-		      fprintf (stderr,
-			       "\noperation aborted due to unrecoverable errors\n\n");
-		      finalize_sql_stmts (&params);
-		      sqlite3_close (handle);
-		      return -1;
-		  }
-		printf
-		    ("Downloading and parsing OSM tile %d of %d - Relations     \r",
-		     tile->tile_no, downloader.count);
-		if (!osm_parse (&params, tile, OBJ_RELATIONS))
-		  {
-		      fprintf (stderr,
-			       "\noperation aborted due to unrecoverable errors\n\n");
-		      finalize_sql_stmts (&params);
-		      sqlite3_close (handle);
-		      return -1;
-		  }
-	    }
-	  tile = tile->next;
+	  fprintf (stderr, "\noperation aborted due to unrecoverable errors\n\n");
+	  finalize_sql_stmts (&params);
+	  sqlite3_close (handle);
+	  write_stats (stats_path, &params, mode, jobs, t_start, "aborted");
+	  return -1;
       }
-    printf ("Download completed                                        \n");
+    if (osm_file != NULL)
+	printf ("Loading completed                                         \n");
+    else
+	printf ("Download completed                                        \n");
+    if (tile_cache != NULL)
+	printf ("%d requests loaded from the tile cache\n",
+		params.cached_tiles);
 
 /* finalizing SQL prepared statements */
-    finalize_sql_stmts (&params);
+    t0 = osm_clock ();
+    inserts = params.stats.insert_seconds;
+    ret = finalize_sql_stmts (&params);
+    /* flushing the last partial batches is accounted as inserting */
+    params.stats.commit_seconds =
+	(osm_clock () - t0) - (params.stats.insert_seconds - inserts);
+    if (!ret)
+      {
+	  fprintf (stderr, "\noperation aborted due to unrecoverable errors\n\n");
+	  sqlite3_close (handle);
+	  write_stats (stats_path, &params, mode, jobs, t_start, "aborted");
+	  return -1;
+      }
+
+/* all data has been loaded: it's now time to create the indices */
+    t0 = osm_clock ();
+    if (!create_osm_raw_indices (&params))
+      {
+	  sqlite3_close (handle);
+	  write_stats (stats_path, &params, mode, jobs, t_start, "aborted");
+	  return -1;
+      }
+    params.stats.index_seconds = osm_clock () - t0;
 
 /* printing out statistics */
     printf ("inserted %d nodes\n", params.wr_nodes);
@@ -4498,6 +8297,12 @@ main (int argc, char *argv[])
     printf ("inserted %d relations\n", params.wr_relations);
     printf ("\t%d tags\n", params.wr_rel_tags);
     printf ("\t%d refs\n", params.wr_rel_refs);
+    printf ("skipped %d duplicate nodes, %d ways, %d relations\n",
+	    params.seen_nodes.duplicates, params.seen_ways.duplicates,
+	    params.seen_relations.duplicates);
+    seen_ids_cleanup (&(params.seen_nodes));
+    seen_ids_cleanup (&(params.seen_ways));
+    seen_ids_cleanup (&(params.seen_relations));
 
     if (mode == MODE_ROAD)
       {
@@ -4507,22 +8312,36 @@ main (int argc, char *argv[])
 	  if (!create_road_tables (&params))
 	    {
 		sqlite3_close (handle);
+		write_stats (stats_path, &params, mode, jobs, t_start,
+			     "aborted");
 		return -1;
 	    }
+	  t0 = osm_clock ();
 	  if (!populate_road_network (&params, &cnt_nodes, &cnt_arcs))
 	    {
 		sqlite3_close (handle);
+		write_stats (stats_path, &params, mode, jobs, t_start,
+			     "aborted");
 		return -1;
 	    }
+	  params.stats.populate_seconds = osm_clock () - t0;
+	  t0 = osm_clock ();
 	  if (!create_road_rtrees (&params))
 	    {
 		sqlite3_close (handle);
+		write_stats (stats_path, &params, mode, jobs, t_start,
+			     "aborted");
 		return -1;
 	    }
+	  params.stats.rtree_seconds = osm_clock () - t0;
+	  params.stats.graph_nodes = cnt_nodes;
+	  params.stats.graph_arcs = cnt_arcs;
 	  printf ("inserted %d ROAD nodes\n", cnt_nodes);
 	  printf ("inserted %d ROAD arcs\n", cnt_arcs);
+	  t0 = osm_clock ();
 	  if (!preserve_osm_tables)
 	      do_clean_roads (&params);
+	  params.stats.cleanup_seconds = osm_clock () - t0;
       }
     else if (mode == MODE_RAIL)
       {
@@ -4533,24 +8352,38 @@ main (int argc, char *argv[])
 	  if (!create_rail_tables (&params))
 	    {
 		sqlite3_close (handle);
+		write_stats (stats_path, &params, mode, jobs, t_start,
+			     "aborted");
 		return -1;
 	    }
+	  t0 = osm_clock ();
 	  if (!populate_rail_network
 	      (&params, &cnt_nodes, &cnt_arcs, &cnt_stations))
 	    {
 		sqlite3_close (handle);
+		write_stats (stats_path, &params, mode, jobs, t_start,
+			     "aborted");
 		return -1;
 	    }
+	  params.stats.populate_seconds = osm_clock () - t0;
+	  t0 = osm_clock ();
 	  if (!create_rail_rtrees (&params))
 	    {
 		sqlite3_close (handle);
+		write_stats (stats_path, &params, mode, jobs, t_start,
+			     "aborted");
 		return -1;
 	    }
+	  params.stats.rtree_seconds = osm_clock () - t0;
+	  params.stats.graph_nodes = cnt_nodes;
+	  params.stats.graph_arcs = cnt_arcs;
 	  printf ("inserted %d RAIL nodes\n", cnt_nodes);
 	  printf ("inserted %d RAIL arcs\n", cnt_arcs);
 	  printf ("inserted %d RAIL stations\n", cnt_stations);
+	  t0 = osm_clock ();
 	  if (!preserve_osm_tables)
 	      do_clean_rails (&params);
+	  params.stats.cleanup_seconds = osm_clock () - t0;
       }
     else if (mode == MODE_MAP)
       {
@@ -4560,26 +8393,27 @@ main (int argc, char *argv[])
 	  int polygons = 0;
 	  int multi_linestrings = 0;
 	  int multi_polygons = 0;
-	  if (!create_map_indices (&params))
-	    {
-		sqlite3_close (handle);
-		return -1;
-	    }
+	  t0 = osm_clock ();
 	  if (!populate_map_layers
-	      (&params, &points, &linestrings, &polygons, &multi_linestrings,
-	       &multi_polygons))
+	      (&params, jobs, &points, &linestrings, &polygons,
+	       &multi_linestrings, &multi_polygons))
 	    {
 		sqlite3_close (handle);
+		write_stats (stats_path, &params, mode, jobs, t_start,
+			     "aborted");
 		return -1;
 	    }
+	  params.stats.populate_seconds = osm_clock () - t0;
 	  finalize_map_stmts ();
 	  printf ("inserted %d Point Features\n", points);
 	  printf ("inserted %d Linestring Features\n", linestrings);
 	  printf ("inserted %d Polygon Features\n", polygons);
 	  printf ("inserted %d MultiLinestring Features\n", multi_linestrings);
 	  printf ("inserted %d MultiPolygon Features\n", multi_polygons);
+	  t0 = osm_clock ();
 	  if (!preserve_osm_tables)
 	      do_clean_map (&params);
+	  params.stats.cleanup_seconds = osm_clock () - t0;
       }
 
     if (in_memory)
@@ -4589,6 +8423,7 @@ main (int argc, char *argv[])
 	  sqlite3_backup *backup;
 	  int ret;
 	  printf ("\nexporting IN_MEMORY database ... wait please ...\n");
+	  t0 = osm_clock ();
 	  ret =
 	      sqlite3_open_v2 (db_path, &disk_db_handle,
 			       SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
@@ -4598,6 +8433,8 @@ main (int argc, char *argv[])
 		fprintf (stderr, "cannot open '%s': %s\n", db_path,
 			 sqlite3_errmsg (disk_db_handle));
 		sqlite3_close (disk_db_handle);
+		write_stats (stats_path, &params, mode, jobs, t_start,
+			     "aborted");
 		return -1;
 	    }
 	  backup = sqlite3_backup_init (disk_db_handle, "main", handle, "main");
@@ -4606,6 +8443,8 @@ main (int argc, char *argv[])
 		fprintf (stderr, "Backup failure: 'MEMORY-DB' wasn't saved\n");
 		sqlite3_close (handle);
 		sqlite3_close (disk_db_handle);
+		write_stats (stats_path, &params, mode, jobs, t_start,
+			     "aborted");
 		return -1;
 	    }
 	  while (1)
@@ -4618,6 +8457,7 @@ main (int argc, char *argv[])
 	  sqlite3_close (handle);
 	  handle = disk_db_handle;
 	  printf ("\tIN_MEMORY database successfully exported\n");
+	  params.stats.export_seconds = osm_clock () - t0;
       }
 
 /* closing the DB connection */
@@ -4625,6 +8465,8 @@ main (int argc, char *argv[])
     spatialite_cleanup_ex (cache);
     spatialite_shutdown ();
     downloader_cleanup (&downloader);
+    node_coords_cleanup (&(params.node_coords));
+    write_stats (stats_path, &params, mode, jobs, t_start, "completed");
     return 0;
 #endif /* end LIBXML2 conditional */
 }